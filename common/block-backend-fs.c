@@ -134,6 +134,38 @@ block_backend_fs_close_block (BlockBackend *bend,
     return ret;
 }
 
+static int
+block_backend_fs_dup_fd (BlockBackend *bend,
+                         BHandle *handle) // 复制块文件的描述符
+{
+    int fd;
+
+    g_return_val_if_fail (handle->rw_type == BLOCK_READ, -1);
+
+    fd = dup (handle->fd);
+    if (fd < 0)
+        seaf_warning ("Failed to dup fd of block %s:%s: %s.\n",
+                      handle->store_id, handle->block_id, strerror (errno));
+
+    return fd;
+}
+
+static int
+block_backend_fs_seek_block (BlockBackend *bend,
+                             BHandle *handle,
+                             guint64 offset) // 移动读位置
+{
+    g_return_val_if_fail (handle->rw_type == BLOCK_READ, -1);
+
+    if (lseek (handle->fd, (off_t)offset, SEEK_SET) < 0) {
+        seaf_warning ("Failed to seek block %s:%s: %s.\n",
+                      handle->store_id, handle->block_id, strerror (errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 static void
 block_backend_fs_block_handle_free (BlockBackend *bend,
                                     BHandle *handle) // 释放句柄空间
@@ -209,6 +241,19 @@ block_backend_fs_block_exists (BlockBackend *bend,
         return FALSE;
 }
 
+static int
+block_backend_fs_block_exists_many (BlockBackend *bend,
+                                    const char *store_id,
+                                    int version,
+                                    const char **block_ids,
+                                    int n_ids,
+                                    gboolean *exists) // 批量判断块是否存在
+{
+    parallel_ids_exist (bend, (StoreIdExistsFunc)block_backend_fs_block_exists,
+                        store_id, version, block_ids, n_ids, exists);
+    return 0;
+}
+
 static int
 block_backend_fs_remove_block (BlockBackend *bend,
                                const char *store_id,
@@ -491,9 +536,12 @@ block_backend_fs_new (const char *seaf_dir, const char *tmp_dir) // 新建后台
     bend->commit_block = block_backend_fs_commit_block;
     bend->close_block = block_backend_fs_close_block;
     bend->exists = block_backend_fs_block_exists;
+    bend->exists_many = block_backend_fs_block_exists_many;
     bend->remove_block = block_backend_fs_remove_block;
     bend->stat_block = block_backend_fs_stat_block;
     bend->stat_block_by_handle = block_backend_fs_stat_block_by_handle;
+    bend->dup_fd = block_backend_fs_dup_fd;
+    bend->seek_block = block_backend_fs_seek_block;
     bend->block_handle_free = block_backend_fs_block_handle_free;
     bend->foreach_block = block_backend_fs_foreach_block;
     bend->remove_store = block_backend_fs_remove_store;
@@ -26,6 +26,12 @@ struct BlockBackend { // 块操作后台，封装了一些块操作函数
                         const char *store_id, int version,
                         const char *block_id);
 
+    /* Optional. Sets exists[i] for each of the @n_ids blocks in @block_ids. */
+    int      (*exists_many) (BlockBackend *bend,
+                             const char *store_id, int version,
+                             const char **block_ids, int n_ids,
+                             gboolean *exists);
+
     int      (*remove_block) (BlockBackend *bend,
                               const char *store_id, int version,
                               const char *block_id);
@@ -36,6 +42,13 @@ struct BlockBackend { // 块操作后台，封装了一些块操作函数
     
     BMetadata* (*stat_block_by_handle) (BlockBackend *bend, BHandle *handle);
 
+    /* Optional. Returns a new descriptor of the local file of a block
+     * opened for read, or -1. */
+    int      (*dup_fd) (BlockBackend *bend, BHandle *handle);
+
+    /* Optional. Moves the read position of a block opened for read. */
+    int      (*seek_block) (BlockBackend *bend, BHandle *handle, guint64 offset);
+
     void     (*block_handle_free) (BlockBackend *bend, BHandle *handle);
 
     int      (*foreach_block) (BlockBackend *bend,
@@ -8,6 +8,7 @@
 #include "seaf-utils.h"
 #include "block-mgr.h"
 #include "log.h"
+#include "sha1-batch.h"
 
 #include <stdio.h>
 #include <errno.h>
@@ -22,6 +23,8 @@
 
 #define SEAF_BLOCK_DIR "blocks"
 
+#define VERIFY_BATCH_SIZE (64 << 20) // 批量验证时，一批块的总大小上限
+
 
 extern BlockBackend * // 创建新的后台，基于文件系统；延后实现
 block_backend_fs_new (const char *block_dir, const char *tmp_dir);
@@ -122,6 +125,51 @@ gboolean seaf_block_manager_block_exists (SeafBlockManager *mgr,
     return mgr->backend->exists (mgr->backend, store_id, version, block_id); // 转发
 }
 
+int // 批量检测块是否存在
+seaf_block_manager_blocks_exist (SeafBlockManager *mgr,
+                                 const char *store_id,
+                                 int version,
+                                 const char **block_ids,
+                                 int n_ids,
+                                 gboolean *exists)
+{
+    BlockBackend *bend = mgr->backend;
+    const char **valid_ids;
+    gboolean *valid_exists;
+    int n_valid = 0, i, j;
+    int ret;
+
+    memset (exists, 0, sizeof(gboolean) * n_ids);
+    if (!store_id || !is_uuid_valid(store_id))
+        return 0;
+
+    if (!bend->exists_many) {
+        for (i = 0; i < n_ids; ++i)
+            exists[i] = seaf_block_manager_block_exists (mgr, store_id, version,
+                                                         block_ids[i]);
+        return 0;
+    }
+
+    valid_ids = g_new (const char *, n_ids);
+    for (i = 0; i < n_ids; ++i) {
+        if (block_ids[i] && is_object_id_valid (block_ids[i]))
+            valid_ids[n_valid++] = block_ids[i];
+    }
+
+    valid_exists = g_new0 (gboolean, n_valid);
+    ret = bend->exists_many (bend, store_id, version, valid_ids, n_valid, valid_exists);
+    if (ret == 0) {
+        for (i = 0, j = 0; i < n_ids; ++i) {
+            if (block_ids[i] && j < n_valid && block_ids[i] == valid_ids[j])
+                exists[i] = valid_exists[j++];
+        }
+    }
+
+    g_free (valid_ids);
+    g_free (valid_exists);
+    return ret;
+}
+
 int // 移除块
 seaf_block_manager_remove_block (SeafBlockManager *mgr,
                                  const char *store_id,
@@ -148,6 +196,25 @@ seaf_block_manager_stat_block (SeafBlockManager *mgr,
     return mgr->backend->stat_block (mgr->backend, store_id, version, block_id); // 转发
 }
 
+int // 获取块文件的描述符
+seaf_block_manager_dup_block_fd (SeafBlockManager *mgr,
+                                 BlockHandle *handle)
+{
+    if (!mgr->backend->dup_fd)
+        return -1;
+    return mgr->backend->dup_fd (mgr->backend, handle); // 转发
+}
+
+int // 移动块的读位置
+seaf_block_manager_seek_block (SeafBlockManager *mgr,
+                               BlockHandle *handle,
+                               guint64 offset)
+{
+    if (!mgr->backend->seek_block)
+        return -1;
+    return mgr->backend->seek_block (mgr->backend, handle, offset); // 转发
+}
+
 BlockMetadata * // 获取块元数据，依靠句柄
 seaf_block_manager_stat_block_by_handle (SeafBlockManager *mgr,
                                          BlockHandle *handle)
@@ -266,6 +333,109 @@ seaf_block_manager_verify_block (SeafBlockManager *mgr,
         return FALSE; // 失败
 }
 
+char * // 读取整个块
+seaf_block_manager_read_whole_block (SeafBlockManager *mgr,
+                                     const char *store_id,
+                                     int version,
+                                     const char *block_id,
+                                     int *len)
+{
+    BlockHandle *h;
+    BlockMetadata *bmd;
+    char *buf = NULL;
+    int size, n, off = 0;
+
+    h = seaf_block_manager_open_block (mgr,
+                                       store_id, version,
+                                       block_id, BLOCK_READ);
+    if (!h) {
+        seaf_warning ("Failed to open block %s:%.8s.\n", store_id, block_id);
+        return NULL;
+    }
+
+    bmd = seaf_block_manager_stat_block_by_handle (mgr, h);
+    if (!bmd) {
+        seaf_warning ("Failed to stat block %s:%.8s.\n", store_id, block_id);
+        goto out;
+    }
+    size = bmd->size;
+    g_free (bmd);
+
+    /* One more byte to notice a block that grew since stat. */
+    buf = g_malloc (size + 1);
+    while (off <= size) {
+        n = seaf_block_manager_read_block (mgr, h, buf + off, size + 1 - off);
+        if (n < 0) {
+            seaf_warning ("Failed to read block %s:%.8s.\n", store_id, block_id);
+            g_free (buf);
+            buf = NULL;
+            goto out;
+        }
+        if (n == 0)
+            break;
+        off += n;
+    }
+    /* A block with the wrong size fails verification anyway. */
+    *len = off;
+
+out:
+    seaf_block_manager_close_block (mgr, h);
+    seaf_block_manager_block_handle_free (mgr, h);
+    return buf;
+}
+
+int // 批量验证块
+seaf_block_manager_verify_blocks (SeafBlockManager *mgr,
+                                  const char *store_id,
+                                  int version,
+                                  char **block_ids,
+                                  int n_blocks,
+                                  gboolean *valid)
+{
+    int lanes = sha1_batch_lanes ();
+    SHA1BatchJob *jobs = g_new0 (SHA1BatchJob, lanes);
+    char **bufs = g_new0 (char *, lanes);
+    guint8 *sha1s = g_new (guint8, lanes * 20);
+    char check_id[41];
+    gint64 batch_size;
+    gboolean io_error = FALSE;
+    int done = 0, n, len, i;
+
+    while (done < n_blocks && !io_error) {
+        /* Read blocks until the batch is full or too large. */
+        n = 0;
+        batch_size = 0;
+        while (done + n < n_blocks && n < lanes &&
+               batch_size < VERIFY_BATCH_SIZE) {
+            bufs[n] = seaf_block_manager_read_whole_block (mgr, store_id, version,
+                                                           block_ids[done + n], &len);
+            if (!bufs[n]) {
+                io_error = TRUE;
+                break;
+            }
+            jobs[n].data = bufs[n];
+            jobs[n].len = len;
+            jobs[n].digest = sha1s + n * 20;
+            batch_size += len;
+            ++n;
+        }
+
+        sha1_batch (jobs, n);
+
+        for (i = 0; i < n; ++i) {
+            rawdata_to_hex (sha1s + i * 20, check_id, 20);
+            valid[done + i] = (strcmp (check_id, block_ids[done + i]) == 0);
+            g_free (bufs[i]);
+        }
+        done += n;
+    }
+
+    g_free (jobs);
+    g_free (bufs);
+    g_free (sha1s);
+    return done;
+}
+
 int // 移除仓库中的所有块
 seaf_block_manager_remove_store (SeafBlockManager *mgr,
                                  const char *store_id)
@@ -98,12 +98,47 @@ void // 释放块的句柄
 seaf_block_manager_block_handle_free (SeafBlockManager *mgr,
                                       BlockHandle *handle);
 
+/*
+ * Get a file descriptor of a block opened for read, so that its content
+ * can be sent with sendfile() instead of being read into memory. The
+ * descriptor stays valid after the handle is closed; the caller must
+ * close it. Reading from it may move the position of the handle.
+ *
+ * Returns: the descriptor, or -1 if the backend doesn't keep blocks in
+ * local files.
+ */
+int // 获取块文件的描述符
+seaf_block_manager_dup_block_fd (SeafBlockManager *mgr,
+                                 BlockHandle *handle);
+
+/*
+ * Moves the read position of a block opened for read to @offset.
+ * Returns -1 if it fails or the backend can't seek; the caller can read
+ * and drop the data before @offset instead.
+ */
+int // 移动块的读位置
+seaf_block_manager_seek_block (SeafBlockManager *mgr,
+                               BlockHandle *handle,
+                               guint64 offset);
+
 gboolean 
 seaf_block_manager_block_exists (SeafBlockManager *mgr,
                                  const char *store_id,
                                  int version,
                                  const char *block_id);
 
+/*
+ * Sets exists[i] for each of the @n_ids blocks in @block_ids. Backends that
+ * support it check the blocks in one batch. Invalid ids don't exist.
+ */
+int // 批量检测块是否存在
+seaf_block_manager_blocks_exist (SeafBlockManager *mgr,
+                                 const char *store_id,
+                                 int version,
+                                 const char **block_ids,
+                                 int n_ids,
+                                 gboolean *exists);
+
 int // 移除块
 seaf_block_manager_remove_block (SeafBlockManager *mgr,
                                  const char *store_id,
@@ -152,4 +187,26 @@ seaf_block_manager_verify_block (SeafBlockManager *mgr,
                                  const char *block_id,
                                  gboolean *io_error);
 
+/* Reads a whole block into memory. Returns NULL on error. */
+char * // 读取整个块
+seaf_block_manager_read_whole_block (SeafBlockManager *mgr,
+                                     const char *store_id,
+                                     int version,
+                                     const char *block_id,
+                                     int *len);
+
+/*
+ * Verifies several blocks at a time, hashing them in parallel with
+ * sha1_batch(). @valid[i] tells whether block i matches its id. Returns
+ * the number of blocks verified; if it's less than @n_blocks, the next
+ * block couldn't be read.
+ */
+int // 批量验证块
+seaf_block_manager_verify_blocks (SeafBlockManager *mgr,
+                                  const char *store_id,
+                                  int version,
+                                  char **block_ids,
+                                  int n_blocks,
+                                  gboolean *valid);
+
 #endif
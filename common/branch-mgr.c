@@ -300,6 +300,7 @@ seaf_branch_manager_update_branch (SeafBranchManager *mgr, SeafBranch *branch)
 #if defined( SEAFILE_SERVER ) && defined( FULL_FEATURE )
 
 #include "mq-mgr.h"
+#include "http-server.h"
 
 static gboolean
 get_commit_id (SeafDBRow *row, void *data)
@@ -329,6 +330,11 @@ publish_repo_update_event (const char *repo_id, const char *commit_id)
  {
      seaf_repo_manager_update_repo_info (seaf->repo_mgr, branch->repo_id, branch->commit_id);
  
+     /* Virtual repos are synced too. */
+     if (seaf->http_server && strcmp (branch->name, "master") == 0)
+         seaf_http_server_notify_head_changed (seaf->http_server,
+                                               branch->repo_id, branch->commit_id);
+ 
      if (seaf_repo_manager_is_virtual_repo (seaf->repo_mgr, branch->repo_id))
          return;
 
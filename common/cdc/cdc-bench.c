@@ -0,0 +1,167 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+    分块断点查找的吞吐量测试
+
+    Cuts random data in memory with the rabin path of file_chunk_cdc and
+    with FastCDC, single threaded, and reports GB/s and the block sizes.
+    Hashing of the blocks isn't included, only the boundary scan. The
+    lane-parallel FastCDC scan is checked against the serial one.
+
+        make cdc-bench && ./cdc-bench [data MB] [avg block KB]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rabin-checksum.h"
+#include "fastcdc.h"
+
+#define BLOCK_WIN_SZ    48      // 与cdc.c相同
+#define BREAK_VALUE     0x0013
+
+typedef size_t (*CutFunc) (const void *arg, const unsigned char *buf, size_t len);
+
+typedef struct RabinParams {
+    uint32_t min_sz, max_sz, mask;
+} RabinParams;
+
+/* The scan loop of file_chunk_cdc(). */
+static size_t
+rabin_find_cut (const void *arg, const unsigned char *buf, size_t len)
+{
+    const RabinParams *p = arg;
+    unsigned int fingerprint = 0;
+    size_t cur;
+
+    if (len < p->min_sz)
+        return len;
+
+    for (cur = p->min_sz - 1; cur < len; ++cur) {
+        fingerprint = (cur == p->min_sz - 1) ?
+            rabin_checksum ((char *)buf + cur - BLOCK_WIN_SZ + 1, BLOCK_WIN_SZ) :
+            rabin_rolling_checksum (fingerprint, BLOCK_WIN_SZ,
+                                    buf[cur - BLOCK_WIN_SZ], buf[cur]);
+        if ((fingerprint & p->mask) == (BREAK_VALUE & p->mask) ||
+            cur + 1 >= p->max_sz)
+            return cur + 1;
+    }
+    return len;
+}
+
+static size_t
+fastcdc_cut (const void *arg, const unsigned char *buf, size_t len)
+{
+    return fastcdc_find_cut (arg, buf, len);
+}
+
+static size_t
+fastcdc_serial_cut (const void *arg, const unsigned char *buf, size_t len)
+{
+    return fastcdc_find_cut_serial (arg, buf, len);
+}
+
+static double
+now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define ROUNDS 3
+
+/* Cuts the whole buffer, returns the number of blocks and the best time
+ * of ROUNDS runs. Cut lengths are stored in @cuts if it's not NULL. */
+static size_t
+cut_all (CutFunc func, const void *arg, const unsigned char *data, size_t size,
+         size_t *cuts, double *secs)
+{
+    size_t off, n = 0, cut;
+    double start, t;
+    int round;
+
+    *secs = 0;
+    for (round = 0; round < ROUNDS; ++round) {
+        start = now ();
+        off = n = 0;
+        while (off < size) {
+            cut = func (arg, data + off, size - off);
+            if (cuts)
+                cuts[n] = cut;
+            off += cut;
+            ++n;
+        }
+        t = now () - start;
+        if (round == 0 || t < *secs)
+            *secs = t;
+    }
+
+    return n;
+}
+
+static void
+report (const char *name, size_t size, size_t n_blocks, double secs)
+{
+    printf ("%-16s %8.2f GB/s %10zu blocks, avg %8.1f KB\n", name,
+            size / secs / 1e9, n_blocks, size / (double)n_blocks / 1024);
+}
+
+int
+main (int argc, char **argv)
+{
+    size_t size = (argc > 1 ? atol (argv[1]) : 1024) << 20;
+    uint32_t avg = (argc > 2 ? atol (argv[2]) : 1024) << 10;
+    unsigned char *data;
+    size_t *cuts_serial, *cuts_lanes;
+    size_t n, n_serial, n_lanes, i;
+    uint64_t x = 88172645463325252ULL;
+    RabinParams rp;
+    FastCDCParams fp;
+    double secs;
+
+    data = malloc (size);
+    cuts_serial = malloc (sizeof(size_t) * (size / 64 + 1));
+    cuts_lanes = malloc (sizeof(size_t) * (size / 64 + 1));
+    if (!data || !cuts_serial || !cuts_lanes) {
+        fprintf (stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (i = 0; i + 8 <= size; i += 8) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy (data + i, &x, 8);
+    }
+
+    /* Same ratios as the defaults of cdc.c: min = avg / 4, max = avg * 4. */
+    rabin_init (BLOCK_WIN_SZ);
+    rp.min_sz = avg / 4;
+    rp.max_sz = avg * 4;
+    rp.mask = avg - 1;
+    fastcdc_params_init (&fp, avg / 4, avg, avg * 4);
+
+    printf ("%zu MB of random data, avg block size %u KB\n", size >> 20, avg >> 10);
+
+    n = cut_all (rabin_find_cut, &rp, data, size, NULL, &secs);
+    report ("rabin", size, n, secs);
+
+    n_serial = cut_all (fastcdc_serial_cut, &fp, data, size, cuts_serial, &secs);
+    report ("fastcdc serial", size, n_serial, secs);
+
+    n_lanes = cut_all (fastcdc_cut, &fp, data, size, cuts_lanes, &secs);
+    report ("fastcdc lanes", size, n_lanes, secs);
+
+    if (n_serial != n_lanes ||
+        memcmp (cuts_serial, cuts_lanes, sizeof(size_t) * n_serial) != 0) {
+        fprintf (stderr, "Lane-parallel scan doesn't match the serial scan.\n");
+        return 1;
+    }
+
+    free (data);
+    free (cuts_serial);
+    free (cuts_lanes);
+    return 0;
+}
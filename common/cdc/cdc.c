@@ -25,6 +25,7 @@
 #include "cdc.h"
 #include "../seafile-crypt.h"
 
+#include "fastcdc.h"
 #include "rabin-checksum.h"
 #define finger rabin_checksum
 #define rolling_finger rabin_rolling_checksum
@@ -116,6 +117,127 @@ do {                                                         \
     cur = 0;                                                 \ // tail，cur也随之进行相对移动
 }while(0); // 表示执行一次
 
+static int // 写一个块并记录其校验和
+write_cdc_block (CDCFileDescriptor *file_descr,
+                 CDCDescriptor *chunk_descr,
+                 SeafileCrypt *crypt,
+                 gboolean write_data,
+                 SHA_CTX *file_ctx)
+{
+    if (file_descr->block_nr == file_descr->max_block_nr) {
+        seaf_warning ("Block id array is not large enough, bail out.\n");
+        return -1;
+    }
+
+    if (file_descr->write_block (file_descr->repo_id, file_descr->version,
+                                 chunk_descr, crypt, chunk_descr->checksum,
+                                 write_data) < 0) {
+        g_warning ("CDC: failed to write chunk.\n");
+        return -1;
+    }
+
+    memcpy (file_descr->blk_sha1s + file_descr->block_nr * CHECKSUM_LENGTH,
+            chunk_descr->checksum, CHECKSUM_LENGTH);
+    SHA1_Update (file_ctx, chunk_descr->checksum, 20);
+    file_descr->block_nr++;
+
+    return 0;
+}
+
+/*
+ * FastCDC chunking. Unlike the rabin path, data is read in large slices
+ * into a buffer of twice the max block size, and blocks are passed to
+ * write_block() in place. The remaining data is only moved to the front
+ * when less than a max block is left behind the buffer end.
+ */
+static int
+file_chunk_fastcdc (int fd_src,
+                    CDCFileDescriptor *file_descr,
+                    SeafileCrypt *crypt,
+                    gboolean write_data,
+                    gint64 *indexed)
+{
+    FastCDCParams params;
+    CDCDescriptor chunk_descr;
+    SHA_CTX file_ctx;
+    SeafStat sb;
+    char *buf;
+    size_t buf_sz, start = 0, tail = 0, avail, cut;
+    uint64_t expected_size;
+    gboolean eof = FALSE;
+    ssize_t n;
+    int ret = 0;
+
+    if (seaf_fstat (fd_src, &sb) < 0) {
+        seaf_warning ("CDC: failed to stat: %s.\n", strerror(errno));
+        return -1;
+    }
+    expected_size = sb.st_size;
+
+    init_cdc_file_descriptor (fd_src, expected_size, file_descr);
+    fastcdc_params_init (&params, file_descr->block_min_sz,
+                         file_descr->block_sz, file_descr->block_max_sz);
+
+    buf_sz = (size_t)params.max_sz * 2;
+    buf = malloc (buf_sz);
+    if (!buf)
+        return -1;
+
+    memset (&chunk_descr, 0, sizeof(chunk_descr));
+    SHA1_Init (&file_ctx);
+
+    while (1) {
+        if (!eof && tail - start < params.max_sz) {
+            if (start > buf_sz - params.max_sz) {
+                memmove (buf, buf + start, tail - start);
+                tail -= start;
+                start = 0;
+            }
+
+            n = readn (fd_src, buf + tail, buf_sz - tail);
+            if (n < 0) {
+                seaf_warning ("CDC: failed to read: %s.\n", strerror(errno));
+                ret = -1;
+                goto out;
+            }
+            if ((size_t)n < buf_sz - tail)
+                eof = TRUE;
+            tail += n;
+            file_descr->file_size += n;
+
+            if (file_descr->file_size > expected_size) {
+                seaf_warning ("File size changed while chunking.\n");
+                ret = -1;
+                goto out;
+            }
+        }
+
+        avail = tail - start;
+        if (avail == 0)
+            break;
+
+        cut = fastcdc_find_cut (&params, (unsigned char *)buf + start, avail);
+
+        chunk_descr.block_buf = buf + start;
+        chunk_descr.len = cut;
+        chunk_descr.offset = file_descr->file_size - (tail - start);
+        if (write_cdc_block (file_descr, &chunk_descr, crypt, write_data, &file_ctx) < 0) {
+            ret = -1;
+            goto out;
+        }
+        if (indexed)
+            *indexed += cut;
+
+        start += cut;
+    }
+
+    SHA1_Final (file_descr->file_sum, &file_ctx);
+
+out:
+    free (buf);
+    return ret;
+}
+
 /* content-defined chunking */
 // 基于内容可变长度分块
 int file_chunk_cdc(int fd_src, // 文件标识符
@@ -128,6 +250,10 @@ int file_chunk_cdc(int fd_src, // 文件标识符
     uint32_t buf_sz; // 缓冲大小
     SHA_CTX file_ctx; // SHA1上下文
     CDCDescriptor chunk_descr; // 创建分块过程信息
+
+    if (file_descr->algorithm == CDC_ALGO_FASTCDC)
+        return file_chunk_fastcdc (fd_src, file_descr, crypt, write_data, indexed);
+
     SHA1_Init (&file_ctx); // 初始化SHA1
 
     SeafStat sb; // seafile状态
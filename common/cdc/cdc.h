@@ -32,6 +32,11 @@ struct _CDCFileDescriptor;
 struct _CDCDescriptor;
 struct SeafileCrypt;
 
+typedef enum { // 断点查找算法
+    CDC_ALGO_RABIN = 0, // 拉宾指纹，48字节窗口（默认）
+    CDC_ALGO_FASTCDC,   // FastCDC，gear哈希和归一化分块，见fastcdc.h
+} CDCAlgorithm;
+
 // 规定写块文件的方法参数列表如下
 typedef int (*WriteblockFunc)(const char *repo_id, // 仓库id
                               int version, // 版本
@@ -57,6 +62,10 @@ typedef struct _CDCFileDescriptor { // 文件分块信息
 
     char repo_id[37];      // 文件所属仓库的id
     int version;           // 文件的版本
+
+    /* Blocks cut by different algorithms don't deduplicate with each other,
+     * so the algorithm should only be changed on purpose. */
+    int algorithm;         // 分块算法，CDCAlgorithm
 } CDCFileDescriptor;
 
 typedef struct _CDCDescriptor { // 分块过程信息
@@ -0,0 +1,269 @@
+/*
+FastCDC 分块断点查找（gear哈希 + 归一化分块）
+https://www.usenix.org/conference/atc16/technical-sessions/presentation/xia
+*/
+
+#include "fastcdc.h"
+
+#define GEAR_WIN 64     // gear哈希实际覆盖的字节数
+#define N_LANES 2       // 并行扫描的路数
+#define LANE_SZ 2048    // 每路扫描的长度
+
+#ifdef __GNUC__
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#else
+#define unlikely(x) (x)
+#endif
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+/* Random values from splitmix64. Must never change, or files will be cut
+ * differently and stop deduplicating with existing blocks. */
+static const uint64_t gear[256] = {
+    0xc962ab1939eb280bULL, 0xcfe32c584de0b730ULL, 0xb0ab0b8754fee145ULL,
+    0xfaa1013b704f9e0aULL, 0x7059d4e5aa868dedULL, 0x3562b4a8ea27d866ULL,
+    0xb54585c4a0fb42aaULL, 0x1147d0e757b2feedULL, 0x1f9ca0a7f066256eULL,
+    0x28af041de1dd54b4ULL, 0xe1fe4440eaea7d9bULL, 0xa6715299d42ff07eULL,
+    0x541b48c5f1647802ULL, 0x3dc9f69ef499ba0aULL, 0x4b9aa509a54d44a0ULL,
+    0xc9d58b033161f534ULL, 0x5b3d5c28c104b616ULL, 0x0ffb2e191f018b59ULL,
+    0xf2369f1621e19a6aULL, 0xcec8f1b49310ea26ULL, 0x31094e5e892b9fb1ULL,
+    0x29443ceec9ead060ULL, 0xfb0b3811a1bea49fULL, 0x342fa9b3eda7b994ULL,
+    0x154c62f17f2b2700ULL, 0xd30086a29cc2f50fULL, 0xbe106926ca9dc084ULL,
+    0xb5e3a4d854143125ULL, 0xf50c10bf1f29c052ULL, 0x3ac7b7c16614d661ULL,
+    0x1dc1c56db37acec3ULL, 0x04edfb0db1b6c49bULL, 0xadf288348c20bd1eULL,
+    0xae3dd1f589bd1568ULL, 0x931e863f147695b9ULL, 0x6e7148dc4fe48d56ULL,
+    0x123c8f7156041743ULL, 0x95419f54efb63fc4ULL, 0x6e80f4402aaf4c3aULL,
+    0x8008c6fa9f819d91ULL, 0x883498fbf778f6d3ULL, 0xa64e7b94714da8d9ULL,
+    0x3dcd14949fb8387bULL, 0x67192905fc56c7dcULL, 0xfefe29a57c958727ULL,
+    0xce38e50019576152ULL, 0x4fec631dcb0dcdfbULL, 0x0a295e48b8229da3ULL,
+    0x8538499bc076a4a3ULL, 0x4d50399600eb619cULL, 0x759557dfcd4653f8ULL,
+    0xa3b4df4c6f4b0a98ULL, 0x40717c3eed49435dULL, 0x20e9ac3785aaa95eULL,
+    0xd08835709d92457fULL, 0x4143864e4ebd0d57ULL, 0x6913fbf6b71010dfULL,
+    0x6adca7e177d28441ULL, 0x32815857d10fbbb2ULL, 0x916f91215a4efb1cULL,
+    0xfe5e47a1de4c5a8bULL, 0xc09c51390b84d633ULL, 0x95a7879733c28abcULL,
+    0x5a0e92d8307dffb9ULL, 0xe04e46184d36ac8fULL, 0x538bd44afa21a102ULL,
+    0x7545b322dee81fccULL, 0x202d95280b4bbc39ULL, 0xa3dd36e5426393dbULL,
+    0x5c386f4c9ca38b47ULL, 0x9cde22d1b3fe6214ULL, 0xdf368d0e78e4ae14ULL,
+    0xf393c586796ed349ULL, 0x5e6c3ab78001fe5dULL, 0xf0d1f3452f8d0da4ULL,
+    0x79ff4d84ac16f342ULL, 0xf0bf289ccb55b573ULL, 0x34fd2efb721b67e5ULL,
+    0xa3d8cc8670a9f19eULL, 0xc48e0fd898b58320ULL, 0xa56af4c72c4afe6cULL,
+    0x0e7b1d2c7738ce97ULL, 0x96460dd78509ec01ULL, 0x82656b958fc53162ULL,
+    0x574a7d4623df12feULL, 0x848da4dbaa10d066ULL, 0x7c1bf90685be2efdULL,
+    0xf9501681a36c1efdULL, 0x007bc1aca4ea0e9bULL, 0xa475b0d15218fd61ULL,
+    0x8608658bbbbf2abdULL, 0x78ca0ae68407e4acULL, 0x42cb2b3804f1bd4fULL,
+    0xae63c485a299f717ULL, 0x52bf8fb435c468c3ULL, 0x36e678a928d75e89ULL,
+    0x67fee1021c1b8077ULL, 0x5c1af039c5c88440ULL, 0x4fedec084a9832f6ULL,
+    0x590de762aaa8c15aULL, 0x99579277773cd779ULL, 0xf3c6dd97121c4035ULL,
+    0x699d0b448a2ef85dULL, 0xc8f1761648045983ULL, 0x00eb346f3a557941ULL,
+    0x6a451f831bf0a387ULL, 0xf0f8ade0a30632aaULL, 0x5bba68544931b49fULL,
+    0xe0dc655118e30ca0ULL, 0xdd79126a0c5d69b2ULL, 0x575a951d480ee686ULL,
+    0x2f905907cf683f7eULL, 0x4dd21f23acb8ebb4ULL, 0x27fdbae693ca1e84ULL,
+    0x7ee38a9659017760ULL, 0x28777de3232aee5cULL, 0x24941341928a2cb2ULL,
+    0x897228cc1b61aba3ULL, 0x07efef99550c0aedULL, 0xacaa9972b66bc6ceULL,
+    0x3aaea0e3dd685e9dULL, 0x75efa0c82600f338ULL, 0x413ad9e567b14de5ULL,
+    0xa05b9032a85226ecULL, 0xbd83f2ba162f8bd1ULL, 0x100af4646d4534ccULL,
+    0xfaab4ae8d1133916ULL, 0xec39f86b612912ecULL, 0x363404b85473ae63ULL,
+    0x1aaf33e0d50e3ec2ULL, 0xf393c9255539de05ULL, 0x53e6c0bdb1c8e790ULL,
+    0x59b42d6e2f39174dULL, 0x39feed2a0a3b72bdULL, 0x33136b9fffd70c81ULL,
+    0xa7547803e76aded3ULL, 0x9be60f8419e75494ULL, 0x7606120f7cea249eULL,
+    0x3ec9714714e1e26eULL, 0x9c42f90677fe1a19ULL, 0x6005c581d19abaaeULL,
+    0xc3564eccc232523aULL, 0x0d0fa274ca324dd8ULL, 0xde3aca8ff2aba687ULL,
+    0xddd7080d4ff35385ULL, 0x571611465fc76a02ULL, 0xac45df7371fcf451ULL,
+    0xcee173b64a08b9f3ULL, 0x397835154178c8cdULL, 0x467524991e29d074ULL,
+    0x6b5a42d7246cd6a3ULL, 0x73c45c285168743bULL, 0x1bedaa822ce9ce31ULL,
+    0x398ace86691eda35ULL, 0x4c4e1d502dea9da4ULL, 0x638c31c2b4aa4307ULL,
+    0x82a40912fcf25a61ULL, 0x26ac990e264d88d7ULL, 0xb558f63fe88eaf23ULL,
+    0x74e9f99eb69d185dULL, 0x74f647f4e0b9d983ULL, 0x205e0b9a577ce5eaULL,
+    0xcf4b2eadeb92efb4ULL, 0xa05ed0b2e59c158fULL, 0xeb1d2b4deb8c399bULL,
+    0x2594c4cf41eb821cULL, 0xab4bd1c743b12704ULL, 0x068a246f39830993ULL,
+    0x91e41b2e5e1df61dULL, 0xeba24a39dc37b196ULL, 0xa5dd6520871d3963ULL,
+    0x731d2eafb261f6d5ULL, 0xe18a0ef72f4c16eeULL, 0xe311c89a5090541eULL,
+    0x2a83ec86748e89f5ULL, 0xddcfc6470b6db276ULL, 0xd848e0ace7997362ULL,
+    0xf3965a21bb04107aULL, 0x14078d0e76db64e1ULL, 0x85e37d72cc8b2997ULL,
+    0xa989184efc85db88ULL, 0x8f8f0cf656a79096ULL, 0x6aa10b72048b0542ULL,
+    0x8bacba03e0ca362bULL, 0x79177c398ec53677ULL, 0xe1274f067ce9d769ULL,
+    0x5f142d614dc208deULL, 0xd64e75f9916c238fULL, 0xceb2865baef8119cULL,
+    0x77747fee9f298744ULL, 0x4b17cc6a19950863ULL, 0xaf85dc2b4395c10fULL,
+    0xb5b0170fff2506b7ULL, 0xd0308a63fd6bac87ULL, 0xd6ab9b292d83d51eULL,
+    0x70e32cda045987f1ULL, 0xc170434589ce2fc8ULL, 0x759dffc0e3cfd56eULL,
+    0xc59e8a8bad8314abULL, 0xaedb30c0e889ea09ULL, 0x8844b899a6b8fa4dULL,
+    0x00cca3f10b2efa2aULL, 0xbe0b424c65779ff7ULL, 0xfc635fa8e05ae696ULL,
+    0x6d0e19ddd258e428ULL, 0x4e8de2c5ca5f79b8ULL, 0xf7c69a4ed6a73145ULL,
+    0x2d5328679c9529b5ULL, 0x3d1459494dae7916ULL, 0x5950ee1cf696399fULL,
+    0xb1bab054242c8dfbULL, 0x6d8a02d393d0177aULL, 0x2daf567747ae7de7ULL,
+    0xdba2f97eab61c308ULL, 0x2019fa76235a0a61ULL, 0xe29703664471a90cULL,
+    0x53c2bbfcec2a9226ULL, 0x520827b99e5d2707ULL, 0xd291e7136a83416dULL,
+    0xcfb65db2de7a4501ULL, 0xc8e80af673b41411ULL, 0x642317f0dd219957ULL,
+    0x2085c7f003fd1067ULL, 0xccb5268322792106ULL, 0xf464648181d7e422ULL,
+    0x69f2461b23e5fadcULL, 0x21661fe09b8a6ec0ULL, 0x677217e013c91f5dULL,
+    0x1839b4da9f1f68b3ULL, 0x1a03127d588c037eULL, 0x25ec3fcd4337a287ULL,
+    0x9b3d552a7dd9d91bULL, 0xf4987f32a4428facULL, 0x4a7f08b4bee86e61ULL,
+    0x6df20c932eae91fcULL, 0x43a1544fb413f8ccULL, 0x538729ccb19423e6ULL,
+    0x116ff2310c42e42bULL, 0x2c3bc22c5f806a8fULL, 0x28b7524e9866687bULL,
+    0x9f6cc2d9b0ccd075ULL, 0x77e26325ff183b7eULL, 0xa4b46ed7bc37bbbfULL,
+    0x2b2dc6eb2fadb7d8ULL, 0x3137382ab397f7cdULL, 0xfd895852bb56fa41ULL,
+    0x402b7cfdef08931eULL, 0x574c7344277945f7ULL, 0x52275f0c83fa0be6ULL,
+    0x9c6eacd4c7bda96aULL, 0x914ff38fc88b9660ULL, 0x996db9088689e071ULL,
+    0x090b7fb511563a70ULL, 0xbcaa4d33246ea6d9ULL, 0x26c978fd9c30d9c0ULL,
+    0xb6e6fec77af499f8ULL,
+};
+
+#define ROLL(h, b) (((h) << 1) + gear[(b)])
+
+static uint64_t // 第62位起向下n位为1的掩码
+high_bits_mask (int n)
+{
+    if (n <= 0)
+        return 0;
+    if (n > 63)
+        n = 63;
+    return (~(uint64_t)0 << (64 - n)) >> 1;
+}
+
+void
+fastcdc_params_init (FastCDCParams *params,
+                     uint32_t min_sz, uint32_t avg_sz, uint32_t max_sz)
+{
+    int bits = 0;
+
+    if (min_sz < GEAR_WIN)
+        min_sz = GEAR_WIN;
+    if (max_sz < min_sz)
+        max_sz = min_sz;
+    if (avg_sz < min_sz)
+        avg_sz = min_sz;
+    if (avg_sz > max_sz)
+        avg_sz = max_sz;
+
+    while (bits < 31 && ((uint32_t)1 << (bits + 1)) <= avg_sz)
+        ++bits;
+
+    params->min_sz = min_sz;
+    params->normal_sz = avg_sz;
+    params->max_sz = max_sz;
+    /* Normalization level 2. */
+    params->mask_s = high_bits_mask (bits + 2);
+    params->mask_l = high_bits_mask (bits - 2);
+}
+
+/* Returns the first block length L in [lo, hi] for which the hash of
+ * buf[L-64 .. L-1] matches @mask, or 0. */
+static size_t
+scan_serial (const unsigned char *buf, size_t lo, size_t hi, uint64_t mask)
+{
+    uint64_t h = 0;
+    size_t i;
+
+    for (i = lo - GEAR_WIN; i < lo - 1; ++i)
+        h = ROLL (h, buf[i]);
+
+    for (i = lo - 1; i < hi; ++i) {
+        h = ROLL (h, buf[i]);
+        if (!(h & mask))
+            return i + 1;
+    }
+
+    return 0;
+}
+
+/* Same as scan_serial(), 1.2-1.8x faster (see cdc-bench). The range is split into pairs
+ * of lanes, which are hashed in lockstep: a single stream is bound by the
+ * latency of the shift-add chain, independent lanes keep the CPU busy.
+ * Each lane is started 63 bytes early, which gives it the exact hash.
+ * Lanes also move two bytes per step,
+ *     h = (h << 2) + (G[b0] << 1) + G[b1],
+ * and the hash after b0 is checked shifted left by one. That's exact
+ * because masks never include bit 63. */
+static size_t
+scan_lanes (const unsigned char *buf, size_t lo, size_t hi, uint64_t mask)
+{
+    const unsigned char *p0, *p1;
+    uint64_t h0, h1, mask_ls = mask << 1;
+    size_t j, first1;
+
+    while (hi + 1 - lo >= N_LANES * LANE_SZ) {
+        p0 = buf + lo - 1;
+        p1 = p0 + LANE_SZ;
+        h0 = h1 = 0;
+
+        for (j = GEAR_WIN - 1; j > 0; --j) {
+            h0 = ROLL (h0, p0[-(long)j]);
+            h1 = ROLL (h1, p1[-(long)j]);
+        }
+
+        first1 = LANE_SZ;
+        for (j = 0; j < LANE_SZ; j += 2) {
+            h0 = (h0 << 2) + (gear[p0[j]] << 1);
+            h1 = (h1 << 2) + (gear[p1[j]] << 1);
+            if (unlikely (!(h0 & mask_ls) | !(h1 & mask_ls))) {
+                /* Lane 0 comes first, its first hit is the answer. */
+                if (!(h0 & mask_ls))
+                    return lo + j;
+                if (first1 == LANE_SZ)
+                    first1 = j;
+            }
+
+            h0 += gear[p0[j + 1]];
+            h1 += gear[p1[j + 1]];
+            if (unlikely (!(h0 & mask) | !(h1 & mask))) {
+                if (!(h0 & mask))
+                    return lo + j + 1;
+                if (first1 == LANE_SZ)
+                    first1 = j + 1;
+            }
+        }
+
+        if (first1 < LANE_SZ)
+            return lo + LANE_SZ + first1;
+
+        lo += N_LANES * LANE_SZ;
+    }
+
+    if (lo <= hi)
+        return scan_serial (buf, lo, hi, mask);
+    return 0;
+}
+
+typedef size_t (*ScanFunc) (const unsigned char *buf, size_t lo, size_t hi,
+                            uint64_t mask);
+
+static size_t
+find_cut (const FastCDCParams *params, const unsigned char *buf, size_t len,
+          ScanFunc scan)
+{
+    size_t n, hi, cut;
+
+    if (len <= params->min_sz)
+        return len;
+    n = MIN (len, params->max_sz);
+
+    /* Before the normal size, the harder mask. */
+    if (params->normal_sz > params->min_sz) {
+        hi = MIN (params->normal_sz - 1, n);
+        cut = scan (buf, params->min_sz, hi, params->mask_s);
+        if (cut)
+            return cut;
+    }
+
+    if (n >= params->normal_sz) {
+        cut = scan (buf, params->normal_sz, n, params->mask_l);
+        if (cut)
+            return cut;
+    }
+
+    return n;
+}
+
+size_t
+fastcdc_find_cut (const FastCDCParams *params, const unsigned char *buf, size_t len)
+{
+    return find_cut (params, buf, len, scan_lanes);
+}
+
+size_t
+fastcdc_find_cut_serial (const FastCDCParams *params, const unsigned char *buf, size_t len)
+{
+    return find_cut (params, buf, len, scan_serial);
+}
@@ -0,0 +1,41 @@
+/*
+FastCDC 分块断点查找（gear哈希 + 归一化分块）
+https://www.usenix.org/conference/atc16/technical-sessions/presentation/xia
+*/
+
+#ifndef _FASTCDC_H
+#define _FASTCDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The gear hash at a position is sum(G[b[i-k]] << k) over the last 64
+ * bytes, so it doesn't depend on where hashing started. A position is a
+ * cut point when the bits selected by the mask, the highest ones below
+ * bit 63, are all zero.
+ * Normalized chunking uses a harder mask before the normal size and an
+ * easier one after it, which narrows the distribution of block sizes.
+ */
+typedef struct FastCDCParams {
+    uint32_t min_sz;    // 块的最小大小（不小于64）
+    uint32_t normal_sz; // 切换掩码的位置，即平均大小
+    uint32_t max_sz;    // 块的最大大小
+    uint64_t mask_s;    // 小于normal_sz时的掩码（位数多）
+    uint64_t mask_l;    // 大于等于normal_sz时的掩码（位数少）
+} FastCDCParams;
+
+void // 根据块大小设置参数
+fastcdc_params_init (FastCDCParams *params,
+                     uint32_t min_sz, uint32_t avg_sz, uint32_t max_sz);
+
+/* Returns the length of the first block in @buf. @len must be at least
+ * max_sz unless @buf holds the rest of the file. @len (or max_sz) is
+ * returned if there's no cut point. */
+size_t // 查找第一个断点，多路并行扫描
+fastcdc_find_cut (const FastCDCParams *params, const unsigned char *buf, size_t len);
+
+size_t // 同上，逐字节扫描（用于校验）
+fastcdc_find_cut_serial (const FastCDCParams *params, const unsigned char *buf, size_t len);
+
+#endif
@@ -15,11 +15,22 @@
 #include "seafile-session.h"
 #include "commit-mgr.h"
 #include "seaf-utils.h"
+#include "lru-cache.h"
 
 #define MAX_TIME_SKEW 259200    /* 3 days */
 
+#define COMMIT_CACHE_N_SHARDS 16 // 提交缓存分片数
+#define DEFAULT_COMMIT_CACHE_ENTRIES 100000 // 默认提交缓存项数上限
+#define DEFAULT_COMMIT_CACHE_SIZE_MB 64 // 默认提交缓存大小（MB）
+
 struct _SeafCommitManagerPriv { // 私有域
-    int dummy;
+    /*
+     * Parsed commit objects, keyed by repo_id + commit_id. Commit objects
+     * are content-addressed, so cached entries never go stale. The cache
+     * owns its commits privately and hands out copies, so callers that
+     * modify or over-unref their commits can't corrupt the cached ones.
+     */
+    LRUCache *commit_cache; // 提交缓存；为NULL表示禁用
 };
 
 static SeafCommit * // 从数据载入提交
@@ -165,13 +176,59 @@ seaf_commit_free (SeafCommit *commit) // 释放提交空间
     if (commit->second_parent_id) g_free (commit->second_parent_id);
     if (commit->repo_name) g_free (commit->repo_name);
     if (commit->repo_desc) g_free (commit->repo_desc);
+    if (commit->repo_category) g_free (commit->repo_category);
     if (commit->device_name) g_free (commit->device_name);
     g_free (commit->client_version);
     g_free (commit->magic);
     g_free (commit->random_key);
+    g_free (commit->salt);
     g_free (commit);
 }
 
+SeafCommit *
+seaf_commit_dup (SeafCommit *commit) // 复制提交
+{
+    SeafCommit *new_commit;
+
+    new_commit = g_memdup (commit, sizeof(SeafCommit));
+    new_commit->ref = 1;
+
+    new_commit->desc = g_strdup (commit->desc);
+    new_commit->creator_name = g_strdup (commit->creator_name);
+    new_commit->parent_id = g_strdup (commit->parent_id);
+    new_commit->second_parent_id = g_strdup (commit->second_parent_id);
+    new_commit->repo_name = g_strdup (commit->repo_name);
+    new_commit->repo_desc = g_strdup (commit->repo_desc);
+    new_commit->repo_category = g_strdup (commit->repo_category);
+    new_commit->device_name = g_strdup (commit->device_name);
+    new_commit->client_version = g_strdup (commit->client_version);
+    new_commit->magic = g_strdup (commit->magic);
+    new_commit->random_key = g_strdup (commit->random_key);
+    new_commit->salt = g_strdup (commit->salt);
+
+    return new_commit;
+}
+
+static gint64 // 估算提交对象的内存占用
+commit_mem_size (SeafCommit *commit)
+{
+    gint64 size = sizeof(SeafCommit);
+    const char *strs[] = {
+        commit->desc, commit->creator_name, commit->parent_id,
+        commit->second_parent_id, commit->repo_name, commit->repo_desc,
+        commit->repo_category, commit->device_name, commit->client_version,
+        commit->magic, commit->random_key, commit->salt,
+    };
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(strs); ++i) {
+        if (strs[i])
+            size += strlen(strs[i]) + 1;
+    }
+
+    return size;
+}
+
 void
 seaf_commit_ref (SeafCommit *commit) // 增加提交的引用
 {
@@ -197,6 +254,29 @@ seaf_commit_manager_new (SeafileSession *seaf) // 创建提交管理器
     mgr->seaf = seaf;
     mgr->obj_store = seaf_obj_store_new (mgr->seaf, "commits"); // 开辟新的对象存储空间
 
+    GError *error = NULL;
+    gint64 max_entries, size_mb;
+
+    max_entries = g_key_file_get_int64 (seaf->config,
+                                        "fs_cache", "commit_cache_entries",
+                                        &error); // 提交缓存项数上限
+    if (error) {
+        max_entries = DEFAULT_COMMIT_CACHE_ENTRIES;
+        g_clear_error (&error);
+    }
+    size_mb = g_key_file_get_int64 (seaf->config,
+                                    "fs_cache", "commit_cache_size",
+                                    &error); // 提交缓存大小（MB）
+    if (error) {
+        size_mb = DEFAULT_COMMIT_CACHE_SIZE_MB;
+        g_clear_error (&error);
+    }
+    if (max_entries > 0 && size_mb > 0)
+        mgr->priv->commit_cache = lru_cache_new (COMMIT_CACHE_N_SHARDS,
+                                                 max_entries, size_mb << 20,
+                                                 (GBoxedCopyFunc)seaf_commit_dup,
+                                                 (GDestroyNotify)seaf_commit_unref);
+
     return mgr;
 }
 
@@ -210,23 +290,43 @@ seaf_commit_manager_init (SeafCommitManager *mgr) // 初始化提交管理器
     return 0;
 }
 
-#if 0
-inline static void
-add_commit_to_cache (SeafCommitManager *mgr, SeafCommit *commit)
+static char * // 生成缓存键
+commit_cache_key (const char *repo_id, const char *commit_id)
 {
-    g_hash_table_insert (mgr->priv->commit_cache,
-                         g_strdup(commit->commit_id),
-                         commit);
-    seaf_commit_ref (commit);
+    return g_strconcat (repo_id, commit_id, NULL);
 }
 
-inline static void
-remove_commit_from_cache (SeafCommitManager *mgr, SeafCommit *commit)
+/* The cache keeps its own copy, @commit is not referenced. */
+static void // 加入缓存
+add_commit_to_cache (SeafCommitManager *mgr,
+                     const char *repo_id,
+                     SeafCommit *commit)
 {
-    g_hash_table_remove (mgr->priv->commit_cache, commit->commit_id);
-    seaf_commit_unref (commit);
+    char *key;
+
+    if (!mgr->priv->commit_cache)
+        return;
+
+    key = commit_cache_key (repo_id, commit->commit_id);
+    lru_cache_insert (mgr->priv->commit_cache, key,
+                      seaf_commit_dup (commit), commit_mem_size (commit));
+    g_free (key);
+}
+
+static void // 从缓存中删除
+remove_commit_from_cache (SeafCommitManager *mgr,
+                          const char *repo_id,
+                          const char *commit_id)
+{
+    char *key;
+
+    if (!mgr->priv->commit_cache)
+        return;
+
+    key = commit_cache_key (repo_id, commit_id);
+    lru_cache_remove (mgr->priv->commit_cache, key);
+    g_free (key);
 }
-#endif
 
 int
 seaf_commit_manager_add_commit (SeafCommitManager *mgr,
@@ -234,10 +334,12 @@ seaf_commit_manager_add_commit (SeafCommitManager *mgr,
 {
     int ret;
 
-    /* add_commit_to_cache (mgr, commit); */
     if ((ret = save_commit (mgr, commit->repo_id, commit->version, commit)) < 0) // 存入硬盘
         return -1;
-    
+
+    /* New commits are usually read back right away as the branch head. */
+    add_commit_to_cache (mgr, commit->repo_id, commit);
+
     return 0;
 }
 
@@ -249,20 +351,7 @@ seaf_commit_manager_del_commit (SeafCommitManager *mgr,
 {
     g_return_if_fail (id != NULL);
 
-#if 0
-    commit = g_hash_table_lookup(mgr->priv->commit_cache, id);
-    if (!commit)
-        goto delete;
-
-    /*
-     * Catch ref count bug here. We have bug in commit ref, the
-     * following assert can't pass. TODO: fix the commit ref bug
-     */
-    /* g_assert (commit->ref <= 1); */
-    remove_commit_from_cache (mgr, commit);
-
-delete:
-#endif
+    remove_commit_from_cache (mgr, repo_id, id);
 
     delete_commit (mgr, repo_id, version, id); // 从硬盘删除
 }
@@ -274,20 +363,21 @@ seaf_commit_manager_get_commit (SeafCommitManager *mgr,
                                 const char *id) // 获取提交
 {
     SeafCommit *commit;
-
-#if 0
-    commit = g_hash_table_lookup (mgr->priv->commit_cache, id);
-    if (commit != NULL) {
-        seaf_commit_ref (commit);
-        return commit;
+    char *key = NULL;
+
+    if (mgr->priv->commit_cache && id) { // 查找缓存；缓存返回的是副本
+        key = commit_cache_key (repo_id, id);
+        commit = lru_cache_lookup (mgr->priv->commit_cache, key);
+        g_free (key);
+        if (commit)
+            return commit;
     }
-#endif
 
     commit = load_commit (mgr, repo_id, version, id); // 从硬盘加载
     if (!commit)
         return NULL;
 
-    /* add_commit_to_cache (mgr, commit); */
+    add_commit_to_cache (mgr, repo_id, commit);
 
     return commit;
 }
@@ -921,5 +1011,30 @@ int // 删除存储
 seaf_commit_manager_remove_store (SeafCommitManager *mgr,
                                   const char *store_id)
 {
+    if (mgr->priv->commit_cache)
+        lru_cache_remove_by_prefix (mgr->priv->commit_cache, store_id);
     return seaf_obj_store_remove_store (mgr->obj_store, store_id);
 }
+
+json_t * // 获取提交缓存的统计信息
+seaf_commit_manager_get_cache_stats (SeafCommitManager *mgr)
+{
+    LRUCacheStats stats;
+    json_t *object;
+
+    object = json_object ();
+    json_object_set_int_member (object, "enabled", mgr->priv->commit_cache != NULL);
+    if (!mgr->priv->commit_cache)
+        return object;
+
+    lru_cache_get_stats (mgr->priv->commit_cache, &stats);
+    json_object_set_int_member (object, "entries", stats.n_entries);
+    json_object_set_int_member (object, "max_entries", stats.max_entries);
+    json_object_set_int_member (object, "mem_size", stats.size);
+    json_object_set_int_member (object, "max_mem_size", stats.max_size);
+    json_object_set_int_member (object, "hits", stats.hits);
+    json_object_set_int_member (object, "misses", stats.misses);
+    json_object_set_int_member (object, "evictions", stats.evictions);
+
+    return object;
+}
@@ -8,6 +8,7 @@
 typedef struct _SeafCommit SeafCommit;
 
 #include <glib/gstdio.h>
+#include <jansson.h>
 #include "db.h"
 
 #include "obj-store.h"
@@ -73,6 +74,10 @@ seaf_commit_ref (SeafCommit *commit);
 void // 移除引用
 seaf_commit_unref (SeafCommit *commit);
 
+/* Returns a deep copy of @commit with ref count 1. */
+SeafCommit * // 复制提交
+seaf_commit_dup (SeafCommit *commit);
+
 /* Set stop to TRUE if you want to stop traversing a branch in the history graph. 
    Note, if currently there are multi branches, this function will be called again. 
    So, set stop to TRUE not always stop traversing the history graph.
@@ -129,12 +134,11 @@ seaf_commit_manager_del_commit (SeafCommitManager *mgr,
 
 /**
  * Find a commit object.
- * This function increments ref count of returned object.
- * Not MT safe.
+ * Recently used commits are served from an in-memory cache. The returned
+ * object is always a private copy owned by the caller.
  */
 // 寻找一个提交对象
-// 增加引用并返回对象
-// 线程不安全
+// 优先从缓存中查找，返回调用者私有的副本
 SeafCommit* 
 seaf_commit_manager_get_commit (SeafCommitManager *mgr,
                                 const char *repo_id,
@@ -215,4 +219,11 @@ int
 seaf_commit_manager_remove_store (SeafCommitManager *mgr,
                                   const char *store_id); // 释放提交管理器空间
 
+/*
+ * Returns a json object with the counters of the commit cache:
+ * entries, max_entries, mem_size, max_mem_size, hits, misses and evictions.
+ */
+json_t * // 获取提交缓存的统计信息
+seaf_commit_manager_get_cache_stats (SeafCommitManager *mgr);
+
 #endif
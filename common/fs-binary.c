@@ -0,0 +1,365 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* fs对象的二进制存储格式 */
+
+#include "common.h"
+
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "utils.h"
+#include "log.h"
+
+#include "fs-binary.h"
+
+#define HEADER_LEN (SEAF_FS_BIN_MAGIC_LEN + 2)
+/* Refuse to inflate absurd lengths from corrupted objects. */
+#define MAX_PAYLOAD_LEN (256 << 20)
+
+struct SeafFSBinWriter {
+    GByteArray *buf;
+    GByteArray *rec; // 当前目录项
+};
+
+gboolean
+seaf_fs_bin_is_binary (const guint8 *data, int len)
+{
+    return len >= HEADER_LEN &&
+        memcmp (data, SEAF_FS_BIN_MAGIC, SEAF_FS_BIN_MAGIC_LEN) == 0;
+}
+
+static void
+put_varint (GByteArray *a, guint64 v)
+{
+    guint8 b[10];
+    int n = 0;
+
+    while (v >= 0x80) {
+        b[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    b[n++] = v;
+    g_byte_array_append (a, b, n);
+}
+
+static void
+put_svarint (GByteArray *a, gint64 v)
+{
+    put_varint (a, ((guint64)v << 1) ^ (guint64)(v >> 63));
+}
+
+SeafFSBinWriter *
+seaf_fs_bin_writer_new (int type, int version)
+{
+    SeafFSBinWriter *w = g_new0 (SeafFSBinWriter, 1);
+
+    w->buf = g_byte_array_new ();
+    w->rec = g_byte_array_new ();
+    put_varint (w->buf, type);
+    put_varint (w->buf, version);
+
+    return w;
+}
+
+void
+seaf_fs_bin_put_file (SeafFSBinWriter *w, guint64 size, guint32 n_blocks)
+{
+    put_varint (w->buf, size);
+    put_varint (w->buf, n_blocks);
+}
+
+void
+seaf_fs_bin_put_block (SeafFSBinWriter *w, const guint8 *raw_id)
+{
+    g_byte_array_append (w->buf, raw_id, 20);
+}
+
+void
+seaf_fs_bin_put_n_dirents (SeafFSBinWriter *w, guint32 n_dirents)
+{
+    put_varint (w->buf, n_dirents);
+}
+
+void
+seaf_fs_bin_put_dirent (SeafFSBinWriter *w, guint32 mode, const char *hex_id,
+                        const char *name, int name_len, gint64 mtime,
+                        const char *modifier, gint64 size)
+{
+    GByteArray *rec = w->rec;
+    guint8 raw_id[20];
+
+    g_byte_array_set_size (rec, 0);
+    put_varint (rec, mode);
+    hex_to_rawdata (hex_id, raw_id, 20);
+    g_byte_array_append (rec, raw_id, 20);
+    put_varint (rec, name_len);
+    g_byte_array_append (rec, (const guint8 *)name, name_len);
+    put_svarint (rec, mtime);
+    if (S_ISREG(mode)) {
+        int modifier_len = modifier ? strlen(modifier) : 0;
+        put_varint (rec, modifier_len);
+        g_byte_array_append (rec, (const guint8 *)modifier, modifier_len);
+        put_svarint (rec, size);
+    }
+
+    put_varint (w->buf, rec->len);
+    g_byte_array_append (w->buf, rec->data, rec->len);
+}
+
+static void
+put_header (GByteArray *out, int compression)
+{
+    guint8 b[2] = { SEAF_FS_BIN_FORMAT_VERSION, compression };
+
+    g_byte_array_append (out, (const guint8 *)SEAF_FS_BIN_MAGIC,
+                         SEAF_FS_BIN_MAGIC_LEN);
+    g_byte_array_append (out, b, 2);
+}
+
+guint8 *
+seaf_fs_bin_writer_finish (SeafFSBinWriter *w, int compression, int *len)
+{
+    GByteArray *payload = w->buf;
+    GByteArray *out = g_byte_array_sized_new (payload->len / 2 + 32);
+    gsize bound;
+    int ret = 0;
+
+    put_header (out, compression);
+
+    switch (compression) {
+    case SEAF_FS_BIN_COMPRESS_NONE:
+        g_byte_array_append (out, payload->data, payload->len);
+        break;
+    case SEAF_FS_BIN_COMPRESS_ZLIB: {
+        uLongf dest_len;
+
+        put_varint (out, payload->len);
+        bound = compressBound (payload->len);
+        dest_len = bound;
+        g_byte_array_set_size (out, out->len + bound);
+        if (compress2 (out->data + out->len - bound, &dest_len,
+                       payload->data, payload->len, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            ret = -1;
+            break;
+        }
+        g_byte_array_set_size (out, out->len - bound + dest_len);
+        break;
+    }
+#ifdef HAVE_ZSTD
+    case SEAF_FS_BIN_COMPRESS_ZSTD: {
+        size_t n;
+
+        put_varint (out, payload->len);
+        bound = ZSTD_compressBound (payload->len);
+        g_byte_array_set_size (out, out->len + bound);
+        n = ZSTD_compress (out->data + out->len - bound, bound,
+                           payload->data, payload->len, 3);
+        if (ZSTD_isError (n)) {
+            ret = -1;
+            break;
+        }
+        g_byte_array_set_size (out, out->len - bound + n);
+        break;
+    }
+#endif
+    default:
+        ret = -1;
+    }
+
+    g_byte_array_free (w->buf, TRUE);
+    g_byte_array_free (w->rec, TRUE);
+    g_free (w);
+
+    if (ret < 0) {
+        seaf_warning ("Failed to encode fs object with compression %d.\n",
+                      compression);
+        g_byte_array_free (out, TRUE);
+        return NULL;
+    }
+
+    *len = out->len;
+    return g_byte_array_free (out, FALSE);
+}
+
+static int
+get_varint (SeafFSBinReader *r, guint64 *v)
+{
+    guint64 x = 0;
+    int shift;
+
+    for (shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        guint8 b = *r->p++;
+        x |= (guint64)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int
+get_svarint (SeafFSBinReader *r, gint64 *v)
+{
+    guint64 x;
+
+    if (get_varint (r, &x) < 0)
+        return -1;
+    *v = (gint64)(x >> 1) ^ -(gint64)(x & 1);
+    return 0;
+}
+
+static int
+decompress_payload (SeafFSBinReader *r, int compression)
+{
+    guint64 raw_len;
+
+    if (get_varint (r, &raw_len) < 0 || raw_len > MAX_PAYLOAD_LEN)
+        return -1;
+    r->payload = g_malloc (raw_len ? raw_len : 1);
+
+    switch (compression) {
+    case SEAF_FS_BIN_COMPRESS_ZLIB: {
+        uLongf dest_len = raw_len;
+
+        if (uncompress (r->payload, &dest_len, r->p, r->end - r->p) != Z_OK ||
+            dest_len != raw_len)
+            return -1;
+        break;
+    }
+#ifdef HAVE_ZSTD
+    case SEAF_FS_BIN_COMPRESS_ZSTD: {
+        size_t n = ZSTD_decompress (r->payload, raw_len, r->p, r->end - r->p);
+        if (ZSTD_isError (n) || n != raw_len)
+            return -1;
+        break;
+    }
+#endif
+    default:
+        seaf_warning ("Unsupported fs object compression %d.\n", compression);
+        return -1;
+    }
+
+    r->p = r->payload;
+    r->end = r->payload + raw_len;
+    return 0;
+}
+
+int
+seaf_fs_bin_reader_init (SeafFSBinReader *r, const guint8 *data, int len)
+{
+    guint64 type, version, v;
+    int compression;
+
+    memset (r, 0, sizeof(*r));
+
+    if (!seaf_fs_bin_is_binary (data, len) ||
+        data[SEAF_FS_BIN_MAGIC_LEN] != SEAF_FS_BIN_FORMAT_VERSION)
+        return -1;
+    compression = data[SEAF_FS_BIN_MAGIC_LEN + 1];
+    r->p = data + HEADER_LEN;
+    r->end = data + len;
+
+    if (compression != SEAF_FS_BIN_COMPRESS_NONE &&
+        decompress_payload (r, compression) < 0)
+        goto err;
+
+    if (get_varint (r, &type) < 0 || get_varint (r, &version) < 0)
+        goto err;
+    r->type = type;
+    r->version = version;
+
+    if (r->type == 1) { // SEAF_METADATA_TYPE_FILE
+        if (get_varint (r, &r->file_size) < 0 || get_varint (r, &v) < 0 ||
+            v > (guint64)(r->end - r->p) / 20)
+            goto err;
+    } else {
+        if (get_varint (r, &v) < 0 || v > (guint64)(r->end - r->p))
+            goto err;
+    }
+    r->count = v;
+
+    return 0;
+
+err:
+    seaf_fs_bin_reader_clear (r);
+    return -1;
+}
+
+void
+seaf_fs_bin_reader_clear (SeafFSBinReader *r)
+{
+    g_free (r->payload);
+    r->payload = NULL;
+    r->p = r->end = NULL;
+}
+
+const guint8 *
+seaf_fs_bin_reader_next_block (SeafFSBinReader *r)
+{
+    const guint8 *id;
+
+    if (r->n_read >= r->count || r->end - r->p < 20)
+        return NULL;
+
+    id = r->p;
+    r->p += 20;
+    ++r->n_read;
+    return id;
+}
+
+static int
+get_bytes (SeafFSBinReader *r, const guint8 *rec_end,
+           const char **s, int *len)
+{
+    guint64 n;
+
+    /* The varint may have run past the end of the record. */
+    if (get_varint (r, &n) < 0 || r->p > rec_end ||
+        n > (guint64)(rec_end - r->p))
+        return -1;
+    *s = (const char *)r->p;
+    *len = n;
+    r->p += n;
+    return 0;
+}
+
+int
+seaf_fs_bin_reader_next_dirent (SeafFSBinReader *r, SeafFSBinDirent *dent)
+{
+    guint64 rec_len, mode;
+    const guint8 *rec_end;
+
+    if (r->n_read >= r->count)
+        return 0;
+
+    if (get_varint (r, &rec_len) < 0 || rec_len > (guint64)(r->end - r->p))
+        return -1;
+    rec_end = r->p + rec_len;
+
+    memset (dent, 0, sizeof(*dent));
+    if (get_varint (r, &mode) < 0 || rec_end - r->p < 20)
+        return -1;
+    dent->mode = mode;
+    dent->id = r->p;
+    r->p += 20;
+
+    if (get_bytes (r, rec_end, &dent->name, &dent->name_len) < 0 ||
+        get_svarint (r, &dent->mtime) < 0)
+        return -1;
+    if (S_ISREG(dent->mode) &&
+        (get_bytes (r, rec_end, &dent->modifier, &dent->modifier_len) < 0 ||
+         get_svarint (r, &dent->size) < 0))
+        return -1;
+
+    /* Skip fields added by later writers. */
+    if (r->p > rec_end)
+        return -1;
+    r->p = rec_end;
+    ++r->n_read;
+
+    return 1;
+}
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* fs对象的二进制存储格式 */
+
+/*
+ * A compact storage format for version 1 fs objects, instead of
+ * zlib-compressed json. The id of an object is still the sha1 of its
+ * json form; the json can be rebuilt from the binary form exactly.
+ *
+ *   magic "\xffSFB", format version (1 byte), compression (1 byte),
+ *   [uncompressed length (varint), if compressed,] payload
+ *
+ * The payload is the object type and version (varints), then
+ *   file: size (varint), number of blocks (varint), raw 20-byte block ids;
+ *   dir:  number of dirents (varint), then every dirent prefixed by its
+ *         length (varint): mode (varint), raw 20-byte id, name length
+ *         (varint), name, mtime (zigzag varint) and for regular files
+ *         modifier length (varint), modifier, size (zigzag varint).
+ *
+ * The same format is read by fileserver/fsmgr.
+ */
+
+#ifndef SEAF_FS_BINARY_H
+#define SEAF_FS_BINARY_H
+
+#include <glib.h>
+
+#define SEAF_FS_BIN_MAGIC "\xff" "SFB"
+#define SEAF_FS_BIN_MAGIC_LEN 4
+#define SEAF_FS_BIN_FORMAT_VERSION 1
+
+enum { // 压缩方式
+    SEAF_FS_BIN_COMPRESS_NONE = 0,
+    SEAF_FS_BIN_COMPRESS_ZLIB = 1,
+    SEAF_FS_BIN_COMPRESS_ZSTD = 2, // 只在编译时启用zstd时可用
+};
+
+gboolean // 数据是否为二进制格式
+seaf_fs_bin_is_binary (const guint8 *data, int len);
+
+/* Encoder. Fields are put in the order of the format. */
+
+typedef struct SeafFSBinWriter SeafFSBinWriter;
+
+SeafFSBinWriter *
+seaf_fs_bin_writer_new (int type, int version);
+
+void
+seaf_fs_bin_put_file (SeafFSBinWriter *w, guint64 size, guint32 n_blocks);
+
+void // 写入一个块id（20字节原始数据）
+seaf_fs_bin_put_block (SeafFSBinWriter *w, const guint8 *raw_id);
+
+void
+seaf_fs_bin_put_n_dirents (SeafFSBinWriter *w, guint32 n_dirents);
+
+void // @modifier和@size只对普通文件写入
+seaf_fs_bin_put_dirent (SeafFSBinWriter *w, guint32 mode, const char *hex_id,
+                        const char *name, int name_len, gint64 mtime,
+                        const char *modifier, gint64 size);
+
+/* Frees @w and returns the encoded object, NULL on failure. */
+guint8 *
+seaf_fs_bin_writer_finish (SeafFSBinWriter *w, int compression, int *len);
+
+/*
+ * Zero-copy reader. Block ids, names and modifiers point into the
+ * object data, or into the decompressed payload owned by the reader;
+ * they are valid until the reader is cleared. Names are not
+ * nul-terminated.
+ */
+
+typedef struct SeafFSBinReader {
+    int type;
+    int version;
+    guint64 file_size; // 只对文件有效
+    guint32 count; // 块数或目录项数
+
+    /* private */
+    guint8 *payload; // 解压后的数据
+    const guint8 *p;
+    const guint8 *end;
+    guint32 n_read;
+} SeafFSBinReader;
+
+typedef struct SeafFSBinDirent {
+    guint32 mode;
+    const guint8 *id; // 20字节原始数据
+    const char *name;
+    int name_len;
+    gint64 mtime;
+    const char *modifier; // 只对普通文件有效
+    int modifier_len;
+    gint64 size;
+} SeafFSBinDirent;
+
+/* Returns -1 if @data is not a valid binary object. */
+int
+seaf_fs_bin_reader_init (SeafFSBinReader *r, const guint8 *data, int len);
+
+void
+seaf_fs_bin_reader_clear (SeafFSBinReader *r);
+
+/* Returns the next raw block id, or NULL at the end or on error. */
+const guint8 *
+seaf_fs_bin_reader_next_block (SeafFSBinReader *r);
+
+/* Returns 1 and fills @dent, 0 at the end, -1 on error. */
+int
+seaf_fs_bin_reader_next_dirent (SeafFSBinReader *r, SeafFSBinDirent *dent);
+
+#endif
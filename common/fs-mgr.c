@@ -21,9 +21,12 @@ char *strcasestr (const char *haystack, const char *needle);
 #include "seafile-session.h"
 #include "seafile-error.h"
 #include "fs-mgr.h"
+#include "fs-binary.h"
 #include "block-mgr.h"
 #include "utils.h"
 #include "seaf-utils.h"
+#include "lru-cache.h"
+#include "sha1-batch.h"
 #define DEBUG_FLAG SEAFILE_DEBUG_OTHER
 #include "log.h"
 #include "../common/seafile-crypt.h"
@@ -40,6 +43,25 @@ char *strcasestr (const char *haystack, const char *needle);
 struct _SeafFSManagerPriv { // 私有域
     /* GHashTable      *seafile_cache; */
     GHashTable      *bl_cache; // 块表缓存
+    /*
+     * Parsed dir objects, keyed by store_id + dir_id. Dir objects are
+     * content-addressed, so cached entries never go stale.
+     */
+    LRUCache        *dir_cache; // 目录对象缓存；为NULL表示禁用
+    /*
+     * Block offset tables, keyed by file id. A file id fixes its blocks and
+     * so their sizes, tables never go stale either.
+     */
+    LRUCache        *offset_cache; // 块偏移表缓存；为NULL表示禁用
+    struct SeafObjStore *offset_store; // 持久化的块偏移表；为NULL表示不保存
+    /*
+     * New version 1 objects are stored in the binary format of fs-binary.h.
+     * Both formats are always readable.
+     */
+    gboolean         binary_objects; // 以二进制格式保存新对象
+    int              bin_compression; // 二进制对象的压缩方式
+    /* Writes blocks of files indexed by StreamIndexer, shared by all uploads. */
+    GThreadPool     *stream_index_pool; // 流式索引写块线程池
 };
 
 typedef struct SeafileOndisk { // Seafile字节流内容（版本0下的seafile对象存储）
@@ -60,6 +82,28 @@ typedef struct SeafdirOndisk { // Seadir字节流内容
     char    dirents[0];
 } __attribute__((gcc_struct, __packed__)) SeafdirOndisk;
 
+#define DIR_CACHE_N_SHARDS 16 // 目录对象缓存分片数
+#define DEFAULT_DIR_CACHE_SIZE_MB 100 // 默认目录对象缓存大小（MB）
+#define OFFSET_CACHE_N_SHARDS 8 // 块偏移表缓存分片数
+#define DEFAULT_OFFSET_CACHE_SIZE_MB 16 // 默认块偏移表缓存大小（MB）
+
+static gint64 // 估算目录对象的内存占用
+dir_mem_size (SeafDir *dir)
+{
+    gint64 size = sizeof(SeafDir) + dir->ondisk_size;
+    GList *ptr;
+    SeafDirent *dent;
+
+    for (ptr = dir->entries; ptr; ptr = ptr->next) {
+        dent = ptr->data;
+        size += sizeof(GList) + sizeof(SeafDirent) + dent->name_len + 1;
+        if (dent->modifier)
+            size += strlen(dent->modifier) + 1;
+    }
+
+    return size;
+}
+
 #ifndef SEAFILE_SERVER
 uint32_t // 计算分块大小
 calculate_chunk_size (uint64_t total_size);
@@ -70,6 +114,53 @@ write_seafile (SeafFSManager *fs_mgr,
                unsigned char *obj_sha1); // seafile对象的SHA1
 #endif  /* SEAFILE_SERVER */
 
+/*
+ * [fs_object]
+ * format = binary
+ * compression = zstd
+ *
+ * stores new fs objects in the binary format. compression is one of none,
+ * zlib (the default) and zstd. zstd objects can't be read by the go
+ * fileserver, zlib is used instead when it is enabled.
+ */
+static void // 读取fs对象存储格式配置
+load_fs_object_format (SeafFSManager *mgr, GKeyFile *config)
+{
+    char *format, *compression;
+
+    mgr->priv->bin_compression = SEAF_FS_BIN_COMPRESS_ZLIB;
+
+    format = g_key_file_get_string (config, "fs_object", "format", NULL);
+    mgr->priv->binary_objects = (g_strcmp0 (format, "binary") == 0);
+    if (format && !mgr->priv->binary_objects && strcmp (format, "json") != 0)
+        seaf_warning ("[fs mgr] Unknown fs object format %s, use json.\n", format);
+    g_free (format);
+
+    compression = g_key_file_get_string (config, "fs_object", "compression", NULL);
+    if (!compression || strcmp (compression, "zlib") == 0) {
+        g_free (compression);
+        return;
+    }
+
+    if (strcmp (compression, "none") == 0) {
+        mgr->priv->bin_compression = SEAF_FS_BIN_COMPRESS_NONE;
+    } else if (strcmp (compression, "zstd") == 0) {
+#ifdef HAVE_ZSTD
+        if (g_key_file_get_boolean (config, "fileserver", "use_go_fileserver", NULL))
+            seaf_warning ("[fs mgr] zstd fs objects can't be read by the go fileserver, "
+                          "use zlib.\n");
+        else
+            mgr->priv->bin_compression = SEAF_FS_BIN_COMPRESS_ZSTD;
+#else
+        seaf_warning ("[fs mgr] Built without zstd, use zlib for fs objects.\n");
+#endif
+    } else {
+        seaf_warning ("[fs mgr] Unknown fs object compression %s, use zlib.\n",
+                      compression);
+    }
+    g_free (compression);
+}
+
 SeafFSManager * // 创建新的文件系统管理器
 seaf_fs_manager_new (SeafileSession *seaf,
                      const char *seaf_dir)
@@ -86,9 +177,50 @@ seaf_fs_manager_new (SeafileSession *seaf,
 
     mgr->priv = g_new0(SeafFSManagerPriv, 1); // 私有域
 
+    GError *error = NULL;
+    gint64 cache_size_mb = g_key_file_get_int64 (seaf->config,
+                                                 "fs_cache", "dir_cache_size",
+                                                 &error); // 目录对象缓存大小（MB）
+    if (error) {
+        cache_size_mb = DEFAULT_DIR_CACHE_SIZE_MB;
+        g_clear_error (&error);
+    }
+    if (cache_size_mb > 0)
+        mgr->priv->dir_cache = lru_cache_new (DIR_CACHE_N_SHARDS,
+                                              0, cache_size_mb << 20,
+                                              (GBoxedCopyFunc)seaf_dir_dup,
+                                              (GDestroyNotify)seaf_dir_free);
+
+    cache_size_mb = g_key_file_get_int64 (seaf->config,
+                                          "fs_cache", "block_offset_cache_size",
+                                          &error); // 块偏移表缓存大小（MB）
+    if (error) {
+        cache_size_mb = DEFAULT_OFFSET_CACHE_SIZE_MB;
+        g_clear_error (&error);
+    }
+    if (cache_size_mb > 0)
+        mgr->priv->offset_cache = lru_cache_new (OFFSET_CACHE_N_SHARDS,
+                                                 0, cache_size_mb << 20,
+                                                 (GBoxedCopyFunc)seaf_block_offsets_ref,
+                                                 (GDestroyNotify)seaf_block_offsets_unref);
+
+    if (g_key_file_get_boolean (seaf->config,
+                                "fs_cache", "persist_block_offsets", NULL)) {
+        mgr->priv->offset_store = seaf_obj_store_new (seaf, "offsets");
+        if (!mgr->priv->offset_store)
+            seaf_warning ("[fs mgr] Failed to create block offset store.\n");
+    }
+
+    load_fs_object_format (mgr, seaf->config);
+
     return mgr;
 }
 
+#if defined SEAFILE_SERVER && defined FULL_FEATURE
+static void
+stream_index_worker (gpointer vdata, gpointer user_data);
+#endif
+
 int // 初始化管理器
 seaf_fs_manager_init (SeafFSManager *mgr)
 {
@@ -97,6 +229,14 @@ seaf_fs_manager_init (SeafFSManager *mgr)
         return -1;
     }
 
+#if defined SEAFILE_SERVER && defined FULL_FEATURE
+    if (seaf->http_server)
+        mgr->priv->stream_index_pool =
+            g_thread_pool_new (stream_index_worker, NULL,
+                               seaf->http_server->stream_index_threads,
+                               FALSE, NULL);
+#endif
+
     return 0;
 }
 
@@ -458,7 +598,21 @@ write_seafile (SeafFSManager *fs_mgr, // 管理器
             goto out;
         }
 
-        if (seaf_compress (ondisk, ondisk_size, &compressed, &outlen) < 0) { // 将字节流压缩
+        if (fs_mgr->priv->binary_objects) { // 二进制格式
+            SeafFSBinWriter *w;
+            int i;
+
+            w = seaf_fs_bin_writer_new (SEAF_METADATA_TYPE_FILE,
+                                        seafile_version_from_repo_version(version));
+            seaf_fs_bin_put_file (w, cdc->file_size, cdc->block_nr);
+            for (i = 0; i < cdc->block_nr; ++i)
+                seaf_fs_bin_put_block (w, cdc->blk_sha1s + i * 20);
+            compressed = seaf_fs_bin_writer_finish (w, fs_mgr->priv->bin_compression,
+                                                    &outlen);
+        } else if (seaf_compress (ondisk, ondisk_size, &compressed, &outlen) < 0) { // 将字节流压缩
+            compressed = NULL;
+        }
+        if (!compressed) {
             seaf_warning ("Failed to compress seafile obj %s:%s.\n",
                           repo_id, seafile_id);
             ret = -1;
@@ -612,6 +766,8 @@ create_cdc_for_empty_file (CDCFileDescriptor *cdc)
 
 #define FIXED_BLOCK_SIZE (1<<20)
 
+#define INDEX_BATCH_SIZE (64 << 20) // 一个分块任务读入的数据量上限
+
 typedef struct ChunkingData {
     const char *repo_id;
     int version;
@@ -619,16 +775,70 @@ typedef struct ChunkingData {
     SeafileCrypt *crypt;
     guint8 *blk_sha1s;
     GAsyncQueue *finished_tasks;
+    int batch_blocks; // 每个任务包含的块数
 } ChunkingData;
 
+/* Like seafile_write_chunk(), for several blocks whose checksums are
+ * computed in parallel. */
+static int // 批量写块
+seafile_write_chunks (const char *repo_id,
+                      int version,
+                      CDCDescriptor *chunks,
+                      int n_chunks,
+                      SeafileCrypt *crypt)
+{
+    SHA1BatchJob *jobs = g_new0 (SHA1BatchJob, n_chunks);
+    char **encrypted_bufs = g_new0 (char *, n_chunks);
+    int enc_len;
+    int i, ret = 0;
+
+    for (i = 0; i < n_chunks; ++i) {
+        jobs[i].data = chunks[i].block_buf;
+        jobs[i].len = chunks[i].len;
+        jobs[i].digest = chunks[i].checksum;
+
+        /* Encrypt before write to disk if needed, and we don't encrypt
+         * empty files. */
+        if (crypt != NULL && chunks[i].len) {
+            if (seafile_encrypt (&encrypted_bufs[i], &enc_len,
+                                 chunks[i].block_buf, chunks[i].len, crypt) != 0) {
+                seaf_warning ("Error: failed to encrypt block\n");
+                ret = -1;
+                goto out;
+            }
+            jobs[i].data = encrypted_bufs[i];
+            jobs[i].len = enc_len;
+        }
+    }
+
+    sha1_batch (jobs, n_chunks);
+
+    for (i = 0; i < n_chunks; ++i) {
+        ret = do_write_chunk (repo_id, version, chunks[i].checksum,
+                              jobs[i].data, jobs[i].len);
+        if (ret < 0)
+            break;
+    }
+
+out:
+    for (i = 0; i < n_chunks; ++i)
+        g_free (encrypted_bufs[i]);
+    g_free (encrypted_bufs);
+    g_free (jobs);
+    return ret;
+}
+
+/* A task covers up to batch_blocks consecutive blocks. */
 static void
 chunking_worker (gpointer vdata, gpointer user_data)
 {
     ChunkingData *data = user_data;
     CDCDescriptor *chunk = vdata;
+    gint64 block_size = seaf->http_server->fixed_block_size;
+    CDCDescriptor *blocks = NULL;
     int fd = -1;
     ssize_t n;
-    int idx;
+    int n_blocks, idx, i;
 
     chunk->block_buf = g_new0 (char, chunk->len);
     if (!chunk->block_buf) {
@@ -657,16 +867,26 @@ chunking_worker (gpointer vdata, gpointer user_data)
         goto out;
     }
 
-    chunk->result = seafile_write_chunk (data->repo_id, data->version,
-                                         chunk, data->crypt,
-                                         chunk->checksum, 1);
+    n_blocks = (chunk->len + block_size - 1) / block_size;
+    blocks = g_new0 (CDCDescriptor, n_blocks);
+    for (i = 0; i < n_blocks; ++i) {
+        blocks[i].offset = chunk->offset + i * block_size;
+        blocks[i].len = MIN (block_size, chunk->len - i * block_size);
+        blocks[i].block_buf = chunk->block_buf + i * block_size;
+    }
+
+    chunk->result = seafile_write_chunks (data->repo_id, data->version,
+                                          blocks, n_blocks, data->crypt);
     if (chunk->result < 0)
         goto out;
 
-    idx = chunk->offset / seaf->http_server->fixed_block_size;
-    memcpy (data->blk_sha1s + idx * CHECKSUM_LENGTH, chunk->checksum, CHECKSUM_LENGTH);
+    idx = chunk->offset / block_size;
+    for (i = 0; i < n_blocks; ++i)
+        memcpy (data->blk_sha1s + (idx + i) * CHECKSUM_LENGTH,
+                blocks[i].checksum, CHECKSUM_LENGTH);
 
 out:
+    g_free (blocks);
     g_free (chunk->block_buf);
     close (fd);
     g_async_queue_push (data->finished_tasks, chunk);
@@ -709,6 +929,10 @@ split_file_to_block (const char *repo_id,
     data.crypt = crypt;
     data.blk_sha1s = block_sha1s;
     data.finished_tasks = finished_tasks;
+    /* Several blocks per task, so that their checksums are computed in
+     * parallel. */
+    data.batch_blocks = MAX (1, MIN (sha1_batch_lanes (),
+                                     INDEX_BATCH_SIZE / seaf->http_server->fixed_block_size));
 
     tpool = g_thread_pool_new (chunking_worker, &data,
                                seaf->http_server->max_indexing_threads, FALSE, NULL);
@@ -721,8 +945,9 @@ split_file_to_block (const char *repo_id,
     guint64 offset = 0;
     guint64 len;
     guint64 left = (guint64)file_size;
+    guint64 task_size = seaf->http_server->fixed_block_size * data.batch_blocks;
     while (left > 0) {
-        len = ((left >= seaf->http_server->fixed_block_size) ? seaf->http_server->fixed_block_size : left);
+        len = ((left >= task_size) ? task_size : left);
 
         chunk = g_new0 (CDCDescriptor, 1);
         chunk->offset = offset;
@@ -742,7 +967,7 @@ split_file_to_block (const char *repo_id,
             goto out;
         }
         if (indexed)
-            *indexed += seaf->http_server->fixed_block_size;
+            *indexed += chunk->len;
 
         if ((--n_pending) <= 0) {
             if (indexed)
@@ -766,6 +991,313 @@ out:
     return ret;
 }
 
+struct StreamIndexer {
+    SeafFSManager *mgr;
+    char repo_id[37];
+    int version;
+    SeafileCrypt crypt;
+    gboolean encrypted;
+    gint64 block_size;
+    int ref_count;              /* owner + queued tasks */
+
+    /* Only used by the owner. */
+    CDCDescriptor *cur;         /* block being filled */
+    gint64 file_size;
+    GPtrArray *chunks;          /* all blocks in file order */
+
+    pthread_mutex_t lock;
+    int n_pending;              /* queued tasks */
+    int max_pending;
+    gboolean finished;          // 数据已全部提交
+    gboolean done;              // 所有块及seafile对象已写完
+    gboolean cancelled;         // 已释放，未写的块不再写
+    int result;
+    unsigned char file_id[20];
+    StreamIndexNotify notify;
+    void *notify_data;
+};
+
+/* A NULL chunk only marks the end of the file, see
+ * seaf_fs_manager_stream_index_finish(). */
+typedef struct StreamIndexTask {
+    StreamIndexer *idx;
+    CDCDescriptor *chunk;
+} StreamIndexTask;
+
+static void
+stream_index_unref (StreamIndexer *idx)
+{
+    CDCDescriptor *chunk;
+    gboolean last;
+    guint i;
+
+    pthread_mutex_lock (&idx->lock);
+    last = (--idx->ref_count == 0);
+    pthread_mutex_unlock (&idx->lock);
+    if (!last)
+        return;
+
+    if (idx->cur) {
+        g_free (idx->cur->block_buf);
+        g_free (idx->cur);
+    }
+    for (i = 0; i < idx->chunks->len; ++i) {
+        chunk = g_ptr_array_index (idx->chunks, i);
+        g_free (chunk->block_buf);
+        g_free (chunk);
+    }
+    g_ptr_array_free (idx->chunks, TRUE);
+    pthread_mutex_destroy (&idx->lock);
+    g_free (idx);
+}
+
+static int // 写seafile对象
+stream_index_write_seafile (StreamIndexer *idx)
+{
+    CDCFileDescriptor cdc;
+    CDCDescriptor *chunk;
+    guint i;
+    int ret = 0;
+
+    if (idx->file_size == 0) {
+        /* handle empty file. */
+        memset (idx->file_id, 0, 20);
+        return 0;
+    }
+
+    memset (&cdc, 0, sizeof(cdc));
+    memcpy (cdc.repo_id, idx->repo_id, 36);
+    cdc.version = idx->version;
+    cdc.file_size = idx->file_size;
+    cdc.block_nr = idx->chunks->len;
+    cdc.blk_sha1s = g_new (uint8_t, cdc.block_nr * CHECKSUM_LENGTH);
+    for (i = 0; i < idx->chunks->len; ++i) {
+        chunk = g_ptr_array_index (idx->chunks, i);
+        memcpy (cdc.blk_sha1s + i * CHECKSUM_LENGTH, chunk->checksum, CHECKSUM_LENGTH);
+    }
+
+    if (write_seafile (idx->mgr, idx->repo_id, idx->version, &cdc, idx->file_id) < 0) {
+        seaf_warning ("Failed to write seafile for uploaded file in %s.\n", idx->repo_id);
+        ret = -1;
+    }
+
+    g_free (cdc.blk_sha1s);
+    return ret;
+}
+
+static void
+stream_index_worker (gpointer vdata, gpointer user_data)
+{
+    StreamIndexTask *task = vdata;
+    StreamIndexer *idx = task->idx;
+    CDCDescriptor *chunk = task->chunk;
+    gboolean cancelled, last, ok;
+    int rc = 0;
+
+    pthread_mutex_lock (&idx->lock);
+    cancelled = idx->cancelled;
+    pthread_mutex_unlock (&idx->lock);
+
+    if (chunk && !cancelled)
+        rc = seafile_write_chunk (idx->repo_id, idx->version, chunk,
+                                  idx->encrypted ? &idx->crypt : NULL,
+                                  chunk->checksum, TRUE);
+    if (chunk) {
+        g_free (chunk->block_buf);
+        chunk->block_buf = NULL;
+    }
+
+    pthread_mutex_lock (&idx->lock);
+    if (rc < 0)
+        idx->result = -1;
+    --idx->n_pending;
+    last = (idx->finished && idx->n_pending == 0);
+    ok = (!idx->cancelled && idx->result == 0);
+    pthread_mutex_unlock (&idx->lock);
+
+    /* The blocks are all written, and the owner doesn't touch the chunks
+     * after finishing. */
+    if (last && ok)
+        rc = stream_index_write_seafile (idx);
+
+    pthread_mutex_lock (&idx->lock);
+    if (last) {
+        if (rc < 0)
+            idx->result = -1;
+        idx->done = TRUE;
+    }
+    if (idx->notify)
+        idx->notify (idx->notify_data);
+    pthread_mutex_unlock (&idx->lock);
+
+    stream_index_unref (idx);
+    g_free (task);
+}
+
+/* @last marks the end of the file in the same step, so that exactly one
+ * worker sees all tasks finished. */
+static void // 提交一个写块任务
+stream_index_push (StreamIndexer *idx, CDCDescriptor *chunk, gboolean last)
+{
+    StreamIndexTask *task = g_new0 (StreamIndexTask, 1);
+
+    task->idx = idx;
+    task->chunk = chunk;
+
+    pthread_mutex_lock (&idx->lock);
+    ++idx->n_pending;
+    ++idx->ref_count;
+    if (last)
+        idx->finished = TRUE;
+    pthread_mutex_unlock (&idx->lock);
+
+    g_thread_pool_push (idx->mgr->priv->stream_index_pool, task, NULL);
+}
+
+StreamIndexer *
+seaf_fs_manager_stream_index_new (SeafFSManager *mgr,
+                                  const char *repo_id,
+                                  int version,
+                                  SeafileCrypt *crypt,
+                                  StreamIndexNotify notify,
+                                  void *notify_data)
+{
+    StreamIndexer *idx;
+
+    /* Files of version 0 repos are cut with CDC. */
+    if (version == 0 || !mgr->priv->stream_index_pool)
+        return NULL;
+
+    idx = g_new0 (StreamIndexer, 1);
+    idx->mgr = mgr;
+    memcpy (idx->repo_id, repo_id, 36);
+    idx->version = version;
+    if (crypt) {
+        idx->crypt = *crypt;
+        idx->encrypted = TRUE;
+    }
+    idx->block_size = seaf->http_server->fixed_block_size;
+    idx->ref_count = 1;
+    idx->chunks = g_ptr_array_new ();
+    pthread_mutex_init (&idx->lock, NULL);
+    idx->max_pending = seaf->http_server->max_indexing_threads * 2;
+    if (idx->max_pending <= 0)
+        idx->max_pending = 2;
+    idx->notify = notify;
+    idx->notify_data = notify_data;
+
+    return idx;
+}
+
+int
+seaf_fs_manager_stream_index_feed (StreamIndexer *idx, const char *buf, size_t len)
+{
+    CDCDescriptor *chunk;
+    size_t n;
+    int result;
+
+    pthread_mutex_lock (&idx->lock);
+    result = idx->result;
+    pthread_mutex_unlock (&idx->lock);
+    if (result < 0)
+        return -1;
+
+    while (len > 0) {
+        if (!idx->cur) {
+            idx->cur = g_new0 (CDCDescriptor, 1);
+            idx->cur->offset = idx->file_size;
+            idx->cur->block_buf = g_new (char, idx->block_size);
+        }
+
+        n = MIN (len, (size_t)(idx->block_size - idx->cur->len));
+        memcpy (idx->cur->block_buf + idx->cur->len, buf, n);
+        idx->cur->len += n;
+        idx->file_size += n;
+        buf += n;
+        len -= n;
+
+        if (idx->cur->len == idx->block_size) {
+            chunk = idx->cur;
+            idx->cur = NULL;
+            g_ptr_array_add (idx->chunks, chunk);
+            stream_index_push (idx, chunk, FALSE);
+        }
+    }
+
+    return 0;
+}
+
+gboolean
+seaf_fs_manager_stream_index_is_busy (StreamIndexer *idx)
+{
+    gboolean busy;
+
+    pthread_mutex_lock (&idx->lock);
+    busy = (idx->n_pending >= idx->max_pending);
+    pthread_mutex_unlock (&idx->lock);
+
+    return busy;
+}
+
+void
+seaf_fs_manager_stream_index_finish (StreamIndexer *idx)
+{
+    CDCDescriptor *chunk = idx->cur;
+
+    idx->cur = NULL;
+    if (chunk)
+        g_ptr_array_add (idx->chunks, chunk);
+
+    /* Even without a last partial block, a task is queued to write the
+     * seafile object once the other blocks are written. */
+    stream_index_push (idx, chunk, TRUE);
+}
+
+gboolean
+seaf_fs_manager_stream_index_is_done (StreamIndexer *idx)
+{
+    gboolean done;
+
+    pthread_mutex_lock (&idx->lock);
+    done = idx->done;
+    pthread_mutex_unlock (&idx->lock);
+
+    return done;
+}
+
+int
+seaf_fs_manager_stream_index_get_result (StreamIndexer *idx,
+                                         unsigned char sha1[],
+                                         gint64 *size)
+{
+    int ret;
+
+    pthread_mutex_lock (&idx->lock);
+    ret = (idx->done && idx->result == 0) ? 0 : -1;
+    pthread_mutex_unlock (&idx->lock);
+
+    if (ret == 0) {
+        memcpy (sha1, idx->file_id, 20);
+        *size = idx->file_size;
+    }
+    return ret;
+}
+
+void
+seaf_fs_manager_stream_index_free (StreamIndexer *idx)
+{
+    if (!idx)
+        return;
+
+    /* Queued blocks are dropped. Blocks already written are orphaned. */
+    pthread_mutex_lock (&idx->lock);
+    idx->cancelled = TRUE;
+    idx->notify = NULL;
+    pthread_mutex_unlock (&idx->lock);
+
+    stream_index_unref (idx);
+}
+
 #endif  /* SEAFILE_SERVER */
 
 #define CDC_AVERAGE_BLOCK_SIZE (1 << 23) /* 8MB */
@@ -808,6 +1340,8 @@ seaf_fs_manager_index_blocks (SeafFSManager *mgr,
             cdc.write_block = seafile_write_chunk;
             memcpy (cdc.repo_id, repo_id, 36);
             cdc.version = version;
+            if (seaf->http_server->use_fastcdc)
+                cdc.algorithm = CDC_ALGO_FASTCDC;
             if (filename_chunk_cdc (file_path, &cdc, crypt, write_data, indexed) < 0) {
                 seaf_warning ("Failed to chunk file with CDC.\n");
                 return -1;
@@ -1252,10 +1786,72 @@ seafile_from_json (const char *id, void *data, int len)
     return seafile;
 }
 
+static Seafile * // 从二进制读取器获取seafile对象
+seafile_from_bin_reader (const char *id, SeafFSBinReader *r)
+{
+    Seafile *seafile;
+    const guint8 *raw_id;
+    int i;
+
+    if (r->type != SEAF_METADATA_TYPE_FILE) {
+        seaf_debug ("Object %s is not a file.\n", id);
+        return NULL;
+    }
+
+    if (r->version < 1) {
+        seaf_debug ("Seafile object %s version should be > 0, version is %d.\n",
+                    id, r->version);
+        return NULL;
+    }
+
+    seafile = g_new0 (Seafile, 1);
+
+    seafile->object.type = SEAF_METADATA_TYPE_FILE;
+
+    memcpy (seafile->file_id, id, 40);
+    seafile->version = r->version;
+    seafile->file_size = r->file_size;
+    seafile->n_blocks = r->count;
+    seafile->blk_sha1s = g_new0 (char *, seafile->n_blocks);
+    seafile->ref_count = 1;
+
+    for (i = 0; i < seafile->n_blocks; ++i) {
+        raw_id = seaf_fs_bin_reader_next_block (r);
+        if (!raw_id) {
+            seaf_warning ("Bad data format for seafile object %s.\n", id);
+            seafile_free (seafile);
+            return NULL;
+        }
+        seafile->blk_sha1s[i] = g_malloc (41);
+        rawdata_to_hex (raw_id, seafile->blk_sha1s[i], 20);
+    }
+
+    return seafile;
+}
+
+static Seafile * // 二进制字节流转seafile对象
+seafile_from_binary (const char *id, void *data, int len)
+{
+    SeafFSBinReader r;
+    Seafile *seafile;
+
+    if (seaf_fs_bin_reader_init (&r, data, len) < 0) {
+        seaf_warning ("Failed to decode seafile object %s.\n", id);
+        return NULL;
+    }
+
+    seafile = seafile_from_bin_reader (id, &r);
+
+    seaf_fs_bin_reader_clear (&r);
+    return seafile;
+}
+
 static Seafile * // 字节流转对象
 seafile_from_data (const char *id, void *data, int len, gboolean is_json)
 {
-    if (is_json)
+    if (is_json && seaf_fs_bin_is_binary (data, len))
+        return seafile_from_binary (id, data, len);
+    else if (is_json)
         return seafile_from_json (id, data, len);
     else
         return seafile_from_v0_data (id, data, len);
@@ -1380,6 +1976,23 @@ seafile_to_data (Seafile *file, int *len)
         return seafile_to_v0_data (file, len);
 }
 
+static guint8 * // 对象转二进制字节流
+seafile_to_binary (Seafile *file, int compression, int *len)
+{
+    SeafFSBinWriter *w;
+    guint8 raw_id[20];
+    int i;
+
+    w = seaf_fs_bin_writer_new (SEAF_METADATA_TYPE_FILE, file->version);
+    seaf_fs_bin_put_file (w, file->file_size, file->n_blocks);
+    for (i = 0; i < file->n_blocks; ++i) {
+        hex_to_rawdata (file->blk_sha1s[i], raw_id, 20);
+        seaf_fs_bin_put_block (w, raw_id);
+    }
+
+    return seaf_fs_bin_writer_finish (w, compression, len);
+}
+
 int // 保存seafile对象
 seafile_save (SeafFSManager *fs_mgr,
               const char *repo_id,
@@ -1393,7 +2006,14 @@ seafile_save (SeafFSManager *fs_mgr,
     if (seaf_obj_store_obj_exists (fs_mgr->obj_store, repo_id, version, file->file_id))
         return 0;
 
-    data = seafile_to_data (file, &len);
+    if (version > 0 && fs_mgr->priv->binary_objects) {
+        /* The id is still computed from the json form. */
+        data = seafile_to_json (file, &len);
+        g_free (data);
+        data = seafile_to_binary (file, fs_mgr->priv->bin_compression, &len);
+    } else {
+        data = seafile_to_data (file, &len);
+    }
     if (!data)
         return -1;
 
@@ -1530,6 +2150,30 @@ seaf_dirent_dup (SeafDirent *dent)
     return new_dent;
 }
 
+SeafDir * // 复制seafdir
+seaf_dir_dup (SeafDir *dir)
+{
+    SeafDir *new_dir;
+    GList *ptr;
+
+    new_dir = g_new0 (SeafDir, 1);
+    new_dir->object.type = dir->object.type;
+    new_dir->version = dir->version;
+    memcpy (new_dir->dir_id, dir->dir_id, 41);
+
+    for (ptr = dir->entries; ptr; ptr = ptr->next)
+        new_dir->entries = g_list_prepend (new_dir->entries,
+                                           seaf_dirent_dup (ptr->data));
+    new_dir->entries = g_list_reverse (new_dir->entries);
+
+    if (dir->ondisk) {
+        new_dir->ondisk = g_memdup (dir->ondisk, dir->ondisk_size);
+        new_dir->ondisk_size = dir->ondisk_size;
+    }
+
+    return new_dir;
+}
+
 static SeafDir * // 字节流转seafdir；版本0
 seaf_dir_from_v0_data (const char *dir_id, const uint8_t *data, int len)
 {
@@ -1727,11 +2371,81 @@ seaf_dir_from_json (const char *dir_id, uint8_t *data, int len)
     return dir;
 }
 
+static SeafDir * // 从二进制读取器获取seafdir
+seaf_dir_from_bin_reader (const char *dir_id, SeafFSBinReader *r)
+{
+    SeafDir *dir;
+    SeafDirent *dirent;
+    SeafFSBinDirent bin_dent;
+    int n;
+
+    if (r->type != SEAF_METADATA_TYPE_DIR) {
+        seaf_debug ("Object %s is not a dir.\n", dir_id);
+        return NULL;
+    }
+
+    if (r->version < 1) {
+        seaf_debug ("Dir object %s version should be > 0, version is %d.\n",
+                    dir_id, r->version);
+        return NULL;
+    }
+
+    dir = g_new0 (SeafDir, 1);
+
+    dir->object.type = SEAF_METADATA_TYPE_DIR;
+
+    memcpy (dir->dir_id, dir_id, 40);
+    dir->version = r->version;
+
+    while ((n = seaf_fs_bin_reader_next_dirent (r, &bin_dent)) > 0) {
+        dirent = g_new0 (SeafDirent, 1);
+        dirent->version = dir->version;
+        dirent->mode = bin_dent.mode;
+        rawdata_to_hex (bin_dent.id, dirent->id, 20);
+        dirent->name_len = bin_dent.name_len;
+        dirent->name = g_strndup (bin_dent.name, bin_dent.name_len);
+        dirent->mtime = bin_dent.mtime;
+        if (S_ISREG(dirent->mode)) {
+            dirent->modifier = g_strndup (bin_dent.modifier, bin_dent.modifier_len);
+            dirent->size = bin_dent.size;
+        }
+        dir->entries = g_list_prepend (dir->entries, dirent);
+    }
+    dir->entries = g_list_reverse (dir->entries);
+
+    if (n < 0) {
+        seaf_warning ("Bad data format for dir object %s.\n", dir_id);
+        seaf_dir_free (dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+static SeafDir * // 二进制字节流转seafdir
+seaf_dir_from_binary (const char *dir_id, uint8_t *data, int len)
+{
+    SeafFSBinReader r;
+    SeafDir *dir;
+
+    if (seaf_fs_bin_reader_init (&r, data, len) < 0) {
+        seaf_warning ("Failed to decode dir object %s.\n", dir_id);
+        return NULL;
+    }
+
+    dir = seaf_dir_from_bin_reader (dir_id, &r);
+
+    seaf_fs_bin_reader_clear (&r);
+    return dir;
+}
+
 SeafDir * // 字节流转seafdir
 seaf_dir_from_data (const char *dir_id, uint8_t *data, int len,
                     gboolean is_json)
 {
-    if (is_json)
+    if (is_json && seaf_fs_bin_is_binary (data, len))
+        return seaf_dir_from_binary (dir_id, data, len);
+    else if (is_json)
         return seaf_dir_from_json (dir_id, data, len);
     else
         return seaf_dir_from_v0_data (dir_id, data, len);
@@ -1852,6 +2566,38 @@ seaf_dir_to_data (SeafDir *dir, int *len)
         return seaf_dir_to_v0_data (dir, len);
 }
 
+/*
+ * Returns NULL if the json form of @dir can't be rebuilt from the binary
+ * form, e.g. a file without modifier or a name that isn't valid utf-8,
+ * which json leaves out. Such dirs are stored as json.
+ */
+static guint8 * // seafdir转二进制字节流
+seaf_dir_to_binary (SeafDir *dir, int compression, int *len)
+{
+    SeafFSBinWriter *w;
+    GList *ptr;
+    SeafDirent *dent;
+
+    for (ptr = dir->entries; ptr; ptr = ptr->next) {
+        dent = ptr->data;
+        if (!g_utf8_validate (dent->name, dent->name_len, NULL))
+            return NULL;
+        if (S_ISREG(dent->mode) &&
+            (!dent->modifier || !g_utf8_validate (dent->modifier, -1, NULL)))
+            return NULL;
+    }
+
+    w = seaf_fs_bin_writer_new (SEAF_METADATA_TYPE_DIR, dir->version);
+    seaf_fs_bin_put_n_dirents (w, g_list_length (dir->entries));
+    for (ptr = dir->entries; ptr; ptr = ptr->next) {
+        dent = ptr->data;
+        seaf_fs_bin_put_dirent (w, dent->mode, dent->id, dent->name, dent->name_len,
+                                dent->mtime, dent->modifier, dent->size);
+    }
+
+    return seaf_fs_bin_writer_finish (w, compression, len);
+}
+
 int // 保存seafdir对象
 seaf_dir_save (SeafFSManager *fs_mgr,
                const char *repo_id,
@@ -1867,6 +2613,21 @@ seaf_dir_save (SeafFSManager *fs_mgr,
     if (seaf_obj_store_obj_exists (fs_mgr->obj_store, repo_id, version, dir->dir_id))
         return 0;
 
+    /* dir->ondisk is the compressed json, which also fixed dir->dir_id. */
+    if (version > 0 && fs_mgr->priv->binary_objects) {
+        guint8 *data;
+        int len;
+
+        data = seaf_dir_to_binary (dir, fs_mgr->priv->bin_compression, &len);
+        if (data) {
+            if (seaf_obj_store_write_obj (fs_mgr->obj_store, repo_id, version,
+                                          dir->dir_id, data, len, FALSE) < 0)
+                ret = -1;
+            g_free (data);
+            return ret;
+        }
+    }
+
     if (seaf_obj_store_write_obj (fs_mgr->obj_store, repo_id, version, dir->dir_id,
                                   dir->ondisk, dir->ondisk_size, FALSE) < 0)
         ret = -1;
@@ -1883,8 +2644,8 @@ seaf_fs_manager_get_seafdir(SeafFSManager *mgr,
     void *data;
     int len;
     SeafDir *dir;
-
-    /* TODO: add hash cache */
+    LRUCache *cache = mgr->priv->dir_cache;
+    char *key = NULL;
 
     if (memcmp (dir_id, EMPTY_SHA1, 40) == 0) { // 特判空目录
         dir = g_new0 (SeafDir, 1);
@@ -1893,15 +2654,30 @@ seaf_fs_manager_get_seafdir(SeafFSManager *mgr,
         return dir;
     }
 
+    if (cache) { // 查找缓存；缓存返回的是副本
+        key = g_strconcat (repo_id, dir_id, NULL);
+        dir = lru_cache_lookup (cache, key);
+        if (dir) {
+            g_free (key);
+            return dir;
+        }
+    }
+
     if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
                                  dir_id, &data, &len) < 0) { // 字节流
         seaf_warning ("[fs mgr] Failed to read dir %s.\n", dir_id);
+        g_free (key);
         return NULL;
     }
 
     dir = seaf_dir_from_data (dir_id, data, len, (version > 0)); // 字节流转对象
     g_free (data);
 
+    if (dir && cache) { // 加入缓存
+        lru_cache_insert (cache, key, seaf_dir_dup (dir), dir_mem_size (dir));
+    }
+    g_free (key);
+
     return dir;
 }
 
@@ -2022,11 +2798,30 @@ parse_metadata_type_json (const char *obj_id, uint8_t *data, int len)
     return type;
 }
 
+static int // 从二进制字节流获取类型
+parse_metadata_type_binary (const char *obj_id, uint8_t *data, int len)
+{
+    SeafFSBinReader r;
+    int type;
+
+    if (seaf_fs_bin_reader_init (&r, data, len) < 0) {
+        seaf_warning ("Failed to decode fs object %s.\n", obj_id);
+        return SEAF_METADATA_TYPE_INVALID;
+    }
+
+    type = r.type;
+
+    seaf_fs_bin_reader_clear (&r);
+    return type;
+}
+
 int // seaf对象获取类型
 seaf_metadata_type_from_data (const char *obj_id,
                               uint8_t *data, int len, gboolean is_json)
 {
-    if (is_json)
+    if (is_json && seaf_fs_bin_is_binary (data, len))
+        return parse_metadata_type_binary (obj_id, data, len);
+    else if (is_json)
         return parse_metadata_type_json (obj_id, data, len);
     else
         return parse_metadata_type_v0 (data, len);
@@ -2089,12 +2884,73 @@ fs_object_from_json (const char *obj_id, uint8_t *data, int len)
     return fs_obj;
 }
 
+static SeafFSObject * // 二进制字节流转文件系统对象
+fs_object_from_binary (const char *obj_id, uint8_t *data, int len)
+{
+    SeafFSBinReader r;
+    SeafFSObject *fs_obj;
+
+    if (seaf_fs_bin_reader_init (&r, data, len) < 0) {
+        seaf_warning ("Failed to decode fs object %s.\n", obj_id);
+        return NULL;
+    }
+
+    if (r.type == SEAF_METADATA_TYPE_FILE)
+        fs_obj = (SeafFSObject *)seafile_from_bin_reader (obj_id, &r);
+    else if (r.type == SEAF_METADATA_TYPE_DIR)
+        fs_obj = (SeafFSObject *)seaf_dir_from_bin_reader (obj_id, &r);
+    else {
+        seaf_warning ("Invalid fs type %d.\n", r.type);
+        fs_obj = NULL;
+    }
+
+    seaf_fs_bin_reader_clear (&r);
+    return fs_obj;
+}
+
+/*
+ * Rebuilds the json form of a binary object, the bytes its id is computed
+ * from. Returns NULL if @data is corrupt or doesn't match @obj_id.
+ */
+static guint8 * // 二进制字节流转json字节流（未压缩）
+fs_object_binary_to_json (const char *obj_id, uint8_t *data, int len,
+                          int *json_len)
+{
+    SeafFSObject *fs_obj;
+    guint8 *json = NULL;
+    char id[41];
+
+    fs_obj = fs_object_from_binary (obj_id, data, len);
+    if (!fs_obj)
+        return NULL;
+
+    /* to_json() recomputes the id of the object. */
+    if (fs_obj->type == SEAF_METADATA_TYPE_FILE) {
+        json = seafile_to_json ((Seafile *)fs_obj, json_len);
+        memcpy (id, ((Seafile *)fs_obj)->file_id, 41);
+    } else {
+        json = seaf_dir_to_json ((SeafDir *)fs_obj, json_len);
+        memcpy (id, ((SeafDir *)fs_obj)->dir_id, 41);
+    }
+    seaf_fs_object_free (fs_obj);
+
+    if (strncmp (id, obj_id, 40) != 0) {
+        seaf_warning ("Binary fs object %s doesn't match its id.\n", obj_id);
+        g_free (json);
+        return NULL;
+    }
+
+    return json;
+}
+
 SeafFSObject * // 获取文件系统对象
 seaf_fs_object_from_data (const char *obj_id,
                           uint8_t *data, int len,
                           gboolean is_json)
 {
-    if (is_json)
+    if (is_json && seaf_fs_bin_is_binary (data, len))
+        return fs_object_from_binary (obj_id, data, len);
+    else if (is_json)
         return fs_object_from_json (obj_id, data, len);
     else
         return fs_object_from_v0_data (obj_id, data, len);
@@ -2388,12 +3244,42 @@ seaf_fs_manager_object_exists (SeafFSManager *mgr,
     return seaf_obj_store_obj_exists (mgr->obj_store, repo_id, version, id); // 转发
 }
 
+int // 批量判断对象是否存在
+seaf_fs_manager_objects_exist (SeafFSManager *mgr,
+                               const char *repo_id,
+                               int version,
+                               const char **ids,
+                               int n_ids,
+                               gboolean *exists)
+{
+    int i;
+
+    if (seaf_obj_store_obj_exists_many (mgr->obj_store, repo_id, version,
+                                        ids, n_ids, exists) < 0)
+        return -1;
+
+    /* Empty file and dir always exists. */
+    for (i = 0; i < n_ids; ++i) {
+        if (ids[i] && memcmp (ids[i], EMPTY_SHA1, 40) == 0)
+            exists[i] = TRUE;
+    }
+
+    return 0;
+}
+
 void // 删除对象
 seaf_fs_manager_delete_object (SeafFSManager *mgr,
                                const char *repo_id,
                                int version,
                                const char *id)
 {
+    if (mgr->priv->dir_cache) {
+        char *key = g_strconcat (repo_id, id, NULL);
+        lru_cache_remove (mgr->priv->dir_cache, key);
+        g_free (key);
+    }
+    if (mgr->priv->offset_store)
+        seaf_obj_store_delete_obj (mgr->priv->offset_store, repo_id, version, id);
     seaf_obj_store_delete_obj (mgr->obj_store, repo_id, version, id); // 转发
 }
 
@@ -2877,7 +3763,11 @@ verify_fs_object_json (const char *obj_id, uint8_t *data, int len)
     unsigned char sha1[20];
     char hex[41];
 
-    if (seaf_decompress (data, len, &decompressed, &outlen) < 0) { // 解压
+    if (seaf_fs_bin_is_binary (data, len)) { // 二进制格式，重建json
+        decompressed = fs_object_binary_to_json (obj_id, data, len, &outlen);
+        if (!decompressed)
+            return FALSE;
+    } else if (seaf_decompress (data, len, &decompressed, &outlen) < 0) { // 解压
         seaf_warning ("Failed to decompress fs object %s.\n", obj_id);
         return FALSE;
     }
@@ -3060,6 +3950,163 @@ seaf_fs_manager_verify_object (SeafFSManager *mgr,
     return ret;
 }
 
+int // 以json格式读取对象
+seaf_fs_manager_read_json_object (SeafFSManager *mgr,
+                                  const char *repo_id,
+                                  int version,
+                                  const char *obj_id,
+                                  void **data,
+                                  int *len)
+{
+    void *raw;
+    int raw_len;
+    guint8 *json;
+    int json_len;
+    int ret;
+
+    if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
+                                 obj_id, &raw, &raw_len) < 0)
+        return -1;
+
+    if (version == 0 || !seaf_fs_bin_is_binary (raw, raw_len)) {
+        *data = raw;
+        *len = raw_len;
+        return 0;
+    }
+
+    json = fs_object_binary_to_json (obj_id, raw, raw_len, &json_len);
+    g_free (raw);
+    if (!json)
+        return -1;
+
+    ret = seaf_compress (json, json_len, (guint8 **)data, len);
+    g_free (json);
+    return ret;
+}
+
+/*
+ * Encodes the json object @data in the binary format. Returns NULL if the
+ * json can't be rebuilt from it, e.g. objects written by the go fileserver,
+ * whose json encoder formats differently.
+ */
+static guint8 * // json对象转二进制字节流
+fs_object_json_to_binary (SeafFSManager *mgr, const char *obj_id,
+                          uint8_t *data, int len, int *out_len)
+{
+    SeafFSObject *fs_obj;
+    guint8 *json, *out;
+    int json_len;
+    char id[41];
+
+    fs_obj = fs_object_from_json (obj_id, data, len);
+    if (!fs_obj)
+        return NULL;
+
+    if (fs_obj->type == SEAF_METADATA_TYPE_FILE) {
+        json = seafile_to_json ((Seafile *)fs_obj, &json_len);
+        memcpy (id, ((Seafile *)fs_obj)->file_id, 41);
+        out = seafile_to_binary ((Seafile *)fs_obj, mgr->priv->bin_compression,
+                                 out_len);
+    } else {
+        json = seaf_dir_to_json ((SeafDir *)fs_obj, &json_len);
+        memcpy (id, ((SeafDir *)fs_obj)->dir_id, 41);
+        out = seaf_dir_to_binary ((SeafDir *)fs_obj, mgr->priv->bin_compression,
+                                  out_len);
+    }
+    g_free (json);
+    seaf_fs_object_free (fs_obj);
+
+    if (out && strncmp (id, obj_id, 40) != 0) {
+        g_free (out);
+        return NULL;
+    }
+
+    return out;
+}
+
+int // 转换对象的存储格式
+seaf_fs_manager_convert_object (SeafFSManager *mgr,
+                                const char *repo_id,
+                                int version,
+                                const char *obj_id,
+                                gboolean to_binary)
+{
+    void *data = NULL;
+    int len;
+    guint8 *out = NULL, *json;
+    int out_len, json_len;
+    gboolean is_binary;
+    int ret = 0;
+
+    if (version == 0 || memcmp (obj_id, EMPTY_SHA1, 40) == 0)
+        return 0;
+
+    if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
+                                 obj_id, &data, &len) < 0) {
+        seaf_warning ("[fs mgr] Failed to read object %s:%s.\n", repo_id, obj_id);
+        return -1;
+    }
+
+    is_binary = seaf_fs_bin_is_binary (data, len);
+    if (to_binary ? is_binary : !is_binary)
+        goto out;
+
+    if (to_binary) {
+        out = fs_object_json_to_binary (mgr, obj_id, data, len, &out_len);
+        if (!out) {
+            seaf_debug ("[fs mgr] Object %s:%s is kept as json.\n", repo_id, obj_id);
+            goto out;
+        }
+        /* Check the round trip before replacing the object. */
+        json = fs_object_binary_to_json (obj_id, out, out_len, &json_len);
+        if (!json) {
+            ret = -1;
+            goto out;
+        }
+        g_free (json);
+    } else {
+        json = fs_object_binary_to_json (obj_id, data, len, &json_len);
+        if (!json) {
+            ret = -1;
+            goto out;
+        }
+        ret = seaf_compress (json, json_len, &out, &out_len);
+        g_free (json);
+        if (ret < 0)
+            goto out;
+    }
+
+    g_free (data);
+    data = NULL;
+
+    if (seaf_obj_store_write_obj (mgr->obj_store, repo_id, version, obj_id,
+                                  out, out_len, TRUE) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    /* The pack backend treats writes of existing objects as no-ops. */
+    if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
+                                 obj_id, &data, &len) == 0 &&
+        seaf_fs_bin_is_binary (data, len) == is_binary) {
+        seaf_obj_store_delete_obj (mgr->obj_store, repo_id, version, obj_id);
+        if (seaf_obj_store_write_obj (mgr->obj_store, repo_id, version, obj_id,
+                                      out, out_len, TRUE) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    ret = 1;
+
+out:
+    if (ret < 0)
+        seaf_warning ("[fs mgr] Failed to convert object %s:%s.\n", repo_id, obj_id);
+    g_free (data);
+    g_free (out);
+    return ret;
+}
+
 int // 获取seafdir版本（版本0返回0，其他版本返回头文件定义版本）
 dir_version_from_repo_version (int repo_version)
 {
@@ -3082,9 +4129,208 @@ int // 移除存储
 seaf_fs_manager_remove_store (SeafFSManager *mgr,
                               const char *store_id)
 {
+    if (mgr->priv->dir_cache)
+        lru_cache_remove_by_prefix (mgr->priv->dir_cache, store_id);
+    if (mgr->priv->offset_store)
+        seaf_obj_store_remove_store (mgr->priv->offset_store, store_id);
     return seaf_obj_store_remove_store (mgr->obj_store, store_id);
 }
 
+SeafBlockOffsets *
+seaf_block_offsets_ref (SeafBlockOffsets *offsets)
+{
+    g_atomic_int_inc (&offsets->ref);
+    return offsets;
+}
+
+void
+seaf_block_offsets_unref (SeafBlockOffsets *offsets)
+{
+    if (!offsets)
+        return;
+    if (g_atomic_int_dec_and_test (&offsets->ref))
+        g_free (offsets);
+}
+
+static SeafBlockOffsets *
+block_offsets_new (guint32 n_blocks)
+{
+    SeafBlockOffsets *offsets;
+
+    offsets = g_malloc0 (sizeof(SeafBlockOffsets) +
+                         (n_blocks + 1) * sizeof(guint64));
+    offsets->ref = 1;
+    offsets->n_blocks = n_blocks;
+
+    return offsets;
+}
+
+/*
+ * On disk a table is the number of blocks (32 bits) followed by the end
+ * offset of every block (64 bits), all in network byte order. The Go
+ * fileserver reads and writes the same format.
+ */
+static SeafBlockOffsets *
+block_offsets_from_data (Seafile *file, const guint8 *data, int len)
+{
+    SeafBlockOffsets *offsets;
+    guint32 n_blocks, i;
+    guint64 end;
+
+    if (len < 4)
+        return NULL;
+    n_blocks = ntohl (*(guint32 *)data);
+    if (n_blocks != file->n_blocks || len != 4 + 8 * (gint64)n_blocks)
+        return NULL;
+
+    offsets = block_offsets_new (n_blocks);
+    for (i = 0; i < n_blocks; ++i) {
+        memcpy (&end, data + 4 + 8 * i, 8);
+        end = ntoh64 (end);
+        if (end < offsets->offsets[i]) {
+            seaf_block_offsets_unref (offsets);
+            return NULL;
+        }
+        offsets->offsets[i + 1] = end;
+    }
+
+    if (offsets->offsets[n_blocks] != file->file_size) {
+        seaf_block_offsets_unref (offsets);
+        return NULL;
+    }
+
+    return offsets;
+}
+
+static void
+save_block_offsets (SeafFSManager *mgr, const char *repo_id, int version,
+                    const char *file_id, SeafBlockOffsets *offsets)
+{
+    int len = 4 + 8 * offsets->n_blocks;
+    guint8 *data = g_malloc (len);
+    guint64 end;
+    guint32 i;
+
+    *(guint32 *)data = htonl (offsets->n_blocks);
+    for (i = 0; i < offsets->n_blocks; ++i) {
+        end = hton64 (offsets->offsets[i + 1]);
+        memcpy (data + 4 + 8 * i, &end, 8);
+    }
+
+    if (seaf_obj_store_write_obj (mgr->priv->offset_store, repo_id, version,
+                                  file_id, data, len, FALSE) < 0)
+        seaf_warning ("[fs mgr] Failed to save block offsets of %s:%s.\n",
+                      repo_id, file_id);
+    g_free (data);
+}
+
+static SeafBlockOffsets *
+load_block_offsets (SeafFSManager *mgr, const char *repo_id, int version,
+                    Seafile *file)
+{
+    SeafBlockOffsets *offsets;
+    BlockMetadata *bmd;
+    void *data;
+    int len;
+    guint32 i;
+
+    if (mgr->priv->offset_store &&
+        seaf_obj_store_read_obj (mgr->priv->offset_store, repo_id, version,
+                                 file->file_id, &data, &len) == 0) {
+        offsets = block_offsets_from_data (file, data, len);
+        g_free (data);
+        if (offsets)
+            return offsets;
+        seaf_warning ("[fs mgr] Invalid block offsets of %s:%s, rebuild them.\n",
+                      repo_id, file->file_id);
+    }
+
+    offsets = block_offsets_new (file->n_blocks);
+    for (i = 0; i < file->n_blocks; ++i) {
+        bmd = seaf_block_manager_stat_block (seaf->block_mgr, repo_id, version,
+                                             file->blk_sha1s[i]);
+        if (!bmd) {
+            seaf_warning ("[fs mgr] Failed to stat block %s:%s.\n",
+                          repo_id, file->blk_sha1s[i]);
+            seaf_block_offsets_unref (offsets);
+            return NULL;
+        }
+        offsets->offsets[i + 1] = offsets->offsets[i] + bmd->size;
+        g_free (bmd);
+    }
+
+    if (mgr->priv->offset_store)
+        save_block_offsets (mgr, repo_id, version, file->file_id, offsets);
+
+    return offsets;
+}
+
+SeafBlockOffsets *
+seaf_fs_manager_get_block_offsets (SeafFSManager *mgr,
+                                   const char *repo_id,
+                                   int version,
+                                   Seafile *file)
+{
+    LRUCache *cache = mgr->priv->offset_cache;
+    SeafBlockOffsets *offsets;
+
+    if (cache) {
+        offsets = lru_cache_lookup (cache, file->file_id);
+        if (offsets)
+            return offsets;
+    }
+
+    offsets = load_block_offsets (mgr, repo_id, version, file);
+    if (offsets && cache)
+        lru_cache_insert (cache, file->file_id, seaf_block_offsets_ref (offsets),
+                          sizeof(SeafBlockOffsets) +
+                          (offsets->n_blocks + 1) * sizeof(guint64));
+
+    return offsets;
+}
+
+int
+seaf_block_offsets_find (SeafBlockOffsets *offsets, guint64 offset)
+{
+    guint32 lo = 0, hi = offsets->n_blocks, mid;
+
+    if (offset >= offsets->offsets[offsets->n_blocks])
+        return -1;
+
+    /* The last block starting at or before @offset; skips empty blocks. */
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (offsets->offsets[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+json_t * // 获取目录对象缓存的统计信息
+seaf_fs_manager_get_dir_cache_stats (SeafFSManager *mgr)
+{
+    LRUCacheStats stats;
+    json_t *object;
+
+    object = json_object ();
+    json_object_set_int_member (object, "enabled", mgr->priv->dir_cache != NULL);
+    if (!mgr->priv->dir_cache)
+        return object;
+
+    lru_cache_get_stats (mgr->priv->dir_cache, &stats);
+    json_object_set_int_member (object, "entries", stats.n_entries);
+    json_object_set_int_member (object, "mem_size", stats.size);
+    json_object_set_int_member (object, "max_mem_size", stats.max_size);
+    json_object_set_int_member (object, "hits", stats.hits);
+    json_object_set_int_member (object, "misses", stats.misses);
+    json_object_set_int_member (object, "evictions", stats.evictions);
+
+    return object;
+}
+
 GObject * // 根据相对路径，获取文件数量
 seaf_fs_manager_get_file_count_info_by_path (SeafFSManager *mgr,
                                              const char *repo_id,
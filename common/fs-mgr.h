@@ -5,6 +5,7 @@
 #define SEAF_FILE_MGR_H
 
 #include <glib.h>
+#include <jansson.h>
 
 #include "seafile-object.h"
 
@@ -44,6 +45,17 @@ struct _Seafile { // 文件
     int         ref_count; // 引用次数
 };
 
+/*
+ * Where the blocks of a file start: block i holds bytes [offsets[i],
+ * offsets[i+1]) of the file, offsets[n_blocks] is the file size.
+ * Immutable and refcounted, tables are shared through a cache.
+ */
+typedef struct _SeafBlockOffsets {
+    gint        ref;
+    guint32     n_blocks;
+    guint64     offsets[0];
+} SeafBlockOffsets;
+
 typedef struct SearchResult { // 搜索结果
     char *path; // 路径
     gint64 size; // 大小
@@ -95,6 +107,9 @@ seaf_dir_new (const char *id, GList *entries, int version);
 void  // 释放目录对象
 seaf_dir_free (SeafDir *dir);
 
+SeafDir * // 复制目录对象
+seaf_dir_dup (SeafDir *dir);
+
 SeafDir * // 字节流转目录对象
 seaf_dir_from_data (const char *dir_id, uint8_t *data, int len,
                     gboolean is_json);
@@ -231,6 +246,59 @@ seaf_fs_manager_index_blocks (SeafFSManager *mgr,
                               gboolean use_cdc,
                               gint64 *indexed);
 
+#if defined SEAFILE_SERVER && defined FULL_FEATURE
+/*
+ * Indexes a file whose content arrives as a stream, e.g. the body of a web
+ * upload, without a temp file. Data is cut into fixed size blocks, the same
+ * way seaf_fs_manager_index_blocks() cuts a file of a repo with version > 0,
+ * and every complete block is hashed and written by a shared pool of worker
+ * threads while the rest of the data is still being received.
+ *
+ * None of the functions block. @notify is called from a worker thread,
+ * with an internal lock held, every time a block is written, so that the
+ * caller can check seaf_fs_manager_stream_index_is_busy() and
+ * seaf_fs_manager_stream_index_is_done() again.
+ */
+typedef struct StreamIndexer StreamIndexer;
+
+typedef void (*StreamIndexNotify) (void *data);
+
+/* Returns NULL if the repo version doesn't use fixed size blocks. */
+StreamIndexer * // 创建流式索引
+seaf_fs_manager_stream_index_new (SeafFSManager *mgr,
+                                  const char *repo_id,
+                                  int version,
+                                  SeafileCrypt *crypt,
+                                  StreamIndexNotify notify,
+                                  void *notify_data);
+
+int // 追加文件数据
+seaf_fs_manager_stream_index_feed (StreamIndexer *idx, const char *buf, size_t len);
+
+/* Too many blocks are waiting to be written. The caller should stop
+ * feeding data until notified. */
+gboolean // 待写的块是否过多
+seaf_fs_manager_stream_index_is_busy (StreamIndexer *idx);
+
+/* Queues the remaining data and the seafile object. The indexer can't be
+ * fed any more afterwards. */
+void // 结束输入
+seaf_fs_manager_stream_index_finish (StreamIndexer *idx);
+
+gboolean // 是否已全部写完
+seaf_fs_manager_stream_index_is_done (StreamIndexer *idx);
+
+int // 获取文件id和大小；未完成或失败时返回-1
+seaf_fs_manager_stream_index_get_result (StreamIndexer *idx,
+                                         unsigned char sha1[],
+                                         gint64 *size);
+
+/* After this returns, @notify isn't called any more. Blocks not written
+ * yet are dropped. */
+void // 释放
+seaf_fs_manager_stream_index_free (StreamIndexer *idx);
+#endif
+
 Seafile * // 获取seafile对象
 seaf_fs_manager_get_seafile (SeafFSManager *mgr,
                              const char *repo_id,
@@ -306,6 +374,15 @@ seaf_fs_manager_object_exists (SeafFSManager *mgr,
                                int version,
                                const char *id);
 
+/* Sets exists[i] for each of the @n_ids objects in @ids, in one batch. */
+int // 批量判断对象是否存在
+seaf_fs_manager_objects_exist (SeafFSManager *mgr,
+                               const char *repo_id,
+                               int version,
+                               const char **ids,
+                               int n_ids,
+                               gboolean *exists);
+
 void // 删除对象
 seaf_fs_manager_delete_object (SeafFSManager *mgr,
                                const char *repo_id,
@@ -413,6 +490,31 @@ seaf_fs_manager_verify_object (SeafFSManager *mgr,
                                gboolean verify_id,
                                gboolean *io_error);
 
+/*
+ * Reads an fs object in the form clients expect: zlib-compressed json for
+ * version 1 objects. Objects stored in the binary format are converted.
+ */
+int // 以json格式读取对象
+seaf_fs_manager_read_json_object (SeafFSManager *mgr,
+                                  const char *repo_id,
+                                  int version,
+                                  const char *obj_id,
+                                  void **data,
+                                  int *len);
+
+/*
+ * Rewrites an fs object of a version 1 repo in the binary format
+ * (@to_binary) or as json. Objects that are already in that form, or whose
+ * json can't be rebuilt exactly from the binary form, are left alone.
+ * Returns 1 if the object was converted, 0 if left alone, -1 on errors.
+ */
+int // 转换对象的存储格式
+seaf_fs_manager_convert_object (SeafFSManager *mgr,
+                                const char *repo_id,
+                                int version,
+                                const char *obj_id,
+                                gboolean to_binary);
+
 int // 根据仓库的版本获取seafdir的版本
 dir_version_from_repo_version (int repo_version);
 
@@ -437,6 +539,34 @@ seaf_fs_manager_get_file_count_info_by_path (SeafFSManager *mgr,
                                              const char *path,
                                              GError **error);
 
+/*
+ * Returns a json object with the counters of the in-memory dir object cache:
+ * entries, mem_size, max_mem_size, hits, misses and evictions.
+ */
+json_t * // 获取目录对象缓存的统计信息
+seaf_fs_manager_get_dir_cache_stats (SeafFSManager *mgr);
+
+/*
+ * Returns the block offset table of @file, from the cache, from the
+ * persisted tables ([fs_cache] persist_block_offsets) or else by stat'ing
+ * every block. Only valid for unencrypted files: blocks of encrypted files
+ * are larger than the data they hold.
+ */
+SeafBlockOffsets * // 获取文件的块偏移表
+seaf_fs_manager_get_block_offsets (SeafFSManager *mgr,
+                                   const char *repo_id,
+                                   int version,
+                                   Seafile *file);
+
+SeafBlockOffsets *
+seaf_block_offsets_ref (SeafBlockOffsets *offsets);
+
+void
+seaf_block_offsets_unref (SeafBlockOffsets *offsets);
+
+int // 二分查找包含offset的块，超出文件大小时返回-1
+seaf_block_offsets_find (SeafBlockOffsets *offsets, guint64 offset);
+
 GList * // 搜索文件（按文件名），返回结果列表
 seaf_fs_manager_search_files (SeafFSManager *mgr,
                               const char *repo_id,
@@ -12,14 +12,24 @@
 #include "log.h"
 
 #define DEFAULT_MAX_CONNECTIONS 100
+#define DEFAULT_GROUP_RELOAD_INTERVAL 300 /* 5 minutes */
+#define GROUP_GRAPH_LOAD_TRIES 3
 
 struct _CcnetGroupManagerPriv {
     CcnetDB	*db;
     const char *table_name;
+
+    pthread_rwlock_t graph_lock;
+    gboolean graph_loaded;
+    gint graph_version;         /* Bumped by every change made by this manager. */
+    int reload_interval;        /* Seconds between reloads of the graph, 0 to disable. */
+    GHashTable *groups;         /* group id -> GroupNode */
+    GHashTable *user_groups;    /* lowercased user -> sorted ids of groups */
 };
 
 static int open_db (CcnetGroupManager *manager);
 static int check_db_table (CcnetGroupManager *manager, CcnetDB *db);
+static int load_group_graph (CcnetGroupManager *mgr);
 
 CcnetGroupManager* ccnet_group_manager_new (SeafileSession *session)
 {
@@ -27,6 +37,7 @@ CcnetGroupManager* ccnet_group_manager_new (SeafileSession *session)
 
     manager->session = session;
     manager->priv = g_new0 (CcnetGroupManagerPriv, 1);
+    pthread_rwlock_init (&manager->priv->graph_lock, NULL);
 
     return manager;
 }
@@ -48,8 +59,42 @@ ccnet_group_manager_prepare (CcnetGroupManager *manager)
     return open_db(manager);
 }
 
+static void *
+reload_group_graph_thread (void *arg)
+{
+    CcnetGroupManager *mgr = arg;
+
+    while (1) {
+        sleep (mgr->priv->reload_interval);
+        load_group_graph (mgr);
+    }
+
+    return NULL;
+}
+
 void ccnet_group_manager_start (CcnetGroupManager *manager)
 {
+    GError *error = NULL;
+    pthread_t tid;
+    int interval;
+
+    interval = g_key_file_get_integer (manager->session->ccnet_config, "GROUP",
+                                       "RELOAD_INTERVAL", &error);
+    if (error) {
+        interval = DEFAULT_GROUP_RELOAD_INTERVAL;
+        g_clear_error (&error);
+    }
+    manager->priv->reload_interval = interval;
+
+    load_group_graph (manager);
+
+    if (interval > 0) {
+        if (pthread_create (&tid, NULL, reload_group_graph_thread, manager) != 0) {
+            ccnet_warning ("Failed to create group reload thread.\n");
+            return;
+        }
+        pthread_detach (tid);
+    }
 }
 
 static CcnetDB *
@@ -231,6 +276,533 @@ static int check_db_table (CcnetGroupManager *manager, CcnetDB *db)
     return 0;
 }
 
+/* -------- In-memory group hierarchy ---------------- */
+
+/*
+ * Once the manager is started, groups, their paths in GroupStructure and
+ * the memberships of users are kept in memory, so group lists of users and
+ * ancestors or descendants of groups are answered without db queries.
+ * Changes made by this manager are written to the db first, then applied
+ * here. Changes made by other programs or servers sharing the db are picked
+ * up by reloading the whole graph every [GROUP] RELOAD_INTERVAL seconds.
+ * Before the graph is loaded, or if loading failed, the db is used.
+ */
+
+typedef struct GroupNode {
+    int id;
+    char *name;
+    char *creator;
+    gint64 timestamp;
+    int parent_group_id;
+    GArray *path;           /* From the top group to this one, NULL if not in structure. */
+    GArray *children;       /* Groups whose parent is this one. */
+    GArray *descendants;    /* Groups below this one in the structure. */
+} GroupNode;
+
+static void
+group_node_free (GroupNode *node)
+{
+    g_free (node->name);
+    g_free (node->creator);
+    if (node->path)
+        g_array_free (node->path, TRUE);
+    if (node->children)
+        g_array_free (node->children, TRUE);
+    if (node->descendants)
+        g_array_free (node->descendants, TRUE);
+    g_free (node);
+}
+
+/* Sorted sets of group ids. */
+
+static void
+id_set_add (GArray **set, int id)
+{
+    int lo = 0, hi, mid;
+
+    if (!*set)
+        *set = g_array_new (FALSE, FALSE, sizeof(int));
+
+    hi = (*set)->len;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (g_array_index (*set, int, mid) < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < (*set)->len && g_array_index (*set, int, lo) == id)
+        return;
+    g_array_insert_val (*set, lo, id);
+}
+
+static void
+id_set_remove (GArray *set, int id)
+{
+    guint i;
+
+    if (!set)
+        return;
+    for (i = 0; i < set->len; ++i) {
+        if (g_array_index (set, int, i) == id) {
+            g_array_remove_index (set, i);
+            return;
+        }
+    }
+}
+
+static gboolean
+id_set_contains (GArray *set, int id)
+{
+    guint i;
+
+    if (!set)
+        return FALSE;
+    for (i = 0; i < set->len; ++i) {
+        if (g_array_index (set, int, i) == id)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static gint
+compare_group_ids (const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+/* Parses a GroupStructure path, "1, 5, 9". */
+static GArray *
+parse_group_path (const char *path)
+{
+    GArray *ids = g_array_new (FALSE, FALSE, sizeof(int));
+    char **tokens = g_strsplit (path, ",", -1);
+    char **ptr;
+    int id;
+
+    for (ptr = tokens; *ptr; ++ptr) {
+        id = atoi (g_strstrip (*ptr));
+        if (id > 0)
+            g_array_append_val (ids, id);
+    }
+    g_strfreev (tokens);
+
+    return ids;
+}
+
+static GroupNode *
+lookup_group_node (CcnetGroupManager *mgr, int group_id)
+{
+    return g_hash_table_lookup (mgr->priv->groups, GINT_TO_POINTER(group_id));
+}
+
+/* Adds @node to the children and descendants of the groups above it. */
+static void
+link_group_node (CcnetGroupManager *mgr, GroupNode *node)
+{
+    GroupNode *up;
+    guint i;
+
+    if (node->parent_group_id > 0 &&
+        (up = lookup_group_node (mgr, node->parent_group_id)) != NULL)
+        id_set_add (&up->children, node->id);
+
+    if (!node->path)
+        return;
+    for (i = 0; i + 1 < node->path->len; ++i) {
+        up = lookup_group_node (mgr, g_array_index (node->path, int, i));
+        if (up)
+            id_set_add (&up->descendants, node->id);
+    }
+}
+
+static void
+unlink_group_node (CcnetGroupManager *mgr, GroupNode *node)
+{
+    GroupNode *up;
+    guint i;
+
+    if (node->parent_group_id > 0 &&
+        (up = lookup_group_node (mgr, node->parent_group_id)) != NULL)
+        id_set_remove (up->children, node->id);
+
+    if (!node->path)
+        return;
+    for (i = 0; i + 1 < node->path->len; ++i) {
+        up = lookup_group_node (mgr, g_array_index (node->path, int, i));
+        if (up)
+            id_set_remove (up->descendants, node->id);
+    }
+}
+
+static gboolean
+load_group_node_cb (CcnetDBRow *row, void *data)
+{
+    GHashTable *groups = data;
+    GroupNode *node = g_new0 (GroupNode, 1);
+
+    node->id = seaf_db_row_get_column_int (row, 0);
+    node->name = g_strdup (seaf_db_row_get_column_text (row, 1));
+    node->creator = g_strdup (seaf_db_row_get_column_text (row, 2));
+    node->timestamp = seaf_db_row_get_column_int64 (row, 3);
+    node->parent_group_id = seaf_db_row_get_column_int (row, 4);
+    g_hash_table_replace (groups, GINT_TO_POINTER(node->id), node);
+
+    return TRUE;
+}
+
+static gboolean
+load_group_path_cb (CcnetDBRow *row, void *data)
+{
+    GHashTable *groups = data;
+    int group_id = seaf_db_row_get_column_int (row, 0);
+    const char *path = seaf_db_row_get_column_text (row, 1);
+    GroupNode *node = g_hash_table_lookup (groups, GINT_TO_POINTER(group_id));
+
+    if (node && path) {
+        if (node->path)
+            g_array_free (node->path, TRUE);
+        node->path = parse_group_path (path);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+load_group_user_cb (CcnetDBRow *row, void *data)
+{
+    GHashTable *user_groups = data;
+    int group_id = seaf_db_row_get_column_int (row, 0);
+    const char *user = seaf_db_row_get_column_text (row, 1);
+    GArray *ids;
+
+    if (!user)
+        return TRUE;
+
+    char *user_l = g_ascii_strdown (user, -1);
+    ids = g_hash_table_lookup (user_groups, user_l);
+    if (!ids) {
+        id_set_add (&ids, group_id);
+        g_hash_table_insert (user_groups, user_l, ids);
+    } else {
+        id_set_add (&ids, group_id);
+        g_free (user_l);
+    }
+
+    return TRUE;
+}
+
+static void
+free_id_set (gpointer data)
+{
+    g_array_free (data, TRUE);
+}
+
+/* Returns 1 if a change was made while loading, the result is dropped then. */
+static int
+try_load_group_graph (CcnetGroupManager *mgr)
+{
+    CcnetDB *db = mgr->priv->db;
+    GHashTable *groups, *user_groups, *old_groups, *old_user_groups;
+    GString *sql = g_string_new ("");
+    GHashTableIter iter;
+    gpointer value;
+    gint64 start = g_get_monotonic_time ();
+    gint version = g_atomic_int_get (&mgr->priv->graph_version);
+
+    groups = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                    (GDestroyNotify)group_node_free);
+    user_groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_id_set);
+
+    if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL)
+        g_string_printf (sql, "SELECT group_id, group_name, creator_name, timestamp, "
+                         "parent_group_id FROM \"%s\"", mgr->priv->table_name);
+    else
+        g_string_printf (sql, "SELECT group_id, group_name, creator_name, timestamp, "
+                         "parent_group_id FROM `%s`", mgr->priv->table_name);
+
+    if (seaf_db_statement_foreach_row (db, sql->str, load_group_node_cb, groups, 0) < 0 ||
+        seaf_db_statement_foreach_row (db, "SELECT group_id, path FROM GroupStructure",
+                                       load_group_path_cb, groups, 0) < 0 ||
+        seaf_db_statement_foreach_row (db, "SELECT group_id, user_name FROM GroupUser",
+                                       load_group_user_cb, user_groups, 0) < 0) {
+        ccnet_warning ("Failed to load groups from the db.\n");
+        g_hash_table_destroy (groups);
+        g_hash_table_destroy (user_groups);
+        g_string_free (sql, TRUE);
+        return -1;
+    }
+    g_string_free (sql, TRUE);
+
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    /* The change may be missing from what was just read. */
+    if (g_atomic_int_get (&mgr->priv->graph_version) != version) {
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        g_hash_table_destroy (groups);
+        g_hash_table_destroy (user_groups);
+        return 1;
+    }
+    old_groups = mgr->priv->groups;
+    old_user_groups = mgr->priv->user_groups;
+    mgr->priv->groups = groups;
+    mgr->priv->user_groups = user_groups;
+    g_hash_table_iter_init (&iter, groups);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        link_group_node (mgr, value);
+    mgr->priv->graph_loaded = TRUE;
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+
+    if (old_groups)
+        g_hash_table_destroy (old_groups);
+    if (old_user_groups)
+        g_hash_table_destroy (old_user_groups);
+
+    ccnet_debug ("Loaded %u groups and the groups of %u users in %"G_GINT64_FORMAT" ms.\n",
+                 g_hash_table_size (groups), g_hash_table_size (user_groups),
+                 (g_get_monotonic_time () - start) / 1000);
+    return 0;
+}
+
+static int
+load_group_graph (CcnetGroupManager *mgr)
+{
+    int i, rc = 1;
+
+    for (i = 0; i < GROUP_GRAPH_LOAD_TRIES && rc == 1; ++i)
+        rc = try_load_group_graph (mgr);
+
+    if (rc == 1)
+        ccnet_message ("Groups kept changing while loading them, "
+                       "trying again later.\n");
+    return rc == 0 ? 0 : -1;
+}
+
+static void
+graph_add_group (CcnetGroupManager *mgr, int group_id, const char *group_name,
+                 const char *creator, gint64 timestamp, int parent_group_id,
+                 const char *path)
+{
+    GroupNode *node;
+
+    g_atomic_int_inc (&mgr->priv->graph_version);
+    if (!mgr->priv->graph_loaded)
+        return;
+
+    node = g_new0 (GroupNode, 1);
+    node->id = group_id;
+    node->name = g_strdup (group_name);
+    node->creator = g_strdup (creator);
+    node->timestamp = timestamp;
+    node->parent_group_id = parent_group_id;
+    if (path)
+        node->path = parse_group_path (path);
+
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    g_hash_table_replace (mgr->priv->groups, GINT_TO_POINTER(group_id), node);
+    link_group_node (mgr, node);
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+}
+
+static void
+graph_remove_group (CcnetGroupManager *mgr, int group_id)
+{
+    GroupNode *node;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_atomic_int_inc (&mgr->priv->graph_version);
+    if (!mgr->priv->graph_loaded)
+        return;
+
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    node = lookup_group_node (mgr, group_id);
+    if (node) {
+        unlink_group_node (mgr, node);
+        g_hash_table_remove (mgr->priv->groups, GINT_TO_POINTER(group_id));
+    }
+    g_hash_table_iter_init (&iter, mgr->priv->user_groups);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        id_set_remove (value, group_id);
+        if (((GArray *)value)->len == 0)
+            g_hash_table_iter_remove (&iter);
+    }
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+}
+
+static void
+graph_add_member (CcnetGroupManager *mgr, int group_id, const char *user)
+{
+    GArray *ids;
+
+    g_atomic_int_inc (&mgr->priv->graph_version);
+    if (!mgr->priv->graph_loaded)
+        return;
+
+    char *user_l = g_ascii_strdown (user, -1);
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    ids = g_hash_table_lookup (mgr->priv->user_groups, user_l);
+    if (!ids) {
+        id_set_add (&ids, group_id);
+        g_hash_table_insert (mgr->priv->user_groups, user_l, ids);
+        user_l = NULL;
+    } else {
+        id_set_add (&ids, group_id);
+    }
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+    g_free (user_l);
+}
+
+/* Removes @user from @group_id, or from all groups if @group_id is -1. */
+static void
+graph_remove_member (CcnetGroupManager *mgr, int group_id, const char *user)
+{
+    GArray *ids;
+
+    g_atomic_int_inc (&mgr->priv->graph_version);
+    if (!mgr->priv->graph_loaded)
+        return;
+
+    char *user_l = g_ascii_strdown (user, -1);
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    ids = g_hash_table_lookup (mgr->priv->user_groups, user_l);
+    if (ids) {
+        if (group_id >= 0)
+            id_set_remove (ids, group_id);
+        if (group_id < 0 || ids->len == 0)
+            g_hash_table_remove (mgr->priv->user_groups, user_l);
+    }
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+    g_free (user_l);
+}
+
+static void
+graph_rename_member (CcnetGroupManager *mgr, const char *old_user, const char *new_user)
+{
+    GArray *old_ids, *new_ids;
+    gpointer key;
+    guint i;
+
+    g_atomic_int_inc (&mgr->priv->graph_version);
+    if (!mgr->priv->graph_loaded)
+        return;
+
+    char *old_l = g_ascii_strdown (old_user, -1);
+    char *new_l = g_ascii_strdown (new_user, -1);
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    if (g_hash_table_lookup_extended (mgr->priv->user_groups, old_l,
+                                      &key, (gpointer *)&old_ids)) {
+        g_hash_table_steal (mgr->priv->user_groups, old_l);
+        g_free (key);
+        new_ids = g_hash_table_lookup (mgr->priv->user_groups, new_l);
+        if (new_ids) {
+            for (i = 0; i < old_ids->len; ++i)
+                id_set_add (&new_ids, g_array_index (old_ids, int, i));
+            g_array_free (old_ids, TRUE);
+        } else {
+            g_hash_table_insert (mgr->priv->user_groups, new_l, old_ids);
+            new_l = NULL;
+        }
+    }
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+    g_free (old_l);
+    g_free (new_l);
+}
+
+static void
+graph_update_group (CcnetGroupManager *mgr, int group_id,
+                    const char *group_name, const char *creator)
+{
+    GroupNode *node;
+
+    g_atomic_int_inc (&mgr->priv->graph_version);
+    if (!mgr->priv->graph_loaded)
+        return;
+
+    pthread_rwlock_wrlock (&mgr->priv->graph_lock);
+    node = lookup_group_node (mgr, group_id);
+    if (node && group_name) {
+        g_free (node->name);
+        node->name = g_strdup (group_name);
+    }
+    if (node && creator) {
+        g_free (node->creator);
+        node->creator = g_strdup (creator);
+    }
+    pthread_rwlock_unlock (&mgr->priv->graph_lock);
+}
+
+static CcnetGroup *
+group_from_node (GroupNode *node, gboolean lower_creator)
+{
+    CcnetGroup *group;
+    char *creator = lower_creator ? g_ascii_strdown (node->creator ? node->creator : "", -1)
+                                  : g_strdup (node->creator);
+
+    group = g_object_new (CCNET_TYPE_GROUP,
+                          "id", node->id,
+                          "group_name", node->name,
+                          "creator_name", creator,
+                          "timestamp", node->timestamp,
+                          "source", "DB",
+                          "parent_group_id", node->parent_group_id,
+                          NULL);
+    g_free (creator);
+
+    return group;
+}
+
+/* Returns groups of the ids in @ids that exist, in the order of @ids. */
+static GList *
+groups_from_ids (CcnetGroupManager *mgr, GArray *ids, gboolean descending)
+{
+    GList *ret = NULL;
+    GroupNode *node;
+    guint i;
+
+    for (i = 0; ids && i < ids->len; ++i) {
+        node = lookup_group_node (mgr, g_array_index (ids, int, i));
+        if (node)
+            ret = g_list_prepend (ret, group_from_node (node, FALSE));
+    }
+
+    return descending ? ret : g_list_reverse (ret);
+}
+
+/* The ascending ids of groups @user_l is in, and their ancestors if
+ * @with_ancestors. Called with the graph lock held.
+ */
+static GArray *
+collect_user_group_ids (CcnetGroupManager *mgr, const char *user_l,
+                        gboolean with_ancestors)
+{
+    GArray *direct = g_hash_table_lookup (mgr->priv->user_groups, user_l);
+    GArray *ret = g_array_new (FALSE, FALSE, sizeof(int));
+    GroupNode *node;
+    guint i, j;
+    int id;
+
+    for (i = 0; direct && i < direct->len; ++i) {
+        id = g_array_index (direct, int, i);
+        node = lookup_group_node (mgr, id);
+        if (!node)
+            continue;
+
+        if (!with_ancestors || node->parent_group_id == 0 || !node->path) {
+            id_set_add (&ret, id);
+            continue;
+        }
+        for (j = 0; j < node->path->len; ++j) {
+            id = g_array_index (node->path, int, j);
+            if (lookup_group_node (mgr, id))
+                id_set_add (&ret, id);
+        }
+    }
+
+    return ret;
+}
+
+/* -------- Group Management ---------------- */
+
 static gboolean
 get_group_id_cb (CcnetDBRow *row, void *data)
 {
@@ -263,6 +835,7 @@ create_group_common (CcnetGroupManager *mgr,
     GString *sql = g_string_new ("");
     const char *table_name = mgr->priv->table_name;
     int group_id = -1;
+    char *group_path = NULL;
     CcnetDBTrans *trans = seaf_db_begin_transaction (db);
 
     char *user_name_l = g_ascii_strdown (user_name, -1);
@@ -309,7 +882,8 @@ create_group_common (CcnetGroupManager *mgr,
     }
 
     if (parent_group_id == -1) { // 顶级组
-        g_string_printf (sql, "INSERT INOT GroupStructure (group_id, path) VALUES (?,'%d')", group_id);
+        group_path = g_strdup_printf ("%d", group_id);
+        g_string_printf (sql, "INSERT INTO GroupStructure (group_id, path) VALUES (?,'%s')", group_path);
         if (seaf_db_trans_query (trans, sql->str, 1, "int", group_id) < 0)
             goto error;
     } else if (parent_group_id > 0) { // 非顶级组
@@ -319,18 +893,25 @@ create_group_common (CcnetGroupManager *mgr,
                                              &path, 1, "int", parent_group_id); // 获取父路径
         if (!path)
             goto error;
-        g_string_printf (sql, "INSERT INTO GroupStructure (group_id, path) VALUES (?, '%s, %d')", path, group_id); // 产生新的路径（path格式：`A, B, C`）
-        if (seaf_db_trans_query (trans, sql->str, 1, "int", group_id) < 0) {
-            g_free (path);
-            goto error;
-        }
+        group_path = g_strdup_printf ("%s, %d", path, group_id); // 产生新的路径（path格式：`A, B, C`）
         g_free (path);
+        g_string_printf (sql, "INSERT INTO GroupStructure (group_id, path) VALUES (?, '%s')", group_path);
+        if (seaf_db_trans_query (trans, sql->str, 1, "int", group_id) < 0)
+            goto error;
     }
 
-    seaf_db_commit (trans);
+    if (seaf_db_commit (trans) < 0)
+        goto error;
     seaf_db_trans_close (trans);
+
+    graph_add_group (mgr, group_id, group_name, user_name_l, now,
+                     parent_group_id, group_path);
+    if (g_strcmp0(user_name, "system admin") != 0)
+        graph_add_member (mgr, group_id, user_name_l);
+
     g_string_free (sql, TRUE);
     g_free (user_name_l);
+    g_free (group_path);
     return group_id;
 
 error:
@@ -339,6 +920,7 @@ error:
     g_set_error (error, CCNET_DOMAIN, 0, "Failed to create group");
     g_string_free (sql, TRUE);
     g_free (user_name_l);
+    g_free (group_path);
     return -1;
 }
 
@@ -501,6 +1083,8 @@ int ccnet_group_manager_remove_group (CcnetGroupManager *mgr,
     g_string_printf (sql, "DELETE FROM GroupStructure WHERE group_id=?");
     seaf_db_statement_query (db, sql->str, 1, "int", group_id);
 
+    graph_remove_group (mgr, group_id);
+
     g_string_free (sql, TRUE);
     
     return 0;
@@ -547,6 +1131,8 @@ int ccnet_group_manager_add_member (CcnetGroupManager *mgr,
     int rc = seaf_db_statement_query (db, "INSERT INTO GroupUser (group_id, user_name, is_staff) VALUES (?, ?, ?)",
                                        3, "int", group_id, "string", member_name_l,
                                        "int", 0);
+    if (rc >= 0)
+        graph_add_member (mgr, group_id, member_name_l);
     g_free (member_name_l);
     if (rc < 0) {
         g_set_error (error, CCNET_DOMAIN, 0, "Failed to add member to group");
@@ -578,7 +1164,8 @@ int ccnet_group_manager_remove_member (CcnetGroupManager *mgr,
     }
 
     sql = "DELETE FROM GroupUser WHERE group_id=? AND user_name=?";
-    seaf_db_statement_query (db, sql, 2, "int", group_id, "string", member_name);
+    if (seaf_db_statement_query (db, sql, 2, "int", group_id, "string", member_name) >= 0)
+        graph_remove_member (mgr, group_id, member_name);
 
     return 0;
 }
@@ -632,6 +1219,7 @@ int ccnet_group_manager_set_group_name (CcnetGroupManager *mgr,
         seaf_db_statement_query (db, sql->str, 2, "string", group_name, "int", group_id);
     }
     g_string_free (sql, TRUE);
+    graph_update_group (mgr, group_id, group_name, NULL);
 
     return 0;
 }
@@ -656,10 +1244,11 @@ int ccnet_group_manager_quit_group (CcnetGroupManager *mgr,
         return -1;
     }
 
-    seaf_db_statement_query (db,
-                              "DELETE FROM GroupUser WHERE group_id=? "
-                              "AND user_name=?",
-                              2, "int", group_id, "string", user_name);
+    if (seaf_db_statement_query (db,
+                                 "DELETE FROM GroupUser WHERE group_id=? "
+                                 "AND user_name=?",
+                                 2, "int", group_id, "string", user_name) >= 0)
+        graph_remove_member (mgr, group_id, user_name);
 
     return 0;
 }
@@ -696,9 +1285,30 @@ ccnet_group_manager_get_ancestor_groups (CcnetGroupManager *mgr, int group_id)
     CcnetDB *db = mgr->priv->db;
     GList *ret = NULL;
     CcnetGroup *group = NULL;
-    GString *sql = g_string_new ("");
+    GString *sql;
     const char *table_name = mgr->priv->table_name;
 
+    if (mgr->priv->graph_loaded) {
+        GroupNode *node;
+        GArray *ids;
+
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        node = lookup_group_node (mgr, group_id);
+        if (node && node->path) {
+            ids = g_array_sized_new (FALSE, FALSE, sizeof(int), node->path->len);
+            g_array_append_vals (ids, node->path->data, node->path->len);
+            g_array_sort (ids, (GCompareFunc)compare_group_ids);
+            ret = groups_from_ids (mgr, ids, FALSE);
+            g_array_free (ids, TRUE);
+        } else if (node) {
+            ret = g_list_prepend (ret, group_from_node (node, TRUE));
+        }
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        return ret;
+    }
+
+    sql = g_string_new ("");
+
     g_string_printf (sql, "SELECT path FROM GroupStructure WHERE group_id=?");
 
     char *path = seaf_db_statement_get_string (db, sql->str, 1, "int", group_id);
@@ -775,6 +1385,20 @@ ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
     CcnetGroup *group;
     int parent_group_id = 0, group_id = 0;
 
+    if (mgr->priv->graph_loaded) {
+        GArray *ids;
+
+        char *user_l = g_ascii_strdown (user_name, -1);
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        ids = collect_user_group_ids (mgr, user_l, return_ancestors);
+        ret = groups_from_ids (mgr, ids, TRUE);
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        g_array_free (ids, TRUE);
+        g_free (user_l);
+        g_string_free (sql, TRUE);
+        return ret;
+    }
+
     if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL)
         g_string_printf (sql, 
             "SELECT g.group_id, group_name, creator_name, timestamp, parent_group_id FROM "
@@ -891,10 +1515,22 @@ ccnet_group_manager_get_child_groups (CcnetGroupManager *mgr, int group_id,
                                       GError **error)
 {
     CcnetDB *db = mgr->priv->db;
-    GString *sql = g_string_new ("");
+    GString *sql;
     GList *ret = NULL;
     const char *table_name = mgr->priv->table_name;
 
+    if (mgr->priv->graph_loaded) {
+        GroupNode *node;
+
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        node = lookup_group_node (mgr, group_id);
+        if (node)
+            ret = groups_from_ids (mgr, node->children, FALSE);
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        return ret;
+    }
+
+    sql = g_string_new ("");
     if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL)
         g_string_printf (sql,
             "SELECT group_id, group_name, creator_name, timestamp, parent_group_id FROM "
@@ -922,6 +1558,20 @@ ccnet_group_manager_get_descendants_groups(CcnetGroupManager *mgr, int group_id,
     CcnetDB *db = mgr->priv->db;
     const char *table_name = mgr->priv->table_name;
 
+    if (mgr->priv->graph_loaded) {
+        GroupNode *node;
+
+        /* Groups not in the structure have no descendants, nor themselves. */
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        node = lookup_group_node (mgr, group_id);
+        if (node && node->path) {
+            ret = groups_from_ids (mgr, node->descendants, FALSE);
+            ret = g_list_prepend (ret, group_from_node (node, FALSE));
+        }
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        return ret;
+    }
+
     GString *sql = g_string_new("");
     if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL)
         g_string_printf (sql, "SELECT g.group_id, group_name, creator_name, timestamp, "
@@ -955,10 +1605,22 @@ ccnet_group_manager_get_group (CcnetGroupManager *mgr, int group_id,
                                GError **error)
 {
     CcnetDB *db = mgr->priv->db;
-    GString *sql = g_string_new ("");
+    GString *sql;
     CcnetGroup *ccnetgroup = NULL;
     const char *table_name = mgr->priv->table_name;
 
+    if (mgr->priv->graph_loaded) {
+        GroupNode *node;
+
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        node = lookup_group_node (mgr, group_id);
+        if (node)
+            ccnetgroup = group_from_node (node, TRUE);
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        return ccnetgroup;
+    }
+
+    sql = g_string_new ("");
     if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL)
         g_string_printf (sql,
             "SELECT group_id, group_name, creator_name, timestamp, parent_group_id FROM "
@@ -1091,10 +1753,11 @@ ccnet_group_manager_remove_group_user (CcnetGroupManager *mgr,
 {
     CcnetDB *db = mgr->priv->db;
 
-    seaf_db_statement_query (db,
-                              "DELETE FROM GroupUser "
-                              "WHERE user_name = ?",
-                              1, "string", user);
+    if (seaf_db_statement_query (db,
+                                 "DELETE FROM GroupUser "
+                                 "WHERE user_name = ?",
+                                 1, "string", user) >= 0)
+        graph_remove_member (mgr, -1, user);
 
     return 0;
 }
@@ -1107,6 +1770,25 @@ ccnet_group_manager_is_group_user (CcnetGroupManager *mgr,
 {
     CcnetDB *db = mgr->priv->db;
 
+    if (mgr->priv->graph_loaded) {
+        GArray *ids;
+        gboolean found;
+
+        char *user_l = g_ascii_strdown (user, -1);
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        if (in_structure) {
+            ids = collect_user_group_ids (mgr, user_l, TRUE);
+            found = id_set_contains (ids, group_id);
+            g_array_free (ids, TRUE);
+        } else {
+            found = id_set_contains (g_hash_table_lookup (mgr->priv->user_groups, user_l),
+                                     group_id);
+        }
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        g_free (user_l);
+        return found ? 1 : 0;
+    }
+
     gboolean exists, err;
     exists = seaf_db_statement_exists (db, "SELECT group_id FROM GroupUser "
                                         "WHERE group_id=? AND user_name=?", &err,
@@ -1314,7 +1996,8 @@ ccnet_group_manager_set_group_creator (CcnetGroupManager *mgr,
                          table_name);
     }
 
-    seaf_db_statement_query (db, sql->str, 2, "string", user_name, "int", group_id);
+    if (seaf_db_statement_query (db, sql->str, 2, "string", user_name, "int", group_id) >= 0)
+        graph_update_group (mgr, group_id, NULL, user_name);
     g_string_free (sql, TRUE);
 
     return 0;
@@ -1466,5 +2149,38 @@ ccnet_group_manager_update_group_user (CcnetGroupManager *mgr,
         return -1;
     }
 
+    graph_rename_member (mgr, old_email, new_email);
+
     return 0;
 }
+
+GArray *
+ccnet_group_manager_get_group_ids_by_user (CcnetGroupManager *mgr,
+                                           const char *user_name,
+                                           gboolean return_ancestors,
+                                           GError **error)
+{
+    GArray *ids;
+    GList *groups, *ptr;
+    int group_id;
+
+    if (mgr->priv->graph_loaded) {
+        char *user_l = g_ascii_strdown (user_name, -1);
+        pthread_rwlock_rdlock (&mgr->priv->graph_lock);
+        ids = collect_user_group_ids (mgr, user_l, return_ancestors);
+        pthread_rwlock_unlock (&mgr->priv->graph_lock);
+        g_free (user_l);
+        return ids;
+    }
+
+    groups = ccnet_group_manager_get_groups_by_user (mgr, user_name,
+                                                     return_ancestors, error);
+    ids = g_array_new (FALSE, FALSE, sizeof(int));
+    for (ptr = groups; ptr; ptr = ptr->next) {
+        g_object_get (ptr->data, "id", &group_id, NULL);
+        id_set_add (&ids, group_id);
+    }
+    g_list_free_full (groups, g_object_unref);
+
+    return ids;
+}
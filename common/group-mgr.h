@@ -82,6 +82,15 @@ ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
                                         gboolean return_ancestors,
                                         GError **error); // 获取用户的组
 
+/* Ascending ids of the groups @user_name is in, with their ancestors if
+ * @return_ancestors. Served from memory once the manager is started.
+ */
+GArray *
+ccnet_group_manager_get_group_ids_by_user (CcnetGroupManager *mgr,
+                                           const char *user_name,
+                                           gboolean return_ancestors,
+                                           GError **error); // 获取用户所在组的id
+
 CcnetGroup *
 ccnet_group_manager_get_group (CcnetGroupManager *mgr, int group_id,
                                GError **error); // 获取组
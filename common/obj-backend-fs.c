@@ -342,6 +342,19 @@ obj_backend_fs_exists (ObjBackend *bend,
     return FALSE;
 }
 
+static int // 批量判断文件是否存在
+obj_backend_fs_exists_many (ObjBackend *bend,
+                            const char *repo_id,
+                            int version,
+                            const char **obj_ids,
+                            int n_ids,
+                            gboolean *exists)
+{
+    parallel_ids_exist (bend, (StoreIdExistsFunc)obj_backend_fs_exists,
+                        repo_id, version, obj_ids, n_ids, exists);
+    return 0;
+}
+
 static void // 删除文件
 obj_backend_fs_delete (ObjBackend *bend,
                        const char *repo_id,
@@ -523,6 +536,7 @@ obj_backend_fs_new (const char *seaf_dir, const char *obj_type)
     bend->read = obj_backend_fs_read;
     bend->write = obj_backend_fs_write;
     bend->exists = obj_backend_fs_exists;
+    bend->exists_many = obj_backend_fs_exists_many;
     bend->delete = obj_backend_fs_delete;
     bend->foreach_obj = obj_backend_fs_foreach_obj;
     bend->copy = obj_backend_fs_copy;
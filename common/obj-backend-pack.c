@@ -0,0 +1,1790 @@
+/* 使用打包文件实现seafile对象后台 */
+
+/*
+ * Pack file object backend.
+ *
+ * Instead of storing every object in its own file, objects are appended to
+ * per-store pack files:
+ *
+ *   [seaf_dir]/storage/[obj_type]-packs/[store_id]/[name].pack
+ *   [seaf_dir]/storage/[obj_type]-packs/[store_id]/[name].idx
+ *
+ * [name] is the creation time in microseconds (16 hex digits) followed by
+ * the pid of the creating process, so that sorting pack names sorts packs
+ * from oldest to newest.
+ *
+ * A pack is a header followed by records:
+ *
+ *   "SEAFPACK" | version (u32)
+ *   id (20 bytes) | len (u32) | data (len bytes)
+ *   ...
+ *
+ * A record with len == PACK_TOMBSTONE marks the object as deleted. When the
+ * same id appears more than once, the record in the newest pack wins. A
+ * writer starts a new pack before appending a record that would be
+ * shadowed by a newer pack of another writer.
+ *
+ * Every process that writes to a store appends to a pack of its own, which
+ * it holds an exclusive flock on. Once a pack reaches max_pack_size it is
+ * sealed: a sorted index (.idx) is written next to it. The index is mmapped
+ * by readers and searched with a 256-entry fanout table plus binary search.
+ * Packs without an index (the current pack of some writer, or one left over
+ * by a crashed writer) are scanned into an in-memory hash table. When a
+ * process finds that the writer of such a pack is gone, it seals the pack.
+ *
+ * Objects not found in packs are looked up in the loose (one file per
+ * object) layout, so a store can be migrated while the server is running.
+ *
+ * Records shadowed by newer ones and tombstones take space until the pack
+ * holding them is repacked. Repacking replaces a sealed pack [name] with
+ * [name].[time], which only holds its newest records and sorts right after
+ * [name], so the replacement keeps the place of the old pack in the order.
+ */
+
+#include "common.h"
+#include "utils.h"
+#include "obj-backend.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#endif
+
+#define DEBUG_FLAG SEAFILE_DEBUG_OTHER
+#include "log.h"
+
+#define PACK_MAGIC "SEAFPACK"
+#define INDEX_MAGIC "SEAFPIDX"
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 12 // magic + version
+#define RECORD_HEADER_SIZE 24 // id + len
+#define PACK_TOMBSTONE 0xFFFFFFFF // 删除标记
+
+#define DEFAULT_MAX_PACK_SIZE (256 << 20) // 默认打包文件大小上限
+#define PACK_REFRESH_INTERVAL 100 // 查找未命中时两次刷新之间的最小间隔（毫秒）
+#define REPACK_MIN_LIVE_RATIO 50 // 有效记录占比低于该百分比的打包文件会被重写
+
+/* How pack_store_find() handles a miss. */
+enum {
+    FIND_NO_REFRESH = 0,
+    FIND_REFRESH, // 刷新后再查找一次，每个存储每PACK_REFRESH_INTERVAL毫秒最多刷新一次
+    FIND_FORCE_REFRESH, // 总是刷新后再查找一次
+};
+
+extern ObjBackend *
+obj_backend_fs_new (const char *seaf_dir, const char *obj_type);
+
+typedef struct IndexHeader { // 索引文件头
+    char    magic[8];
+    guint32 version;
+    guint32 n_entries; // 索引项数
+    guint64 pack_size; // 索引覆盖的打包文件长度
+    guint32 fanout[256]; // fanout[i]为id首字节<=i的索引项数
+} __attribute__((__packed__)) IndexHeader;
+
+typedef struct IndexEntry { // 索引项（同时用作内存中的索引项）
+    unsigned char id[20];
+    guint32       len; // 对象长度；PACK_TOMBSTONE表示已删除
+    guint64       offset; // 对象数据在打包文件中的偏移
+} __attribute__((__packed__)) IndexEntry;
+
+typedef struct Pack { // 打包文件
+    char        *name;
+    char        *path; // 打包文件路径
+    int          fd;
+    gint         ref_count;
+    gboolean     own; // 是否是本进程正在写入的打包文件
+
+    /* Sealed packs: mmapped index, entries in network byte order. */
+    void        *idx_map;
+    size_t       idx_map_len;
+    IndexHeader *idx_header;
+    IndexEntry  *entries;
+    guint32      n_entries;
+
+    /* Unsealed packs: in-memory index. */
+    GHashTable  *table; // raw id -> IndexEntry (host byte order)
+    gint64       size; // 已解析（或已写入）的长度
+} Pack;
+
+typedef struct PackStore { // 每个存储（仓库）的打包文件集合
+    char            *store_id;
+    char            *dir;
+    gint             ref_count;
+
+    pthread_rwlock_t lock; // 保护packs和各个打包文件的索引
+    GPtrArray       *packs; // 按从旧到新排序
+    time_t           dir_mtime; // 上次扫描时目录的修改时间
+    gint64           next_refresh; // 下次允许按需刷新的时间（单调时钟，微秒）
+
+    pthread_mutex_t  write_lock; // 串行化追加写
+    Pack            *active; // 本进程正在写入的打包文件
+} PackStore;
+
+typedef struct PackPriv { // 私有域
+    char            *pack_dir; // [seaf_dir]/storage/[obj_type]-packs
+    ObjBackend      *loose; // 旧的一个对象一个文件的布局
+    gint64           max_pack_size;
+
+    pthread_mutex_t  lock;
+    GHashTable      *stores; // store_id -> PackStore
+} PackPriv;
+
+static guint
+raw_id_hash (gconstpointer key)
+{
+    /* Object ids are SHA1 hashes, any 4 bytes are well distributed. */
+    guint h;
+    memcpy (&h, key, sizeof(h));
+    return h;
+}
+
+static gboolean
+raw_id_equal (gconstpointer a, gconstpointer b)
+{
+    return memcmp (a, b, 20) == 0;
+}
+
+static int
+compare_index_entries (const void *a, const void *b)
+{
+    return memcmp (((const IndexEntry *)a)->id, ((const IndexEntry *)b)->id, 20);
+}
+
+/* Pack. */
+
+static void // 释放打包文件
+pack_free (Pack *pack)
+{
+    if (pack->fd >= 0)
+        close (pack->fd);
+    if (pack->idx_map)
+        munmap (pack->idx_map, pack->idx_map_len);
+    if (pack->table)
+        g_hash_table_destroy (pack->table);
+    g_free (pack->name);
+    g_free (pack->path);
+    g_free (pack);
+}
+
+static Pack *
+pack_ref (Pack *pack)
+{
+    g_atomic_int_inc (&pack->ref_count);
+    return pack;
+}
+
+/* Packs removed from a store stay open until the last reader is done. */
+static void
+pack_unref (Pack *pack)
+{
+    if (g_atomic_int_dec_and_test (&pack->ref_count))
+        pack_free (pack);
+}
+
+static char * // 打包文件对应的索引文件路径
+index_path (Pack *pack)
+{
+    char *path = g_strdup (pack->path);
+    /* Replace ".pack" with ".idx". */
+    strcpy (path + strlen(path) - strlen(".pack"), ".idx");
+    return path;
+}
+
+/* Returns 0 on success, -1 if the index doesn't exist or is invalid. */
+static int // 载入（mmap）索引文件
+pack_load_index (Pack *pack)
+{
+    char *path = index_path (pack);
+    SeafStat st;
+    void *map;
+    IndexHeader *hdr;
+    int fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        g_free (path);
+        return -1;
+    }
+
+    if (seaf_fstat (fd, &st) < 0 || st.st_size < sizeof(IndexHeader)) {
+        close (fd);
+        g_free (path);
+        return -1;
+    }
+
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        seaf_warning ("[pack backend] Failed to mmap %s: %s.\n", path, strerror(errno));
+        g_free (path);
+        return -1;
+    }
+
+    hdr = map;
+    if (memcmp (hdr->magic, INDEX_MAGIC, 8) != 0 ||
+        ntohl (hdr->version) != PACK_VERSION ||
+        sizeof(IndexHeader) + (gint64)ntohl(hdr->n_entries) * sizeof(IndexEntry) != st.st_size) {
+        seaf_warning ("[pack backend] Invalid index file %s.\n", path);
+        munmap (map, st.st_size);
+        g_free (path);
+        return -1;
+    }
+
+    g_free (path);
+
+    if (pack->table) {
+        g_hash_table_destroy (pack->table);
+        pack->table = NULL;
+    }
+    pack->idx_map = map;
+    pack->idx_map_len = st.st_size;
+    pack->idx_header = hdr;
+    pack->entries = (IndexEntry *)((char *)map + sizeof(IndexHeader));
+    pack->n_entries = ntohl (hdr->n_entries);
+    pack->size = (gint64)GUINT64_FROM_BE (hdr->pack_size);
+
+    return 0;
+}
+
+static void // 向内存索引中加入一项
+pack_table_insert (Pack *pack, const unsigned char *id, guint32 len, guint64 offset)
+{
+    IndexEntry *entry = g_new (IndexEntry, 1);
+
+    memcpy (entry->id, id, 20);
+    entry->len = len;
+    entry->offset = offset;
+    /* Later records replace earlier ones. */
+    g_hash_table_replace (pack->table, entry->id, entry);
+}
+
+/*
+ * Parse records appended since the last scan. A record that is only
+ * partially written is left for the next scan.
+ */
+static int // 扫描未封存的打包文件
+pack_scan (Pack *pack)
+{
+    SeafStat st;
+    char hdr[RECORD_HEADER_SIZE];
+    guint32 len;
+    gint64 pos;
+    guint64 data_len;
+
+    if (seaf_fstat (pack->fd, &st) < 0) {
+        seaf_warning ("[pack backend] Failed to stat %s: %s.\n",
+                      pack->path, strerror(errno));
+        return -1;
+    }
+
+    if (pack->size == 0) {
+        char magic[PACK_HEADER_SIZE];
+        if (st.st_size < PACK_HEADER_SIZE)
+            return 0;
+        if (pread (pack->fd, magic, PACK_HEADER_SIZE, 0) != PACK_HEADER_SIZE ||
+            memcmp (magic, PACK_MAGIC, 8) != 0) {
+            seaf_warning ("[pack backend] Invalid pack file %s.\n", pack->path);
+            return -1;
+        }
+        pack->size = PACK_HEADER_SIZE;
+    }
+
+    pos = pack->size;
+    while (pos + RECORD_HEADER_SIZE <= st.st_size) {
+        if (pread (pack->fd, hdr, RECORD_HEADER_SIZE, pos) != RECORD_HEADER_SIZE) {
+            seaf_warning ("[pack backend] Failed to read %s: %s.\n",
+                          pack->path, strerror(errno));
+            return -1;
+        }
+        memcpy (&len, hdr + 20, 4);
+        len = ntohl (len);
+        data_len = (len == PACK_TOMBSTONE) ? 0 : len;
+        if (pos + RECORD_HEADER_SIZE + data_len > st.st_size)
+            break;
+        pack_table_insert (pack, (unsigned char *)hdr, len, pos + RECORD_HEADER_SIZE);
+        pos += RECORD_HEADER_SIZE + data_len;
+    }
+    pack->size = pos;
+
+    return 0;
+}
+
+static Pack * // 打开一个已有的打包文件
+pack_open (const char *dir, const char *name)
+{
+    Pack *pack = g_new0 (Pack, 1);
+
+    pack->name = g_strdup (name);
+    pack->path = g_strdup_printf ("%s/%s.pack", dir, name);
+    pack->ref_count = 1;
+    pack->fd = open (pack->path, O_RDONLY);
+    if (pack->fd < 0) {
+        seaf_warning ("[pack backend] Failed to open %s: %s.\n",
+                      pack->path, strerror(errno));
+        pack_free (pack);
+        return NULL;
+    }
+
+    if (pack_load_index (pack) == 0)
+        return pack;
+
+    pack->table = g_hash_table_new_full (raw_id_hash, raw_id_equal, NULL, g_free);
+    if (pack_scan (pack) < 0) {
+        pack_free (pack);
+        return NULL;
+    }
+
+    return pack;
+}
+
+/* Returns the newest entry for @id in @pack, or NULL. */
+static const IndexEntry * // 在打包文件中查找对象
+pack_lookup (Pack *pack, const unsigned char *id, IndexEntry *out)
+{
+    const IndexEntry *e;
+    guint32 lo, hi, mid;
+    int cmp;
+
+    if (pack->table) {
+        e = g_hash_table_lookup (pack->table, id);
+        if (!e)
+            return NULL;
+        *out = *e;
+        return out;
+    }
+
+    lo = (id[0] == 0) ? 0 : ntohl (pack->idx_header->fanout[id[0] - 1]);
+    hi = ntohl (pack->idx_header->fanout[id[0]]);
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        e = &pack->entries[mid];
+        cmp = memcmp (id, e->id, 20);
+        if (cmp == 0) {
+            memcpy (out->id, e->id, 20);
+            out->len = ntohl (e->len);
+            out->offset = GUINT64_FROM_BE (e->offset);
+            return out;
+        }
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Write a sorted index for @pack. The index is written to a temp file
+ * first, so readers never see a partial index.
+ */
+static int // 生成索引文件
+pack_write_index (Pack *pack)
+{
+    IndexHeader hdr;
+    IndexEntry *entries, *e;
+    GHashTableIter iter;
+    gpointer value;
+    guint32 n, i;
+    char *path = NULL, *tmp_path = NULL;
+    int fd = -1;
+    int ret = 0;
+
+    n = g_hash_table_size (pack->table);
+    entries = g_new (IndexEntry, n > 0 ? n : 1);
+    i = 0;
+    g_hash_table_iter_init (&iter, pack->table);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        entries[i++] = *(IndexEntry *)value;
+    qsort (entries, n, sizeof(IndexEntry), compare_index_entries);
+
+    memset (&hdr, 0, sizeof(hdr));
+    memcpy (hdr.magic, INDEX_MAGIC, 8);
+    hdr.version = htonl (PACK_VERSION);
+    hdr.n_entries = htonl (n);
+    hdr.pack_size = GUINT64_TO_BE (pack->size);
+    for (i = 0; i < n; ++i) {
+        e = &entries[i];
+        hdr.fanout[e->id[0]]++;
+        e->len = htonl (e->len);
+        e->offset = GUINT64_TO_BE (e->offset);
+    }
+    for (i = 1; i < 256; ++i)
+        hdr.fanout[i] += hdr.fanout[i - 1];
+    for (i = 0; i < 256; ++i)
+        hdr.fanout[i] = htonl (hdr.fanout[i]);
+
+    path = index_path (pack);
+    tmp_path = g_strconcat (path, ".XXXXXX", NULL);
+    fd = g_mkstemp (tmp_path);
+    if (fd < 0) {
+        seaf_warning ("[pack backend] Failed to create %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (writen (fd, &hdr, sizeof(hdr)) < 0 ||
+        writen (fd, entries, (size_t)n * sizeof(IndexEntry)) < 0 ||
+        fsync (fd) < 0) {
+        seaf_warning ("[pack backend] Failed to write %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (g_rename (tmp_path, path) < 0) {
+        seaf_warning ("[pack backend] Failed to rename %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+out:
+    if (fd >= 0)
+        close (fd);
+    if (ret < 0 && tmp_path)
+        g_unlink (tmp_path);
+    g_free (entries);
+    g_free (path);
+    g_free (tmp_path);
+    return ret;
+}
+
+/* Seal @pack and switch it to the mmapped index. */
+static int // 封存打包文件
+pack_seal (Pack *pack)
+{
+    if (pack_write_index (pack) < 0)
+        return -1;
+    return pack_load_index (pack);
+}
+
+/* Pack store. */
+
+static gint
+compare_packs (gconstpointer a, gconstpointer b)
+{
+    const Pack *pa = *(Pack **)a, *pb = *(Pack **)b;
+    return strcmp (pa->name, pb->name);
+}
+
+static PackStore *
+pack_store_new (PackPriv *priv, const char *store_id)
+{
+    PackStore *store = g_new0 (PackStore, 1);
+
+    store->store_id = g_strdup (store_id);
+    store->dir = g_build_filename (priv->pack_dir, store_id, NULL);
+    store->ref_count = 1;
+    store->dir_mtime = -1;
+    pthread_rwlock_init (&store->lock, NULL);
+    pthread_mutex_init (&store->write_lock, NULL);
+    store->packs = g_ptr_array_new_with_free_func ((GDestroyNotify)pack_unref);
+
+    return store;
+}
+
+static void
+pack_store_unref (PackStore *store)
+{
+    if (!g_atomic_int_dec_and_test (&store->ref_count))
+        return;
+
+    g_ptr_array_free (store->packs, TRUE);
+    pthread_rwlock_destroy (&store->lock);
+    pthread_mutex_destroy (&store->write_lock);
+    g_free (store->store_id);
+    g_free (store->dir);
+    g_free (store);
+}
+
+static PackStore * // 获取存储，增加引用
+get_pack_store (PackPriv *priv, const char *store_id)
+{
+    PackStore *store;
+
+    pthread_mutex_lock (&priv->lock);
+    store = g_hash_table_lookup (priv->stores, store_id);
+    if (!store) {
+        store = pack_store_new (priv, store_id);
+        g_hash_table_insert (priv->stores, store->store_id, store);
+    }
+    g_atomic_int_inc (&store->ref_count);
+    pthread_mutex_unlock (&priv->lock);
+
+    return store;
+}
+
+static Pack *
+find_pack (PackStore *store, const char *name)
+{
+    Pack *pack;
+    guint i;
+
+    for (i = 0; i < store->packs->len; ++i) {
+        pack = g_ptr_array_index (store->packs, i);
+        if (strcmp (pack->name, name) == 0)
+            return pack;
+    }
+    return NULL;
+}
+
+/* Seal a pack whose writer is gone (e.g. crashed or exited). */
+static void // 封存已无写入者的打包文件
+maybe_seal_orphan_pack (Pack *pack)
+{
+    int fd;
+
+    fd = open (pack->path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    if (flock (fd, LOCK_EX | LOCK_NB) == 0) {
+        /* Pick up anything written since the last scan before sealing. */
+        if (pack_scan (pack) == 0 && pack_seal (pack) == 0)
+            seaf_message ("[pack backend] Sealed orphan pack %s.\n", pack->path);
+        flock (fd, LOCK_UN);
+    }
+    close (fd);
+}
+
+/*
+ * Pick up packs created, appended to or sealed by other writers, and drop
+ * packs removed by repacking, since the last refresh. Must be called with
+ * the write lock of store->lock held.
+ */
+static void // 刷新存储的打包文件列表
+pack_store_refresh (PackStore *store)
+{
+    SeafStat st;
+    GDir *dir;
+    const char *dname;
+    char *name;
+    Pack *pack;
+    GHashTable *names;
+    int i;
+    gboolean dir_changed;
+
+    __atomic_store_n (&store->next_refresh,
+                      g_get_monotonic_time () + PACK_REFRESH_INTERVAL * 1000,
+                      __ATOMIC_RELAXED);
+
+    if (seaf_stat (store->dir, &st) < 0)
+        return;
+
+    dir_changed = (st.st_mtime != store->dir_mtime);
+    /* mtime has a granularity of one second. If the dir was modified
+     * within the last second, it may be modified again with the same mtime.
+     */
+    if (st.st_mtime >= time(NULL) - 1)
+        store->dir_mtime = -1;
+    else
+        store->dir_mtime = st.st_mtime;
+
+    /* New packs or new indexes only show up as new directory entries. */
+    if (dir_changed) {
+        dir = g_dir_open (store->dir, 0, NULL);
+        if (!dir)
+            return;
+        names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        while ((dname = g_dir_read_name (dir)) != NULL) {
+            if (!g_str_has_suffix (dname, ".pack"))
+                continue;
+            name = g_strndup (dname, strlen(dname) - strlen(".pack"));
+            if (!find_pack (store, name)) {
+                pack = pack_open (store->dir, name);
+                if (pack)
+                    g_ptr_array_add (store->packs, pack);
+            }
+            g_hash_table_add (names, name);
+        }
+        g_dir_close (dir);
+
+        for (i = (int)store->packs->len - 1; i >= 0; --i) {
+            pack = g_ptr_array_index (store->packs, i);
+            if (!pack->own && !g_hash_table_contains (names, pack->name))
+                g_ptr_array_remove_index (store->packs, i);
+        }
+        g_hash_table_destroy (names);
+        g_ptr_array_sort (store->packs, compare_packs);
+    }
+
+    for (i = 0; i < (int)store->packs->len; ++i) {
+        pack = g_ptr_array_index (store->packs, i);
+        if (!pack->table || pack->own)
+            continue;
+        if (dir_changed && pack_load_index (pack) == 0)
+            continue;
+        pack_scan (pack);
+        if (dir_changed)
+            maybe_seal_orphan_pack (pack);
+    }
+}
+
+/* Returns the pack holding the newest record of @id, which may be a
+ * tombstone. Must be called with store->lock held.
+ */
+static Pack * // 查找对象的最新记录
+pack_store_lookup_record (PackStore *store, const unsigned char *id,
+                          IndexEntry *ret_entry)
+{
+    Pack *pack;
+    int i;
+
+    for (i = (int)store->packs->len - 1; i >= 0; --i) {
+        pack = g_ptr_array_index (store->packs, i);
+        if (pack_lookup (pack, id, ret_entry) != NULL)
+            return pack;
+    }
+
+    return NULL;
+}
+
+/* Must be called with store->lock held. */
+static gboolean // 在所有打包文件中查找对象，新的记录优先
+pack_store_lookup (PackStore *store, const unsigned char *id,
+                   Pack **ret_pack, IndexEntry *ret_entry)
+{
+    Pack *pack;
+
+    pack = pack_store_lookup_record (store, id, ret_entry);
+    if (!pack || ret_entry->len == PACK_TOMBSTONE)
+        return FALSE;
+
+    if (ret_pack)
+        *ret_pack = pack;
+    return TRUE;
+}
+
+/*
+ * Lookups of objects that don't exist yet are common, e.g. every write
+ * checks first. A refresh takes the write lock of the store, so misses
+ * refresh at most once per PACK_REFRESH_INTERVAL. Records written by other
+ * processes within that interval may be missed; for writes that only means
+ * a duplicate record.
+ */
+static gboolean // 距上次刷新是否已超过PACK_REFRESH_INTERVAL
+pack_store_refresh_due (PackStore *store)
+{
+    return g_get_monotonic_time () >=
+        __atomic_load_n (&store->next_refresh, __ATOMIC_RELAXED);
+}
+
+/*
+ * @refresh is one of FIND_NO_REFRESH, FIND_REFRESH and FIND_FORCE_REFRESH.
+ * A pack returned in @ret_pack is referenced, release it with pack_unref().
+ */
+static gboolean // 查找对象；找不到时按@refresh刷新后再查找一次
+pack_store_find (PackStore *store, const unsigned char *id, int refresh,
+                 Pack **ret_pack, IndexEntry *ret_entry)
+{
+    gboolean found;
+
+    pthread_rwlock_rdlock (&store->lock);
+    found = pack_store_lookup (store, id, ret_pack, ret_entry);
+    if (found && ret_pack)
+        pack_ref (*ret_pack);
+    pthread_rwlock_unlock (&store->lock);
+
+    if (found || refresh == FIND_NO_REFRESH)
+        return found;
+    if (refresh == FIND_REFRESH && !pack_store_refresh_due (store))
+        return FALSE;
+
+    pthread_rwlock_wrlock (&store->lock);
+    /* Concurrent misses wait here for one refresh instead of each doing one. */
+    if (refresh == FIND_FORCE_REFRESH || pack_store_refresh_due (store))
+        pack_store_refresh (store);
+    found = pack_store_lookup (store, id, ret_pack, ret_entry);
+    if (found && ret_pack)
+        pack_ref (*ret_pack);
+    pthread_rwlock_unlock (&store->lock);
+
+    return found;
+}
+
+static Pack * // 新建本进程写入的打包文件
+pack_create (PackStore *store)
+{
+    Pack *pack;
+    char header[PACK_HEADER_SIZE];
+    guint32 version = htonl (PACK_VERSION);
+    char *tmp_path;
+
+    if (g_mkdir_with_parents (store->dir, 0777) < 0) {
+        seaf_warning ("[pack backend] Failed to create dir %s: %s.\n",
+                      store->dir, strerror(errno));
+        return NULL;
+    }
+
+    pack = g_new0 (Pack, 1);
+    pack->name = g_strdup_printf ("%016"G_GINT64_MODIFIER"x-%d",
+                                  g_get_real_time(), (int)getpid());
+    pack->path = g_strdup_printf ("%s/%s.pack", store->dir, pack->name);
+    pack->ref_count = 1;
+    pack->own = TRUE;
+    pack->fd = -1;
+    pack->table = g_hash_table_new_full (raw_id_hash, raw_id_equal, NULL, g_free);
+
+    /* Create the pack under a temp name and lock it before it becomes
+     * visible, so that no other process takes it as an orphan pack.
+     */
+    tmp_path = g_strconcat (pack->path, ".tmp", NULL);
+    pack->fd = open (tmp_path, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (pack->fd < 0) {
+        seaf_warning ("[pack backend] Failed to create %s: %s.\n",
+                      tmp_path, strerror(errno));
+        goto error;
+    }
+
+    /* Tells other processes that this pack is still being written. */
+    if (flock (pack->fd, LOCK_EX | LOCK_NB) < 0) {
+        seaf_warning ("[pack backend] Failed to lock %s: %s.\n",
+                      tmp_path, strerror(errno));
+        goto error;
+    }
+
+    memcpy (header, PACK_MAGIC, 8);
+    memcpy (header + 8, &version, 4);
+    if (writen (pack->fd, header, PACK_HEADER_SIZE) < 0) {
+        seaf_warning ("[pack backend] Failed to write %s: %s.\n",
+                      tmp_path, strerror(errno));
+        goto error;
+    }
+    pack->size = PACK_HEADER_SIZE;
+
+    if (g_rename (tmp_path, pack->path) < 0) {
+        seaf_warning ("[pack backend] Failed to rename %s: %s.\n",
+                      tmp_path, strerror(errno));
+        goto error;
+    }
+
+    g_free (tmp_path);
+    return pack;
+
+error:
+    if (pack->fd >= 0)
+        g_unlink (tmp_path);
+    g_free (tmp_path);
+    pack_free (pack);
+    return NULL;
+}
+
+/* Must be called with store->write_lock held. */
+static int // 封存当前打包文件
+seal_active_pack (PackStore *store)
+{
+    Pack *active = store->active;
+    int ret;
+
+    if (!active)
+        return 0;
+
+    if (fsync (active->fd) < 0) {
+        seaf_warning ("[pack backend] Failed to fsync %s: %s.\n",
+                      active->path, strerror(errno));
+        return -1;
+    }
+
+    /* The in-memory index of the active pack is only modified with
+     * write_lock held, so the index can be written without blocking readers.
+     */
+    if (pack_write_index (active) < 0)
+        return -1;
+
+    pthread_rwlock_wrlock (&store->lock);
+    ret = pack_load_index (active);
+    if (ret == 0) {
+        active->own = FALSE;
+        store->active = NULL;
+    }
+    pthread_rwlock_unlock (&store->lock);
+
+    if (ret == 0)
+        flock (active->fd, LOCK_UN);
+
+    return ret;
+}
+
+/*
+ * Records are ordered by the names of their packs, not by when they were
+ * appended. If the newest record of @id is in a pack created after the
+ * active one, e.g. a tombstone written by seaf-fsck, a record appended to
+ * the active pack would be shadowed by it. A new pack is started instead.
+ *
+ * Must be called with store->write_lock held.
+ */
+static gboolean // 对象的最新记录是否在更新的打包文件中
+is_shadowed_by_newer_pack (PackStore *store, const unsigned char *id)
+{
+    IndexEntry entry;
+    Pack *pack;
+    gboolean ret;
+
+    if (!store->active)
+        return FALSE;
+
+    pthread_rwlock_rdlock (&store->lock);
+    pack = pack_store_lookup_record (store, id, &entry);
+    ret = (pack && strcmp (pack->name, store->active->name) > 0);
+    pthread_rwlock_unlock (&store->lock);
+
+    return ret;
+}
+
+/* Must be called with store->write_lock held. */
+static Pack * // 获取当前打包文件；超过大小上限或会被更新的记录覆盖时换新
+get_active_pack (PackPriv *priv, PackStore *store, const unsigned char *id, int len)
+{
+    Pack *pack;
+
+    if (store->active &&
+        (store->active->size + len > priv->max_pack_size ||
+         is_shadowed_by_newer_pack (store, id))) {
+        if (seal_active_pack (store) < 0)
+            seaf_warning ("[pack backend] Failed to seal pack %s, keep writing to it.\n",
+                          store->active->path);
+    }
+
+    if (store->active)
+        return store->active;
+
+    pack = pack_create (store);
+    if (!pack)
+        return NULL;
+
+    pthread_rwlock_wrlock (&store->lock);
+    g_ptr_array_add (store->packs, pack);
+    g_ptr_array_sort (store->packs, compare_packs);
+    pthread_rwlock_unlock (&store->lock);
+
+    store->active = pack;
+    return pack;
+}
+
+/* @len == PACK_TOMBSTONE appends a tombstone. */
+static int // 追加一条记录
+pack_store_append (PackPriv *priv, PackStore *store, const unsigned char *id,
+                   const void *data, guint32 len, gboolean need_sync)
+{
+    Pack *pack;
+    guint32 data_len = (len == PACK_TOMBSTONE) ? 0 : len;
+    char *buf;
+    guint32 len_n = htonl (len);
+    gint64 offset;
+    int ret = 0;
+
+    buf = g_malloc (RECORD_HEADER_SIZE + data_len);
+    memcpy (buf, id, 20);
+    memcpy (buf + 20, &len_n, 4);
+    if (data_len > 0)
+        memcpy (buf + RECORD_HEADER_SIZE, data, data_len);
+
+    pthread_mutex_lock (&store->write_lock);
+
+    pack = get_active_pack (priv, store, id, RECORD_HEADER_SIZE + data_len);
+    if (!pack) {
+        ret = -1;
+        goto out;
+    }
+
+    /* Write the whole record with one call, so that concurrent scanners
+     * either see all of it or none of it.
+     */
+    offset = pack->size;
+    if (pwrite (pack->fd, buf, RECORD_HEADER_SIZE + data_len, offset) !=
+        RECORD_HEADER_SIZE + data_len) {
+        seaf_warning ("[pack backend] Failed to write %s: %s.\n",
+                      pack->path, strerror(errno));
+        /* Drop whatever was partially written. */
+        if (ftruncate (pack->fd, offset) < 0)
+            seaf_warning ("[pack backend] Failed to truncate %s.\n", pack->path);
+        ret = -1;
+        goto out;
+    }
+
+    if (need_sync && fsync (pack->fd) < 0) {
+        seaf_warning ("[pack backend] Failed to fsync %s: %s.\n",
+                      pack->path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    pthread_rwlock_wrlock (&store->lock);
+    pack_table_insert (pack, id, len, offset + RECORD_HEADER_SIZE);
+    pack->size = offset + RECORD_HEADER_SIZE + data_len;
+    pthread_rwlock_unlock (&store->lock);
+
+out:
+    pthread_mutex_unlock (&store->write_lock);
+    g_free (buf);
+    return ret;
+}
+
+/* Backend interface. */
+
+static int // 读
+obj_backend_pack_read (ObjBackend *bend,
+                       const char *repo_id,
+                       int version,
+                       const char *obj_id,
+                       void **data,
+                       int *len)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    Pack *pack = NULL;
+    IndexEntry entry;
+    unsigned char id[20];
+    gboolean found;
+    char *buf;
+    int ret = 0;
+
+    hex_to_rawdata (obj_id, id, 20);
+    store = get_pack_store (priv, repo_id);
+
+    found = pack_store_find (store, id, FIND_NO_REFRESH, &pack, &entry);
+    if (!found) {
+        /* Objects that haven't been migrated are still loose. Check the loose
+         * layout before refreshing packs, since an object being migrated is
+         * packed before its loose file is removed.
+         */
+        if (priv->loose->read (priv->loose, repo_id, version, obj_id, data, len) == 0)
+            goto out;
+        found = pack_store_find (store, id, FIND_REFRESH, &pack, &entry);
+    }
+
+    if (!found) {
+        seaf_debug ("[pack backend] Object %s:%s not found.\n", repo_id, obj_id);
+        ret = -1;
+        goto out;
+    }
+
+    /* The pack is referenced, so it's safe to read without holding the
+     * lock even if it's removed by a repack meanwhile.
+     */
+    buf = g_malloc (entry.len > 0 ? entry.len : 1);
+    if (pread (pack->fd, buf, entry.len, entry.offset) != entry.len) {
+        seaf_warning ("[pack backend] Failed to read object %s from %s: %s.\n",
+                      obj_id, pack->path, strerror(errno));
+        g_free (buf);
+        ret = -1;
+        goto out;
+    }
+
+    *data = buf;
+    *len = (int)entry.len;
+
+out:
+    if (pack)
+        pack_unref (pack);
+    pack_store_unref (store);
+    return ret;
+}
+
+static gboolean // 判断存在
+obj_backend_pack_exists (ObjBackend *bend,
+                         const char *repo_id,
+                         int version,
+                         const char *obj_id)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    IndexEntry entry;
+    unsigned char id[20];
+    gboolean found;
+
+    hex_to_rawdata (obj_id, id, 20);
+    store = get_pack_store (priv, repo_id);
+
+    found = pack_store_find (store, id, FIND_NO_REFRESH, NULL, &entry);
+    if (!found)
+        found = priv->loose->exists (priv->loose, repo_id, version, obj_id);
+    if (!found)
+        found = pack_store_find (store, id, FIND_REFRESH, NULL, &entry);
+
+    pack_store_unref (store);
+    return found;
+}
+
+/* Looks up the ids whose exists[] is FALSE, with a single lock of the store. */
+static void
+pack_store_find_many (PackStore *store, const char **obj_ids, int n_ids,
+                      int refresh, gboolean *exists)
+{
+    IndexEntry entry;
+    unsigned char id[20];
+    int i;
+
+    if (refresh == FIND_REFRESH && !pack_store_refresh_due (store))
+        return;
+
+    if (refresh != FIND_NO_REFRESH) {
+        pthread_rwlock_wrlock (&store->lock);
+        if (refresh == FIND_FORCE_REFRESH || pack_store_refresh_due (store))
+            pack_store_refresh (store);
+    } else {
+        pthread_rwlock_rdlock (&store->lock);
+    }
+
+    for (i = 0; i < n_ids; ++i) {
+        if (exists[i])
+            continue;
+        hex_to_rawdata (obj_ids[i], id, 20);
+        exists[i] = pack_store_lookup (store, id, NULL, &entry);
+    }
+
+    pthread_rwlock_unlock (&store->lock);
+}
+
+static int // 批量判断存在，查找顺序同obj_backend_pack_exists
+obj_backend_pack_exists_many (ObjBackend *bend,
+                              const char *repo_id,
+                              int version,
+                              const char **obj_ids,
+                              int n_ids,
+                              gboolean *exists)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    const char **missing;
+    gboolean *loose_exists;
+    int *missing_idx;
+    int n_missing = 0, i;
+    int ret = 0;
+
+    memset (exists, 0, sizeof(gboolean) * n_ids);
+    store = get_pack_store (priv, repo_id);
+
+    pack_store_find_many (store, obj_ids, n_ids, FIND_NO_REFRESH, exists);
+
+    missing = g_new (const char *, n_ids);
+    missing_idx = g_new (int, n_ids);
+    for (i = 0; i < n_ids; ++i) {
+        if (!exists[i]) {
+            missing[n_missing] = obj_ids[i];
+            missing_idx[n_missing++] = i;
+        }
+    }
+
+    if (n_missing > 0) {
+        loose_exists = g_new0 (gboolean, n_missing);
+        ret = priv->loose->exists_many (priv->loose, repo_id, version,
+                                        missing, n_missing, loose_exists);
+        gboolean all_found = TRUE;
+        for (i = 0; i < n_missing; ++i) {
+            exists[missing_idx[i]] = loose_exists[i];
+            if (!loose_exists[i])
+                all_found = FALSE;
+        }
+        g_free (loose_exists);
+
+        /* Objects may have been packed by another process meanwhile. */
+        if (!all_found)
+            pack_store_find_many (store, obj_ids, n_ids, FIND_REFRESH, exists);
+    }
+
+    g_free (missing);
+    g_free (missing_idx);
+    pack_store_unref (store);
+    return ret;
+}
+
+static int // 写
+obj_backend_pack_write (ObjBackend *bend,
+                        const char *repo_id,
+                        int version,
+                        const char *obj_id,
+                        void *data,
+                        int len,
+                        gboolean need_sync)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    unsigned char id[20];
+    int ret;
+
+    /* Objects are content-addressed, writing an existing one is a no-op. */
+    if (obj_backend_pack_exists (bend, repo_id, version, obj_id))
+        return 0;
+
+    hex_to_rawdata (obj_id, id, 20);
+    store = get_pack_store (priv, repo_id);
+    ret = pack_store_append (priv, store, id, data, (guint32)len, need_sync);
+    pack_store_unref (store);
+
+    if (ret < 0)
+        seaf_warning ("[pack backend] Failed to write obj %s:%s.\n", repo_id, obj_id);
+    return ret;
+}
+
+static void // 删除
+obj_backend_pack_delete (ObjBackend *bend,
+                         const char *repo_id,
+                         int version,
+                         const char *obj_id)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    IndexEntry entry;
+    unsigned char id[20];
+
+    priv->loose->delete (priv->loose, repo_id, version, obj_id);
+
+    hex_to_rawdata (obj_id, id, 20);
+    store = get_pack_store (priv, repo_id);
+    /* A missed tombstone would leave the object visible, always refresh. */
+    if (pack_store_find (store, id, FIND_FORCE_REFRESH, NULL, &entry))
+        pack_store_append (priv, store, id, NULL, PACK_TOMBSTONE, FALSE);
+    pack_store_unref (store);
+}
+
+typedef struct LooseForeachData {
+    PackStore   *store;
+    SeafObjFunc  process;
+    void        *user_data;
+} LooseForeachData;
+
+static gboolean
+foreach_loose_obj_cb (const char *repo_id, int version,
+                      const char *obj_id, void *user_data)
+{
+    LooseForeachData *data = user_data;
+    unsigned char id[20];
+    IndexEntry entry;
+
+    /* Being migrated, already reported from the packs. */
+    hex_to_rawdata (obj_id, id, 20);
+    if (pack_store_find (data->store, id, FIND_NO_REFRESH, NULL, &entry))
+        return TRUE;
+
+    return data->process (repo_id, version, obj_id, data->user_data);
+}
+
+/*
+ * Objects are reported from the record that is the newest for their id,
+ * so objects written more than once are reported only once.
+ */
+static int // 遍历
+obj_backend_pack_foreach_obj (ObjBackend *bend,
+                              const char *repo_id,
+                              int version,
+                              SeafObjFunc process,
+                              void *user_data)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    Pack *pack, *newest_pack;
+    IndexEntry *entries = NULL, entry;
+    guint32 n_entries, i, j;
+    GHashTableIter iter;
+    gpointer value;
+    GPtrArray *packs;
+    char obj_id[41];
+    gboolean stop = FALSE, is_newest;
+    LooseForeachData data;
+
+    store = get_pack_store (priv, repo_id);
+
+    pthread_rwlock_wrlock (&store->lock);
+    pack_store_refresh (store);
+    packs = g_ptr_array_new_full (store->packs->len, (GDestroyNotify)pack_unref);
+    for (i = 0; i < store->packs->len; ++i)
+        g_ptr_array_add (packs, pack_ref (g_ptr_array_index (store->packs, i)));
+    pthread_rwlock_unlock (&store->lock);
+
+    for (i = 0; i < packs->len && !stop; ++i) {
+        pack = g_ptr_array_index (packs, i);
+
+        /* Take a snapshot of the entries, the callback may take long and
+         * must not run with the lock held.
+         */
+        pthread_rwlock_rdlock (&store->lock);
+        if (pack->table) {
+            n_entries = g_hash_table_size (pack->table);
+            entries = g_new (IndexEntry, n_entries > 0 ? n_entries : 1);
+            n_entries = 0;
+            g_hash_table_iter_init (&iter, pack->table);
+            while (g_hash_table_iter_next (&iter, NULL, &value))
+                entries[n_entries++] = *(IndexEntry *)value;
+        } else {
+            n_entries = pack->n_entries;
+            entries = g_memdup (pack->entries,
+                                n_entries > 0 ? n_entries * sizeof(IndexEntry) : 1);
+        }
+        pthread_rwlock_unlock (&store->lock);
+
+        for (j = 0; j < n_entries; ++j) {
+            pthread_rwlock_rdlock (&store->lock);
+            is_newest = pack_store_lookup (store, entries[j].id, &newest_pack, &entry) &&
+                newest_pack == pack;
+            pthread_rwlock_unlock (&store->lock);
+            if (!is_newest)
+                continue;
+            rawdata_to_hex (entries[j].id, obj_id, 20);
+            if (!process (repo_id, version, obj_id, user_data)) {
+                stop = TRUE;
+                break;
+            }
+        }
+        g_free (entries);
+    }
+    g_ptr_array_free (packs, TRUE);
+
+    if (!stop) {
+        data.store = store;
+        data.process = process;
+        data.user_data = user_data;
+        priv->loose->foreach_obj (priv->loose, repo_id, version,
+                                  foreach_loose_obj_cb, &data);
+    }
+
+    pack_store_unref (store);
+    return 0;
+}
+
+static int // 复制
+obj_backend_pack_copy (ObjBackend *bend,
+                       const char *src_repo_id,
+                       int src_version,
+                       const char *dst_repo_id,
+                       int dst_version,
+                       const char *obj_id)
+{
+    void *data = NULL;
+    int len;
+    int ret;
+
+    if (obj_backend_pack_exists (bend, dst_repo_id, dst_version, obj_id))
+        return 0;
+
+    if (obj_backend_pack_read (bend, src_repo_id, src_version, obj_id, &data, &len) < 0) {
+        seaf_warning ("Failed to read obj %s:%s for copy.\n", src_repo_id, obj_id);
+        return -1;
+    }
+
+    ret = obj_backend_pack_write (bend, dst_repo_id, dst_version, obj_id,
+                                  data, len, FALSE);
+    g_free (data);
+    return ret;
+}
+
+static int // 移除存储
+obj_backend_pack_remove_store (ObjBackend *bend, const char *store_id)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    GDir *dir;
+    const char *dname;
+    char *path;
+
+    pthread_mutex_lock (&priv->lock);
+    store = g_hash_table_lookup (priv->stores, store_id);
+    if (store)
+        g_hash_table_steal (priv->stores, store_id);
+    pthread_mutex_unlock (&priv->lock);
+
+    if (store) {
+        pthread_mutex_lock (&store->write_lock);
+        if (store->active) {
+            flock (store->active->fd, LOCK_UN);
+            store->active->own = FALSE;
+            store->active = NULL;
+        }
+        pthread_mutex_unlock (&store->write_lock);
+        pack_store_unref (store);
+    }
+
+    path = g_build_filename (priv->pack_dir, store_id, NULL);
+    dir = g_dir_open (path, 0, NULL);
+    if (dir) {
+        while ((dname = g_dir_read_name (dir)) != NULL) {
+            char *file = g_build_filename (path, dname, NULL);
+            g_unlink (file);
+            g_free (file);
+        }
+        g_dir_close (dir);
+        g_rmdir (path);
+    }
+    g_free (path);
+
+    return priv->loose->remove_store (priv->loose, store_id);
+}
+
+typedef struct PackLooseData {
+    ObjBackend  *bend;
+    PackStore   *store;
+    gboolean     remove_loose;
+    GPtrArray   *pending; // 已写入打包文件但尚未删除的松散对象
+    gint64       n_packed;
+    int          error;
+} PackLooseData;
+
+/* Make packed objects durable, then remove their loose copies. */
+static int // 提交一批已打包的对象
+flush_pending_loose (PackLooseData *data)
+{
+    PackPriv *priv = data->bend->priv;
+    PackStore *store = data->store;
+    guint i;
+    int ret = 0;
+
+    pthread_mutex_lock (&store->write_lock);
+    if (store->active && fsync (store->active->fd) < 0) {
+        seaf_warning ("[pack backend] Failed to fsync %s: %s.\n",
+                      store->active->path, strerror(errno));
+        ret = -1;
+    }
+    pthread_mutex_unlock (&store->write_lock);
+
+    if (ret == 0 && data->remove_loose) {
+        for (i = 0; i < data->pending->len; ++i)
+            priv->loose->delete (priv->loose, store->store_id, 1,
+                                 g_ptr_array_index (data->pending, i));
+    }
+
+    g_ptr_array_set_size (data->pending, 0);
+    return ret;
+}
+
+static gboolean
+pack_loose_obj_cb (const char *repo_id, int version,
+                   const char *obj_id, void *user_data)
+{
+    PackLooseData *data = user_data;
+    PackPriv *priv = data->bend->priv;
+    unsigned char id[20];
+    IndexEntry entry;
+    void *buf = NULL;
+    int len;
+
+    hex_to_rawdata (obj_id, id, 20);
+    if (!pack_store_find (data->store, id, FIND_NO_REFRESH, NULL, &entry)) {
+        if (priv->loose->read (priv->loose, repo_id, version, obj_id, &buf, &len) < 0) {
+            seaf_warning ("[pack backend] Failed to read loose obj %s:%s.\n",
+                          repo_id, obj_id);
+            data->error = -1;
+            return TRUE;
+        }
+        if (pack_store_append (priv, data->store, id, buf, (guint32)len, FALSE) < 0) {
+            g_free (buf);
+            data->error = -1;
+            return FALSE;
+        }
+        g_free (buf);
+        ++data->n_packed;
+    }
+
+    g_ptr_array_add (data->pending, g_strdup (obj_id));
+    if (data->pending->len >= 1000 && flush_pending_loose (data) < 0) {
+        data->error = -1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Move all loose objects of @store_id into packs. Readers keep working
+ * while this runs: loose files are removed only after the packed copies
+ * are on disk. The last pack is sealed at the end.
+ */
+static int // 将松散对象迁移到打包文件中
+obj_backend_pack_pack_loose_objs (ObjBackend *bend,
+                                  const char *store_id,
+                                  gboolean remove_loose,
+                                  gint64 *n_packed)
+{
+    PackPriv *priv = bend->priv;
+    PackLooseData data;
+
+    memset (&data, 0, sizeof(data));
+    data.bend = bend;
+    data.store = get_pack_store (priv, store_id);
+    data.remove_loose = remove_loose;
+    data.pending = g_ptr_array_new_with_free_func (g_free);
+
+    priv->loose->foreach_obj (priv->loose, store_id, 1, pack_loose_obj_cb, &data);
+
+    if (data.error == 0 && flush_pending_loose (&data) < 0)
+        data.error = -1;
+
+    pthread_mutex_lock (&data.store->write_lock);
+    if (data.error == 0 && seal_active_pack (data.store) < 0)
+        data.error = -1;
+    pthread_mutex_unlock (&data.store->write_lock);
+
+    /* Seal packs left over by writers that are gone. */
+    pthread_rwlock_wrlock (&data.store->lock);
+    data.store->dir_mtime = -1;
+    pack_store_refresh (data.store);
+    pthread_rwlock_unlock (&data.store->lock);
+
+    if (n_packed)
+        *n_packed = data.n_packed;
+
+    g_ptr_array_free (data.pending, TRUE);
+    pack_store_unref (data.store);
+    return data.error;
+}
+
+/* Repack. */
+
+/* Returns the position of @pack in store->packs, or -1. */
+static int
+pack_store_index_of (PackStore *store, Pack *pack)
+{
+    guint i;
+
+    for (i = 0; i < store->packs->len; ++i) {
+        if (g_ptr_array_index (store->packs, i) == pack)
+            return (int)i;
+    }
+    return -1;
+}
+
+/*
+ * Collect the records of sealed @pack that are still needed: records that
+ * are the newest for their id, except tombstones that no older pack has a
+ * record to hide. Returns the size of these records, or -1 if @pack is no
+ * longer in the store.
+ */
+static gint64 // 收集打包文件中仍需要保留的记录
+collect_live_records (PackStore *store, Pack *pack, GArray *live)
+{
+    IndexEntry entry, newest;
+    Pack *older;
+    gint64 live_size = 0;
+    guint32 i;
+    int pos, j;
+    gboolean needed;
+
+    pthread_rwlock_rdlock (&store->lock);
+
+    pos = pack_store_index_of (store, pack);
+    if (pos < 0) {
+        pthread_rwlock_unlock (&store->lock);
+        return -1;
+    }
+
+    for (i = 0; i < pack->n_entries; ++i) {
+        memcpy (entry.id, pack->entries[i].id, 20);
+        entry.len = ntohl (pack->entries[i].len);
+        entry.offset = GUINT64_FROM_BE (pack->entries[i].offset);
+
+        if (pack_store_lookup_record (store, entry.id, &newest) != pack)
+            continue;
+
+        needed = TRUE;
+        if (entry.len == PACK_TOMBSTONE) {
+            needed = FALSE;
+            for (j = 0; j < pos && !needed; ++j) {
+                older = g_ptr_array_index (store->packs, j);
+                needed = (pack_lookup (older, entry.id, &newest) != NULL);
+            }
+        }
+        if (!needed)
+            continue;
+
+        g_array_append_val (live, entry);
+        live_size += RECORD_HEADER_SIZE +
+            (entry.len == PACK_TOMBSTONE ? 0 : entry.len);
+    }
+
+    pthread_rwlock_unlock (&store->lock);
+    return live_size;
+}
+
+static int
+compare_entry_offsets (const void *a, const void *b)
+{
+    guint64 oa = ((const IndexEntry *)a)->offset, ob = ((const IndexEntry *)b)->offset;
+    return (oa > ob) - (oa < ob);
+}
+
+/* [name] or [name].[time] -> [name].[now] */
+static char * // 重写后的打包文件名
+repacked_name (const char *name)
+{
+    const char *dot = strchr (name, '.');
+    int base_len = dot ? (int)(dot - name) : (int)strlen(name);
+
+    return g_strdup_printf ("%.*s.%016"G_GINT64_MODIFIER"x",
+                            base_len, name, g_get_real_time());
+}
+
+/*
+ * Write the @live records of @pack into a new sealed pack that replaces
+ * it. The new pack is complete, with its index, before it becomes visible.
+ */
+static int // 将仍需要的记录写入新的打包文件
+write_repacked_pack (PackStore *store, Pack *pack, GArray *live)
+{
+    Pack *new_pack;
+    IndexEntry *e;
+    char header[PACK_HEADER_SIZE];
+    guint32 version = htonl (PACK_VERSION);
+    guint32 len_n, data_len;
+    char *buf = NULL, *tmp_path, *idx_path = NULL;
+    guint i;
+    int ret = 0;
+
+    g_array_sort (live, compare_entry_offsets);
+
+    new_pack = g_new0 (Pack, 1);
+    new_pack->name = repacked_name (pack->name);
+    new_pack->path = g_strdup_printf ("%s/%s.pack", store->dir, new_pack->name);
+    new_pack->ref_count = 1;
+    new_pack->table = g_hash_table_new_full (raw_id_hash, raw_id_equal, NULL, g_free);
+
+    tmp_path = g_strconcat (new_pack->path, ".tmp", NULL);
+    new_pack->fd = open (tmp_path, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (new_pack->fd < 0) {
+        seaf_warning ("[pack backend] Failed to create %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    memcpy (header, PACK_MAGIC, 8);
+    memcpy (header + 8, &version, 4);
+    if (writen (new_pack->fd, header, PACK_HEADER_SIZE) < 0)
+        goto write_error;
+    new_pack->size = PACK_HEADER_SIZE;
+
+    for (i = 0; i < live->len; ++i) {
+        e = &g_array_index (live, IndexEntry, i);
+        data_len = (e->len == PACK_TOMBSTONE) ? 0 : e->len;
+
+        buf = g_realloc (buf, RECORD_HEADER_SIZE + data_len);
+        memcpy (buf, e->id, 20);
+        len_n = htonl (e->len);
+        memcpy (buf + 20, &len_n, 4);
+        if (data_len > 0 &&
+            pread (pack->fd, buf + RECORD_HEADER_SIZE, data_len, e->offset) != data_len) {
+            seaf_warning ("[pack backend] Failed to read %s: %s.\n",
+                          pack->path, strerror(errno));
+            ret = -1;
+            goto out;
+        }
+        if (writen (new_pack->fd, buf, RECORD_HEADER_SIZE + data_len) < 0)
+            goto write_error;
+
+        pack_table_insert (new_pack, e->id, e->len, new_pack->size + RECORD_HEADER_SIZE);
+        new_pack->size += RECORD_HEADER_SIZE + data_len;
+    }
+
+    if (fsync (new_pack->fd) < 0)
+        goto write_error;
+
+    idx_path = index_path (new_pack);
+    if (pack_write_index (new_pack) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    if (g_rename (tmp_path, new_pack->path) < 0) {
+        seaf_warning ("[pack backend] Failed to rename %s: %s.\n",
+                      tmp_path, strerror(errno));
+        g_unlink (idx_path);
+        ret = -1;
+        goto out;
+    }
+
+    goto out;
+
+write_error:
+    seaf_warning ("[pack backend] Failed to write %s: %s.\n",
+                  tmp_path, strerror(errno));
+    ret = -1;
+
+out:
+    if (ret < 0 && new_pack->fd >= 0)
+        g_unlink (tmp_path);
+    pack_free (new_pack);
+    g_free (buf);
+    g_free (tmp_path);
+    g_free (idx_path);
+    return ret;
+}
+
+/*
+ * Replace @pack if less than REPACK_MIN_LIVE_RATIO percent of it is still
+ * needed. The space freed is added to @freed.
+ */
+static int // 重写一个打包文件
+repack_pack (PackStore *store, Pack *pack, gint64 *freed)
+{
+    GArray *live;
+    gint64 live_size, total;
+    char *idx_path;
+    int ret = 0;
+
+    live = g_array_new (FALSE, FALSE, sizeof(IndexEntry));
+    live_size = collect_live_records (store, pack, live);
+
+    total = pack->size - PACK_HEADER_SIZE;
+    if (live_size < 0 || total <= 0 ||
+        live_size * 100 >= total * REPACK_MIN_LIVE_RATIO)
+        goto out;
+
+    /* A pack without live records, e.g. one left by an interrupted repack
+     * next to its replacement, is just removed.
+     */
+    if (live->len > 0 && write_repacked_pack (store, pack, live) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    /* The replacement takes over from here. Readers that still have the old
+     * pack open keep reading it until they refresh.
+     */
+    idx_path = index_path (pack);
+    if (g_unlink (pack->path) < 0)
+        seaf_warning ("[pack backend] Failed to remove %s: %s.\n",
+                      pack->path, strerror(errno));
+    g_unlink (idx_path);
+    g_free (idx_path);
+
+    *freed += total - live_size;
+
+    pthread_rwlock_wrlock (&store->lock);
+    store->dir_mtime = -1;
+    pack_store_refresh (store);
+    pthread_rwlock_unlock (&store->lock);
+
+out:
+    g_array_free (live, TRUE);
+    return ret;
+}
+
+/*
+ * Rewrite the sealed packs of @store_id that are mostly dead records:
+ * records shadowed by newer ones and tombstones of deleted objects. Packs
+ * are handled from oldest to newest, so tombstones whose object was dropped
+ * from an older pack are dropped too. Only one process repacks a store at
+ * a time; the store dir is flock'ed meanwhile.
+ */
+static int // 回收打包文件中已删除或被覆盖的记录占用的空间
+obj_backend_pack_repack (ObjBackend *bend,
+                         const char *store_id,
+                         gint64 *n_freed)
+{
+    PackPriv *priv = bend->priv;
+    PackStore *store;
+    GPtrArray *packs;
+    Pack *pack;
+    gint64 freed = 0;
+    guint i;
+    int dir_fd;
+    int ret = 0;
+
+    if (n_freed)
+        *n_freed = 0;
+
+    store = get_pack_store (priv, store_id);
+
+    dir_fd = open (store->dir, O_RDONLY);
+    if (dir_fd < 0) {
+        /* No packs yet. */
+        pack_store_unref (store);
+        return 0;
+    }
+    if (flock (dir_fd, LOCK_EX | LOCK_NB) < 0) {
+        seaf_warning ("[pack backend] %s is being repacked by another process.\n",
+                      store_id);
+        close (dir_fd);
+        pack_store_unref (store);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock (&store->lock);
+    store->dir_mtime = -1;
+    pack_store_refresh (store);
+    packs = g_ptr_array_new_with_free_func ((GDestroyNotify)pack_unref);
+    for (i = 0; i < store->packs->len; ++i) {
+        pack = g_ptr_array_index (store->packs, i);
+        /* Unsealed packs may still be appended to. */
+        if (!pack->table)
+            g_ptr_array_add (packs, pack_ref (pack));
+    }
+    pthread_rwlock_unlock (&store->lock);
+
+    for (i = 0; i < packs->len; ++i) {
+        pack = g_ptr_array_index (packs, i);
+        if (repack_pack (store, pack, &freed) < 0) {
+            seaf_warning ("[pack backend] Failed to repack %s.\n", pack->path);
+            ret = -1;
+        }
+    }
+
+    if (n_freed)
+        *n_freed = freed;
+
+    g_ptr_array_free (packs, TRUE);
+    flock (dir_fd, LOCK_UN);
+    close (dir_fd);
+    pack_store_unref (store);
+    return ret;
+}
+
+ObjBackend * // 创建新的后台结构体
+obj_backend_pack_new (const char *seaf_dir, const char *obj_type,
+                      gint64 max_pack_size)
+{
+    ObjBackend *bend;
+    PackPriv *priv;
+    char *dir_name;
+
+    bend = g_new0 (ObjBackend, 1);
+    priv = g_new0 (PackPriv, 1);
+    bend->priv = priv;
+
+    dir_name = g_strconcat (obj_type, "-packs", NULL);
+    priv->pack_dir = g_build_filename (seaf_dir, "storage", dir_name, NULL);
+    g_free (dir_name);
+    priv->max_pack_size = max_pack_size > 0 ? max_pack_size : DEFAULT_MAX_PACK_SIZE;
+
+    if (g_mkdir_with_parents (priv->pack_dir, 0777) < 0) {
+        seaf_warning ("[Obj Backend] Pack dir %s does not exist and"
+                      " is unable to create\n", priv->pack_dir);
+        goto onerror;
+    }
+
+    priv->loose = obj_backend_fs_new (seaf_dir, obj_type);
+    if (!priv->loose)
+        goto onerror;
+
+    pthread_mutex_init (&priv->lock, NULL);
+    priv->stores = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          NULL, (GDestroyNotify)pack_store_unref);
+
+    bend->read = obj_backend_pack_read;
+    bend->write = obj_backend_pack_write;
+    bend->exists = obj_backend_pack_exists;
+    bend->exists_many = obj_backend_pack_exists_many;
+    bend->delete = obj_backend_pack_delete;
+    bend->foreach_obj = obj_backend_pack_foreach_obj;
+    bend->copy = obj_backend_pack_copy;
+    bend->remove_store = obj_backend_pack_remove_store;
+    bend->pack_loose_objs = obj_backend_pack_pack_loose_objs;
+    bend->repack = obj_backend_pack_repack;
+
+    return bend;
+
+onerror:
+    g_free (priv->pack_dir);
+    g_free (priv);
+    g_free (bend);
+
+    return NULL;
+}
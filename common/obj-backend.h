@@ -31,6 +31,14 @@ struct ObjBackend { // 后台结构体，封装了需要的函数
                            int version,
                            const char *obj_id); // 存在
 
+    /* Optional. Sets exists[i] for each of the @n_ids objects in @obj_ids. */
+    int         (*exists_many) (ObjBackend *bend,
+                                const char *repo_id,
+                                int version,
+                                const char **obj_ids,
+                                int n_ids,
+                                gboolean *exists); // 批量判断存在
+
     void        (*delete) (ObjBackend *bend,
                            const char *repo_id,
                            int version,
@@ -52,6 +60,17 @@ struct ObjBackend { // 后台结构体，封装了需要的函数
     int        (*remove_store) (ObjBackend *bend,
                                 const char *store_id); // 移除全部
 
+    /* Optional. Only implemented by backends that pack objects. */
+    int        (*pack_loose_objs) (ObjBackend *bend,
+                                   const char *store_id,
+                                   gboolean remove_loose,
+                                   gint64 *n_packed); // 迁移松散对象
+
+    /* Optional. Reclaims space of dead records in packs. */
+    int        (*repack) (ObjBackend *bend,
+                          const char *store_id,
+                          gint64 *n_freed); // 重写打包文件
+
     void *priv;
 };
 
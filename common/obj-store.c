@@ -19,6 +19,55 @@ typedef struct SeafObjStore SeafObjStore;
 extern ObjBackend * // 创建新的seafile对象后台
 obj_backend_fs_new (const char *seaf_dir, const char *obj_type);
 
+extern ObjBackend * // 创建新的打包文件对象后台
+obj_backend_pack_new (const char *seaf_dir, const char *obj_type,
+                      gint64 max_pack_size);
+
+/*
+ * [obj_backend]
+ * name = pack
+ * max_pack_size = 256 (MB)
+ *
+ * selects the pack backend for fs objects. Commits are few compared to fs
+ * objects, they're always stored as loose files.
+ */
+static ObjBackend * // 根据配置加载后台
+load_obj_backend (SeafileSession *seaf, const char *obj_type)
+{
+    char *backend;
+    gint64 max_pack_size;
+    GError *error = NULL;
+
+    backend = g_key_file_get_string (seaf->config, "obj_backend", "name", NULL);
+    if (!backend || strcmp (backend, "filesystem") == 0 ||
+        strcmp (obj_type, "fs") != 0) {
+        g_free (backend);
+        return obj_backend_fs_new (seaf->seaf_dir, obj_type);
+    }
+
+    if (strcmp (backend, "pack") != 0) {
+        seaf_warning ("Unknown object backend %s.\n", backend);
+        g_free (backend);
+        return NULL;
+    }
+    g_free (backend);
+
+    /* The Go fileserver reads fs objects from the loose layout directly. */
+    if (g_key_file_get_boolean (seaf->config, "fileserver", "use_go_fileserver", NULL)) {
+        seaf_warning ("Pack object backend can't be used with the go fileserver.\n");
+        return NULL;
+    }
+
+    max_pack_size = g_key_file_get_int64 (seaf->config, "obj_backend",
+                                          "max_pack_size", &error);
+    if (error) {
+        max_pack_size = 0;
+        g_clear_error (&error);
+    }
+
+    return obj_backend_pack_new (seaf->seaf_dir, obj_type, max_pack_size << 20);
+}
+
 struct SeafObjStore * // 创建
 seaf_obj_store_new (SeafileSession *seaf, const char *obj_type)
 {
@@ -27,7 +76,7 @@ seaf_obj_store_new (SeafileSession *seaf, const char *obj_type)
     if (!store)
         return NULL;
 
-    store->bend = obj_backend_fs_new (seaf->seaf_dir, obj_type); // 创建一个指定seafile目录、指定对象类型的后台（适配多端存储）
+    store->bend = load_obj_backend (seaf, obj_type); // 创建一个指定seafile目录、指定对象类型的后台（适配多端存储）
     if (!store->bend) {
         seaf_warning ("[Object store] Failed to load backend.\n");
         g_free (store);
@@ -93,6 +142,51 @@ seaf_obj_store_obj_exists (struct SeafObjStore *obj_store,
     return bend->exists (bend, repo_id, version, obj_id);
 }
 
+int // 批量判断存在
+seaf_obj_store_obj_exists_many (struct SeafObjStore *obj_store,
+                                const char *repo_id,
+                                int version,
+                                const char **obj_ids,
+                                int n_ids,
+                                gboolean *exists)
+{
+    ObjBackend *bend = obj_store->bend;
+    const char **valid_ids;
+    gboolean *valid_exists;
+    int n_valid = 0, i, j;
+    int ret;
+
+    memset (exists, 0, sizeof(gboolean) * n_ids);
+    if (!repo_id || !is_uuid_valid(repo_id))
+        return 0;
+
+    if (!bend->exists_many) {
+        for (i = 0; i < n_ids; ++i)
+            exists[i] = seaf_obj_store_obj_exists (obj_store, repo_id, version,
+                                                   obj_ids[i]);
+        return 0;
+    }
+
+    valid_ids = g_new (const char *, n_ids);
+    for (i = 0; i < n_ids; ++i) {
+        if (obj_ids[i] && is_object_id_valid (obj_ids[i]))
+            valid_ids[n_valid++] = obj_ids[i];
+    }
+
+    valid_exists = g_new0 (gboolean, n_valid);
+    ret = bend->exists_many (bend, repo_id, version, valid_ids, n_valid, valid_exists);
+    if (ret == 0) {
+        for (i = 0, j = 0; i < n_ids; ++i) {
+            if (obj_ids[i] && j < n_valid && obj_ids[i] == valid_ids[j])
+                exists[i] = valid_exists[j++];
+        }
+    }
+
+    g_free (valid_ids);
+    g_free (valid_exists);
+    return ret;
+}
+
 void // 删除，同上
 seaf_obj_store_delete_obj (struct SeafObjStore *obj_store,
                            const char *repo_id,
@@ -144,3 +238,34 @@ seaf_obj_store_remove_store (struct SeafObjStore *obj_store,
 
     return bend->remove_store (bend, store_id);
 }
+
+int // 将松散对象迁移到打包文件中
+seaf_obj_store_pack_loose_objs (struct SeafObjStore *obj_store,
+                                const char *store_id,
+                                gboolean remove_loose,
+                                gint64 *n_packed)
+{
+    ObjBackend *bend = obj_store->bend;
+
+    if (!bend->pack_loose_objs) {
+        seaf_warning ("Object backend doesn't support packing objects.\n");
+        return -1;
+    }
+
+    return bend->pack_loose_objs (bend, store_id, remove_loose, n_packed);
+}
+
+int // 回收打包文件中无用记录的空间
+seaf_obj_store_repack (struct SeafObjStore *obj_store,
+                       const char *store_id,
+                       gint64 *n_freed)
+{
+    ObjBackend *bend = obj_store->bend;
+
+    if (!bend->repack) {
+        seaf_warning ("Object backend doesn't support repacking objects.\n");
+        return -1;
+    }
+
+    return bend->repack (bend, store_id, n_freed);
+}
@@ -40,6 +40,18 @@ seaf_obj_store_obj_exists (struct SeafObjStore *obj_store,
                            int version,
                            const char *obj_id);
 
+/*
+ * Sets exists[i] for each of the @n_ids objects in @obj_ids. Backends that
+ * support it check the objects in one batch. Invalid ids don't exist.
+ */
+int // 批量判断是否存在
+seaf_obj_store_obj_exists_many (struct SeafObjStore *obj_store,
+                                const char *repo_id,
+                                int version,
+                                const char **obj_ids,
+                                int n_ids,
+                                gboolean *exists);
+
 void // 删除
 seaf_obj_store_delete_obj (struct SeafObjStore *obj_store,
                            const char *repo_id,
@@ -70,4 +82,25 @@ int // 移除整个存储
 seaf_obj_store_remove_store (struct SeafObjStore *obj_store,
                              const char *store_id);
 
+/*
+ * Move loose objects of @store_id into packs. Only supported by the pack
+ * backend. Loose files are removed after being packed if @remove_loose
+ * is TRUE. The number of objects packed is returned in @n_packed.
+ */
+int // 将松散对象迁移到打包文件中
+seaf_obj_store_pack_loose_objs (struct SeafObjStore *obj_store,
+                                const char *store_id,
+                                gboolean remove_loose,
+                                gint64 *n_packed);
+
+/*
+ * Rewrite packs of @store_id that are mostly deleted or overwritten
+ * objects. Only supported by the pack backend. The number of bytes freed
+ * is returned in @n_freed.
+ */
+int // 回收打包文件中无用记录的空间
+seaf_obj_store_repack (struct SeafObjStore *obj_store,
+                       const char *store_id,
+                       gint64 *n_freed);
+
 #endif
@@ -260,6 +260,30 @@ seafile_pop_event(const char *channel, GError **error)
     }
     return seaf_mq_manager_pop_event (seaf->mq_mgr, channel);
 }
+
+json_t *
+seafile_get_dir_cache_stats (GError **error)
+{
+    return seaf_fs_manager_get_dir_cache_stats (seaf->fs_mgr);
+}
+
+json_t *
+seafile_get_commit_cache_stats (GError **error)
+{
+    return seaf_commit_manager_get_cache_stats (seaf->commit_mgr);
+}
+
+json_t *
+seafile_get_db_pool_stats (GError **error)
+{
+    json_t *object = json_object ();
+
+    json_object_set_new (object, "seafile", seaf_db_get_pool_stats (seaf->db));
+    if (seaf->ccnet_db)
+        json_object_set_new (object, "ccnet", seaf_db_get_pool_stats (seaf->ccnet_db));
+
+    return object;
+}
 #endif
 
 GList*
@@ -4990,6 +5014,29 @@ ccnet_rpc_get_groups (const char *username, int return_ancestors, GError **error
     return ret;
 }
 
+json_t *
+ccnet_rpc_get_user_group_ids (const char *username, GError **error)
+{
+    GArray *ids;
+    json_t *array;
+    guint i;
+
+    if (!username) {
+        g_set_error (error, CCNET_DOMAIN, CCNET_ERR_INTERNAL,
+                     "User name can not be NULL");
+        return NULL;
+    }
+
+    ids = ccnet_group_manager_get_group_ids_by_user (seaf->group_mgr, username,
+                                                     TRUE, error);
+    array = json_array ();
+    for (i = 0; i < ids->len; ++i)
+        json_array_append_new (array, json_integer (g_array_index (ids, int, i)));
+    g_array_free (ids, TRUE);
+
+    return array;
+}
+
 GList *
 ccnet_rpc_list_all_departments (GError **error)
 {
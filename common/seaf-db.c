@@ -4,6 +4,7 @@
 #include "log.h"
 
 #include "seaf-db.h"
+#include "utils.h"
 
 #include <stdarg.h>
 #ifdef HAVE_MYSQL
@@ -12,10 +13,45 @@
 #include <sqlite3.h>
 #include <pthread.h>
 
+/* Histogram of durations: bucket 0 counts durations under 1us, bucket i
+ * those in [2^(i-1), 2^i) us. The last bucket takes everything longer. */
+#define POOL_HIST_BUCKETS 25
+
+typedef struct DBPoolStats { // 连接池统计，均以原子操作更新
+    guint64 checkouts; // 取出连接的次数
+    guint64 exhausted; // 因连接用尽而失败的次数
+    guint64 connects; // 新建连接的次数
+    guint64 pings; // 检测空闲连接的次数
+    guint64 failed_pings; // 检测失败（已断开）的次数
+    guint64 stmt_hits; // 复用缓存的预编译语句的次数
+    guint64 stmt_misses; // 新预编译语句的次数
+    guint64 stmt_evictions; // 因缓存已满而关闭的语句数
+    guint64 stmt_invalidations; // 因重连而清空语句缓存的次数
+    gint open_connections; // 当前打开的连接数
+    gint in_use; // 当前被取出的连接数
+    guint64 wait_hist[POOL_HIST_BUCKETS]; // 取出连接的耗时
+    guint64 hold_hist[POOL_HIST_BUCKETS]; // 连接被占用的时长
+} DBPoolStats;
+
+typedef struct DBConnSlot {
+    struct DBConnection *conn; // 尚未连接或连接已关闭时为NULL
+    guint32 next; // 空闲链表中下一个槽位的下标+1，0表示链表结束
+} DBConnSlot;
+
+/*
+ * Connections live in a fixed array of max_connections slots. The slots
+ * that aren't checked out form a lock-free LIFO free list, so checking a
+ * connection out or in is a single CAS, and the most recently used
+ * connections are reused first. A slot without connection is connected
+ * when checked out.
+ */
 struct DBConnPool { // 数据库连接池
-    GPtrArray *connections; // 连接池
-    pthread_mutex_t lock; // 锁
+    DBConnSlot *slots; // 连接槽位
     int max_connections; // 最大连接数
+    /* Low 32 bits: index+1 of the first free slot, 0 if none.
+     * High 32 bits: a counter bumped on every change, against ABA. */
+    guint64 free_head; // 空闲链表头
+    DBPoolStats stats;
 };
 typedef struct DBConnPool DBConnPool;
 
@@ -24,9 +60,30 @@ struct SeafDB { // 数据库
     DBConnPool *pool; // 连接池
 };
 
+/*
+ * Prepared statements of a connection, keyed by their SQL text, in LRU
+ * order. A statement is taken out of the cache while it runs, so nested
+ * queries on the same connection never share one.
+ */
+typedef struct DBStmtCache {
+    GHashTable *stmts; // sql -> DBCachedStmt，首次使用时创建
+    GQueue lru; // 头部为最近使用的
+    GDestroyNotify free_stmt; // 关闭驱动的语句
+    guint64 tag; // 由驱动解释，变化时缓存失效，如MySQL的连接线程id
+} DBStmtCache;
+
+typedef struct DBCachedStmt {
+    char *sql;
+    void *stmt;
+    GList link; // 在lru中的节点
+} DBCachedStmt;
+
 typedef struct DBConnection { // 数据库连接
-    gboolean is_available; // 空闲
     DBConnPool *pool; // 所在的连接池
+    int slot; // 所在的槽位，不使用连接池时为-1
+    gint64 last_used; // 上次归还的时间
+    gint64 checkout_time; // 本次取出的时间
+    DBStmtCache stmt_cache; // 预编译语句缓存
 } DBConnection;
 
 struct SeafDBRow { // 行，无实现的虚指针
@@ -39,6 +96,11 @@ struct SeafDBTrans { // 事务
 };
 
 typedef struct DBOperations { // 定义了抽象的数据库基本操作，隐藏了实现细节
+    /* Driver level, used by the connection pool. ping is optional. */
+    DBConnection* (*connect)(SeafDB *db);
+    void (*close)(DBConnection *conn);
+    gboolean (*ping)(DBConnection *conn);
+
     DBConnection* (*get_connection)(SeafDB *db);
     void (*release_connection)(DBConnection *conn, gboolean need_close);
     int (*execute_sql_no_stmt)(DBConnection *conn, const char *sql);
@@ -55,139 +117,382 @@ typedef struct DBOperations { // 定义了抽象的数据库基本操作，隐
 
 static DBOperations db_ops; // 静态对象，表示全局使用的数据库
 
-#ifdef HAVE_MYSQL // mysql操作定义，略
+// 连接池实现
 
-/* MySQL Ops */
-static SeafDB *
-mysql_db_new (const char *host,
-              int port,
-              const char *user,
-              const char *password,
-              const char *db_name,
-              const char *unix_socket,
-              gboolean use_ssl,
-              const char *charset);
-static DBConnection *
-mysql_db_get_connection (SeafDB *db);
-static void
-mysql_db_release_connection (DBConnection *vconn);
-static int
-mysql_db_execute_sql_no_stmt (DBConnection *vconn, const char *sql);
-static int
-mysql_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args);
-static int
-mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
-                            SeafDBRowFunc callback, void *data,
-                            int n, va_list args);
-static int
-mysql_db_row_get_column_count (SeafDBRow *row);
-static const char *
-mysql_db_row_get_column_string (SeafDBRow *row, int idx);
-static int
-mysql_db_row_get_column_int (SeafDBRow *row, int idx);
-static gint64
-mysql_db_row_get_column_int64 (SeafDBRow *row, int idx);
-static gboolean
-mysql_db_connection_ping (DBConnection *vconn);
+/* Connections idle longer than this are pinged before being handed out if
+ * the driver can, the server may have closed them. Busy connections are
+ * never pinged. */
+#define CONN_VALIDATE_INTERVAL (30 * G_USEC_PER_SEC)
 
-// mysql连接池实现
 static DBConnPool *
 init_conn_pool_common (int max_connections)
 {
     DBConnPool *pool = g_new0(DBConnPool, 1);
-    pool->connections = g_ptr_array_sized_new (max_connections);
-    pthread_mutex_init (&pool->lock, NULL);
+    int i;
+
     pool->max_connections = max_connections;
+    pool->slots = g_new0 (DBConnSlot, MAX (max_connections, 1));
+    for (i = 0; i < max_connections; ++i)
+        pool->slots[i].next = (i + 1 < max_connections) ? i + 2 : 0;
+    pool->free_head = max_connections > 0 ? 1 : 0;
 
     return pool;
 }
 
+static inline void
+stat_add (guint64 *counter, guint64 n)
+{
+    __atomic_fetch_add (counter, n, __ATOMIC_RELAXED);
+}
+
+static void
+hist_add (guint64 *hist, gint64 usec)
+{
+    int i = 0;
+
+    if (usec > 0)
+        i = 64 - __builtin_clzll ((guint64)usec);
+    if (i >= POOL_HIST_BUCKETS)
+        i = POOL_HIST_BUCKETS - 1;
+    stat_add (&hist[i], 1);
+}
+
+/* Returns the index of a free slot, or -1 if all are checked out. */
+static int // 从空闲链表取出一个槽位
+pool_pop_slot (DBConnPool *pool)
+{
+    guint64 head, new_head;
+    guint32 idx;
+
+    head = __atomic_load_n (&pool->free_head, __ATOMIC_ACQUIRE);
+    do {
+        idx = (guint32)head;
+        if (idx == 0)
+            return -1;
+        new_head = (((head >> 32) + 1) << 32) |
+            __atomic_load_n (&pool->slots[idx - 1].next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n (&pool->free_head, &head, new_head, TRUE,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return idx - 1;
+}
+
+static void // 将槽位放回空闲链表
+pool_push_slot (DBConnPool *pool, int slot)
+{
+    guint64 head, new_head;
+
+    head = __atomic_load_n (&pool->free_head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n (&pool->slots[slot].next, (guint32)head, __ATOMIC_RELAXED);
+        new_head = (((head >> 32) + 1) << 32) | (guint32)(slot + 1);
+    } while (!__atomic_compare_exchange_n (&pool->free_head, &head, new_head, TRUE,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static DBConnection * // 新建连接
+pool_connect (SeafDB *db, int slot)
+{
+    DBConnPool *pool = db->pool;
+    DBConnection *conn;
+
+    conn = db_ops.connect (db);
+    if (!conn)
+        return NULL;
+
+    conn->pool = pool;
+    conn->slot = slot;
+    stat_add (&pool->stats.connects, 1);
+    __atomic_fetch_add (&pool->stats.open_connections, 1, __ATOMIC_RELAXED);
+
+    return conn;
+}
+
+static void // 关闭连接
+pool_close (DBConnection *conn)
+{
+    DBConnPool *pool = conn->pool;
+
+    __atomic_fetch_sub (&pool->stats.open_connections, 1, __ATOMIC_RELAXED);
+    db_ops.close (conn);
+}
+
 static DBConnection *
-mysql_conn_pool_get_connection (SeafDB *db)
+conn_pool_get_connection (SeafDB *db)
 {
     DBConnPool *pool = db->pool;
     DBConnection *conn = NULL;
+    gint64 start, now;
+    int slot;
+
+    start = g_get_monotonic_time ();
 
     if (pool->max_connections == 0) {
-        conn = mysql_db_get_connection (db);
-        conn->pool = pool;
-        return conn;
+        conn = pool_connect (db, -1);
+        goto out;
     }
 
-    pthread_mutex_lock (&pool->lock);
+    slot = pool_pop_slot (pool);
+    if (slot < 0) {
+        stat_add (&pool->stats.exhausted, 1);
+        return NULL;
+    }
 
-    guint i, size = pool->connections->len;
-    for (i = 0; i < size; ++i) {
-        conn = g_ptr_array_index (pool->connections, i);
-        if (conn->is_available && mysql_db_connection_ping (conn)) {
-            conn->is_available = FALSE;
-            goto out;
+    /* The slot is ours until it's pushed back. */
+    conn = pool->slots[slot].conn;
+    if (conn && db_ops.ping && start - conn->last_used > CONN_VALIDATE_INTERVAL) {
+        stat_add (&pool->stats.pings, 1);
+        if (!db_ops.ping (conn)) {
+            stat_add (&pool->stats.failed_pings, 1);
+            pool_close (conn);
+            conn = NULL;
         }
     }
-    conn = NULL;
-    if (size < pool->max_connections) {
-        conn = mysql_db_get_connection (db);
-        if (conn) {
-            conn->pool = pool;
-            conn->is_available = FALSE;
-            g_ptr_array_add (pool->connections, conn);
+
+    if (!conn) {
+        conn = pool_connect (db, slot);
+        pool->slots[slot].conn = conn;
+        if (!conn) {
+            pool_push_slot (pool, slot);
+            return NULL;
         }
     }
 
 out:
-    pthread_mutex_unlock (&pool->lock);
+    if (!conn)
+        return NULL;
+
+    now = g_get_monotonic_time ();
+    conn->checkout_time = now;
+    stat_add (&pool->stats.checkouts, 1);
+    __atomic_fetch_add (&pool->stats.in_use, 1, __ATOMIC_RELAXED);
+    hist_add (pool->stats.wait_hist, now - start);
+
     return conn;
 }
 
 static void
-mysql_conn_pool_release_connection (DBConnection *conn, gboolean need_close)
+conn_pool_release_connection (DBConnection *conn, gboolean need_close)
 {
+    DBConnPool *pool;
+    gint64 now;
+    int slot;
+
     if (!conn)
         return;
 
-    if (conn->pool->max_connections == 0) {
-        mysql_db_release_connection (conn);
+    pool = conn->pool;
+    now = g_get_monotonic_time ();
+    __atomic_fetch_sub (&pool->stats.in_use, 1, __ATOMIC_RELAXED);
+    hist_add (pool->stats.hold_hist, now - conn->checkout_time);
+
+    slot = conn->slot;
+    if (slot < 0) {
+        pool_close (conn);
         return;
     }
 
     if (need_close) {
-        pthread_mutex_lock (&conn->pool->lock);
-        g_ptr_array_remove (conn->pool->connections, conn);
-        pthread_mutex_unlock (&conn->pool->lock);
-        mysql_db_release_connection (conn);
-        return;
+        pool_close (conn);
+        pool->slots[slot].conn = NULL;
+    } else {
+        conn->last_used = now;
     }
 
-    pthread_mutex_lock (&conn->pool->lock);
-    conn->is_available = TRUE;
-    pthread_mutex_unlock (&conn->pool->lock);
+    pool_push_slot (pool, slot);
 }
 
-#define KEEPALIVE_INTERVAL 30
-static void *
-mysql_conn_keepalive (void *arg) // 利用互斥锁检查数据库连接；每30s执行一次
+static void
+hist_to_json (json_t *object, const char *key, guint64 *hist)
 {
-    DBConnPool *pool = arg;
-    DBConnection *conn = NULL;
+    json_t *array = json_array ();
+    json_t *bucket;
+    guint64 count;
+    int i;
 
-    while (1) {
-        pthread_mutex_lock (&pool->lock);
+    /* [upper bound in us, count] for non-empty buckets; the last bucket
+     * has no upper bound and is reported with -1. */
+    for (i = 0; i < POOL_HIST_BUCKETS; ++i) {
+        count = __atomic_load_n (&hist[i], __ATOMIC_RELAXED);
+        if (count == 0)
+            continue;
+        bucket = json_array ();
+        json_array_append_new (bucket, json_integer (i < POOL_HIST_BUCKETS - 1 ?
+                                                     (json_int_t)1 << i : -1));
+        json_array_append_new (bucket, json_integer (count));
+        json_array_append_new (array, bucket);
+    }
 
-        guint i, size = pool->connections->len;
-        for (i = 0; i < size; ++i) {
-            conn = g_ptr_array_index (pool->connections, i);
-            if (conn->is_available) {
-                mysql_db_connection_ping (conn);
-            }
-        }
-        pthread_mutex_unlock (&pool->lock);
+    json_object_set_new (object, key, array);
+}
+
+static json_t *
+conn_pool_get_stats (DBConnPool *pool)
+{
+    DBPoolStats *stats = &pool->stats;
+    json_t *object = json_object ();
+
+    json_object_set_int_member (object, "max_connections", pool->max_connections);
+    json_object_set_int_member (object, "open_connections",
+                                __atomic_load_n (&stats->open_connections, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "in_use",
+                                __atomic_load_n (&stats->in_use, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "checkouts",
+                                __atomic_load_n (&stats->checkouts, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "exhausted",
+                                __atomic_load_n (&stats->exhausted, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "connects",
+                                __atomic_load_n (&stats->connects, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "pings",
+                                __atomic_load_n (&stats->pings, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "failed_pings",
+                                __atomic_load_n (&stats->failed_pings, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "stmt_cache_hits",
+                                __atomic_load_n (&stats->stmt_hits, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "stmt_cache_misses",
+                                __atomic_load_n (&stats->stmt_misses, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "stmt_cache_evictions",
+                                __atomic_load_n (&stats->stmt_evictions, __ATOMIC_RELAXED));
+    json_object_set_int_member (object, "stmt_cache_invalidations",
+                                __atomic_load_n (&stats->stmt_invalidations, __ATOMIC_RELAXED));
+    hist_to_json (object, "wait_time_us", stats->wait_hist);
+    hist_to_json (object, "hold_time_us", stats->hold_hist);
+
+    return object;
+}
+
+// 预编译语句缓存
+
+/* Per connection. Seafile issues a few dozen distinct statements, most of
+ * them on hot paths. */
+#define STMT_CACHE_SIZE 64
+
+static void
+cached_stmt_free (DBStmtCache *cache, DBCachedStmt *cached)
+{
+    if (cached->stmt)
+        cache->free_stmt (cached->stmt);
+    g_free (cached->sql);
+    g_free (cached);
+}
+
+/* Closes all statements, e.g. before the connection is closed. */
+static void // 清空语句缓存
+stmt_cache_clear (DBStmtCache *cache)
+{
+    GList *link;
+
+    /* The links are embedded in the statements, don't let GQueue free them. */
+    while ((link = g_queue_pop_head_link (&cache->lru)) != NULL)
+        cached_stmt_free (cache, link->data);
+    if (cache->stmts) {
+        g_hash_table_destroy (cache->stmts);
+        cache->stmts = NULL;
+    }
+}
+
+/*
+ * Returns the cached statement of @sql, or NULL if the driver must prepare
+ * a new one. The statement belongs to the caller until it's put back with
+ * stmt_cache_put(). @tag is compared with the tag the cached statements
+ * were prepared under; if it changed, they are all dropped.
+ */
+static void * // 取出缓存的语句
+stmt_cache_take (DBConnection *conn, const char *sql, guint64 tag)
+{
+    DBStmtCache *cache = &conn->stmt_cache;
+    DBCachedStmt *cached;
+    void *stmt;
+
+    if (cache->tag != tag) {
+        if (cache->stmts && g_hash_table_size (cache->stmts) > 0)
+            stat_add (&conn->pool->stats.stmt_invalidations, 1);
+        stmt_cache_clear (cache);
+        cache->tag = tag;
+    }
 
-        sleep (KEEPALIVE_INTERVAL);
+    cached = cache->stmts ? g_hash_table_lookup (cache->stmts, sql) : NULL;
+    if (!cached) {
+        stat_add (&conn->pool->stats.stmt_misses, 1);
+        return NULL;
+    }
+
+    stat_add (&conn->pool->stats.stmt_hits, 1);
+    g_hash_table_remove (cache->stmts, sql);
+    g_queue_unlink (&cache->lru, &cached->link);
+    stmt = cached->stmt;
+    cached->stmt = NULL;
+    cached_stmt_free (cache, cached);
+
+    return stmt;
+}
+
+/* Puts @stmt, reset by the driver, back as the most recently used. */
+static void // 放回语句
+stmt_cache_put (DBConnection *conn, const char *sql, void *stmt)
+{
+    DBStmtCache *cache = &conn->stmt_cache;
+    DBCachedStmt *cached;
+
+    if (!cache->stmts)
+        cache->stmts = g_hash_table_new (g_str_hash, g_str_equal);
+
+    /* A nested query of the same sql has put its own one back. */
+    if (g_hash_table_lookup (cache->stmts, sql)) {
+        cache->free_stmt (stmt);
+        return;
     }
 
-    return NULL;
+    cached = g_new0 (DBCachedStmt, 1);
+    cached->sql = g_strdup (sql);
+    cached->stmt = stmt;
+    cached->link.data = cached;
+    g_hash_table_insert (cache->stmts, cached->sql, cached);
+    g_queue_push_head_link (&cache->lru, &cached->link);
+
+    while (cache->lru.length > STMT_CACHE_SIZE) {
+        cached = g_queue_pop_tail_link (&cache->lru)->data;
+        g_hash_table_remove (cache->stmts, cached->sql);
+        cached_stmt_free (cache, cached);
+        stat_add (&conn->pool->stats.stmt_evictions, 1);
+    }
 }
 
+#ifdef HAVE_MYSQL // mysql操作定义，略
+
+/* MySQL Ops */
+static SeafDB *
+mysql_db_new (const char *host,
+              int port,
+              const char *user,
+              const char *password,
+              const char *db_name,
+              const char *unix_socket,
+              gboolean use_ssl,
+              const char *charset);
+static DBConnection *
+mysql_db_get_connection (SeafDB *db);
+static void
+mysql_db_release_connection (DBConnection *vconn);
+static int
+mysql_db_execute_sql_no_stmt (DBConnection *vconn, const char *sql);
+static int
+mysql_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args);
+static int
+mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
+                            SeafDBRowFunc callback, void *data,
+                            int n, va_list args);
+static int
+mysql_db_row_get_column_count (SeafDBRow *row);
+static const char *
+mysql_db_row_get_column_string (SeafDBRow *row, int idx);
+static int
+mysql_db_row_get_column_int (SeafDBRow *row, int idx);
+static gint64
+mysql_db_row_get_column_int64 (SeafDBRow *row, int idx);
+static gboolean
+mysql_db_connection_ping (DBConnection *vconn);
+
 SeafDB *
 seaf_db_new_mysql (const char *host,
                    int port,
@@ -206,8 +511,11 @@ seaf_db_new_mysql (const char *host,
         return NULL;
     db->type = SEAF_DB_TYPE_MYSQL;
 
-    db_ops.get_connection = mysql_conn_pool_get_connection;
-    db_ops.release_connection = mysql_conn_pool_release_connection;
+    db_ops.connect = mysql_db_get_connection;
+    db_ops.close = mysql_db_release_connection;
+    db_ops.ping = mysql_db_connection_ping;
+    db_ops.get_connection = conn_pool_get_connection;
+    db_ops.release_connection = conn_pool_release_connection;
     db_ops.execute_sql_no_stmt = mysql_db_execute_sql_no_stmt;
     db_ops.execute_sql = mysql_db_execute_sql;
     db_ops.query_foreach_row = mysql_db_query_foreach_row;
@@ -218,14 +526,6 @@ seaf_db_new_mysql (const char *host,
 
     db->pool = init_conn_pool_common (max_connections);
 
-    pthread_t tid;
-    int ret = pthread_create (&tid, NULL, mysql_conn_keepalive, db->pool);
-    if (ret != 0) {
-        seaf_warning ("Failed to create mysql connection keepalive thread.\n");
-        return NULL;
-    }
-    pthread_detach (tid);
-
     return db;
 }
 
@@ -238,7 +538,7 @@ sqlite_db_new (const char *db_path);
 static DBConnection *
 sqlite_db_get_connection (SeafDB *db);
 static void
-sqlite_db_release_connection (DBConnection *vconn, gboolean need_close);
+sqlite_db_release_connection (DBConnection *vconn);
 static int
 sqlite_db_execute_sql_no_stmt (DBConnection *vconn, const char *sql);
 static int
@@ -266,8 +566,13 @@ seaf_db_new_sqlite (const char *db_path, int max_connections)
         return NULL;
     db->type = SEAF_DB_TYPE_SQLITE;
     // 全局使用sqlite数据库
-    db_ops.get_connection = sqlite_db_get_connection;
-    db_ops.release_connection = sqlite_db_release_connection;
+    /* Connections are pooled like MySQL ones, so that their prepared
+     * statements are kept. SQLite connections don't need pings. */
+    db_ops.connect = sqlite_db_get_connection;
+    db_ops.close = sqlite_db_release_connection;
+    db_ops.ping = NULL;
+    db_ops.get_connection = conn_pool_get_connection;
+    db_ops.release_connection = conn_pool_release_connection;
     db_ops.execute_sql_no_stmt = sqlite_db_execute_sql_no_stmt;
     db_ops.execute_sql = sqlite_db_execute_sql;
     db_ops.query_foreach_row = sqlite_db_query_foreach_row;
@@ -276,6 +581,8 @@ seaf_db_new_sqlite (const char *db_path, int max_connections)
     db_ops.row_get_column_int = sqlite_db_row_get_column_int;
     db_ops.row_get_column_int64 = sqlite_db_row_get_column_int64;
 
+    db->pool = init_conn_pool_common (max_connections);
+
     return db;
 }
 
@@ -287,6 +594,17 @@ seaf_db_type (SeafDB *db)
     return db->type;
 }
 
+json_t *
+seaf_db_get_pool_stats (SeafDB *db)
+{
+    json_t *object;
+
+    object = conn_pool_get_stats (db->pool);
+    json_object_set_string_member (object, "type",
+                                   db->type == SEAF_DB_TYPE_MYSQL ? "mysql" : "sqlite");
+    return object;
+}
+
 int // 查询，非预编译
 seaf_db_query (SeafDB *db, const char *sql)
 {
@@ -703,6 +1021,12 @@ mysql_db_new (const char *host,
 
 typedef char my_bool;
 
+static void
+mysql_stmt_free (gpointer stmt)
+{
+    mysql_stmt_close (stmt);
+}
+
 static DBConnection *
 mysql_db_get_connection (SeafDB *vdb)
 {
@@ -737,6 +1061,7 @@ mysql_db_get_connection (SeafDB *vdb)
 
     conn = g_new0 (MySQLDBConnection, 1);
     conn->db_conn = db_conn;
+    conn->parent.stmt_cache.free_stmt = mysql_stmt_free;
 
     return (DBConnection *)conn;
 }
@@ -749,6 +1074,7 @@ mysql_db_release_connection (DBConnection *vconn)
 
     MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
 
+    stmt_cache_clear (&vconn->stmt_cache);
     mysql_close (conn->db_conn);
 
     g_free (conn);
@@ -787,6 +1113,38 @@ _prepare_stmt_mysql (MYSQL *db, const char *sql)
     return stmt;
 }
 
+/* Takes the statement of @sql from the cache of @conn, or prepares it. */
+static MYSQL_STMT * // 获取预编译语句
+get_stmt_mysql (MySQLDBConnection *conn, const char *sql)
+{
+    MYSQL_STMT *stmt;
+
+    /* MYSQL_OPT_RECONNECT may have reconnected silently, which drops the
+     * statements on the server. A new connection has a new thread id. */
+    stmt = stmt_cache_take ((DBConnection *)conn, sql,
+                            mysql_thread_id (conn->db_conn));
+    if (stmt)
+        return stmt;
+
+    return _prepare_stmt_mysql (conn->db_conn, sql);
+}
+
+/* Keeps @stmt for the next query of @sql if it ran successfully. */
+static void // 归还预编译语句
+put_stmt_mysql (MySQLDBConnection *conn, const char *sql, MYSQL_STMT *stmt,
+                gboolean success)
+{
+    if (!success) {
+        mysql_stmt_close (stmt);
+        return;
+    }
+
+    /* Discards unread rows; parameters and results are bound again on
+     * every execution, so no reset round trip is needed. */
+    mysql_stmt_free_result (stmt);
+    stmt_cache_put ((DBConnection *)conn, sql, stmt);
+}
+
 static int
 _bind_params_mysql (MYSQL_STMT *stmt, MYSQL_BIND *params, int n, va_list args)
 {
@@ -842,12 +1200,11 @@ static int
 mysql_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args)
 {
     MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
-    MYSQL *db = conn->db_conn;
     MYSQL_STMT *stmt = NULL;
     MYSQL_BIND *params = NULL;
     int ret = 0;
 
-    stmt = _prepare_stmt_mysql (db, sql);
+    stmt = get_stmt_mysql (conn, sql);
     if (!stmt) {
         return -1;
     }
@@ -870,7 +1227,7 @@ mysql_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args)
 
 out:
     if (stmt)
-        mysql_stmt_close (stmt);
+        put_stmt_mysql (conn, sql, stmt, ret == 0);
     if (params) {
         int i;
         for (i = 0; i < n; ++i) {
@@ -899,7 +1256,6 @@ mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
                             int n, va_list args)
 {
     MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
-    MYSQL *db = conn->db_conn;
     MYSQL_STMT *stmt = NULL;
     MYSQL_BIND *params = NULL;
     MySQLDBRow row;
@@ -908,7 +1264,7 @@ mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
 
     memset (&row, 0, sizeof(row));
 
-    stmt = _prepare_stmt_mysql (db, sql);
+    stmt = get_stmt_mysql (conn, sql);
     if (!stmt) {
         return -1;
     }
@@ -979,10 +1335,8 @@ mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
     }
 
 out:
-    if (stmt) {
-        mysql_stmt_free_result (stmt);
-        mysql_stmt_close (stmt);
-    }
+    if (stmt)
+        put_stmt_mysql (conn, sql, stmt, nrows >= 0);
     if (params) {
         for (i = 0; i < n; ++i) {
             g_free (params[i].buffer);
@@ -1202,6 +1556,12 @@ sqlite_db_new (const char *db_path)
     return (SeafDB *)db;
 }
 
+static void
+sqlite_stmt_free (gpointer stmt)
+{
+    sqlite3_finalize (stmt);
+}
+
 static DBConnection *
 sqlite_db_get_connection (SeafDB *vdb)
 {
@@ -1220,18 +1580,21 @@ sqlite_db_get_connection (SeafDB *vdb)
 
     conn = g_new0 (SQLiteDBConnection, 1);
     conn->db_conn = db_conn;
+    conn->parent.stmt_cache.free_stmt = sqlite_stmt_free;
 
     return (DBConnection *)conn;
 }
 
 static void
-sqlite_db_release_connection (DBConnection *vconn, gboolean need_close)
+sqlite_db_release_connection (DBConnection *vconn)
 {
     if (!vconn)
         return;
 
     SQLiteDBConnection *conn = (SQLiteDBConnection *)vconn;
 
+    /* sqlite3_close() fails while statements are left. */
+    stmt_cache_clear (&vconn->stmt_cache);
     sqlite3_close (conn->db_conn);
 
     g_free (conn);
@@ -1290,6 +1653,41 @@ _bind_parameters_sqlite (sqlite3 *db, sqlite3_stmt *stmt, int n, va_list args)
     return 0;
 }
 
+/* Takes the statement of @sql from the cache of @conn, or prepares it. */
+static sqlite3_stmt * // 获取预编译语句
+get_stmt_sqlite (SQLiteDBConnection *conn, const char *sql)
+{
+    sqlite3_stmt *stmt;
+    int rc;
+
+    stmt = stmt_cache_take ((DBConnection *)conn, sql, 0);
+    if (stmt)
+        return stmt;
+
+    rc = sqlite3_blocking_prepare_v2 (conn->db_conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        seaf_warning ("sqlite3_prepare_v2 failed %s: %s", sql, sqlite3_errmsg(conn->db_conn));
+        return NULL;
+    }
+
+    return stmt;
+}
+
+/* Keeps @stmt for the next query of @sql if it ran successfully. */
+static void // 归还预编译语句
+put_stmt_sqlite (SQLiteDBConnection *conn, const char *sql, sqlite3_stmt *stmt,
+                 gboolean success)
+{
+    if (!success) {
+        sqlite3_finalize (stmt);
+        return;
+    }
+
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    stmt_cache_put ((DBConnection *)conn, sql, stmt);
+}
+
 static int
 sqlite_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args)
 {
@@ -1299,11 +1697,9 @@ sqlite_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args
     int rc;
     int ret = 0;
 
-    rc = sqlite3_blocking_prepare_v2 (db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        seaf_warning ("sqlite3_prepare_v2 failed %s: %s", sql, sqlite3_errmsg(db));
+    stmt = get_stmt_sqlite (conn, sql);
+    if (!stmt)
         return -1;
-    }
 
     if (_bind_parameters_sqlite (db, stmt, n, args) < 0) {
         seaf_warning ("Failed to bind parameters for sql %s\n", sql);
@@ -1319,7 +1715,7 @@ sqlite_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args
     }
 
 out:
-    sqlite3_finalize (stmt);
+    put_stmt_sqlite (conn, sql, stmt, ret == 0);
     return ret;
 }
 
@@ -1341,11 +1737,9 @@ sqlite_db_query_foreach_row (DBConnection *vconn, const char *sql,
     int rc;
     int nrows = 0;
 
-    rc = sqlite3_blocking_prepare_v2 (db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        seaf_warning ("sqlite3_prepare_v2 failed %s: %s", sql, sqlite3_errmsg(db));
+    stmt = get_stmt_sqlite (conn, sql);
+    if (!stmt)
         return -1;
-    }
 
     if (_bind_parameters_sqlite (db, stmt, n, args) < 0) {
         seaf_warning ("Failed to bind parameters for sql %s\n", sql);
@@ -1375,7 +1769,7 @@ sqlite_db_query_foreach_row (DBConnection *vconn, const char *sql,
     }
 
 out:
-    sqlite3_finalize (stmt);
+    put_stmt_sqlite (conn, sql, stmt, nrows >= 0);
     return nrows;
 }
 
@@ -1,6 +1,8 @@
 #ifndef SEAF_DB_H
 #define SEAF_DB_H
 
+#include <jansson.h>
+
 enum {
     SEAF_DB_TYPE_SQLITE,
     SEAF_DB_TYPE_MYSQL,
@@ -45,6 +47,11 @@ seaf_db_new_sqlite (const char *db_path, int max_connections);
 int // 查看数据库类型
 seaf_db_type (SeafDB *db);
 
+/* Returns counters and wait/hold time histograms of the connection pool,
+ * and the hit counters of the prepared statement caches. */
+json_t * // 连接池统计
+seaf_db_get_pool_stats (SeafDB *db);
+
 int // sql查询
 seaf_db_query (SeafDB *db, const char *sql);
 
@@ -2078,6 +2078,10 @@ ccnet_user_manager_update_emailuser_id (CcnetUserManager *manager,
 
     ret = 0;
 out:
+#if defined( SEAFILE_SERVER ) && defined( FULL_FEATURE )
+    /* Owners and shares may be renamed even if a later step failed. */
+    seaf_repo_manager_rebuild_perm_index (seaf->repo_mgr);
+#endif
     g_string_free (sql, TRUE);
     return ret;
 }
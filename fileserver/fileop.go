@@ -301,8 +301,9 @@ func doFile(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, fileID
 	return nil
 }
 
+// blockMap caches the block offsets of a file, see fsmgr.GetBlockOffsets.
 type blockMap struct {
-	blkSize    []uint64
+	offsets    []uint64
 	expireTime int64
 }
 
@@ -338,57 +339,42 @@ func doFileRange(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, f
 	conRange := fmt.Sprintf("bytes %d-%d/%d", start, end, file.FileSize)
 	rsp.Header().Set("Content-Range", conRange)
 
-	var blkSize []uint64
+	var offsets []uint64
 	if file.FileSize > cacheBlockMapThreshold {
 		if v, ok := blockMapCacheTable.Load(file.FileID); ok {
 			if blkMap, ok := v.(*blockMap); ok {
-				blkSize = blkMap.blkSize
+				offsets = blkMap.offsets
 			}
 		}
-		if len(blkSize) == 0 {
-			for _, v := range file.BlkIDs {
-				size, err := blockmgr.Stat(repo.StoreID, v)
-				if err != nil {
-					err := fmt.Errorf("failed to stat block %s : %v", v, err)
-					return &appError{err, "", http.StatusInternalServerError}
-				}
-				blkSize = append(blkSize, uint64(size))
-			}
-			blockMapCacheTable.Store(file.FileID, &blockMap{blkSize, time.Now().Unix() + blockMapCacheExpiretime})
+	}
+	if len(offsets) == 0 {
+		offsets, err = fsmgr.GetBlockOffsets(repo.StoreID, file)
+		if offsets == nil {
+			return &appError{err, "", http.StatusInternalServerError}
 		}
-	} else {
-		for _, v := range file.BlkIDs {
-			size, err := blockmgr.Stat(repo.StoreID, v)
-			if err != nil {
-				err := fmt.Errorf("failed to stat block %s : %v", v, err)
-				return &appError{err, "", http.StatusInternalServerError}
-			}
-			blkSize = append(blkSize, uint64(size))
+		if err != nil {
+			log.Printf("%v", err)
+		}
+		if file.FileSize > cacheBlockMapThreshold {
+			blockMapCacheTable.Store(file.FileID, &blockMap{offsets, time.Now().Unix() + blockMapCacheExpiretime})
 		}
 	}
 
-	var off uint64
-	var pos uint64
-	var startBlock int
-	for i, v := range blkSize {
-		pos = start - off
-		off += v
-		if off > start {
-			startBlock = i
-			break
-		}
+	// The first block that ends after start holds it.
+	startBlock := sort.Search(len(file.BlkIDs), func(i int) bool {
+		return offsets[i+1] > start
+	})
+	pos := start - offsets[startBlock]
+	blkSize := func(i int) uint64 {
+		return offsets[i+1] - offsets[i]
 	}
 
 	// Read block from the start block and specified position
-	var i int
+	i := startBlock
 	for ; i < len(file.BlkIDs); i++ {
-		if i < startBlock {
-			continue
-		}
-
 		blkID := file.BlkIDs[i]
 		var buf bytes.Buffer
-		if end-start+1 <= blkSize[i]-pos {
+		if end-start+1 <= blkSize(i)-pos {
 			err := blockmgr.Read(repo.StoreID, blkID, &buf)
 			if err != nil {
 				log.Printf("failed to read block %s: %v", blkID, err)
@@ -413,7 +399,7 @@ func doFileRange(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, f
 			log.Printf("failed to write block %s to response: %v", blkID, err)
 			return nil
 		}
-		start += blkSize[i] - pos
+		start += blkSize(i) - pos
 		i++
 		break
 	}
@@ -422,7 +408,7 @@ func doFileRange(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, f
 	for ; i < len(file.BlkIDs); i++ {
 		blkID := file.BlkIDs[i]
 		var buf bytes.Buffer
-		if end-start+1 <= blkSize[i] {
+		if end-start+1 <= blkSize(i) {
 			err := blockmgr.Read(repo.StoreID, blkID, &buf)
 			if err != nil {
 				log.Printf("failed to read block %s: %v", blkID, err)
@@ -441,7 +427,7 @@ func doFileRange(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, f
 				log.Printf("failed to write block %s to response: %v", blkID, err)
 				return nil
 			}
-			start += blkSize[i]
+			start += blkSize(i)
 		}
 	}
 
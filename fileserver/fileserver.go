@@ -52,6 +52,8 @@ type fileServerOptions struct {
 	windowsEncoding           string
 	// Timeout for fs-id-list requests.
 	fsIDListRequestTimeout uint32
+	// Save block offset tables of files for range requests.
+	persistBlockOffsets bool
 }
 
 var options fileServerOptions
@@ -254,6 +256,11 @@ func loadFileServerOptions() {
 			}
 		}
 	}
+	if section, err := config.GetSection("fs_cache"); err == nil {
+		if key, err := section.GetKey("persist_block_offsets"); err == nil {
+			options.persistBlockOffsets, _ = key.Bool()
+		}
+	}
 
 	ccnetConfPath := filepath.Join(centralDir, "ccnet.conf")
 	config, err = ini.Load(ccnetConfPath)
@@ -329,6 +336,9 @@ func main() {
 	repomgr.Init(seafileDB)
 
 	fsmgr.Init(centralDir, dataDir)
+	if options.persistBlockOffsets {
+		fsmgr.InitBlockOffsetStore(centralDir, dataDir)
+	}
 
 	blockmgr.Init(centralDir, dataDir)
 
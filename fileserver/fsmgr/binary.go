@@ -0,0 +1,354 @@
+package fsmgr
+
+import (
+	"bytes"
+	"compress/zlib"
+	"crypto/sha1"
+	"encoding/binary"
+	"encoding/hex"
+	"fmt"
+	"io"
+	"strconv"
+)
+
+// The binary format of fs objects, see common/fs-binary.h. The C server
+// writes it when [fs_object] format = binary; the fileserver reads both
+// formats and always writes json.
+const (
+	binaryMagic         = "\xffSFB"
+	binaryHeaderLen     = len(binaryMagic) + 2
+	binaryFormatVersion = 1
+
+	binaryCompressNone = 0
+	binaryCompressZlib = 1
+	binaryCompressZstd = 2
+
+	// Refuse to inflate absurd lengths from corrupted objects.
+	maxBinaryPayloadLen = 256 << 20
+)
+
+var errBadBinary = fmt.Errorf("bad binary fs object")
+
+func isBinary(p []byte) bool {
+	return len(p) >= binaryHeaderLen && string(p[:len(binaryMagic)]) == binaryMagic
+}
+
+// binDecoder reads the payload of a binary object. Names and modifiers of a
+// dir are sliced from one string holding the whole payload, and ids from one
+// hex string, so a dir costs a few allocations instead of a few per dirent.
+type binDecoder struct {
+	buf     []byte
+	s       string
+	off     int
+	err     error
+	objType int
+	version int
+}
+
+func newBinDecoder(p []byte) (*binDecoder, error) {
+	if !isBinary(p) || p[len(binaryMagic)] != binaryFormatVersion {
+		return nil, errBadBinary
+	}
+
+	payload := p[binaryHeaderLen:]
+	switch p[len(binaryMagic)+1] {
+	case binaryCompressNone:
+	case binaryCompressZlib:
+		n, k := binary.Uvarint(payload)
+		if k <= 0 || n > maxBinaryPayloadLen {
+			return nil, errBadBinary
+		}
+		out, err := uncompressN(payload[k:], int(n))
+		if err != nil {
+			return nil, err
+		}
+		payload = out
+	case binaryCompressZstd:
+		return nil, fmt.Errorf("zstd compressed fs objects are not supported")
+	default:
+		return nil, fmt.Errorf("unknown fs object compression %d", p[len(binaryMagic)+1])
+	}
+
+	d := &binDecoder{buf: payload}
+	d.objType = int(d.uvarint())
+	d.version = int(d.uvarint())
+	if d.err != nil {
+		return nil, d.err
+	}
+	return d, nil
+}
+
+// uncompressN inflates p, which must hold exactly n bytes, without
+// growing a buffer.
+func uncompressN(p []byte, n int) ([]byte, error) {
+	r, err := zlib.NewReader(bytes.NewReader(p))
+	if err != nil {
+		return nil, err
+	}
+	defer r.Close()
+
+	out := make([]byte, n)
+	if _, err := io.ReadFull(r, out); err != nil {
+		return nil, errBadBinary
+	}
+	// Reading to the end checks the adler32 checksum.
+	var extra [1]byte
+	if k, err := r.Read(extra[:]); k != 0 || err != io.EOF {
+		return nil, errBadBinary
+	}
+	return out, nil
+}
+
+func (d *binDecoder) uvarint() uint64 {
+	if d.err != nil {
+		return 0
+	}
+	v, n := binary.Uvarint(d.buf[d.off:])
+	if n <= 0 {
+		d.err = errBadBinary
+		return 0
+	}
+	d.off += n
+	return v
+}
+
+func (d *binDecoder) varint() int64 {
+	u := d.uvarint()
+	return int64(u>>1) ^ -int64(u&1)
+}
+
+// count reads the number of blocks or dirents, each of which takes at
+// least size bytes.
+func (d *binDecoder) count(size int) int {
+	n := d.uvarint()
+	if n > uint64((len(d.buf)-d.off)/size) {
+		d.err = errBadBinary
+		return 0
+	}
+	return int(n)
+}
+
+func (d *binDecoder) str(end int) string {
+	n := d.uvarint()
+	// A varint may have run past the end of the record.
+	if d.err != nil || d.off > end || n > uint64(end-d.off) {
+		d.err = errBadBinary
+		return ""
+	}
+	s := d.s[d.off : d.off+int(n)]
+	d.off += int(n)
+	return s
+}
+
+// rawID hex-encodes a 20-byte id into dst.
+func (d *binDecoder) rawID(end int, dst []byte) {
+	if d.err != nil || d.off > end || end-d.off < 20 {
+		d.err = errBadBinary
+		return
+	}
+	hex.Encode(dst, d.buf[d.off:d.off+20])
+	d.off += 20
+}
+
+func (seafile *Seafile) fromBinary(p []byte) error {
+	d, err := newBinDecoder(p)
+	if err != nil {
+		return err
+	}
+	return seafile.decode(d)
+}
+
+func (seafile *Seafile) decode(d *binDecoder) error {
+	if d.objType != SeafMetadataTypeFile {
+		return fmt.Errorf("object is not a file")
+	}
+
+	size := d.uvarint()
+	n := d.count(20)
+	ids := make([]byte, 40*n)
+	for i := 0; i < n; i++ {
+		d.rawID(len(d.buf), ids[40*i:])
+	}
+	if d.err != nil {
+		return d.err
+	}
+
+	idStr := string(ids)
+	seafile.Version = d.version
+	seafile.FileType = d.objType
+	seafile.FileSize = size
+	seafile.BlkIDs = make([]string, n)
+	for i := range seafile.BlkIDs {
+		seafile.BlkIDs[i] = idStr[40*i : 40*i+40]
+	}
+
+	return nil
+}
+
+func (seafdir *SeafDir) fromBinary(p []byte) error {
+	d, err := newBinDecoder(p)
+	if err != nil {
+		return err
+	}
+	return seafdir.decode(d)
+}
+
+func (seafdir *SeafDir) decode(d *binDecoder) error {
+	if d.objType != SeafMetadataTypeDir {
+		return fmt.Errorf("object is not a dir")
+	}
+
+	// A dirent takes at least its length, mode, id, name length and mtime.
+	n := d.count(24)
+	d.s = string(d.buf)
+	dents := make([]SeafDirent, n)
+	ids := make([]byte, 40*n)
+	for i := 0; i < n && d.err == nil; i++ {
+		recLen := d.uvarint()
+		if d.err != nil || recLen > uint64(len(d.buf)-d.off) {
+			return errBadBinary
+		}
+		end := d.off + int(recLen)
+
+		dent := &dents[i]
+		dent.Mode = uint32(d.uvarint())
+		d.rawID(end, ids[40*i:])
+		dent.Name = d.str(end)
+		dent.Mtime = d.varint()
+		if IsRegular(dent.Mode) {
+			dent.Modifier = d.str(end)
+			dent.Size = d.varint()
+		}
+
+		// Skip fields added by later writers.
+		if d.off > end {
+			return errBadBinary
+		}
+		d.off = end
+	}
+	if d.err != nil {
+		return d.err
+	}
+
+	idStr := string(ids)
+	seafdir.Version = d.version
+	seafdir.DirType = d.objType
+	seafdir.Entries = make([]*SeafDirent, n)
+	for i := range dents {
+		dents[i].ID = idStr[40*i : 40*i+40]
+		seafdir.Entries[i] = &dents[i]
+	}
+
+	return nil
+}
+
+// binaryToJSON rebuilds the json an object id is computed from, the way the
+// C server encodes it with jansson: sorted keys, ", " and ": " separators.
+func binaryToJSON(objID string, p []byte) ([]byte, error) {
+	d, err := newBinDecoder(p)
+	if err != nil {
+		return nil, err
+	}
+
+	var b bytes.Buffer
+	switch d.objType {
+	case SeafMetadataTypeFile:
+		seafile := new(Seafile)
+		if err := seafile.decode(d); err != nil {
+			return nil, err
+		}
+		seafile.writeJanssonJSON(&b)
+	case SeafMetadataTypeDir:
+		seafdir := new(SeafDir)
+		if err := seafdir.decode(d); err != nil {
+			return nil, err
+		}
+		seafdir.writeJanssonJSON(&b)
+	default:
+		return nil, fmt.Errorf("invalid fs object type %d", d.objType)
+	}
+
+	checksum := sha1.Sum(b.Bytes())
+	if hex.EncodeToString(checksum[:]) != objID {
+		return nil, fmt.Errorf("binary fs object %s doesn't match its id", objID)
+	}
+
+	return b.Bytes(), nil
+}
+
+func (seafile *Seafile) writeJanssonJSON(b *bytes.Buffer) {
+	b.WriteString(`{"block_ids": [`)
+	for i, id := range seafile.BlkIDs {
+		if i > 0 {
+			b.WriteString(", ")
+		}
+		writeJanssonString(b, id)
+	}
+	b.WriteString(`], "size": `)
+	b.WriteString(strconv.FormatInt(int64(seafile.FileSize), 10))
+	b.WriteString(`, "type": `)
+	b.WriteString(strconv.Itoa(SeafMetadataTypeFile))
+	b.WriteString(`, "version": `)
+	b.WriteString(strconv.Itoa(seafile.Version))
+	b.WriteString("}")
+}
+
+func (seafdir *SeafDir) writeJanssonJSON(b *bytes.Buffer) {
+	b.WriteString(`{"dirents": [`)
+	for i, dent := range seafdir.Entries {
+		if i > 0 {
+			b.WriteString(", ")
+		}
+		b.WriteString(`{"id": `)
+		writeJanssonString(b, dent.ID)
+		b.WriteString(`, "mode": `)
+		b.WriteString(strconv.FormatUint(uint64(dent.Mode), 10))
+		if IsRegular(dent.Mode) {
+			b.WriteString(`, "modifier": `)
+			writeJanssonString(b, dent.Modifier)
+		}
+		b.WriteString(`, "mtime": `)
+		b.WriteString(strconv.FormatInt(dent.Mtime, 10))
+		b.WriteString(`, "name": `)
+		writeJanssonString(b, dent.Name)
+		if IsRegular(dent.Mode) {
+			b.WriteString(`, "size": `)
+			b.WriteString(strconv.FormatInt(dent.Size, 10))
+		}
+		b.WriteString("}")
+	}
+	b.WriteString(`], "type": `)
+	b.WriteString(strconv.Itoa(SeafMetadataTypeDir))
+	b.WriteString(`, "version": `)
+	b.WriteString(strconv.Itoa(seafdir.Version))
+	b.WriteString("}")
+}
+
+// writeJanssonString escapes like jansson: only quotes, backslashes and
+// control characters; utf-8 and "/" are written as is.
+func writeJanssonString(b *bytes.Buffer, s string) {
+	b.WriteByte('"')
+	for i := 0; i < len(s); i++ {
+		c := s[i]
+		switch {
+		case c == '"' || c == '\\':
+			b.WriteByte('\\')
+			b.WriteByte(c)
+		case c == '\b':
+			b.WriteString(`\b`)
+		case c == '\f':
+			b.WriteString(`\f`)
+		case c == '\n':
+			b.WriteString(`\n`)
+		case c == '\r':
+			b.WriteString(`\r`)
+		case c == '\t':
+			b.WriteString(`\t`)
+		case c < 0x20:
+			fmt.Fprintf(b, `\u%04X`, c)
+		default:
+			b.WriteByte(c)
+		}
+	}
+	b.WriteByte('"')
+}
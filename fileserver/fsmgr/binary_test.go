@@ -0,0 +1,274 @@
+package fsmgr
+
+import (
+	"bytes"
+	"compress/zlib"
+	"crypto/sha1"
+	"encoding/binary"
+	"encoding/hex"
+	"fmt"
+	"testing"
+)
+
+// The json the C server computes the id of this dir from, dumped by
+// jansson with JSON_SORT_KEYS.
+const janssonDirJSON = `{"dirents": [{"id": "0401fc662e3bc87a41f299a907c056aaf8322a26", "mode": 33188, "modifier": "me@example.com", "mtime": 1600000000, "name": "a \"b\"/c\td.txt", "size": 100}, {"id": "0401fc662e3bc87a41f299a907c056aaf8322a27", "mode": 16384, "mtime": -1, "name": "文件"}], "type": 3, "version": 1}`
+const janssonDirID = "99b23a270d407fc66ca1520a4041209bcd5e1dea"
+
+func testDirents() []*SeafDirent {
+	return []*SeafDirent{
+		NewDirent("0401fc662e3bc87a41f299a907c056aaf8322a26", "a \"b\"/c\td.txt", 0x81a4, 1600000000, "me@example.com", 100),
+		NewDirent("0401fc662e3bc87a41f299a907c056aaf8322a27", "文件", 0x4000, -1, "", 0),
+	}
+}
+
+// Encoders of the C server (common/fs-binary.c), only needed by tests.
+
+func putUvarint(b *bytes.Buffer, v uint64) {
+	var tmp [binary.MaxVarintLen64]byte
+	b.Write(tmp[:binary.PutUvarint(tmp[:], v)])
+}
+
+func putVarint(b *bytes.Buffer, v int64) {
+	var tmp [binary.MaxVarintLen64]byte
+	b.Write(tmp[:binary.PutVarint(tmp[:], v)])
+}
+
+func putRawID(b *bytes.Buffer, id string) {
+	raw, _ := hex.DecodeString(id)
+	b.Write(raw)
+}
+
+func finishBinary(payload []byte, compression byte) []byte {
+	var out bytes.Buffer
+	out.WriteString(binaryMagic)
+	out.WriteByte(binaryFormatVersion)
+	out.WriteByte(compression)
+	if compression == binaryCompressZlib {
+		putUvarint(&out, uint64(len(payload)))
+		w := zlib.NewWriter(&out)
+		w.Write(payload)
+		w.Close()
+	} else {
+		out.Write(payload)
+	}
+	return out.Bytes()
+}
+
+func seafdirToBinary(seafdir *SeafDir, compression byte) []byte {
+	var b, rec bytes.Buffer
+	putUvarint(&b, SeafMetadataTypeDir)
+	putUvarint(&b, uint64(seafdir.Version))
+	putUvarint(&b, uint64(len(seafdir.Entries)))
+	for _, dent := range seafdir.Entries {
+		rec.Reset()
+		putUvarint(&rec, uint64(dent.Mode))
+		putRawID(&rec, dent.ID)
+		putUvarint(&rec, uint64(len(dent.Name)))
+		rec.WriteString(dent.Name)
+		putVarint(&rec, dent.Mtime)
+		if IsRegular(dent.Mode) {
+			putUvarint(&rec, uint64(len(dent.Modifier)))
+			rec.WriteString(dent.Modifier)
+			putVarint(&rec, dent.Size)
+		}
+		putUvarint(&b, uint64(rec.Len()))
+		b.Write(rec.Bytes())
+	}
+	return finishBinary(b.Bytes(), compression)
+}
+
+func seafileToBinary(seafile *Seafile, compression byte) []byte {
+	var b bytes.Buffer
+	putUvarint(&b, SeafMetadataTypeFile)
+	putUvarint(&b, uint64(seafile.Version))
+	putUvarint(&b, seafile.FileSize)
+	putUvarint(&b, uint64(len(seafile.BlkIDs)))
+	for _, id := range seafile.BlkIDs {
+		putRawID(&b, id)
+	}
+	return finishBinary(b.Bytes(), compression)
+}
+
+func TestJanssonJSON(t *testing.T) {
+	seafdir := &SeafDir{Version: 1, Entries: testDirents()}
+	var b bytes.Buffer
+	seafdir.writeJanssonJSON(&b)
+	if b.String() != janssonDirJSON {
+		t.Errorf("Wrong json %s.\n", b.String())
+	}
+
+	seafile := &Seafile{Version: 1, FileSize: 100, BlkIDs: []string{blkID, blkID}}
+	b.Reset()
+	seafile.writeJanssonJSON(&b)
+	expected := fmt.Sprintf(`{"block_ids": ["%s", "%s"], "size": 100, "type": 1, "version": 1}`, blkID, blkID)
+	if b.String() != expected {
+		t.Errorf("Wrong json %s.\n", b.String())
+	}
+
+	b.Reset()
+	writeJanssonString(&b, "\x01\x1f\b\f\n\r\\")
+	if b.String() != `"\u0001\u001F\b\f\n\r\\"` {
+		t.Errorf("Wrong escaping %s.\n", b.String())
+	}
+}
+
+func TestBinaryDir(t *testing.T) {
+	seafdir := &SeafDir{Version: 1, Entries: testDirents()}
+
+	for _, compression := range []byte{binaryCompressNone, binaryCompressZlib} {
+		data := seafdirToBinary(seafdir, compression)
+
+		decoded := new(SeafDir)
+		if err := decoded.FromData(data); err != nil {
+			t.Fatalf("Failed to decode binary dir : %v.\n", err)
+		}
+		if decoded.Version != 1 || decoded.DirType != SeafMetadataTypeDir ||
+			len(decoded.Entries) != len(seafdir.Entries) {
+			t.Fatalf("Wrong binary dir %+v.\n", decoded)
+		}
+		for i, dent := range decoded.Entries {
+			if *dent != *seafdir.Entries[i] {
+				t.Errorf("Wrong dirent %+v, expected %+v.\n", dent, seafdir.Entries[i])
+			}
+		}
+
+		jsonstr, err := binaryToJSON(janssonDirID, data)
+		if err != nil || string(jsonstr) != janssonDirJSON {
+			t.Errorf("Failed to rebuild json : %v, %s.\n", err, jsonstr)
+		}
+		if _, err := binaryToJSON(subDirID, data); err == nil {
+			t.Errorf("Binary object with a wrong id is accepted.\n")
+		}
+
+		// Truncated objects must fail without panics.
+		for i := 0; i < len(data); i++ {
+			if err := new(SeafDir).FromData(data[:i]); err == nil {
+				t.Errorf("Truncated object of %d bytes is accepted.\n", i)
+			}
+		}
+	}
+
+	zstd := seafdirToBinary(seafdir, binaryCompressNone)
+	zstd[binaryHeaderLen-1] = binaryCompressZstd
+	if err := new(SeafDir).FromData(zstd); err == nil {
+		t.Errorf("Zstd compressed object is accepted.\n")
+	}
+}
+
+func TestCorruptBinary(t *testing.T) {
+	// The dirent record ends right after the id, the name length after it
+	// runs past the record and past the object.
+	var b bytes.Buffer
+	putUvarint(&b, SeafMetadataTypeDir)
+	putUvarint(&b, 1)
+	putUvarint(&b, 1)
+	putUvarint(&b, 21)
+	putUvarint(&b, 0x4000)
+	putRawID(&b, subDirID)
+	putUvarint(&b, 1000)
+	data := finishBinary(b.Bytes(), binaryCompressNone)
+
+	// The mode takes 3 bytes, so the id runs past the record as well.
+	if err := new(SeafDir).FromData(data); err == nil {
+		t.Errorf("Corrupt object is accepted.\n")
+	}
+
+	b.Reset()
+	putUvarint(&b, SeafMetadataTypeDir)
+	putUvarint(&b, 1)
+	putUvarint(&b, 1)
+	putUvarint(&b, 21)
+	putUvarint(&b, 0)
+	putRawID(&b, subDirID)
+	putUvarint(&b, 1000)
+	data = finishBinary(b.Bytes(), binaryCompressNone)
+
+	if err := new(SeafDir).FromData(data); err == nil {
+		t.Errorf("Corrupt object is accepted.\n")
+	}
+}
+
+func TestBinaryFile(t *testing.T) {
+	seafile, _ := NewSeafile(1, 1<<40, []string{blkID, subDirID})
+	data := seafileToBinary(seafile, binaryCompressZlib)
+
+	decoded := new(Seafile)
+	if err := decoded.FromData(data); err != nil {
+		t.Fatalf("Failed to decode binary file : %v.\n", err)
+	}
+	if decoded.FileSize != 1<<40 || len(decoded.BlkIDs) != 2 ||
+		decoded.BlkIDs[0] != blkID || decoded.BlkIDs[1] != subDirID {
+		t.Errorf("Wrong binary file %+v.\n", decoded)
+	}
+	if err := new(SeafDir).FromData(data); err == nil {
+		t.Errorf("Binary file is decoded as a dir.\n")
+	}
+}
+
+func TestReadRawBinary(t *testing.T) {
+	seafdir := &SeafDir{Version: 1, Entries: testDirents()}
+	err := WriteRaw(repoID, janssonDirID, bytes.NewReader(seafdirToBinary(seafdir, binaryCompressZlib)))
+	if err != nil {
+		t.Fatalf("Failed to write binary dir : %v.\n", err)
+	}
+
+	decoded, err := GetSeafdir(repoID, janssonDirID)
+	if err != nil || len(decoded.Entries) != 2 || decoded.Entries[1].Name != "文件" {
+		t.Fatalf("Failed to get binary dir : %v.\n", err)
+	}
+
+	// Clients get the json back.
+	var buf bytes.Buffer
+	if err := ReadRaw(repoID, janssonDirID, &buf); err != nil {
+		t.Fatalf("Failed to read binary dir : %v.\n", err)
+	}
+	jsonstr, err := uncompress(buf.Bytes())
+	if err != nil {
+		t.Fatalf("Failed to uncompress dir : %v.\n", err)
+	}
+	checksum := sha1.Sum(jsonstr)
+	if hex.EncodeToString(checksum[:]) != janssonDirID {
+		t.Errorf("Wrong json of binary dir %s.\n", jsonstr)
+	}
+}
+
+// A dir of 100k files, as a dir object of the C server.
+func benchmarkDir() *SeafDir {
+	entries := make([]*SeafDirent, 100000)
+	for i := range entries {
+		checksum := sha1.Sum([]byte(fmt.Sprint(i)))
+		id := hex.EncodeToString(checksum[:])
+		name := fmt.Sprintf("document-%08d-%s.txt", len(entries)-i, id[32:])
+		entries[i] = NewDirent(id, name, 0x81a4, 1600000000+int64(i), "someone@example.com", int64(i)<<10)
+	}
+	return &SeafDir{Version: 1, Entries: entries}
+}
+
+func BenchmarkDecodeDirJSON(b *testing.B) {
+	var jsonstr bytes.Buffer
+	benchmarkDir().writeJanssonJSON(&jsonstr)
+	data, _ := compress(jsonstr.Bytes())
+	b.SetBytes(int64(len(data)))
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		if err := new(SeafDir).FromData(data); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkDecodeDirBinary(b *testing.B) {
+	data := seafdirToBinary(benchmarkDir(), binaryCompressZlib)
+	b.SetBytes(int64(len(data)))
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		if err := new(SeafDir).FromData(data); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
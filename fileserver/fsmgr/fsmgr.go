@@ -5,6 +5,7 @@ import (
 	"bytes"
 	"compress/zlib"
 	"crypto/sha1"
+	"encoding/binary"
 	"encoding/hex"
 	"encoding/json"
 	"fmt"
@@ -13,6 +14,7 @@ import (
 	"strings"
 	"syscall"
 
+	"github.com/haiwen/seafile-server/fileserver/blockmgr"
 	"github.com/haiwen/seafile-server/fileserver/objstore"
 )
 
@@ -60,6 +62,9 @@ const (
 
 var store *objstore.ObjectStore
 
+// offsetStore keeps block offset tables of files, nil if they are not persisted.
+var offsetStore *objstore.ObjectStore
+
 // Empty value of sha1
 const (
 	EmptySha1 = "0000000000000000000000000000000000000000"
@@ -156,8 +161,12 @@ func compress(p []byte) ([]byte, error) {
 	return out.Bytes(), nil
 }
 
-// FromData reads from p and converts JSON-encoded data to Seafile.
+// FromData reads from p and converts JSON-encoded or binary data to Seafile.
 func (seafile *Seafile) FromData(p []byte) error {
+	if isBinary(p) {
+		return seafile.fromBinary(p)
+	}
+
 	b, err := uncompress(p)
 	if err != nil {
 		return err
@@ -210,8 +219,12 @@ func (seafdir *SeafDir) ToData(w io.Writer) error {
 	return nil
 }
 
-// FromData reads from p and converts JSON-encoded data to SeafDir.
+// FromData reads from p and converts JSON-encoded or binary data to SeafDir.
 func (seafdir *SeafDir) FromData(p []byte) error {
+	if isBinary(p) {
+		return seafdir.fromBinary(p)
+	}
+
 	b, err := uncompress(p)
 	if err != nil {
 		return err
@@ -224,9 +237,28 @@ func (seafdir *SeafDir) FromData(p []byte) error {
 	return nil
 }
 
-// ReadRaw reads data in binary format from storage backend.
+// ReadRaw reads an object from storage backend in the form clients expect,
+// zlib-compressed json. Objects stored in the binary format are converted.
 func ReadRaw(repoID string, objID string, w io.Writer) error {
-	err := store.Read(repoID, objID, w)
+	var buf bytes.Buffer
+	err := store.Read(repoID, objID, &buf)
+	if err != nil {
+		return err
+	}
+
+	p := buf.Bytes()
+	if isBinary(p) {
+		jsonstr, err := binaryToJSON(objID, p)
+		if err != nil {
+			return err
+		}
+		p, err = compress(jsonstr)
+		if err != nil {
+			return err
+		}
+	}
+
+	_, err = w.Write(p)
 	if err != nil {
 		return err
 	}
@@ -252,7 +284,7 @@ func GetSeafile(repoID string, fileID string) (*Seafile, error) {
 		return seafile, nil
 	}
 
-	err := ReadRaw(repoID, fileID, &buf)
+	err := store.Read(repoID, fileID, &buf)
 	if err != nil {
 		errors := fmt.Errorf("failed to read seafile object from storage : %v", err)
 		return nil, errors
@@ -309,7 +341,7 @@ func GetSeafdir(repoID string, dirID string) (*SeafDir, error) {
 		return seafdir, nil
 	}
 
-	err := ReadRaw(repoID, dirID, &buf)
+	err := store.Read(repoID, dirID, &buf)
 	if err != nil {
 		errors := fmt.Errorf("failed to read seafdir object from storage : %v", err)
 		return nil, errors
@@ -356,6 +388,79 @@ func SaveSeafdir(repoID string, seafdir *SeafDir) error {
 	return nil
 }
 
+// InitBlockOffsetStore enables persisting the block offset tables of files.
+func InitBlockOffsetStore(seafileConfPath string, seafileDataDir string) {
+	offsetStore = objstore.New(seafileConfPath, seafileDataDir, "offsets")
+}
+
+// GetBlockOffsets returns where the blocks of an unencrypted file start:
+// block i holds bytes [offsets[i], offsets[i+1]) and the last offset is the file size.
+// The table is read from the offset store if it's enabled, otherwise it's
+// built by stat'ing every block and saved.
+func GetBlockOffsets(repoID string, file *Seafile) ([]uint64, error) {
+	if offsetStore != nil {
+		var buf bytes.Buffer
+		if err := offsetStore.Read(repoID, file.FileID, &buf); err == nil {
+			if offsets, err := blockOffsetsFromData(file, buf.Bytes()); err == nil {
+				return offsets, nil
+			}
+		}
+	}
+
+	offsets := make([]uint64, len(file.BlkIDs)+1)
+	for i, blkID := range file.BlkIDs {
+		size, err := blockmgr.Stat(repoID, blkID)
+		if err != nil {
+			err := fmt.Errorf("failed to stat block %s : %v", blkID, err)
+			return nil, err
+		}
+		offsets[i+1] = offsets[i] + uint64(size)
+	}
+
+	if offsetStore != nil {
+		err := offsetStore.Write(repoID, file.FileID, bytes.NewReader(blockOffsetsToData(offsets)), false)
+		if err != nil {
+			err := fmt.Errorf("failed to save block offsets of %s/%s : %v", repoID, file.FileID, err)
+			return offsets, err
+		}
+	}
+
+	return offsets, nil
+}
+
+// A stored table is the number of blocks (32 bits) followed by the end
+// offset of every block (64 bits), all big endian. Same as the C server.
+func blockOffsetsToData(offsets []uint64) []byte {
+	nBlocks := len(offsets) - 1
+	p := make([]byte, 4+8*nBlocks)
+	binary.BigEndian.PutUint32(p, uint32(nBlocks))
+	for i := 0; i < nBlocks; i++ {
+		binary.BigEndian.PutUint64(p[4+8*i:], offsets[i+1])
+	}
+	return p
+}
+
+func blockOffsetsFromData(file *Seafile, p []byte) ([]uint64, error) {
+	if len(p) < 4 {
+		return nil, fmt.Errorf("block offsets too short")
+	}
+	nBlocks := int(binary.BigEndian.Uint32(p))
+	if nBlocks != len(file.BlkIDs) || len(p) != 4+8*nBlocks {
+		return nil, fmt.Errorf("block offsets don't match the file")
+	}
+	offsets := make([]uint64, nBlocks+1)
+	for i := 0; i < nBlocks; i++ {
+		offsets[i+1] = binary.BigEndian.Uint64(p[4+8*i:])
+		if offsets[i+1] < offsets[i] {
+			return nil, fmt.Errorf("invalid block offsets")
+		}
+	}
+	if offsets[nBlocks] != file.FileSize {
+		return nil, fmt.Errorf("block offsets don't match the file size")
+	}
+	return offsets, nil
+}
+
 // Exists check if fs object is exists.
 func Exists(repoID string, objID string) (bool, error) {
 	if objID == EmptySha1 {
@@ -364,6 +469,20 @@ func Exists(repoID string, objID string) (bool, error) {
 	return store.Exists(repoID, objID)
 }
 
+// ExistsMany checks whether each of the fs objects exists. res[i] is for objIDs[i].
+func ExistsMany(repoID string, objIDs []string) ([]bool, error) {
+	res, err := store.ExistsMany(repoID, objIDs)
+	if err != nil {
+		return nil, err
+	}
+	for i, objID := range objIDs {
+		if objID == EmptySha1 {
+			res[i] = true
+		}
+	}
+	return res, nil
+}
+
 func comp(c rune) bool {
 	if c == '/' {
 		return true
@@ -1,9 +1,12 @@
 package fsmgr
 
 import (
+	"bytes"
 	"fmt"
 	"os"
 	"testing"
+
+	"github.com/haiwen/seafile-server/fileserver/blockmgr"
 )
 
 const (
@@ -63,6 +66,7 @@ func delFile() error {
 
 func TestMain(m *testing.M) {
 	Init(seafileConfPath, seafileDataDir)
+	blockmgr.Init(seafileConfPath, seafileDataDir)
 	err := createFile()
 	if err != nil {
 		fmt.Printf("Failed to create test file : %v.\n", err)
@@ -127,3 +131,48 @@ func TestGetSeafdirByPath(t *testing.T) {
 	}
 
 }
+
+func TestGetBlockOffsets(t *testing.T) {
+	// The test file has two blocks of 50 bytes.
+	err := blockmgr.Write(repoID, blkID, bytes.NewReader(make([]byte, 50)))
+	if err != nil {
+		t.Fatalf("Failed to write block : %v.\n", err)
+	}
+	seafile, err := GetSeafile(repoID, fileID)
+	if err != nil {
+		t.Fatalf("Failed to get seafile : %v.\n", err)
+	}
+
+	checkOffsets := func(offsets []uint64) {
+		if len(offsets) != 3 || offsets[0] != 0 || offsets[1] != 50 || offsets[2] != 100 {
+			t.Errorf("Wrong block offsets %v.\n", offsets)
+		}
+	}
+
+	offsets, err := GetBlockOffsets(repoID, seafile)
+	if err != nil {
+		t.Fatalf("Failed to get block offsets : %v.\n", err)
+	}
+	checkOffsets(offsets)
+
+	InitBlockOffsetStore(seafileConfPath, seafileDataDir)
+	defer func() { offsetStore = nil }()
+	offsets, err = GetBlockOffsets(repoID, seafile)
+	if err != nil {
+		t.Fatalf("Failed to save block offsets : %v.\n", err)
+	}
+	checkOffsets(offsets)
+
+	// Now the offsets are read from the offset store.
+	os.RemoveAll(seafileDataDir + "/storage/blocks")
+	offsets, err = GetBlockOffsets(repoID, seafile)
+	if err != nil {
+		t.Fatalf("Failed to read block offsets : %v.\n", err)
+	}
+	checkOffsets(offsets)
+
+	data := blockOffsetsToData([]uint64{0, 50, 90})
+	if _, err := blockOffsetsFromData(seafile, data); err == nil {
+		t.Errorf("Block offsets with a wrong file size are accepted.\n")
+	}
+}
@@ -6,6 +6,14 @@ import (
 	"io/ioutil"
 	"os"
 	"path"
+	"sync"
+	"sync/atomic"
+)
+
+// stat() blocks on disk seeks, many of them overlap well on a cold cache.
+const (
+	existsManyWorkers = 16
+	existsManyBatch   = 256
 )
 
 type fsBackend struct {
@@ -89,6 +97,39 @@ func (b *fsBackend) exists(repoID string, objID string) (bool, error) {
 	return true, nil
 }
 
+func (b *fsBackend) existsMany(repoID string, objIDs []string) ([]bool, error) {
+	res := make([]bool, len(objIDs))
+	nWorkers := (len(objIDs) + existsManyBatch - 1) / existsManyBatch
+	if nWorkers > existsManyWorkers {
+		nWorkers = existsManyWorkers
+	}
+
+	var next int64
+	var wg sync.WaitGroup
+	wg.Add(nWorkers)
+	for i := 0; i < nWorkers; i++ {
+		go func() {
+			defer wg.Done()
+			for {
+				start := int(atomic.AddInt64(&next, existsManyBatch)) - existsManyBatch
+				if start >= len(objIDs) {
+					return
+				}
+				end := start + existsManyBatch
+				if end > len(objIDs) {
+					end = len(objIDs)
+				}
+				for j := start; j < end; j++ {
+					res[j], _ = b.exists(repoID, objIDs[j])
+				}
+			}
+		}()
+	}
+	wg.Wait()
+
+	return res, nil
+}
+
 func (b *fsBackend) stat(repoID string, objID string) (int64, error) {
 	path := path.Join(b.objDir, repoID, objID[:2], objID[2:])
 	fileInfo, err := os.Stat(path)
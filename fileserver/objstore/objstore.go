@@ -22,6 +22,8 @@ type storageBackend interface {
 	write(repoID string, objID string, r io.Reader, sync bool) (err error)
 	// exists checks whether an object exists.
 	exists(repoID string, objID string) (res bool, err error)
+	// existsMany checks whether each of the objects exists, in one batch.
+	existsMany(repoID string, objIDs []string) (res []bool, err error)
 	// stat calculates an object's size
 	stat(repoID string, objID string) (res int64, err error)
 }
@@ -50,6 +52,11 @@ func (s *ObjectStore) Exists(repoID string, objID string) (res bool, err error)
 	return s.backend.exists(repoID, objID)
 }
 
+// ExistsMany checks whether each of the objects exists. res[i] is for objIDs[i].
+func (s *ObjectStore) ExistsMany(repoID string, objIDs []string) (res []bool, err error) {
+	return s.backend.existsMany(repoID, objIDs)
+}
+
 // Stat calculates object size.
 func (s *ObjectStore) Stat(repoID string, objID string) (res int64, err error) {
 	return s.backend.stat(repoID, objID)
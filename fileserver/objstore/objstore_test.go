@@ -98,8 +98,34 @@ func testExists(t *testing.T) {
 	}
 }
 
+func testExistsMany(t *testing.T) {
+	bend := New(seafileConfPath, seafileDataDir, "commit")
+	missingID := "0401fc662e3bc87a41f299a907c056aaf8322a28"
+
+	// Enough ids for several batches.
+	var objIDs []string
+	for i := 0; i < 1000; i++ {
+		objIDs = append(objIDs, objID, missingID)
+	}
+	res, err := bend.ExistsMany(repoID, objIDs)
+	if err != nil || len(res) != len(objIDs) {
+		t.Fatalf("Failed to check objects : %v\n", err)
+	}
+	for i := range objIDs {
+		if res[i] != (objIDs[i] == objID) {
+			t.Errorf("Wrong existence of object %d %s\n", i, objIDs[i])
+		}
+	}
+
+	res, err = bend.ExistsMany(repoID, nil)
+	if err != nil || len(res) != 0 {
+		t.Errorf("Failed to check empty object list : %v\n", err)
+	}
+}
+
 func TestObjStore(t *testing.T) {
 	testWrite(t)
 	testRead(t)
 	testExists(t)
+	testExistsMany(t)
 }
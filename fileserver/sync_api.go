@@ -420,19 +420,29 @@ func postCheckExistCB(rsp http.ResponseWriter, r *http.Request, existType checkE
 		return &appError{nil, err.Error(), http.StatusBadRequest}
 	}
 
-	var neededObjs []string
-	var ret bool
-	for i := 0; i < len(objIDList); i++ {
-		if !isObjectIDValid(objIDList[i]) {
-			continue
-		}
-		if existType == checkFSExist {
-			ret, _ = fsmgr.Exists(storeID, objIDList[i])
-		} else if existType == checkBlockExist {
-			ret = blockmgr.Exists(storeID, objIDList[i])
+	validIDs := objIDList[:0]
+	for _, objID := range objIDList {
+		if isObjectIDValid(objID) {
+			validIDs = append(validIDs, objID)
 		}
-		if !ret {
-			neededObjs = append(neededObjs, objIDList[i])
+	}
+
+	// All ids are checked in one batch, the backend overlaps the syscalls.
+	var exists []bool
+	if existType == checkFSExist {
+		exists, err = fsmgr.ExistsMany(storeID, validIDs)
+	} else {
+		exists, err = blockmgr.ExistsMany(storeID, validIDs)
+	}
+	if err != nil {
+		err := fmt.Errorf("Failed to check objects of %s: %v", storeID, err)
+		return &appError{err, "", http.StatusInternalServerError}
+	}
+
+	var neededObjs []string
+	for i, objID := range validIDs {
+		if !exists[i] {
+			neededObjs = append(neededObjs, objID)
 		}
 	}
 
@@ -0,0 +1,320 @@
+// 块缓存和预读
+#include "common.h"
+
+#include <pthread.h>
+
+#include "log.h"
+#include "utils.h"
+#include "lru-cache.h"
+
+#include "block-cache.h"
+
+#define MAX_SHARDS 8
+#define MIN_SHARD_SIZE (64 << 20) // 分片不能比块小太多，否则块一插入就被淘汰
+#define MAX_QUEUED_PREFETCH 64 // 排队的预读请求上限
+
+enum { // 正在读入的块的状态
+    LOAD_QUEUED = 1, // 预读已排队
+    LOAD_RUNNING, // 正在读
+};
+
+typedef struct PrefetchTask {
+    char store_id[37];
+    int version;
+    char block_id[41];
+} PrefetchTask;
+
+struct BlockCache {
+    SeafBlockManager *block_mgr;
+    LRUCache *blocks; // block id -> CachedBlock
+    int n_threads; // 预读线程数
+    GThreadPool *prefetch_pool; // 调用block_cache_start_prefetch()后创建
+
+    pthread_mutex_t lock; // 保护loading和stats
+    pthread_cond_t loaded;
+    GHashTable *loading; // block id -> 状态
+    BlockCacheStats stats;
+};
+
+static CachedBlock *
+cached_block_ref (CachedBlock *b)
+{
+    g_atomic_int_inc (&b->ref);
+    return b;
+}
+
+void
+cached_block_unref (CachedBlock *b)
+{
+    BlockCache *cache = b->cache;
+
+    if (!g_atomic_int_dec_and_test (&b->ref))
+        return;
+
+    if (b->unused_prefetch) {
+        pthread_mutex_lock (&cache->lock);
+        ++cache->stats.prefetch_wasted;
+        pthread_mutex_unlock (&cache->lock);
+    }
+    g_free (b->data);
+    g_free (b);
+}
+
+static CachedBlock * // 记录预读的块被用到
+mark_used (BlockCache *cache, CachedBlock *b)
+{
+    if (g_atomic_int_compare_and_exchange (&b->unused_prefetch, 1, 0)) {
+        pthread_mutex_lock (&cache->lock);
+        ++cache->stats.prefetch_used;
+        pthread_mutex_unlock (&cache->lock);
+    }
+
+    return b;
+}
+
+static void
+prefetch_worker (gpointer vtask, gpointer vcache);
+
+BlockCache *
+block_cache_new (SeafBlockManager *block_mgr, gint64 max_size, int n_threads)
+{
+    BlockCache *cache = g_new0 (BlockCache, 1);
+    int n_shards = CLAMP (max_size / MIN_SHARD_SIZE, 1, MAX_SHARDS);
+
+    cache->block_mgr = block_mgr;
+    cache->blocks = lru_cache_new (n_shards, 0, max_size,
+                                   (GBoxedCopyFunc)cached_block_ref,
+                                   (GDestroyNotify)cached_block_unref);
+    pthread_mutex_init (&cache->lock, NULL);
+    pthread_cond_init (&cache->loaded, NULL);
+    cache->loading = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    cache->n_threads = n_threads;
+
+    return cache;
+}
+
+void
+block_cache_start_prefetch (BlockCache *cache)
+{
+    if (cache->n_threads <= 0 || cache->prefetch_pool)
+        return;
+
+    cache->prefetch_pool = g_thread_pool_new (prefetch_worker, cache,
+                                              cache->n_threads, FALSE, NULL);
+    if (!cache->prefetch_pool)
+        seaf_warning ("Failed to create prefetch thread pool.\n");
+}
+
+void
+block_cache_free (BlockCache *cache)
+{
+    if (!cache)
+        return;
+
+    if (cache->prefetch_pool)
+        g_thread_pool_free (cache->prefetch_pool, TRUE, TRUE);
+    lru_cache_free (cache->blocks);
+    g_hash_table_destroy (cache->loading);
+    pthread_cond_destroy (&cache->loaded);
+    pthread_mutex_destroy (&cache->lock);
+    g_free (cache);
+}
+
+static CachedBlock * // 查找块，不计入统计
+lookup_block (BlockCache *cache, const char *block_id)
+{
+    CachedBlock *b = lru_cache_lookup (cache->blocks, block_id);
+
+    return b ? mark_used (cache, b) : NULL;
+}
+
+CachedBlock *
+block_cache_lookup (BlockCache *cache, const char *block_id)
+{
+    CachedBlock *b = lookup_block (cache, block_id);
+
+    pthread_mutex_lock (&cache->lock);
+    if (b)
+        ++cache->stats.hits;
+    else
+        ++cache->stats.misses;
+    pthread_mutex_unlock (&cache->lock);
+
+    return b;
+}
+
+/* Reads the block and caches it. The block must be marked as
+ * LOAD_RUNNING by the caller. */
+static CachedBlock * // 读入块
+load_block (BlockCache *cache,
+            const char *store_id, int version, const char *block_id,
+            gboolean prefetch)
+{
+    CachedBlock *b = NULL;
+    char *buf;
+    int len;
+
+    buf = seaf_block_manager_read_whole_block (cache->block_mgr,
+                                               store_id, version,
+                                               block_id, &len);
+    if (buf) {
+        b = g_new0 (CachedBlock, 1);
+        b->data = buf;
+        b->len = len;
+        b->ref = 2; // 一个给缓存，一个给调用者
+        b->unused_prefetch = prefetch;
+        b->cache = cache;
+        lru_cache_insert (cache->blocks, block_id, b, len);
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    g_hash_table_remove (cache->loading, block_id);
+    pthread_cond_broadcast (&cache->loaded);
+    pthread_mutex_unlock (&cache->lock);
+
+    return b;
+}
+
+CachedBlock *
+block_cache_get (BlockCache *cache,
+                 const char *store_id, int version, const char *block_id)
+{
+    CachedBlock *b;
+    gboolean waited = FALSE;
+
+    while (1) {
+        b = lookup_block (cache, block_id);
+        if (b) {
+            pthread_mutex_lock (&cache->lock);
+            if (waited)
+                ++cache->stats.waits;
+            else
+                ++cache->stats.hits;
+            pthread_mutex_unlock (&cache->lock);
+            return b;
+        }
+
+        pthread_mutex_lock (&cache->lock);
+        if (GPOINTER_TO_INT (g_hash_table_lookup (cache->loading, block_id)) == LOAD_RUNNING) {
+            waited = TRUE;
+            pthread_cond_wait (&cache->loaded, &cache->lock);
+            pthread_mutex_unlock (&cache->lock);
+            continue;
+        }
+
+        /* Not loaded, or a prefetch is only queued: read it right here,
+         * the prefetch will find it done. A load that finished just after
+         * the lookup above means the block is read twice, which is
+         * harmless. */
+        g_hash_table_replace (cache->loading, g_strdup (block_id),
+                              GINT_TO_POINTER (LOAD_RUNNING));
+        ++cache->stats.misses;
+        pthread_mutex_unlock (&cache->lock);
+
+        return load_block (cache, store_id, version, block_id, FALSE);
+    }
+}
+
+void
+block_cache_prefetch (BlockCache *cache,
+                      const char *store_id, int version, const char *block_id)
+{
+    PrefetchTask *task;
+    CachedBlock *b;
+
+    if (!cache->prefetch_pool)
+        return;
+
+    /* Checked without the lock, so that a cache hit doesn't wait for it. */
+    b = lru_cache_lookup (cache->blocks, block_id);
+    if (b) {
+        cached_block_unref (b);
+        return;
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    if (g_hash_table_lookup (cache->loading, block_id) ||
+        g_thread_pool_unprocessed (cache->prefetch_pool) >= MAX_QUEUED_PREFETCH) {
+        pthread_mutex_unlock (&cache->lock);
+        return;
+    }
+    g_hash_table_replace (cache->loading, g_strdup (block_id),
+                          GINT_TO_POINTER (LOAD_QUEUED));
+    ++cache->stats.prefetch_issued;
+    pthread_mutex_unlock (&cache->lock);
+
+    task = g_new0 (PrefetchTask, 1);
+    memcpy (task->store_id, store_id, 36);
+    task->version = version;
+    memcpy (task->block_id, block_id, 40);
+    g_thread_pool_push (cache->prefetch_pool, task, NULL);
+}
+
+static void // 预读线程
+prefetch_worker (gpointer vtask, gpointer vcache)
+{
+    PrefetchTask *task = vtask;
+    BlockCache *cache = vcache;
+    CachedBlock *b;
+
+    /* A read may have loaded the block since it was queued. */
+    pthread_mutex_lock (&cache->lock);
+    if (GPOINTER_TO_INT (g_hash_table_lookup (cache->loading, task->block_id)) != LOAD_QUEUED) {
+        pthread_mutex_unlock (&cache->lock);
+        g_free (task);
+        return;
+    }
+    g_hash_table_replace (cache->loading, g_strdup (task->block_id),
+                          GINT_TO_POINTER (LOAD_RUNNING));
+    ++cache->stats.prefetch_loaded;
+    pthread_mutex_unlock (&cache->lock);
+
+    b = load_block (cache, task->store_id, task->version, task->block_id, TRUE);
+    if (b)
+        cached_block_unref (b);
+    g_free (task);
+}
+
+void
+block_cache_get_stats (BlockCache *cache, BlockCacheStats *stats)
+{
+    LRUCacheStats lru_stats;
+
+    pthread_mutex_lock (&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock (&cache->lock);
+
+    lru_cache_get_stats (cache->blocks, &lru_stats);
+    stats->size = lru_stats.size;
+    stats->max_size = lru_stats.max_size;
+    stats->evictions = lru_stats.evictions;
+}
+
+char *
+block_cache_format_stats (BlockCache *cache)
+{
+    BlockCacheStats st;
+    gint64 reads;
+
+    block_cache_get_stats (cache, &st);
+    reads = st.hits + st.misses + st.waits;
+
+    return g_strdup_printf ("hits: %"G_GINT64_FORMAT"\n"
+                            "misses: %"G_GINT64_FORMAT"\n"
+                            "waits: %"G_GINT64_FORMAT"\n"
+                            "hit_rate: %.3f\n"
+                            "prefetch_issued: %"G_GINT64_FORMAT"\n"
+                            "prefetch_loaded: %"G_GINT64_FORMAT"\n"
+                            "prefetch_used: %"G_GINT64_FORMAT"\n"
+                            "prefetch_wasted: %"G_GINT64_FORMAT"\n"
+                            "prefetch_use_rate: %.3f\n"
+                            "size: %"G_GINT64_FORMAT"\n"
+                            "max_size: %"G_GINT64_FORMAT"\n"
+                            "evictions: %"G_GINT64_FORMAT"\n",
+                            st.hits, st.misses, st.waits,
+                            reads ? (double)st.hits / reads : 0.0,
+                            st.prefetch_issued, st.prefetch_loaded,
+                            st.prefetch_used, st.prefetch_wasted,
+                            st.prefetch_loaded ? (double)st.prefetch_used / st.prefetch_loaded : 0.0,
+                            st.size, st.max_size, st.evictions);
+}
@@ -0,0 +1,77 @@
+// 块缓存和预读
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <glib.h>
+
+#include "block-mgr.h"
+
+/*
+ * Whole blocks cached in memory, shared by all opened files and bounded by
+ * size. Blocks are keyed by id only: the id is the hash of the content, so
+ * the same id means the same data in any store.
+ *
+ * Blocks can be prefetched on a background pool. A block is never read
+ * twice at the same time: a read waits for a prefetch of the same block
+ * that is in progress, and takes over one that is only queued.
+ */
+typedef struct BlockCache BlockCache;
+
+/* A cached block, returned with a reference held for the caller. */
+typedef struct CachedBlock {
+    char *data;
+    int len;
+    /* private */
+    gint ref;
+    gint unused_prefetch; // 由预读读入、还没被读请求用到
+    BlockCache *cache;
+} CachedBlock;
+
+void // 释放块的引用
+cached_block_unref (CachedBlock *block);
+
+typedef struct BlockCacheStats {
+    gint64 hits; // 读请求命中
+    gint64 misses; // 读请求同步读块
+    gint64 waits; // 读请求等待进行中的预读
+    gint64 prefetch_issued; // 提交的预读请求
+    gint64 prefetch_loaded; // 预读实际读入的块
+    gint64 prefetch_used; // 之后被读到的预读块
+    gint64 prefetch_wasted; // 没被读到就淘汰的预读块
+    gint64 size; // 当前大小
+    gint64 max_size; // 大小上限
+    gint64 evictions; // 淘汰次数
+} BlockCacheStats;
+
+BlockCache * // 创建缓存；@n_threads为0时不能预读
+block_cache_new (SeafBlockManager *block_mgr, gint64 max_size, int n_threads);
+
+/* Creates the prefetch threads. Threads don't survive fork(), so this is
+ * called after the process has daemonized. Until then, prefetches are
+ * ignored. */
+void // 启动预读线程
+block_cache_start_prefetch (BlockCache *cache);
+
+void
+block_cache_free (BlockCache *cache);
+
+/* Returns the cached block or NULL, never reads it. */
+CachedBlock * // 查找块
+block_cache_lookup (BlockCache *cache, const char *block_id);
+
+/* Returns the block, reading it if it's not cached. NULL on error. */
+CachedBlock * // 获取块
+block_cache_get (BlockCache *cache,
+                 const char *store_id, int version, const char *block_id);
+
+void // 在后台读入块
+block_cache_prefetch (BlockCache *cache,
+                      const char *store_id, int version, const char *block_id);
+
+void // 获取统计信息
+block_cache_get_stats (BlockCache *cache, BlockCacheStats *stats);
+
+char * // 统计信息的文本形式，每行一项
+block_cache_format_stats (BlockCache *cache);
+
+#endif
@@ -13,95 +13,280 @@
 #include "utils.h"
 
 #include "seaf-fuse.h"
+#include "block-cache.h"
 
-int read_file(SeafileSession *seaf,
-              const char *store_id, int version,
-              Seafile *file,
-              char *buf, size_t size,
-              off_t offset, struct fuse_file_info *info) // 读文件
+#define SKIP_BUF_SIZE (64 << 10)
+#define SEQ_READS_FOR_READAHEAD 2 // 连续几次顺序读后开始预读
+
+SeafFuseFile *
+seaf_fuse_file_new (const char *store_id, int version, Seafile *file)
+{
+    SeafFuseFile *f = g_new0 (SeafFuseFile, 1);
+
+    memcpy (f->store_id, store_id, 36);
+    f->version = version;
+    f->file = file;
+    f->offsets = g_new0 (gint64, file->n_blocks + 1);
+    f->cur = -1;
+    f->fd = -1;
+    pthread_mutex_init (&f->lock, NULL);
+
+    return f;
+}
+
+static void // 关闭当前块
+close_cur_block (SeafileSession *seaf, SeafFuseFile *f)
+{
+    if (f->handle) {
+        seaf_block_manager_close_block (seaf->block_mgr, f->handle);
+        seaf_block_manager_block_handle_free (seaf->block_mgr, f->handle);
+        f->handle = NULL;
+    }
+    if (f->fd >= 0) {
+        close (f->fd);
+        f->fd = -1;
+    }
+    f->cur = -1;
+}
+
+void
+seaf_fuse_file_free (SeafileSession *seaf, SeafFuseFile *f)
+{
+    if (!f)
+        return;
+
+    close_cur_block (seaf, f);
+    seafile_unref (f->file);
+    g_free (f->offsets);
+    pthread_mutex_destroy (&f->lock);
+    g_free (f);
+}
+
+/* Returns the index of the block holding @offset, n_blocks if it's beyond
+ * the end of file, or -1 on error. */
+static int // 查找偏移所在的块
+find_block (SeafileSession *seaf, SeafFuseFile *f, gint64 offset)
 {
-    BlockHandle *handle = NULL;;
+    Seafile *file = f->file;
     BlockMetadata *bmd;
     char *blkid;
-    char *ptr;
-    off_t off = 0, nleft;
-    int i, n, ret = -EIO;
+    int lo, hi, mid;
 
-    for (i = 0; i < file->n_blocks; i++) {
-        blkid = file->blk_sha1s[i];
+    /* Sequential reads stay in the current block most of the time. */
+    if (f->cur >= 0 && offset >= f->offsets[f->cur] && offset < f->offsets[f->cur + 1])
+        return f->cur;
 
-        bmd = seaf_block_manager_stat_block(seaf->block_mgr, store_id, version, blkid);
-        if (!bmd)
-            return -EIO;
-
-        if (offset < off + bmd->size) {
-            g_free (bmd);
-            break;
+    while (f->n_known < file->n_blocks && f->offsets[f->n_known] <= offset) {
+        blkid = file->blk_sha1s[f->n_known];
+        bmd = seaf_block_manager_stat_block (seaf->block_mgr,
+                                             f->store_id, f->version, blkid);
+        if (!bmd) {
+            seaf_warning ("Failed to stat block %s:%s.\n", f->store_id, blkid);
+            return -1;
         }
-
-        off += bmd->size;
+        f->offsets[f->n_known + 1] = f->offsets[f->n_known] + bmd->size;
+        ++f->n_known;
         g_free (bmd);
     }
 
-    /* beyond the file size */
-    if (i == file->n_blocks)
-        return 0;
+    if (offset >= f->offsets[f->n_known])
+        return file->n_blocks;
+
+    /* The last block starting at or before @offset. */
+    lo = 0;
+    hi = f->n_known - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (f->offsets[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static int // 打开第i个块，并定位到块内偏移@pos
+open_block_at (SeafileSession *seaf, SeafFuseFile *f, int i, gint64 pos)
+{
+    char *blkid = f->file->blk_sha1s[i];
+    char *skip_buf;
+    int n;
 
-    nleft = size;
-    ptr = buf;
-    while (nleft > 0 && i < file->n_blocks) {
-        blkid = file->blk_sha1s[i];
+    /* Without a descriptor the handle can only be read forward. */
+    if (f->cur == i && (f->fd >= 0 || pos >= f->pos))
+        goto skip;
 
-        handle = seaf_block_manager_open_block(seaf->block_mgr,
-                                               store_id, version,
+    close_cur_block (seaf, f);
+
+    f->handle = seaf_block_manager_open_block (seaf->block_mgr,
+                                               f->store_id, f->version,
                                                blkid, BLOCK_READ);
-        if (!handle) {
-            seaf_warning ("Failed to open block %s:%s.\n", store_id, blkid);
-            return -EIO;
+    if (!f->handle) {
+        seaf_warning ("Failed to open block %s:%s.\n", f->store_id, blkid);
+        return -1;
+    }
+    f->cur = i;
+    f->pos = 0;
+
+    /* A local file can be read at any offset. */
+    f->fd = seaf_block_manager_dup_block_fd (seaf->block_mgr, f->handle);
+    if (f->fd >= 0) {
+        seaf_block_manager_close_block (seaf->block_mgr, f->handle);
+        seaf_block_manager_block_handle_free (seaf->block_mgr, f->handle);
+        f->handle = NULL;
+    }
+
+skip:
+    if (f->fd >= 0) {
+        f->pos = pos;
+        return 0;
+    }
+
+    if (f->pos == pos)
+        return 0;
+
+    skip_buf = g_malloc (SKIP_BUF_SIZE);
+    while (f->pos < pos) {
+        n = seaf_block_manager_read_block (seaf->block_mgr, f->handle, skip_buf,
+                                           MIN (SKIP_BUF_SIZE, pos - f->pos));
+        if (n <= 0) {
+            seaf_warning ("Failed to read block %s:%s.\n", f->store_id, blkid);
+            g_free (skip_buf);
+            close_cur_block (seaf, f);
+            return -1;
+        }
+        f->pos += n;
+    }
+    g_free (skip_buf);
+
+    return 0;
+}
+
+/* Copies from the cached block. A random read only takes the block if
+ * it's cached, a sequential one reads it into the cache. Returns 0 if the
+ * block isn't cached. */
+static int // 从块缓存读
+read_cached (SeafileSession *seaf, SeafFuseFile *f, int i, gint64 pos,
+             char *ptr, gint64 len, gboolean sequential)
+{
+    char *blkid = f->file->blk_sha1s[i];
+    CachedBlock *b;
+
+    if (sequential)
+        b = block_cache_get (seaf->block_cache, f->store_id, f->version, blkid);
+    else
+        b = block_cache_lookup (seaf->block_cache, blkid);
+    if (!b) {
+        if (!sequential)
+            return 0;
+        seaf_warning ("Failed to read block %s:%s.\n", f->store_id, blkid);
+        return -1;
+    }
+
+    if (pos >= b->len) {
+        seaf_warning ("Block %s:%s is shorter than expected.\n", f->store_id, blkid);
+        cached_block_unref (b);
+        return -1;
+    }
+    len = MIN (len, b->len - pos);
+    memcpy (ptr, b->data + pos, len);
+    cached_block_unref (b);
+
+    return len;
+}
+
+static void // 预读当前块之后的块
+readahead (SeafileSession *seaf, SeafFuseFile *f, int i)
+{
+    int end = MIN (i + seaf->readahead_blocks, f->file->n_blocks - 1);
+    int j;
+
+    for (j = MAX (i + 1, f->ra_next); j <= end; ++j)
+        block_cache_prefetch (seaf->block_cache, f->store_id, f->version,
+                              f->file->blk_sha1s[j]);
+    f->ra_next = MAX (f->ra_next, end + 1);
+}
+
+/* Block offsets are looked up lazily and kept with the opened file, and
+ * the block being read is kept open, so a sequential read costs O(1) and
+ * a seek O(log n) once the offsets up to it are known.
+ *
+ * With the block cache, sequential reads go through it and the next
+ * blocks are prefetched in the background. */
+int read_file(SeafileSession *seaf,
+              SeafFuseFile *f,
+              char *buf, size_t size,
+              off_t offset) // 读文件
+{
+    char *ptr = buf;
+    size_t nleft = size;
+    gint64 pos, len;
+    int i = -1, n, ret = 0;
+    gboolean sequential;
+
+    pthread_mutex_lock (&f->lock);
+
+    /* A read starting where the last one ended is sequential. */
+    if (offset == f->next_offset) {
+        ++f->seq_reads;
+    } else {
+        f->seq_reads = 0;
+        f->ra_next = 0;
+    }
+    sequential = seaf->block_cache && f->seq_reads >= SEQ_READS_FOR_READAHEAD;
+
+    while (nleft > 0) {
+        i = find_block (seaf, f, offset);
+        if (i < 0) {
+            ret = -EIO;
+            break;
         }
+        /* beyond the file size */
+        if (i == f->file->n_blocks)
+            break;
 
-        /* trim the offset in a block */
-        if (offset > off) {
-            char *tmp = (char *)malloc(sizeof(char) * (offset - off));
-            if (!tmp)
-                return -ENOMEM;
-
-            n = seaf_block_manager_read_block(seaf->block_mgr, handle,
-                                              tmp, offset-off);
-            if (n != offset - off) {
-                seaf_warning ("Failed to read block %s:%s.\n", store_id, blkid);
-                free (tmp);
-                goto out;
+        pos = offset - f->offsets[i];
+        len = MIN ((gint64)nleft, f->offsets[i + 1] - offset);
+
+        if (seaf->block_cache) {
+            n = read_cached (seaf, f, i, pos, ptr, len, sequential);
+            if (n < 0) {
+                ret = -EIO;
+                break;
             }
+            if (n > 0)
+                goto next;
+        }
 
-            off += n;
-            free(tmp);
+        if (open_block_at (seaf, f, i, pos) < 0) {
+            ret = -EIO;
+            break;
         }
 
-        if ((n = seaf_block_manager_read_block(seaf->block_mgr,
-                                               handle, ptr, nleft)) < 0) {
-            seaf_warning ("Failed to read block %s:%s.\n", store_id, blkid);
-            goto out;
+        if (f->fd >= 0)
+            n = pread (f->fd, ptr, len, pos);
+        else
+            n = seaf_block_manager_read_block (seaf->block_mgr, f->handle, ptr, len);
+        if (n <= 0) {
+            seaf_warning ("Failed to read block %s:%s.\n",
+                          f->store_id, f->file->blk_sha1s[i]);
+            close_cur_block (seaf, f);
+            ret = -EIO;
+            break;
         }
 
+        f->pos += n;
+next:
         nleft -= n;
         ptr += n;
-        off += n;
-        ++i;
-
-        /* At this point we should have read all the content of the block or
-         * have read up to @size bytes. So it's safe to close the block.
-         */
-        seaf_block_manager_close_block(seaf->block_mgr, handle);
-        seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
+        offset += n;
     }
 
-    return size - nleft;
+    f->next_offset = offset;
+    if (sequential && i >= 0 && seaf->readahead_blocks > 0)
+        readahead (seaf, f, i);
 
-out:
-    if (handle) {
-        seaf_block_manager_close_block(seaf->block_mgr, handle);
-        seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
-    }
-    return ret;
+    pthread_mutex_unlock (&f->lock);
+
+    return ret < 0 ? ret : (int)(size - nleft);
 }
@@ -19,6 +19,9 @@
 
 SeafileSession *seaf = NULL;
 
+/* Block cache counters, readable as a file. Not listed in the root. */
+#define STATS_PATH "/.seaf-fuse-stats"
+
 static char *parse_repo_id (const char *repo_id_name) // 复制一个repo_id
 {
     if (strlen(repo_id_name) < 36)
@@ -84,6 +87,15 @@ int parse_fuse_path (const char *path,
 static int seaf_fuse_getattr(const char *path, struct stat *stbuf) // 获取属性至状态缓冲
 {
     memset(stbuf, 0, sizeof(struct stat));
+
+    if (seaf->block_cache && strcmp (path, STATS_PATH) == 0) {
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        /* The content is generated on read, direct_io ignores the size. */
+        stbuf->st_size = 4096;
+        return 0;
+    }
+
     return do_getattr(seaf, path, stbuf);
 }
 
@@ -104,6 +116,8 @@ static int seaf_fuse_open(const char *path, struct fuse_file_info *info) // 给
     SeafRepo *repo = NULL;
     SeafBranch *branch = NULL; // HEAD指向的分支
     SeafCommit *commit = NULL; // 获取分支对应的提交
+    Seafile *file = NULL;
+    char *id = NULL;
     guint32 mode = 0;
     int ret = 0;
 
@@ -111,6 +125,12 @@ static int seaf_fuse_open(const char *path, struct fuse_file_info *info) // 给
     if ((info->flags & 3) != O_RDONLY)
         return -EACCES;
 
+    if (seaf->block_cache && strcmp (path, STATS_PATH) == 0) {
+        info->direct_io = 1;
+        info->fh = 0;
+        return 0;
+    }
+
     if (parse_fuse_path (path, &n_parts, &user, &repo_id, &repo_path) < 0) {
         seaf_warning ("Invalid input path %s.\n", path);
         return -ENOENT;
@@ -140,103 +160,95 @@ static int seaf_fuse_open(const char *path, struct fuse_file_info *info) // 给
         goto out;
     }
 
-    char *id = seaf_fs_manager_path_to_obj_id(seaf->fs_mgr,
-                                              repo->store_id, repo->version,
-                                              commit->root_id,
-                                              repo_path, &mode, NULL);
+    id = seaf_fs_manager_path_to_obj_id(seaf->fs_mgr,
+                                        repo->store_id, repo->version,
+                                        commit->root_id,
+                                        repo_path, &mode, NULL);
     if (!id) {
         seaf_warning ("Path %s doesn't exist in repo %s.\n", repo_path, repo_id);
         ret = -ENOENT;
         goto out;
     }
-    g_free (id);
 
-    if (!S_ISREG(mode))
-        return -EACCES;
+    if (!S_ISREG(mode)) {
+        ret = -EACCES;
+        goto out;
+    }
+
+    /* The file is resolved once here, reads go through info->fh. */
+    file = seaf_fs_manager_get_seafile(seaf->fs_mgr,
+                                       repo->store_id, repo->version, id);
+    if (!file) {
+        ret = -ENOENT;
+        goto out;
+    }
+    info->fh = (uint64_t)(uintptr_t)seaf_fuse_file_new (repo->store_id,
+                                                        repo->version, file);
 
 out:
     g_free (user);
     g_free (repo_id);
     g_free (repo_path);
+    g_free (id);
     seaf_repo_unref (repo);
     seaf_commit_unref (commit);
     return ret;
 }
 
-static int seaf_fuse_read(const char *path, char *buf, size_t size,
-                          off_t offset, struct fuse_file_info *info) // 给出一个fuse路径，然后读文件内容
+static int read_stats (char *buf, size_t size, off_t offset) // 读块缓存统计
 {
-    int n_parts;
-    char *user, *repo_id, *repo_path;
-    SeafRepo *repo = NULL;
-    SeafBranch *branch = NULL;
-    SeafCommit *commit = NULL;
-    Seafile *file = NULL;
-    char *file_id = NULL;
-    int ret = 0;
+    char *stats = block_cache_format_stats (seaf->block_cache);
+    size_t len = strlen (stats);
+
+    if (offset >= (off_t)len) {
+        size = 0;
+    } else {
+        size = MIN (size, len - offset);
+        memcpy (buf, stats + offset, size);
+    }
+    g_free (stats);
 
-    /* Now we only support read-only mode */
-    if ((info->flags & 3) != O_RDONLY)
-        return -EACCES;
+    return size;
+}
 
-    if (parse_fuse_path (path, &n_parts, &user, &repo_id, &repo_path) < 0) {
-        seaf_warning ("Invalid input path %s.\n", path);
-        return -ENOENT;
-    }
+static int seaf_fuse_read(const char *path, char *buf, size_t size,
+                          off_t offset, struct fuse_file_info *info) // 读已打开的文件
+{
+    SeafFuseFile *f = (SeafFuseFile *)(uintptr_t)info->fh;
 
-    if (n_parts != 2 && n_parts != 3) {
-        seaf_warning ("Invalid input path for open: %s.\n", path);
-        ret = -EACCES;
-        goto out;
-    }
+    if (!f && seaf->block_cache && strcmp (path, STATS_PATH) == 0)
+        return read_stats (buf, size, offset);
+    if (!f)
+        return -EBADF;
 
-    repo = seaf_repo_manager_get_repo(seaf->repo_mgr, repo_id);
-    if (!repo) {
-        seaf_warning ("Failed to get repo %s.\n", repo_id);
-        ret = -ENOENT;
-        goto out;
-    }
+    return read_file(seaf, f, buf, size, offset);
+}
 
-    branch = repo->head;
-    commit = seaf_commit_manager_get_commit(seaf->commit_mgr,
-                                            repo->id,
-                                            repo->version,
-                                            branch->commit_id);
-    if (!commit) {
-        seaf_warning ("Failed to get commit %s:%.8s.\n", repo->id, branch->commit_id);
-        ret = -ENOENT;
-        goto out;
-    }
+static int seaf_fuse_release(const char *path, struct fuse_file_info *info) // 关闭文件
+{
+    seaf_fuse_file_free (seaf, (SeafFuseFile *)(uintptr_t)info->fh);
+    info->fh = 0;
+    return 0;
+}
 
-    file_id = seaf_fs_manager_get_seafile_id_by_path(seaf->fs_mgr,
-                                                     repo->store_id, repo->version,
-                                                     commit->root_id,
-                                                     repo_path, NULL);
-    if (!file_id) {
-        seaf_warning ("Path %s doesn't exist in repo %s.\n", repo_path, repo_id);
-        ret = -ENOENT;
-        goto out;
-    }
+/* Runs after fuse_main has daemonized. Threads created before the fork
+ * would not exist in the daemon, so background threads start here. */
+static void *seaf_fuse_init(struct fuse_conn_info *conn) // 挂载后启动后台线程
+{
+    seafile_session_start (seaf);
+    return NULL;
+}
 
-    file = seaf_fs_manager_get_seafile(seaf->fs_mgr,
-                                       repo->store_id, repo->version, file_id);
-    if (!file) {
-        ret = -ENOENT;
-        goto out;
-    }
+static void seaf_fuse_destroy(void *data) // 卸载时记录块缓存统计
+{
+    char *stats;
 
-    ret = read_file(seaf, repo->store_id, repo->version,
-                    file, buf, size, offset, info);
-    seafile_unref (file);
+    if (!seaf->block_cache)
+        return;
 
-out:
-    g_free (user);
-    g_free (repo_id);
-    g_free (repo_path);
-    g_free (file_id);
-    seaf_repo_unref (repo);
-    seaf_commit_unref (commit);
-    return ret;
+    stats = block_cache_format_stats (seaf->block_cache);
+    seaf_message ("Block cache stats:\n%s", stats);
+    g_free (stats);
 }
 
 struct options { // 选项
@@ -275,6 +287,9 @@ static struct fuse_operations seaf_fuse_ops = { // fuse操作
     .readdir = seaf_fuse_readdir,
     .open    = seaf_fuse_open,
     .read    = seaf_fuse_read,
+    .release = seaf_fuse_release,
+    .init = seaf_fuse_init,
+    .destroy = seaf_fuse_destroy,
 };
 
 int main(int argc, char *argv[]) // fuse独立程序
@@ -297,6 +312,10 @@ int main(int argc, char *argv[]) // fuse独立程序
     }
 
     g_type_init();
+#if !GLIB_CHECK_VERSION(2,32,0)
+    /* The block cache prefetches on a thread pool. */
+    g_thread_init (NULL);
+#endif
 
     config_dir = options.config_dir ? : DEFAULT_CONFIG_DIR;
     config_dir = ccnet_expand_path (config_dir);
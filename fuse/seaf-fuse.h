@@ -1,6 +1,8 @@
 #ifndef SEAF_FUSE_H
 #define SEAF_FUSE_H
 
+#include <pthread.h>
+
 #include "seafile-session.h"
 
 int parse_fuse_path (const char *path,
@@ -14,9 +16,38 @@ fuse_get_dirent_by_path (SeafFSManager *mgr,
                          const char *path);
 
 /* file.c */
-int read_file(SeafileSession *seaf, const char *store_id, int version,
-              Seafile *file, char *buf, size_t size,
-              off_t offset, struct fuse_file_info *info); // 读文件
+
+/* An opened file, kept in fuse_file_info->fh. */
+typedef struct SeafFuseFile {
+    char store_id[37];
+    int version;
+    Seafile *file;
+    /* offsets[i] is where block i starts. Only offsets[0..n_known] are
+     * known, blocks are stat'ed as reads get to them. */
+    gint64 *offsets;
+    int n_known;
+    /* The block read last is kept open: with a local descriptor if the
+     * backend has one, otherwise with a handle read at pos. */
+    int cur; // -1表示没有打开的块
+    BlockHandle *handle;
+    int fd;
+    gint64 pos;
+    /* Readahead state: where the last read ended, how many reads in a row
+     * were sequential, and the first block not prefetched yet. */
+    gint64 next_offset;
+    int seq_reads;
+    int ra_next;
+    pthread_mutex_t lock;
+} SeafFuseFile;
+
+SeafFuseFile * // 打开文件；接管@file的引用
+seaf_fuse_file_new (const char *store_id, int version, Seafile *file);
+
+void // 关闭文件
+seaf_fuse_file_free (SeafileSession *seaf, SeafFuseFile *f);
+
+int read_file(SeafileSession *seaf, SeafFuseFile *f,
+              char *buf, size_t size, off_t offset); // 读文件
 
 /* getattr.c */
 int do_getattr(SeafileSession *seaf, const char *path, struct stat *stbuf); // 获取状态
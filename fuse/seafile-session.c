@@ -12,6 +12,10 @@
 
 #include "log.h"
 
+#define DEFAULT_BLOCK_CACHE_SIZE 256 // MB
+#define DEFAULT_READAHEAD_BLOCKS 4
+#define DEFAULT_READAHEAD_THREADS 2
+
 static int
 read_excluded_users (SeafileSession *session);
 
@@ -169,6 +173,49 @@ read_excluded_users (SeafileSession *session)
     return 0;
 }
 
+static int // 读取配置的整数，没有配置时用默认值
+get_fuse_int_config (GKeyFile *config, const char *key, int default_value)
+{
+    GError *error = NULL;
+    int value;
+
+    value = g_key_file_get_integer (config, "fuse", key, &error);
+    if (error) {
+        g_clear_error (&error);
+        return default_value;
+    }
+    return value;
+}
+
+static void // 创建块缓存
+init_block_cache (SeafileSession *session)
+{
+    gint64 cache_size;
+    int n_threads;
+
+    cache_size = get_fuse_int_config (session->config, "block_cache_size",
+                                      DEFAULT_BLOCK_CACHE_SIZE);
+    session->readahead_blocks = get_fuse_int_config (session->config,
+                                                     "readahead_blocks",
+                                                     DEFAULT_READAHEAD_BLOCKS);
+    n_threads = get_fuse_int_config (session->config, "readahead_threads",
+                                     DEFAULT_READAHEAD_THREADS);
+    if (cache_size <= 0) {
+        seaf_message ("Block cache is disabled.\n");
+        return;
+    }
+    if (session->readahead_blocks < 0)
+        session->readahead_blocks = 0;
+    if (session->readahead_blocks == 0)
+        n_threads = 0;
+
+    session->block_cache = block_cache_new (session->block_mgr,
+                                            cache_size << 20, n_threads);
+    seaf_message ("Block cache size is %"G_GINT64_FORMAT" MB, "
+                  "readahead %d blocks with %d threads.\n",
+                  cache_size, session->readahead_blocks, n_threads);
+}
+
 int // 初始化
 seafile_session_init (SeafileSession *session)
 {
@@ -194,11 +241,16 @@ seafile_session_init (SeafileSession *session)
         return -1;
     }
 
+    init_block_cache (session);
+
     return 0;
 }
 
 int
 seafile_session_start (SeafileSession *session)
 {
+    if (session->block_cache)
+        block_cache_start_prefetch (session->block_cache);
+
     return 0;
 }
@@ -15,6 +15,7 @@
 #include "user-mgr.h"
 #include "group-mgr.h"
 #include "org-mgr.h"
+#include "block-cache.h"
 
 typedef struct _SeafileSession SeafileSession;
 
@@ -39,6 +40,10 @@ struct _SeafileSession {
 
     GHashTable          *excluded_users;
 
+    /* NULL if the block cache is disabled. */
+    BlockCache          *block_cache;
+    int                  readahead_blocks;
+
     gboolean create_tables;
     gboolean ccnet_create_tables;
 };
@@ -1134,6 +1134,15 @@ seafile_publish_event(const char *channel, const char *content, GError **error);
 json_t *
 seafile_pop_event(const char *channel, GError **error);
 
+json_t *
+seafile_get_dir_cache_stats (GError **error);
+
+json_t *
+seafile_get_commit_cache_stats (GError **error);
+
+json_t *
+seafile_get_db_pool_stats (GError **error);
+
 GList *
 seafile_search_files (const char *repo_id, const char *str, GError **error);
 
@@ -1231,6 +1240,12 @@ ccnet_rpc_quit_group (int group_id, const char *user_name, GError **error);
 GList *
 ccnet_rpc_get_groups (const char *username, int return_ancestors, GError **error);
 
+/**
+ * Return ids of the groups the user is in and of their ancestors, as a json array.
+ */
+json_t *
+ccnet_rpc_get_user_group_ids (const char *username, GError **error);
+
 GList *
 ccnet_rpc_list_all_departments (GError **error);
 
@@ -5,9 +5,14 @@
 #include <limits.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <openssl/sha.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "bloom-filter.h"
 
 #define SETBIT(a, n) (a[n/CHAR_BIT] |= (1<<(n%CHAR_BIT))) // 将a的第n位设为1
@@ -61,9 +66,16 @@ incr_bit (Bloom *bf, unsigned int bit_idx) // 过滤器的第bit_idx位加一
     unsigned int high;
     unsigned int low;
 
-    SETBIT (bf->a, bit_idx); // 将bitvec的第bit_idx位设为1
+    if (!bf->counting) {
+        /* Set the bit atomically, so that non-counting filters can be
+         * populated from multiple threads.
+         */
+        __sync_fetch_and_or (&bf->a[bit_idx / CHAR_BIT],
+                             (unsigned char)(1 << (bit_idx % CHAR_BIT)));
+        return;
+    }
 
-    if (!bf->counting) return;
+    SETBIT (bf->a, bit_idx); // 将bitvec的第bit_idx位设为1
 
     // 计数器是16位的，每半个字节(4bit)代表一个计数器
     // 要获取bit_idx所对应的计数器，先计算该计数器所在的字节，再判断它是字节的高四位还是低四位
@@ -179,3 +191,222 @@ int bloom_test(Bloom *bloom, const char *s) // 检测key，存在则返回1，
 
     return 1;
 }
+
+/* Blocked bloom filter. */
+
+#define BLOCK_WORDS 8 // 每块的64位字数
+#define BLOCK_BITS (BLOCK_WORDS * 64) // 每块的位数
+#define MAX_K 16
+
+/* Bit positions in a block are the top 9 bits of successive multiplicative
+ * hashes of the seed. Double hashing (h1 + i * h2) within a 512-bit
+ * block is visibly less accurate. */
+#define NEXT_BIT(seed) (((seed) = (seed) * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL) >> 55)
+
+/* Decode the first 16 bytes of a hex id. */
+static inline void // 十六进制id转字节
+decode_id (const char *id, unsigned char raw[16])
+{
+#ifdef __SSE2__
+    /* '0'-'9' are 0x30-0x39, 'a'-'f' and 'A'-'F' have bit 6 set, so the
+     * value of a digit is (c & 0xF) + 9 * ((c >> 6) & 1).
+     */
+    const __m128i lo_nibble = _mm_set1_epi8 (0x0F);
+    const __m128i one = _mm_set1_epi8 (1);
+    const __m128i nine = _mm_set1_epi8 (9);
+    const __m128i low_byte = _mm_set1_epi16 (0x00FF);
+    __m128i c, v, alpha, hi, out[2];
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        c = _mm_loadu_si128 ((const __m128i *)(id + 16 * i));
+        alpha = _mm_and_si128 (_mm_srli_epi16 (c, 6), one);
+        v = _mm_add_epi8 (_mm_and_si128 (c, lo_nibble),
+                          _mm_and_si128 (_mm_sub_epi8 (_mm_setzero_si128 (), alpha), nine));
+        /* Each 16-bit lane holds a high digit in the low byte and a low
+         * digit in the high byte. */
+        hi = _mm_slli_epi16 (_mm_and_si128 (v, low_byte), 4);
+        out[i] = _mm_or_si128 (hi, _mm_srli_epi16 (v, 8));
+    }
+    _mm_storeu_si128 ((__m128i *)raw, _mm_packus_epi16 (out[0], out[1]));
+#else
+    int i;
+    unsigned char h, l;
+
+    for (i = 0; i < 16; ++i) {
+        h = id[2 * i];
+        l = id[2 * i + 1];
+        raw[i] = (((h & 0xF) + 9 * ((h >> 6) & 1)) << 4) |
+                 ((l & 0xF) + 9 * ((l >> 6) & 1));
+    }
+#endif
+}
+
+/* High 64 bits of the 128-bit product of @a and @b. */
+static inline uint64_t
+mul_high64 (uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+    return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+/* Returns the block of @id, and the seed of its bit positions. */
+static inline uint64_t * // 定位key所在的块
+locate_block (BlockedBloom *bloom, const char *id, uint64_t *seed)
+{
+    unsigned char raw[16];
+    uint64_t block_hash;
+
+    decode_id (id, raw);
+    memcpy (&block_hash, raw, 8);
+    memcpy (seed, raw + 8, 8);
+
+    /* Map the hash to [0, n_blocks) without a division. */
+    return bloom->blocks +
+        mul_high64 (block_hash, bloom->n_blocks) * BLOCK_WORDS;
+}
+
+void blocked_bloom_add (BlockedBloom *bloom, const char *id) // 增加key
+{
+    uint64_t *block, mask, seed;
+    unsigned int bit;
+    int i;
+
+    block = locate_block (bloom, id, &seed);
+    for (i = 0; i < bloom->k; ++i) {
+        bit = NEXT_BIT (seed);
+        mask = (uint64_t)1 << (bit % 64);
+        /* Skip the atomic operation, and invalidating the cache line on
+         * other cores, when the bit is already set. */
+        if (!(__atomic_load_n (&block[bit / 64], __ATOMIC_RELAXED) & mask))
+            __atomic_fetch_or (&block[bit / 64], mask, __ATOMIC_RELAXED);
+    }
+}
+
+int blocked_bloom_test (BlockedBloom *bloom, const char *id) // 检测key，存在则返回1，否则返回0
+{
+    uint64_t *block, seed;
+    unsigned int bit;
+    int i;
+
+    block = locate_block (bloom, id, &seed);
+    for (i = 0; i < bloom->k; ++i) {
+        bit = NEXT_BIT (seed);
+        if (!(__atomic_load_n (&block[bit / 64], __ATOMIC_RELAXED) &
+              ((uint64_t)1 << (bit % 64))))
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Expected false positive rate of a blocked bloom filter. The number of
+ * keys in a block follows a Poisson distribution with mean n/n_blocks, a
+ * block with j keys has a false positive rate of (1-(1-1/512)^(kj))^k.
+ */
+static double // 计算期望的假阳性率
+expected_fpr (uint64_t n_keys, uint64_t n_blocks, int k)
+{
+    double lambda = (double)n_keys / n_blocks;
+    double p = exp (-lambda); // j = 0的概率
+    double fpr = 0.0;
+    int j, max_j = (int)(lambda + 10 * sqrt (lambda) + 10);
+
+    for (j = 0; j <= max_j; ++j) {
+        if (j > 0)
+            p *= lambda / j;
+        fpr += p * pow (1.0 - pow (1.0 - 1.0 / BLOCK_BITS, (double)k * j), k);
+    }
+
+    return fpr;
+}
+
+BlockedBloom *blocked_bloom_create (uint64_t n_keys, double fpr, size_t max_bytes)
+{
+    BlockedBloom *bloom;
+    uint64_t n_blocks, max_blocks = 0;
+    double bits_per_key;
+    int k;
+
+    if (n_keys == 0)
+        n_keys = 1;
+    if (fpr <= 0.0 || fpr >= 1.0)
+        return NULL;
+
+    /* Start from the size of a standard bloom filter, then grow it until
+     * the blocked layout, which is a bit less accurate, meets @fpr. */
+    bits_per_key = -log (fpr) / (M_LN2 * M_LN2);
+    n_blocks = (uint64_t)(bits_per_key * n_keys / BLOCK_BITS) + 1;
+    if (max_bytes > 0)
+        max_blocks = max_bytes / (BLOCK_WORDS * sizeof(uint64_t));
+    if (max_blocks == 0)
+        max_blocks = 1;
+
+    for (;;) {
+        if (max_bytes > 0 && n_blocks >= max_blocks) {
+            n_blocks = max_blocks;
+            k = (int)(M_LN2 * n_blocks * BLOCK_BITS / n_keys + 0.5);
+            break;
+        }
+        k = (int)(M_LN2 * n_blocks * BLOCK_BITS / n_keys + 0.5);
+        k = k < 1 ? 1 : (k > MAX_K ? MAX_K : k);
+        if (expected_fpr (n_keys, n_blocks, k) <= fpr)
+            break;
+        n_blocks += n_blocks / 20 + 1;
+    }
+    k = k < 1 ? 1 : (k > MAX_K ? MAX_K : k);
+
+    if ( !(bloom = malloc (sizeof(BlockedBloom))) ) return NULL;
+    /* Align blocks to cache lines. */
+    if (posix_memalign ((void **)&bloom->blocks, 64,
+                        n_blocks * BLOCK_WORDS * sizeof(uint64_t)) != 0) {
+        free (bloom);
+        return NULL;
+    }
+    memset (bloom->blocks, 0, n_blocks * BLOCK_WORDS * sizeof(uint64_t));
+    bloom->n_blocks = n_blocks;
+    bloom->k = k;
+
+    return bloom;
+}
+
+void blocked_bloom_destroy (BlockedBloom *bloom) // 销毁
+{
+    free (bloom->blocks);
+    free (bloom);
+}
+
+size_t blocked_bloom_size (BlockedBloom *bloom) // 占用的字节数
+{
+    return bloom->n_blocks * BLOCK_WORDS * sizeof(uint64_t);
+}
+
+double blocked_bloom_fpr (BlockedBloom *bloom) // 估计当前的假阳性率
+{
+    uint64_t i, *block;
+    int j, n_set;
+    double sum = 0.0;
+
+    /* A random key hits a block with (n_set/512)^k probability. The k
+     * positions aren't quite independent, but close enough for an estimate. */
+    for (i = 0; i < bloom->n_blocks; ++i) {
+        block = bloom->blocks + i * BLOCK_WORDS;
+        n_set = 0;
+        for (j = 0; j < BLOCK_WORDS; ++j)
+            n_set += __builtin_popcountll (block[j]);
+        sum += pow ((double)n_set / BLOCK_BITS, bloom->k);
+    }
+
+    return sum / bloom->n_blocks;
+}
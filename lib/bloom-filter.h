@@ -5,6 +5,7 @@
 #define __BLOOM_H__
 
 #include <stdlib.h>
+#include <stdint.h>
 
 typedef struct {
     size_t          asize; // bitvec(比特向量)大小
@@ -17,8 +18,34 @@ typedef struct {
 
 Bloom *bloom_create (size_t size, int k, int counting); // 创建 (k表示哈希个数(0<k<=4)、counting表示是否是计数布隆过滤器)
 int bloom_destroy (Bloom *bloom); // 销毁
+/* For non-counting filters, bloom_add() and bloom_test() can be called
+ * from multiple threads concurrently. */
 int bloom_add (Bloom *bloom, const char *s); // 增加key
 int bloom_remove (Bloom *bloom, const char *s); // 移除key
 int bloom_test (Bloom *bloom, const char *s); // 检测key，存在则返回1，否则返回0
 
+/*
+ * Blocked bloom filter for 40-char hex SHA1 ids, e.g. block ids.
+ *
+ * All bits of a key fall into one 64-byte (cache line sized) block, so an
+ * add or a test costs a single cache miss. Ids are SHA1 hashes already,
+ * their bytes are used as hash values directly instead of hashing them
+ * again. Adds and tests can be called from multiple threads concurrently.
+ */
+typedef struct {
+    uint64_t       *blocks; // 每个块8个64位字，共512位
+    uint64_t        n_blocks; // 块数
+    int             k; // 每个key设置的位数
+} BlockedBloom;
+
+/* Size the filter for @n_keys keys with false positive rate @fpr.
+ * The filter is not larger than @max_bytes if it's > 0. */
+BlockedBloom *blocked_bloom_create (uint64_t n_keys, double fpr, size_t max_bytes); // 创建
+void blocked_bloom_destroy (BlockedBloom *bloom); // 销毁
+void blocked_bloom_add (BlockedBloom *bloom, const char *id); // 增加key
+int blocked_bloom_test (BlockedBloom *bloom, const char *id); // 检测key，存在则返回1，否则返回0
+size_t blocked_bloom_size (BlockedBloom *bloom); // 占用的字节数
+/* Estimated false positive rate of the filter in its current state. */
+double blocked_bloom_fpr (BlockedBloom *bloom); // 估计当前的假阳性率
+
 #endif
@@ -0,0 +1,264 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* 分片LRU缓存（线程安全） */
+
+#include <string.h>
+#include <pthread.h>
+
+#include "lru-cache.h"
+
+typedef struct CacheEntry { // 缓存项
+    char           *key;
+    gpointer        value;
+    gint64          size; // 大小
+    gint            ref_count; // 引用计数；缓存本身持有一个引用
+    GList          *lru_link; // 在LRU链表中的位置
+    GDestroyNotify  free_func;
+} CacheEntry;
+
+typedef struct CacheShard { // 缓存分片
+    pthread_mutex_t lock;
+    GHashTable     *entries; // key -> CacheEntry
+    GQueue         *lru; // 头部为最近使用
+    gint64          size; // 当前大小
+    gint64          max_entries; // 项数上限；0表示不限
+    gint64          max_size; // 大小上限；0表示不限
+
+    gint64          hits;
+    gint64          misses;
+    gint64          evictions;
+} CacheShard;
+
+struct _LRUCache {
+    int             n_shards;
+    CacheShard     *shards;
+    GBoxedCopyFunc  copy_func;
+    GDestroyNotify  free_func;
+};
+
+static void // 释放缓存项引用
+cache_entry_unref (CacheEntry *entry)
+{
+    if (!g_atomic_int_dec_and_test (&entry->ref_count))
+        return;
+
+    g_free (entry->key);
+    if (entry->free_func)
+        entry->free_func (entry->value);
+    g_free (entry);
+}
+
+LRUCache *
+lru_cache_new (int n_shards,
+               gint64 max_entries,
+               gint64 max_size,
+               GBoxedCopyFunc copy_func,
+               GDestroyNotify free_func)
+{
+    LRUCache *cache;
+    CacheShard *shard;
+    int i;
+
+    g_return_val_if_fail (n_shards > 0 && copy_func != NULL, NULL);
+
+    cache = g_new0 (LRUCache, 1);
+    cache->n_shards = n_shards;
+    cache->shards = g_new0 (CacheShard, n_shards);
+    cache->copy_func = copy_func;
+    cache->free_func = free_func;
+
+    for (i = 0; i < n_shards; ++i) {
+        shard = &cache->shards[i];
+        pthread_mutex_init (&shard->lock, NULL);
+        shard->entries = g_hash_table_new (g_str_hash, g_str_equal);
+        shard->lru = g_queue_new ();
+        /* Round up so that small limits don't end up as "no limit". */
+        if (max_entries > 0)
+            shard->max_entries = (max_entries + n_shards - 1) / n_shards;
+        if (max_size > 0)
+            shard->max_size = (max_size + n_shards - 1) / n_shards;
+    }
+
+    return cache;
+}
+
+void
+lru_cache_free (LRUCache *cache)
+{
+    CacheShard *shard;
+    int i;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < cache->n_shards; ++i) {
+        shard = &cache->shards[i];
+        g_queue_free_full (shard->lru, (GDestroyNotify)cache_entry_unref);
+        g_hash_table_destroy (shard->entries);
+        pthread_mutex_destroy (&shard->lock);
+    }
+    g_free (cache->shards);
+    g_free (cache);
+}
+
+static CacheShard * // 根据键选择分片
+get_shard (LRUCache *cache, const char *key)
+{
+    /* Scramble the hash a bit so that the shard index and the bucket index
+     * inside the shard's hash table are not derived from the same bits.
+     */
+    guint hash = g_str_hash (key) * 2654435761U;
+
+    return &cache->shards[(hash >> 16) % cache->n_shards];
+}
+
+/* Must be called with shard->lock held. */
+static void // 从分片中摘除缓存项
+shard_remove_entry (CacheShard *shard, CacheEntry *entry)
+{
+    g_queue_delete_link (shard->lru, entry->lru_link);
+    g_hash_table_remove (shard->entries, entry->key);
+    shard->size -= entry->size;
+    cache_entry_unref (entry);
+}
+
+gpointer
+lru_cache_lookup (LRUCache *cache, const char *key)
+{
+    CacheShard *shard = get_shard (cache, key);
+    CacheEntry *entry;
+    gpointer ret;
+
+    pthread_mutex_lock (&shard->lock);
+
+    entry = g_hash_table_lookup (shard->entries, key);
+    if (!entry) {
+        ++shard->misses;
+        pthread_mutex_unlock (&shard->lock);
+        return NULL;
+    }
+
+    ++shard->hits;
+    g_atomic_int_inc (&entry->ref_count);
+    /* Move to the front of the LRU list. */
+    g_queue_unlink (shard->lru, entry->lru_link);
+    g_queue_push_head_link (shard->lru, entry->lru_link);
+
+    pthread_mutex_unlock (&shard->lock);
+
+    ret = cache->copy_func (entry->value);
+    cache_entry_unref (entry);
+
+    return ret;
+}
+
+static gboolean // 分片是否超出上限
+shard_over_limit (CacheShard *shard, gint64 extra_size)
+{
+    if (shard->max_entries > 0 &&
+        g_hash_table_size (shard->entries) + 1 > shard->max_entries)
+        return TRUE;
+    if (shard->max_size > 0 && shard->size + extra_size > shard->max_size)
+        return TRUE;
+    return FALSE;
+}
+
+void
+lru_cache_insert (LRUCache *cache, const char *key, gpointer value, gint64 size)
+{
+    CacheShard *shard = get_shard (cache, key);
+    CacheEntry *entry, *victim;
+    GList *link;
+
+    entry = g_new0 (CacheEntry, 1);
+    entry->key = g_strdup (key);
+    entry->value = value;
+    entry->size = size;
+    entry->ref_count = 1;
+    entry->free_func = cache->free_func;
+
+    /* Too large to be cached at all. */
+    if (shard->max_size > 0 && size > shard->max_size) {
+        cache_entry_unref (entry);
+        return;
+    }
+
+    pthread_mutex_lock (&shard->lock);
+
+    /* Another thread may have inserted the same key meanwhile. */
+    if (g_hash_table_lookup (shard->entries, key) != NULL) {
+        pthread_mutex_unlock (&shard->lock);
+        cache_entry_unref (entry);
+        return;
+    }
+
+    while (shard_over_limit (shard, size) &&
+           (link = g_queue_peek_tail_link (shard->lru)) != NULL) { // 淘汰最久未使用的项
+        victim = link->data;
+        shard_remove_entry (shard, victim);
+        ++shard->evictions;
+    }
+
+    g_queue_push_head (shard->lru, entry);
+    entry->lru_link = g_queue_peek_head_link (shard->lru);
+    g_hash_table_insert (shard->entries, entry->key, entry);
+    shard->size += size;
+
+    pthread_mutex_unlock (&shard->lock);
+}
+
+void
+lru_cache_remove (LRUCache *cache, const char *key)
+{
+    CacheShard *shard = get_shard (cache, key);
+    CacheEntry *entry;
+
+    pthread_mutex_lock (&shard->lock);
+    entry = g_hash_table_lookup (shard->entries, key);
+    if (entry)
+        shard_remove_entry (shard, entry);
+    pthread_mutex_unlock (&shard->lock);
+}
+
+void
+lru_cache_remove_by_prefix (LRUCache *cache, const char *prefix)
+{
+    CacheShard *shard;
+    CacheEntry *entry;
+    GList *ptr, *next;
+    size_t len = strlen (prefix);
+    int i;
+
+    for (i = 0; i < cache->n_shards; ++i) {
+        shard = &cache->shards[i];
+        pthread_mutex_lock (&shard->lock);
+        for (ptr = shard->lru->head; ptr; ptr = next) {
+            next = ptr->next;
+            entry = ptr->data;
+            if (strncmp (entry->key, prefix, len) == 0)
+                shard_remove_entry (shard, entry);
+        }
+        pthread_mutex_unlock (&shard->lock);
+    }
+}
+
+void
+lru_cache_get_stats (LRUCache *cache, LRUCacheStats *stats)
+{
+    CacheShard *shard;
+    int i;
+
+    memset (stats, 0, sizeof(LRUCacheStats));
+
+    for (i = 0; i < cache->n_shards; ++i) {
+        shard = &cache->shards[i];
+        pthread_mutex_lock (&shard->lock);
+        stats->n_entries += g_hash_table_size (shard->entries);
+        stats->size += shard->size;
+        stats->max_entries += shard->max_entries;
+        stats->max_size += shard->max_size;
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        pthread_mutex_unlock (&shard->lock);
+    }
+}
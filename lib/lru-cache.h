@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* 分片LRU缓存（线程安全） */
+
+/**
+ * A bounded, thread-safe LRU cache keyed by strings.
+ *
+ * The cache is split into shards, each protected by its own mutex, so that
+ * lookups from different threads rarely contend on the same lock. It can be
+ * bounded by number of entries, by total size in bytes, or both.
+ *
+ * Values are owned by the cache. A lookup never returns the cached value
+ * itself but the result of @copy_func on it: this can be a deep copy for
+ * mutable objects, or just a ref for immutable refcounted ones (e.g.
+ * g_bytes_ref). Entries are refcounted internally, so the copy is made
+ * outside the shard lock and is safe against concurrent eviction.
+ */
+
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <glib.h>
+
+typedef struct _LRUCache LRUCache; // 缓存
+
+typedef struct _LRUCacheStats { // 统计信息
+    gint64 n_entries; // 当前项数
+    gint64 size; // 当前大小
+    gint64 max_entries; // 项数上限
+    gint64 max_size; // 大小上限
+    gint64 hits; // 命中次数
+    gint64 misses; // 未命中次数
+    gint64 evictions; // 淘汰次数
+} LRUCacheStats;
+
+/*
+ * @max_entries and @max_size are limits for the whole cache, 0 means no
+ * limit on that dimension.
+ */
+LRUCache * // 创建缓存
+lru_cache_new (int n_shards,
+               gint64 max_entries,
+               gint64 max_size,
+               GBoxedCopyFunc copy_func,
+               GDestroyNotify free_func);
+
+void // 销毁缓存
+lru_cache_free (LRUCache *cache);
+
+/* Returns copy_func(value), or NULL if @key is not cached. */
+gpointer // 查找
+lru_cache_lookup (LRUCache *cache, const char *key);
+
+/*
+ * Takes ownership of @value. @size is the caller's estimate of the memory
+ * used by @value. If @key is already cached, @value is freed.
+ */
+void // 插入
+lru_cache_insert (LRUCache *cache, const char *key, gpointer value, gint64 size);
+
+void // 删除
+lru_cache_remove (LRUCache *cache, const char *key);
+
+void // 删除所有以prefix开头的项
+lru_cache_remove_by_prefix (LRUCache *cache, const char *prefix);
+
+void // 获取统计信息
+lru_cache_get_stats (LRUCache *cache, LRUCacheStats *stats);
+
+#endif
@@ -106,5 +106,6 @@ func_table = [
     [ "object", ["string", "string", "string", "int"] ],
     [ "object", ["string", "string", "string", "string", "string", "string", "string", "int", "int"] ],
     [ "object", ["string", "string", "string", "string", "string", "string", "int", "string", "int", "int"] ],
+    ["json", []],
     ["json", ["string"]],
 ]
@@ -0,0 +1,642 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* 批量计算SHA1（多缓冲区并行） */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <openssl/sha.h>
+
+#include "sha1-batch.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#define MAX_LANES 16
+#define BLOCK_SZ 64
+
+/* Hashes @n_blocks 64-byte blocks of every lane. */
+typedef void (*CompressFunc) (uint32_t state[][5], const unsigned char **p, size_t n_blocks);
+
+typedef struct SHA1Impl {
+    const char *name;
+    int lanes; // 并行的缓冲区数
+    int min_active; // 忙碌的通道少于此数时，剩余数据交给OpenSSL
+    CompressFunc compress; // NULL表示逐个用OpenSSL计算
+    int (*supported) (void);
+} SHA1Impl;
+
+typedef struct Lane {
+    SHA1BatchJob *job; // NULL表示空闲
+    const unsigned char *p; // 下一个块
+    size_t n_blocks; // 当前阶段剩余的块数
+    int padding; // 是否在处理末尾的填充块
+    unsigned char pad[BLOCK_SZ * 2];
+} Lane;
+
+static const uint32_t sha1_iv[5] = {
+    0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+#ifdef HAVE_X86_SIMD
+
+/* SHA-NI, two interleaved streams. One stream waits on the latency of
+ * sha1rnds4 most of the time, the second one fills the gaps. */
+
+#define SHANI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+
+/* Rounds 4g..4g+3. m[g & 3] becomes W[4g..4g+3]. */
+#define SHANI_GROUP(m, abcd, e, prev, g, f)                                 \
+    do {                                                                    \
+        if ((g) >= 4)                                                       \
+            m[(g) & 3] = _mm_sha1msg2_epu32 (                               \
+                _mm_xor_si128 (_mm_sha1msg1_epu32 (m[(g) & 3],              \
+                                                   m[((g) + 1) & 3]),       \
+                               m[((g) + 2) & 3]),                           \
+                m[((g) + 3) & 3]);                                          \
+        if ((g) == 0)                                                       \
+            e = _mm_add_epi32 (e, m[0]);                                    \
+        else                                                                \
+            e = _mm_sha1nexte_epu32 (prev, m[(g) & 3]);                     \
+        prev = abcd;                                                        \
+        abcd = _mm_sha1rnds4_epu32 (abcd, e, f);                            \
+    } while (0)
+
+#define SHANI_GROUP2(g, f)                                  \
+    do {                                                    \
+        SHANI_GROUP (m0, abcd0, e0, prev0, g, f);           \
+        SHANI_GROUP (m1, abcd1, e1, prev1, g, f);           \
+    } while (0)
+
+SHANI_TARGET static void
+compress_shani (uint32_t state[][5], const unsigned char **p, size_t n_blocks)
+{
+    const __m128i bswap = _mm_set_epi64x (0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    const unsigned char *p0 = p[0], *p1 = p[1];
+    __m128i abcd0, abcd1, e0, e1, prev0, prev1;
+    __m128i abcd0_save, abcd1_save, e0_save, e1_save;
+    __m128i m0[4], m1[4];
+    int i;
+
+    abcd0 = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *)state[0]), 0x1B);
+    abcd1 = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *)state[1]), 0x1B);
+    e0 = _mm_set_epi32 (state[0][4], 0, 0, 0);
+    e1 = _mm_set_epi32 (state[1][4], 0, 0, 0);
+
+    while (n_blocks--) {
+        abcd0_save = abcd0;
+        abcd1_save = abcd1;
+        e0_save = e0;
+        e1_save = e1;
+
+        for (i = 0; i < 4; ++i) {
+            m0[i] = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(p0 + 16 * i)), bswap);
+            m1[i] = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(p1 + 16 * i)), bswap);
+        }
+
+        SHANI_GROUP2 (0, 0);  SHANI_GROUP2 (1, 0);  SHANI_GROUP2 (2, 0);
+        SHANI_GROUP2 (3, 0);  SHANI_GROUP2 (4, 0);
+        SHANI_GROUP2 (5, 1);  SHANI_GROUP2 (6, 1);  SHANI_GROUP2 (7, 1);
+        SHANI_GROUP2 (8, 1);  SHANI_GROUP2 (9, 1);
+        SHANI_GROUP2 (10, 2); SHANI_GROUP2 (11, 2); SHANI_GROUP2 (12, 2);
+        SHANI_GROUP2 (13, 2); SHANI_GROUP2 (14, 2);
+        SHANI_GROUP2 (15, 3); SHANI_GROUP2 (16, 3); SHANI_GROUP2 (17, 3);
+        SHANI_GROUP2 (18, 3); SHANI_GROUP2 (19, 3);
+
+        e0 = _mm_sha1nexte_epu32 (prev0, e0_save);
+        e1 = _mm_sha1nexte_epu32 (prev1, e1_save);
+        abcd0 = _mm_add_epi32 (abcd0, abcd0_save);
+        abcd1 = _mm_add_epi32 (abcd1, abcd1_save);
+
+        p0 += BLOCK_SZ;
+        p1 += BLOCK_SZ;
+    }
+
+    _mm_storeu_si128 ((__m128i *)state[0], _mm_shuffle_epi32 (abcd0, 0x1B));
+    _mm_storeu_si128 ((__m128i *)state[1], _mm_shuffle_epi32 (abcd1, 0x1B));
+    state[0][4] = _mm_extract_epi32 (e0, 3);
+    state[1][4] = _mm_extract_epi32 (e1, 3);
+}
+
+static int
+shani_supported (void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & (1 << 29)))
+        return 0;
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("ssse3") && __builtin_cpu_supports ("sse4.1");
+}
+
+/* AVX2, eight streams in the 32-bit lanes of a vector. */
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define ROTL(x, n) _mm256_or_si256 (_mm256_slli_epi32 (x, n), _mm256_srli_epi32 (x, 32 - (n)))
+
+#define F0(b, c, d) _mm256_xor_si256 (d, _mm256_and_si256 (b, _mm256_xor_si256 (c, d)))
+#define F1(b, c, d) _mm256_xor_si256 (_mm256_xor_si256 (b, c), d)
+#define F2(b, c, d) _mm256_or_si256 (_mm256_and_si256 (b, c),                \
+                                     _mm256_and_si256 (d, _mm256_or_si256 (b, c)))
+#define F3 F1
+
+#define AVX2_ROUND(t, F, k)                                                 \
+    do {                                                                    \
+        if ((t) >= 16)                                                      \
+            w[(t) & 15] = ROTL (_mm256_xor_si256 (                          \
+                _mm256_xor_si256 (w[((t) - 3) & 15], w[((t) - 8) & 15]),    \
+                _mm256_xor_si256 (w[((t) - 14) & 15], w[(t) & 15])), 1);    \
+        tmp = _mm256_add_epi32 (_mm256_add_epi32 (ROTL (a, 5), F (b, c, d)), \
+                                _mm256_add_epi32 (_mm256_add_epi32 (e, k),  \
+                                                  w[(t) & 15]));            \
+        e = d;                                                              \
+        d = c;                                                              \
+        c = ROTL (b, 30);                                                   \
+        b = a;                                                              \
+        a = tmp;                                                            \
+    } while (0)
+
+/* Loads 8 words of every lane, transposed so that out[i] holds word i of
+ * all lanes, and converted from big endian. */
+AVX2_TARGET static inline void
+load_transposed (const unsigned char **p, int off, __m256i *out)
+{
+    const __m256i bswap = _mm256_set_epi8 (12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                           12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i r[8], t[8], u[8];
+    int i;
+
+    for (i = 0; i < 8; ++i)
+        r[i] = _mm256_loadu_si256 ((const __m256i *)(p[i] + off));
+
+    for (i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32 (r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32 (r[i], r[i + 1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64 (t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64 (t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64 (t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64 (t[i + 1], t[i + 3]);
+    }
+    for (i = 0; i < 4; ++i) {
+        out[i] = _mm256_shuffle_epi8 (_mm256_permute2x128_si256 (u[i], u[i + 4], 0x20), bswap);
+        out[i + 4] = _mm256_shuffle_epi8 (_mm256_permute2x128_si256 (u[i], u[i + 4], 0x31), bswap);
+    }
+}
+
+AVX2_TARGET static void
+compress_avx2 (uint32_t state[][5], const unsigned char **p, size_t n_blocks)
+{
+    const __m256i k0 = _mm256_set1_epi32 (0x5A827999);
+    const __m256i k1 = _mm256_set1_epi32 (0x6ED9EBA1);
+    const __m256i k2 = _mm256_set1_epi32 (0x8F1BBCDC);
+    const __m256i k3 = _mm256_set1_epi32 (0xCA62C1D6);
+    const unsigned char *q[8];
+    uint32_t col[5][8];
+    __m256i h[5], w[16], a, b, c, d, e, tmp;
+    int i, j;
+
+    for (i = 0; i < 5; ++i) {
+        for (j = 0; j < 8; ++j)
+            col[i][j] = state[j][i];
+        h[i] = _mm256_loadu_si256 ((const __m256i *)col[i]);
+    }
+    memcpy (q, p, sizeof(q));
+
+    while (n_blocks--) {
+        load_transposed (q, 0, w);
+        load_transposed (q, 32, w + 8);
+        for (j = 0; j < 8; ++j)
+            q[j] += BLOCK_SZ;
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+
+        AVX2_ROUND (0, F0, k0);  AVX2_ROUND (1, F0, k0);  AVX2_ROUND (2, F0, k0);
+        AVX2_ROUND (3, F0, k0);  AVX2_ROUND (4, F0, k0);  AVX2_ROUND (5, F0, k0);
+        AVX2_ROUND (6, F0, k0);  AVX2_ROUND (7, F0, k0);  AVX2_ROUND (8, F0, k0);
+        AVX2_ROUND (9, F0, k0);  AVX2_ROUND (10, F0, k0); AVX2_ROUND (11, F0, k0);
+        AVX2_ROUND (12, F0, k0); AVX2_ROUND (13, F0, k0); AVX2_ROUND (14, F0, k0);
+        AVX2_ROUND (15, F0, k0); AVX2_ROUND (16, F0, k0); AVX2_ROUND (17, F0, k0);
+        AVX2_ROUND (18, F0, k0); AVX2_ROUND (19, F0, k0);
+
+        AVX2_ROUND (20, F1, k1); AVX2_ROUND (21, F1, k1); AVX2_ROUND (22, F1, k1);
+        AVX2_ROUND (23, F1, k1); AVX2_ROUND (24, F1, k1); AVX2_ROUND (25, F1, k1);
+        AVX2_ROUND (26, F1, k1); AVX2_ROUND (27, F1, k1); AVX2_ROUND (28, F1, k1);
+        AVX2_ROUND (29, F1, k1); AVX2_ROUND (30, F1, k1); AVX2_ROUND (31, F1, k1);
+        AVX2_ROUND (32, F1, k1); AVX2_ROUND (33, F1, k1); AVX2_ROUND (34, F1, k1);
+        AVX2_ROUND (35, F1, k1); AVX2_ROUND (36, F1, k1); AVX2_ROUND (37, F1, k1);
+        AVX2_ROUND (38, F1, k1); AVX2_ROUND (39, F1, k1);
+
+        AVX2_ROUND (40, F2, k2); AVX2_ROUND (41, F2, k2); AVX2_ROUND (42, F2, k2);
+        AVX2_ROUND (43, F2, k2); AVX2_ROUND (44, F2, k2); AVX2_ROUND (45, F2, k2);
+        AVX2_ROUND (46, F2, k2); AVX2_ROUND (47, F2, k2); AVX2_ROUND (48, F2, k2);
+        AVX2_ROUND (49, F2, k2); AVX2_ROUND (50, F2, k2); AVX2_ROUND (51, F2, k2);
+        AVX2_ROUND (52, F2, k2); AVX2_ROUND (53, F2, k2); AVX2_ROUND (54, F2, k2);
+        AVX2_ROUND (55, F2, k2); AVX2_ROUND (56, F2, k2); AVX2_ROUND (57, F2, k2);
+        AVX2_ROUND (58, F2, k2); AVX2_ROUND (59, F2, k2);
+
+        AVX2_ROUND (60, F3, k3); AVX2_ROUND (61, F3, k3); AVX2_ROUND (62, F3, k3);
+        AVX2_ROUND (63, F3, k3); AVX2_ROUND (64, F3, k3); AVX2_ROUND (65, F3, k3);
+        AVX2_ROUND (66, F3, k3); AVX2_ROUND (67, F3, k3); AVX2_ROUND (68, F3, k3);
+        AVX2_ROUND (69, F3, k3); AVX2_ROUND (70, F3, k3); AVX2_ROUND (71, F3, k3);
+        AVX2_ROUND (72, F3, k3); AVX2_ROUND (73, F3, k3); AVX2_ROUND (74, F3, k3);
+        AVX2_ROUND (75, F3, k3); AVX2_ROUND (76, F3, k3); AVX2_ROUND (77, F3, k3);
+        AVX2_ROUND (78, F3, k3); AVX2_ROUND (79, F3, k3);
+
+        h[0] = _mm256_add_epi32 (h[0], a);
+        h[1] = _mm256_add_epi32 (h[1], b);
+        h[2] = _mm256_add_epi32 (h[2], c);
+        h[3] = _mm256_add_epi32 (h[3], d);
+        h[4] = _mm256_add_epi32 (h[4], e);
+    }
+
+    for (i = 0; i < 5; ++i) {
+        _mm256_storeu_si256 ((__m256i *)col[i], h[i]);
+        for (j = 0; j < 8; ++j)
+            state[j][i] = col[i][j];
+    }
+}
+
+static int
+avx2_supported (void)
+{
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("avx2");
+}
+
+/* AVX-512, sixteen streams. Rotates and the round functions are single
+ * instructions here. */
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+#define AVX512_ROUND(t, f, k)                                               \
+    do {                                                                    \
+        if ((t) >= 16)                                                      \
+            x[(t) & 15] = _mm512_rol_epi32 (_mm512_ternarylogic_epi32 (     \
+                _mm512_xor_si512 (x[((t) - 3) & 15], x[((t) - 8) & 15]),    \
+                x[((t) - 14) & 15], x[(t) & 15], 0x96), 1);                 \
+        tmp = _mm512_add_epi32 (                                            \
+            _mm512_add_epi32 (_mm512_rol_epi32 (a, 5),                      \
+                              _mm512_ternarylogic_epi32 (b, c, d, f)),      \
+            _mm512_add_epi32 (_mm512_add_epi32 (e, k), x[(t) & 15]));       \
+        e = d;                                                              \
+        d = c;                                                              \
+        c = _mm512_rol_epi32 (b, 30);                                       \
+        b = a;                                                              \
+        a = tmp;                                                            \
+    } while (0)
+
+#define AVX512_ROUNDS5(t, f, k)                                             \
+    do {                                                                    \
+        AVX512_ROUND ((t), f, k);     AVX512_ROUND ((t) + 1, f, k);         \
+        AVX512_ROUND ((t) + 2, f, k); AVX512_ROUND ((t) + 3, f, k);         \
+        AVX512_ROUND ((t) + 4, f, k);                                       \
+    } while (0)
+
+AVX512_TARGET static void
+compress_avx512 (uint32_t state[][5], const unsigned char **p, size_t n_blocks)
+{
+    const __m512i k0 = _mm512_set1_epi32 (0x5A827999);
+    const __m512i k1 = _mm512_set1_epi32 (0x6ED9EBA1);
+    const __m512i k2 = _mm512_set1_epi32 (0x8F1BBCDC);
+    const __m512i k3 = _mm512_set1_epi32 (0xCA62C1D6);
+    const __m512i bswap = _mm512_set4_epi32 (0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+    const __m512i step = _mm512_set1_epi64 (BLOCK_SZ);
+    uint32_t col[5][16];
+    __m512i h[5], x[16], a, b, c, d, e, tmp, addr_lo, addr_hi;
+    __m256i lo, hi;
+    int i, j;
+
+    for (i = 0; i < 5; ++i) {
+        for (j = 0; j < 16; ++j)
+            col[i][j] = state[j][i];
+        h[i] = _mm512_loadu_si512 (col[i]);
+    }
+    addr_lo = _mm512_loadu_si512 (p);
+    addr_hi = _mm512_loadu_si512 (p + 8);
+
+    while (n_blocks--) {
+        /* Gathers with absolute addresses: the base is the word offset. */
+        for (i = 0; i < 16; ++i) {
+            lo = _mm512_i64gather_epi32 (addr_lo, (const void *)(uintptr_t)(4 * i), 1);
+            hi = _mm512_i64gather_epi32 (addr_hi, (const void *)(uintptr_t)(4 * i), 1);
+            x[i] = _mm512_shuffle_epi8 (
+                _mm512_inserti64x4 (_mm512_castsi256_si512 (lo), hi, 1), bswap);
+        }
+        addr_lo = _mm512_add_epi64 (addr_lo, step);
+        addr_hi = _mm512_add_epi64 (addr_hi, step);
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+
+        AVX512_ROUNDS5 (0, 0xCA, k0);  AVX512_ROUNDS5 (5, 0xCA, k0);
+        AVX512_ROUNDS5 (10, 0xCA, k0); AVX512_ROUNDS5 (15, 0xCA, k0);
+        AVX512_ROUNDS5 (20, 0x96, k1); AVX512_ROUNDS5 (25, 0x96, k1);
+        AVX512_ROUNDS5 (30, 0x96, k1); AVX512_ROUNDS5 (35, 0x96, k1);
+        AVX512_ROUNDS5 (40, 0xE8, k2); AVX512_ROUNDS5 (45, 0xE8, k2);
+        AVX512_ROUNDS5 (50, 0xE8, k2); AVX512_ROUNDS5 (55, 0xE8, k2);
+        AVX512_ROUNDS5 (60, 0x96, k3); AVX512_ROUNDS5 (65, 0x96, k3);
+        AVX512_ROUNDS5 (70, 0x96, k3); AVX512_ROUNDS5 (75, 0x96, k3);
+
+        h[0] = _mm512_add_epi32 (h[0], a);
+        h[1] = _mm512_add_epi32 (h[1], b);
+        h[2] = _mm512_add_epi32 (h[2], c);
+        h[3] = _mm512_add_epi32 (h[3], d);
+        h[4] = _mm512_add_epi32 (h[4], e);
+    }
+
+    for (i = 0; i < 5; ++i) {
+        _mm512_storeu_si512 (col[i], h[i]);
+        for (j = 0; j < 16; ++j)
+            state[j][i] = col[i][j];
+    }
+}
+
+static int
+avx512_supported (void)
+{
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw");
+}
+
+#endif  /* HAVE_X86_SIMD */
+
+static int
+always_supported (void)
+{
+    return 1;
+}
+
+static const SHA1Impl impls[] = {
+#ifdef HAVE_X86_SIMD
+    { "avx512", 16, 6, compress_avx512, avx512_supported },
+    { "shani", 2, 2, compress_shani, shani_supported },
+    { "avx2", 8, 3, compress_avx2, avx2_supported },
+#endif
+    { "openssl", 1, 1, NULL, always_supported },
+};
+
+#define N_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static void // 进入填充阶段：末尾不足一块的数据、0x80、0和长度
+lane_pad (Lane *lane)
+{
+    size_t len = lane->job->len;
+    size_t rem = len % BLOCK_SZ;
+    uint64_t bits = (uint64_t)len << 3;
+    int n = rem + 9 > BLOCK_SZ ? 2 : 1;
+    int i;
+
+    memcpy (lane->pad, (const unsigned char *)lane->job->data + len - rem, rem);
+    lane->pad[rem] = 0x80;
+    memset (lane->pad + rem + 1, 0, n * BLOCK_SZ - rem - 1 - 8);
+    for (i = 0; i < 8; ++i)
+        lane->pad[n * BLOCK_SZ - 1 - i] = (unsigned char)(bits >> (8 * i));
+
+    lane->p = lane->pad;
+    lane->n_blocks = n;
+    lane->padding = 1;
+}
+
+static void // 开始计算@job
+lane_start (Lane *lane, SHA1BatchJob *job, uint32_t *state)
+{
+    memcpy (state, sha1_iv, sizeof(sha1_iv));
+    lane->job = job;
+    lane->p = job->data;
+    lane->n_blocks = job->len / BLOCK_SZ;
+    lane->padding = 0;
+    if (lane->n_blocks == 0)
+        lane_pad (lane);
+}
+
+static void
+put_digest (const uint32_t *state, unsigned char *digest)
+{
+    int i;
+
+    for (i = 0; i < 5; ++i) {
+        digest[4 * i] = state[i] >> 24;
+        digest[4 * i + 1] = state[i] >> 16;
+        digest[4 * i + 2] = state[i] >> 8;
+        digest[4 * i + 3] = state[i];
+    }
+}
+
+/* Hashes the rest of the job of @lane with OpenSSL, starting from the
+ * state after the full blocks hashed so far. */
+static void
+lane_finish_openssl (Lane *lane, const uint32_t *state)
+{
+    SHA1BatchJob *job = lane->job;
+    size_t done = (job->len / BLOCK_SZ - lane->n_blocks) * BLOCK_SZ;
+    SHA_CTX ctx;
+
+    SHA1_Init (&ctx);
+    ctx.h0 = state[0];
+    ctx.h1 = state[1];
+    ctx.h2 = state[2];
+    ctx.h3 = state[3];
+    ctx.h4 = state[4];
+    ctx.Nl = (SHA_LONG)(done << 3);
+    ctx.Nh = (SHA_LONG)((uint64_t)done >> 29);
+    SHA1_Update (&ctx, (const unsigned char *)job->data + done, job->len - done);
+    SHA1_Final (job->digest, &ctx);
+}
+
+static void
+run_batch (const SHA1Impl *impl, SHA1BatchJob *jobs, int n_jobs)
+{
+    Lane lanes[MAX_LANES];
+    uint32_t state[MAX_LANES][5];
+    const unsigned char *p[MAX_LANES], *busy;
+    int next = 0, n_active = 0, i;
+    size_t n;
+
+    if (!impl->compress || n_jobs < impl->min_active) {
+        for (i = 0; i < n_jobs; ++i)
+            SHA1 (jobs[i].data, jobs[i].len, jobs[i].digest);
+        return;
+    }
+
+    for (i = 0; i < impl->lanes; ++i) {
+        lanes[i].job = NULL;
+        if (next < n_jobs) {
+            lane_start (&lanes[i], &jobs[next++], state[i]);
+            ++n_active;
+        }
+    }
+
+    while (n_active > 0) {
+        /* Busy lanes are refilled as long as there are jobs left, so this
+         * only happens at the end. Idle lanes would hash garbage, it's
+         * cheaper to hash the rest of the data one buffer at a time. */
+        if (n_active < impl->min_active) {
+            for (i = 0; i < impl->lanes; ++i) {
+                if (lanes[i].job && !lanes[i].padding) {
+                    lane_finish_openssl (&lanes[i], state[i]);
+                    lanes[i].job = NULL;
+                    --n_active;
+                }
+            }
+            if (n_active == 0)
+                break;
+        }
+
+        n = SIZE_MAX;
+        busy = NULL;
+        for (i = 0; i < impl->lanes; ++i) {
+            if (lanes[i].job) {
+                busy = lanes[i].p;
+                if (lanes[i].n_blocks < n)
+                    n = lanes[i].n_blocks;
+            }
+        }
+        /* Idle lanes hash the data of a busy one, the result is dropped. */
+        for (i = 0; i < impl->lanes; ++i)
+            p[i] = lanes[i].job ? lanes[i].p : busy;
+
+        impl->compress (state, p, n);
+
+        for (i = 0; i < impl->lanes; ++i) {
+            Lane *lane = &lanes[i];
+
+            if (!lane->job)
+                continue;
+            lane->p += n * BLOCK_SZ;
+            lane->n_blocks -= n;
+            if (lane->n_blocks > 0)
+                continue;
+
+            if (!lane->padding) {
+                lane_pad (lane);
+            } else {
+                put_digest (state[i], lane->job->digest);
+                lane->job = NULL;
+                --n_active;
+                if (next < n_jobs) {
+                    lane_start (lane, &jobs[next++], state[i]);
+                    ++n_active;
+                }
+            }
+        }
+    }
+}
+
+static pthread_once_t pick_once = PTHREAD_ONCE_INIT;
+static const SHA1Impl *picked_impl; // 校准选出的实现，只在pick_once中写入
+static const SHA1Impl *forced_impl; // sha1_batch_set_impl()指定的实现
+
+#define CALIBRATE_BUF_SZ (64 << 10)
+
+/* CPU time of the calling thread, so that other busy threads in the
+ * process don't distort the calibration. */
+static double
+thread_cpu_time (void)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) < 0 &&
+        clock_gettime (CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Which one is fastest depends on the CPU: SHA-NI beats AVX2 on some and
+ * not on others. Each supported one hashes a full batch of 64KB buffers,
+ * the best of 3 runs counts. */
+static const SHA1Impl *
+pick_impl (void)
+{
+    const SHA1Impl *best = &impls[N_IMPLS - 1];
+    double best_time = 0, start, t;
+    unsigned char *buf, digests[MAX_LANES][20];
+    SHA1BatchJob jobs[MAX_LANES];
+    size_t i;
+    int j, round;
+
+    buf = calloc (1, CALIBRATE_BUF_SZ * MAX_LANES);
+    if (!buf)
+        return best;
+
+    for (j = 0; j < MAX_LANES; ++j) {
+        jobs[j].data = buf + j * CALIBRATE_BUF_SZ;
+        jobs[j].len = CALIBRATE_BUF_SZ;
+        jobs[j].digest = digests[j];
+    }
+
+    for (i = 0; i < N_IMPLS; ++i) {
+        if (!impls[i].supported ())
+            continue;
+        for (round = 0; round < 3; ++round) {
+            start = thread_cpu_time ();
+            run_batch (&impls[i], jobs, MAX_LANES);
+            t = thread_cpu_time () - start;
+            if (best_time == 0 || t < best_time) {
+                best = &impls[i];
+                best_time = t;
+            }
+        }
+    }
+
+    free (buf);
+    return best;
+}
+
+static void
+pick_impl_once (void)
+{
+    picked_impl = pick_impl ();
+}
+
+static const SHA1Impl *
+get_impl (void)
+{
+    const SHA1Impl *impl = __atomic_load_n (&forced_impl, __ATOMIC_ACQUIRE);
+
+    if (impl)
+        return impl;
+
+    pthread_once (&pick_once, pick_impl_once);
+    return picked_impl;
+}
+
+int
+sha1_batch_set_impl (const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < N_IMPLS; ++i) {
+        if (strcmp (impls[i].name, name) == 0) {
+            if (!impls[i].supported ())
+                return -1;
+            __atomic_store_n (&forced_impl, &impls[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+sha1_batch_impl (void)
+{
+    return get_impl()->name;
+}
+
+int
+sha1_batch_lanes (void)
+{
+    return get_impl()->lanes;
+}
+
+void
+sha1_batch (SHA1BatchJob *jobs, int n_jobs)
+{
+    run_batch (get_impl (), jobs, n_jobs);
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* 批量计算SHA1（多缓冲区并行） */
+
+/**
+ * Hashes several independent buffers at once.
+ *
+ * A single SHA1 stream is bound by the latency of its compression rounds.
+ * Hashing a few buffers side by side keeps the execution units busy: with
+ * SHA-NI two streams are interleaved, with AVX2 and AVX-512 eight or
+ * sixteen streams are hashed in the lanes of one vector. OpenSSL, one
+ * buffer at a time, is the fallback. The fastest one the CPU supports is
+ * measured on first use. Results are always identical to SHA1().
+ *
+ * Callers should pass at least sha1_batch_lanes() buffers of similar size
+ * in one call to get the benefit; the buffers of one call don't need to
+ * have the same length.
+ */
+
+#ifndef SHA1_BATCH_H
+#define SHA1_BATCH_H
+
+#include <stddef.h>
+
+typedef struct SHA1BatchJob {
+    const void *data;
+    size_t len;
+    unsigned char *digest; // 20字节的结果
+} SHA1BatchJob;
+
+void // 计算@n_jobs个缓冲区的SHA1
+sha1_batch (SHA1BatchJob *jobs, int n_jobs);
+
+int // 并行的缓冲区数，即一批建议的最少缓冲区数
+sha1_batch_lanes (void);
+
+const char * // 当前使用的实现
+sha1_batch_impl (void);
+
+/* Forces an implementation: "openssl", "shani", "avx2" or "avx512". Returns -1 if
+ * it isn't supported by the CPU. Meant for benchmarks and tests. */
+int
+sha1_batch_set_impl (const char *name);
+
+#endif
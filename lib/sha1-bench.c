@@ -0,0 +1,175 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+    批量SHA1的吞吐量测试
+
+    Hashes blocks of random data one at a time with OpenSSL, as block ids
+    are computed today, and in batches with every implementation of
+    sha1_batch() the CPU supports. Single threaded. Results of every
+    implementation are checked against SHA1() first, on buffers of mixed
+    lengths around the padding boundaries.
+
+        make sha1-bench && ./sha1-bench [data MB] [block KB]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <openssl/sha.h>
+
+#include "sha1-batch.h"
+
+#define ROUNDS 3
+#define BATCH 16
+
+static const char *impl_names[] = { "openssl", "shani", "avx2", "avx512" };
+
+static double
+now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Buffers of lengths 0..300 and a few larger ones, hashed in batches of
+ * varying size. */
+static int
+check_impl (const unsigned char *data)
+{
+    static const size_t big[] = { 4096, 65536, 65599, 1 << 20 };
+    SHA1BatchJob jobs[400];
+    unsigned char digests[400][20], expected[20];
+    int n = 0, i, start, batch;
+
+    for (i = 0; i <= 300; ++i) {
+        jobs[n].data = data + i * 7;
+        jobs[n].len = i;
+        jobs[n].digest = digests[n];
+        ++n;
+    }
+    for (i = 0; i < (int)(sizeof(big) / sizeof(big[0])); ++i) {
+        jobs[n].data = data + i;
+        jobs[n].len = big[i];
+        jobs[n].digest = digests[n];
+        ++n;
+    }
+
+    for (batch = 1; batch <= 13; batch += 3) {
+        memset (digests, 0, sizeof(digests));
+        for (start = 0; start < n; start += batch)
+            sha1_batch (jobs + start, start + batch <= n ? batch : n - start);
+
+        for (i = 0; i < n; ++i) {
+            SHA1 (jobs[i].data, jobs[i].len, expected);
+            if (memcmp (expected, digests[i], 20) != 0) {
+                fprintf (stderr, "%s: wrong digest, length %zu, batch %d\n",
+                         sha1_batch_impl (), jobs[i].len, batch);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static double
+bench_single (const unsigned char *data, size_t size, size_t block_sz)
+{
+    unsigned char digest[20];
+    double best = 0, t;
+    size_t off;
+    int round;
+
+    for (round = 0; round < ROUNDS; ++round) {
+        t = now ();
+        for (off = 0; off + block_sz <= size; off += block_sz)
+            SHA1 (data + off, block_sz, digest);
+        t = now () - t;
+        if (round == 0 || t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+static double
+bench_batch (const unsigned char *data, size_t size, size_t block_sz)
+{
+    SHA1BatchJob jobs[BATCH];
+    unsigned char digests[BATCH][20];
+    double best = 0, t;
+    size_t off;
+    int round, n;
+
+    for (round = 0; round < ROUNDS; ++round) {
+        t = now ();
+        n = 0;
+        for (off = 0; off + block_sz <= size; off += block_sz) {
+            jobs[n].data = data + off;
+            jobs[n].len = block_sz;
+            jobs[n].digest = digests[n];
+            if (++n == BATCH) {
+                sha1_batch (jobs, n);
+                n = 0;
+            }
+        }
+        sha1_batch (jobs, n);
+        t = now () - t;
+        if (round == 0 || t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+int
+main (int argc, char **argv)
+{
+    size_t size = (argc > 1 ? atol (argv[1]) : 512) << 20;
+    size_t block_sz = (argc > 2 ? atol (argv[2]) : 1024) << 10;
+    unsigned char *data;
+    uint64_t x = 88172645463325252ULL;
+    size_t i;
+    double secs;
+
+    if (block_sz == 0 || block_sz > size) {
+        fprintf (stderr, "Bad block size.\n");
+        return 1;
+    }
+
+    data = malloc (size);
+    if (!data) {
+        fprintf (stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (i = 0; i + 8 <= size; i += 8) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy (data + i, &x, 8);
+    }
+
+    printf ("%zu MB of random data, block size %zu KB, %s is used by default\n",
+            size >> 20, block_sz >> 10, sha1_batch_impl ());
+
+    secs = bench_single (data, size, block_sz);
+    printf ("%-16s %8.2f GB/s\n", "openssl SHA1()", size / secs / 1e9);
+
+    for (i = 0; i < sizeof(impl_names) / sizeof(impl_names[0]); ++i) {
+        if (sha1_batch_set_impl (impl_names[i]) < 0) {
+            printf ("%-16s not supported\n", impl_names[i]);
+            continue;
+        }
+        if (check_impl (data) < 0)
+            return 1;
+        secs = bench_batch (data, size, block_sz);
+        printf ("batch %-10s %8.2f GB/s, %d lanes\n", impl_names[i],
+                size / secs / 1e9, sha1_batch_lanes ());
+    }
+
+    free (data);
+    return 0;
+}
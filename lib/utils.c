@@ -2508,3 +2508,145 @@ ccnet_key_file_get_string (GKeyFile *keyf,
 
     return g_strchomp(v); // 删除末尾的空格
 }
+
+/* Threads shared by all parallel_for_each_index() calls, so that busy
+ * callers don't each start their own. */
+#define PARALLEL_POOL_THREADS 16
+
+typedef struct ParallelIndexData {
+    int n;
+    int batch;
+    volatile gint next; // 下一批的起始下标
+    ParallelIndexFunc func;
+    void *user_data;
+
+    GMutex lock;
+    GCond done_cond;
+    int n_done; // 已完成的下标数
+    int ref; // 调用者和排队的辅助任务各持有一个
+} ParallelIndexData;
+
+static void
+parallel_index_data_unref (ParallelIndexData *pd)
+{
+    if (!g_atomic_int_dec_and_test (&pd->ref))
+        return;
+
+    g_mutex_clear (&pd->lock);
+    g_cond_clear (&pd->done_cond);
+    g_free (pd);
+}
+
+static void
+parallel_index_run (ParallelIndexData *pd)
+{
+    int start, end, i;
+
+    while ((start = g_atomic_int_add (&pd->next, pd->batch)) < pd->n) {
+        end = MIN (start + pd->batch, pd->n);
+        for (i = start; i < end; ++i)
+            pd->func (i, pd->user_data);
+
+        g_mutex_lock (&pd->lock);
+        pd->n_done += end - start;
+        if (pd->n_done == pd->n)
+            g_cond_signal (&pd->done_cond);
+        g_mutex_unlock (&pd->lock);
+    }
+}
+
+/* A helper queued behind other callers' work may find nothing left. */
+static void
+parallel_index_worker (gpointer data, gpointer user_data)
+{
+    ParallelIndexData *pd = data;
+
+    parallel_index_run (pd);
+    parallel_index_data_unref (pd);
+}
+
+static gpointer
+create_parallel_pool (gpointer data)
+{
+    return g_thread_pool_new (parallel_index_worker, NULL,
+                              PARALLEL_POOL_THREADS, FALSE, NULL);
+}
+
+void
+parallel_for_each_index (int n, int n_threads, int batch,
+                         ParallelIndexFunc func, void *user_data)
+{
+    static GOnce pool_once = G_ONCE_INIT;
+    GThreadPool *pool;
+    ParallelIndexData *pd;
+    int i;
+
+    if (n <= 0)
+        return;
+    if (batch < 1)
+        batch = 1;
+
+    pd = g_new0 (ParallelIndexData, 1);
+    pd->n = n;
+    pd->batch = batch;
+    pd->func = func;
+    pd->user_data = user_data;
+    g_mutex_init (&pd->lock);
+    g_cond_init (&pd->done_cond);
+    pd->ref = 1;
+
+    /* No more helpers than batches; the caller is one of the threads. */
+    n_threads = MIN (n_threads, (n + batch - 1) / batch) - 1;
+    pool = g_once (&pool_once, create_parallel_pool, NULL);
+    for (i = 0; pool && i < n_threads; ++i) {
+        g_atomic_int_inc (&pd->ref);
+        if (!g_thread_pool_push (pool, pd, NULL)) {
+            g_atomic_int_dec_and_test (&pd->ref);
+            break;
+        }
+    }
+
+    parallel_index_run (pd);
+
+    /* Only wait for indexes being handled by helpers, not for helpers that
+     * haven't started yet. */
+    g_mutex_lock (&pd->lock);
+    while (pd->n_done < pd->n)
+        g_cond_wait (&pd->done_cond, &pd->lock);
+    g_mutex_unlock (&pd->lock);
+
+    parallel_index_data_unref (pd);
+}
+
+typedef struct IdsExistData {
+    void *backend;
+    StoreIdExistsFunc func;
+    const char *store_id;
+    int version;
+    const char **ids;
+    gboolean *exists;
+} IdsExistData;
+
+static void
+ids_exist_func (int index, void *user_data)
+{
+    IdsExistData *data = user_data;
+
+    data->exists[index] = data->func (data->backend, data->store_id,
+                                      data->version, data->ids[index]);
+}
+
+/* stat() blocks on disk seeks, many of them overlap well on a cold cache. */
+#define IDS_EXIST_THREADS 16
+#define IDS_EXIST_BATCH 256
+
+void
+parallel_ids_exist (void *backend, StoreIdExistsFunc func,
+                    const char *store_id, int version,
+                    const char **ids, int n_ids, gboolean *exists)
+{
+    IdsExistData data = { backend, func, store_id, version, ids, exists };
+
+    parallel_for_each_index (n_ids, IDS_EXIST_THREADS, IDS_EXIST_BATCH,
+                             ids_exist_func, &data);
+}
@@ -419,4 +419,27 @@ gchar* ccnet_key_file_get_string (GKeyFile *keyf,
                                   const char *category,
                                   const char *key); // 配置文件取值，keyf[category][key] -> str，并删除末尾的空格
 
+typedef void (*ParallelIndexFunc) (int index, void *user_data);
+
+/*
+ * Calls @func for every index in [0, @n) from up to @n_threads threads,
+ * handing out @batch consecutive indexes at a time. The caller's thread
+ * takes part, the others come from a thread pool shared by all callers.
+ * The call returns when all indexes are done. Meant for overlapping many
+ * small blocking syscalls, e.g. stat() on many files.
+ */
+void
+parallel_for_each_index (int n, int n_threads, int batch,
+                         ParallelIndexFunc func, void *user_data); // 多线程遍历下标
+
+typedef gboolean (*StoreIdExistsFunc) (void *backend, const char *store_id,
+                                       int version, const char *id);
+
+/* Sets @exists[i] to whether @ids[i] exists in @backend, checking them in
+ * parallel. Backs the exists_many() of the file system backends. */
+void
+parallel_ids_exist (void *backend, StoreIdExistsFunc func,
+                    const char *store_id, int version,
+                    const char **ids, int n_ids, gboolean *exists); // 并行判断多个对象是否存在
+
 #endif
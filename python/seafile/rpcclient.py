@@ -808,6 +808,20 @@ class SeafServerThreadedRpcClient(NamedPipeClient):
     def pop_event(channel):
         pass
 
+    # fs object cache
+    @searpc_func("json", [])
+    def get_dir_cache_stats():
+        pass
+
+    @searpc_func("json", [])
+    def get_commit_cache_stats():
+        pass
+
+    # database connection pool
+    @searpc_func("json", [])
+    def get_db_pool_stats():
+        pass
+
     @searpc_func("objlist", ["string", "string"])
     def search_files(self, repo_id, search_str):
         pass
@@ -922,6 +936,10 @@ class SeafServerThreadedRpcClient(NamedPipeClient):
     def get_groups(self, user_name, return_ancestors):
         pass
 
+    @searpc_func("json", ["string"])
+    def get_user_group_ids(self, user_name):
+        pass
+
     @searpc_func("objlist", [])
     def list_all_departments(self):
         pass
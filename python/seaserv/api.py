@@ -848,6 +848,15 @@ class SeafileAPI(object):
     def pop_event(self, channel):
         return seafserv_threaded_rpc.pop_event(channel)
 
+    def get_dir_cache_stats(self):
+        return seafserv_threaded_rpc.get_dir_cache_stats()
+
+    def get_commit_cache_stats(self):
+        return seafserv_threaded_rpc.get_commit_cache_stats()
+
+    def get_db_pool_stats(self):
+        return seafserv_threaded_rpc.get_db_pool_stats()
+
     def search_files(self, repo_id, search_str):
         return seafserv_threaded_rpc.search_files(repo_id, search_str)
     
@@ -1051,6 +1060,13 @@ class CcnetAPI(object):
         """
         return ccnet_threaded_rpc.get_groups(user_name, 1 if return_ancestors else 0)
 
+    def get_user_group_ids(self, user_name):
+        """
+        Get ids of the groups the user belongs to and of their ancestors.
+        Return: a sorted list of group ids
+        """
+        return ccnet_threaded_rpc.get_user_group_ids(user_name)
+
     def get_all_groups(self, start, limit, source=None):
         """
         For CE, source is not used and should alwasys be None.
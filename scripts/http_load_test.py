@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+# coding: UTF-8
+'''Load test for the sync endpoints of the seafile http server.
+
+Opens many concurrent keep-alive connections and measures latency of
+GET /repo/<id>/block/<id>, POST /repo/<id>/pack-fs and
+GET /repo/<id>/commit/HEAD. Block and fs object ids are collected from the
+head commit of the repo before the test starts.
+
+    python3 http_load_test.py -u http://127.0.0.1:8082 -r <repo_id> -t <sync token> -c 5000
+'''
+
+import argparse
+import asyncio
+import json
+import random
+import resource
+import struct
+import sys
+import time
+import zlib
+from urllib.parse import urlparse
+
+ENDPOINTS = ('block', 'pack-fs', 'commit-head')
+
+
+class Conn(object):
+    def __init__(self, host, port):
+        self.host = host
+        self.port = port
+        self.reader = None
+        self.writer = None
+
+    async def request(self, method, path, headers, body=b''):
+        if self.writer is None:
+            self.reader, self.writer = await asyncio.open_connection(self.host, self.port)
+
+        lines = ['%s %s HTTP/1.1' % (method, path), 'Host: %s' % self.host,
+                 'Content-Length: %d' % len(body)]
+        lines += ['%s: %s' % kv for kv in headers.items()]
+        self.writer.write(('\r\n'.join(lines) + '\r\n\r\n').encode() + body)
+
+        try:
+            status_line = await self.reader.readline()
+            if not status_line:
+                raise ConnectionError('connection closed')
+            status = int(status_line.split()[1])
+            resp_headers = {}
+            while True:
+                line = await self.reader.readline()
+                if line in (b'\r\n', b'\n', b''):
+                    break
+                k, v = line.decode('latin-1').split(':', 1)
+                resp_headers[k.strip().lower()] = v.strip()
+
+            if resp_headers.get('transfer-encoding') == 'chunked':
+                data = b''
+                while True:
+                    size = int((await self.reader.readline()).split(b';')[0], 16)
+                    chunk = await self.reader.readexactly(size + 2)
+                    if size == 0:
+                        break
+                    data += chunk[:-2]
+            else:
+                data = await self.reader.readexactly(int(resp_headers.get('content-length', 0)))
+
+            if resp_headers.get('connection', '').lower() == 'close':
+                self.close()
+        except Exception:
+            self.close()
+            raise
+
+        return status, data
+
+    def close(self):
+        if self.writer is not None:
+            self.writer.close()
+        self.reader = self.writer = None
+
+
+def parse_pack(data):
+    objs = {}
+    off = 0
+    while off + 44 <= len(data):
+        obj_id = data[off:off+40].decode()
+        size = struct.unpack('!I', data[off+40:off+44])[0]
+        objs[obj_id] = data[off+44:off+44+size]
+        off += 44 + size
+    return objs
+
+
+async def collect_ids(conn, repo_id, headers, max_objs):
+    '''Returns the head commit id, and fs object and block ids reachable from it.'''
+    status, data = await conn.request('GET', '/repo/%s/commit/HEAD' % repo_id, headers)
+    if status != 200:
+        sys.exit('Failed to get head commit: %d' % status)
+    head = json.loads(data)['head_commit_id']
+
+    status, data = await conn.request('GET', '/repo/%s/commit/%s' % (repo_id, head), headers)
+    if status != 200:
+        sys.exit('Failed to get commit %s: %d' % (head, status))
+    root_id = json.loads(data)['root_id']
+
+    fs_ids, block_ids = [], set()
+    queue = [root_id]
+    while queue and len(fs_ids) < max_objs:
+        batch, queue = queue[:100], queue[100:]
+        batch = [i for i in batch if i != '0' * 40]
+        if not batch:
+            continue
+        status, data = await conn.request('POST', '/repo/%s/pack-fs' % repo_id, headers,
+                                          json.dumps(batch).encode())
+        if status != 200:
+            sys.exit('Failed to pack fs objects: %d' % status)
+        for obj_id, raw in parse_pack(data).items():
+            fs_ids.append(obj_id)
+            obj = json.loads(zlib.decompress(raw))
+            for dent in obj.get('dirents', []):
+                queue.append(dent['id'])
+            block_ids.update(obj.get('block_ids', []))
+
+    return head, fs_ids, sorted(block_ids)
+
+
+class Stats(object):
+    def __init__(self):
+        self.latencies = {e: [] for e in ENDPOINTS}
+        self.errors = {e: 0 for e in ENDPOINTS}
+        self.bytes = 0
+
+    def report(self, elapsed):
+        print('%-12s %9s %9s %9s %9s %9s %7s' %
+              ('endpoint', 'requests', 'req/s', 'p50(ms)', 'p99(ms)', 'max(ms)', 'errors'))
+        for e in ENDPOINTS:
+            lat = sorted(self.latencies[e])
+            if not lat:
+                continue
+            pct = lambda p: lat[min(len(lat) - 1, int(len(lat) * p))] * 1000
+            print('%-12s %9d %9.0f %9.1f %9.1f %9.1f %7d' %
+                  (e, len(lat), len(lat) / elapsed, pct(0.5), pct(0.99), lat[-1] * 1000,
+                   self.errors[e]))
+        print('received %.1f MB in %.1fs' % (self.bytes / 1e6, elapsed))
+
+
+async def client(args, headers, ids, stats, deadline, start_event):
+    head, fs_ids, block_ids = ids
+    endpoints = [e for e in args.endpoints if e != 'block' or block_ids]
+    conn = Conn(args.host, args.port)
+    await start_event.wait()
+
+    while time.monotonic() < deadline:
+        endpoint = random.choice(endpoints)
+        if endpoint == 'block':
+            req = ('GET', '/repo/%s/block/%s' % (args.repo_id, random.choice(block_ids)), b'')
+        elif endpoint == 'pack-fs':
+            batch = random.sample(fs_ids, min(len(fs_ids), args.pack_size))
+            req = ('POST', '/repo/%s/pack-fs' % args.repo_id, json.dumps(batch).encode())
+        else:
+            req = ('GET', '/repo/%s/commit/HEAD' % args.repo_id, b'')
+
+        t = time.monotonic()
+        try:
+            status, data = await conn.request(req[0], req[1], headers, req[2])
+        except Exception:
+            stats.errors[endpoint] += 1
+            await asyncio.sleep(0.1)
+            continue
+        stats.latencies[endpoint].append(time.monotonic() - t)
+        stats.bytes += len(data)
+        if status != 200:
+            stats.errors[endpoint] += 1
+
+    conn.close()
+
+
+async def main(args):
+    headers = {'Seafile-Repo-Token': args.token}
+    conn = Conn(args.host, args.port)
+    ids = await collect_ids(conn, args.repo_id, headers, args.max_objs)
+    conn.close()
+    print('head commit %s, %d fs objects, %d blocks' % (ids[0], len(ids[1]), len(ids[2])))
+
+    stats = Stats()
+    start_event = asyncio.Event()
+    deadline = time.monotonic() + args.warmup + args.duration
+    tasks = [asyncio.ensure_future(client(args, headers, ids, stats, deadline, start_event))
+             for _ in range(args.clients)]
+    start_event.set()
+
+    # Connections are set up during warmup; only later requests are counted.
+    await asyncio.sleep(args.warmup)
+    stats.latencies = {e: [] for e in ENDPOINTS}
+    stats.errors = {e: 0 for e in ENDPOINTS}
+    stats.bytes = 0
+    start = time.monotonic()
+
+    await asyncio.gather(*tasks)
+    stats.report(time.monotonic() - start)
+
+
+def parse_args():
+    ap = argparse.ArgumentParser(description='Load test seafile http sync endpoints.')
+    ap.add_argument('-u', '--url', default='http://127.0.0.1:8082')
+    ap.add_argument('-r', '--repo-id', required=True)
+    ap.add_argument('-t', '--token', required=True, help='sync token of the repo')
+    ap.add_argument('-c', '--clients', type=int, default=5000)
+    ap.add_argument('-d', '--duration', type=float, default=30, help='seconds')
+    ap.add_argument('-w', '--warmup', type=float, default=5, help='seconds')
+    ap.add_argument('-e', '--endpoints', default=','.join(ENDPOINTS),
+                    help='comma separated, from %s' % ', '.join(ENDPOINTS))
+    ap.add_argument('--pack-size', type=int, default=20, help='fs objects per pack-fs request')
+    ap.add_argument('--max-objs', type=int, default=10000, help='fs objects to collect')
+    args = ap.parse_args()
+
+    url = urlparse(args.url)
+    args.host = url.hostname
+    args.port = url.port or 80
+    args.endpoints = args.endpoints.split(',')
+    for e in args.endpoints:
+        if e not in ENDPOINTS:
+            ap.error('unknown endpoint %s' % e)
+    return args
+
+
+if __name__ == '__main__':
+    args = parse_args()
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < args.clients + 100:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (min(hard, args.clients + 100), hard))
+    asyncio.get_event_loop().run_until_complete(main(args))
@@ -322,3 +322,10 @@ CREATE TABLE IF NOT EXISTS WebUploadTempFiles (
   file_path TEXT NOT NULL,
   tmp_file_path TEXT NOT NULL
 ) ENGINE=INNODB;
+
+CREATE TABLE IF NOT EXISTS PermChange (
+  id BIGINT NOT NULL PRIMARY KEY AUTO_INCREMENT,
+  repo_id CHAR(37) NOT NULL,
+  change_time BIGINT,
+  INDEX(change_time)
+) ENGINE=INNODB;
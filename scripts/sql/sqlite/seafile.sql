@@ -63,3 +63,5 @@ CREATE INDEX IF NOT EXISTS OrgFromEmailIndex on OrgSharedRepo (from_email);
 CREATE INDEX IF NOT EXISTS OrgToEmailIndex on OrgSharedRepo (to_email);
 CREATE INDEX IF NOT EXISTS OrgLibIdIndex on OrgSharedRepo (repo_id);
 CREATE TABLE IF NOT EXISTS SystemInfo (info_key VARCHAR(256), info_value VARCHAR(1024));
+CREATE TABLE IF NOT EXISTS PermChange (id INTEGER PRIMARY KEY AUTOINCREMENT, repo_id CHAR(37) NOT NULL, change_time BIGINT);
+CREATE INDEX IF NOT EXISTS PermChangeTimeIndex on PermChange (change_time);
@@ -30,6 +30,9 @@
 #define FILE_TYPE_MAP_DEFAULT_LEN 1
 #define BUFFER_SIZE 1024 * 64
 #define MULTI_DOWNLOAD_FILE_PREFIX "documents-export-"
+#define ZIP_STREAM_READ_SIZE (64 * 1024)
+/* Stop reading the archive while this much of it waits to be sent. */
+#define ZIP_STREAM_HIGH_WATERMARK (1024 * 1024)
 
 struct file_type_map {
     char *suffix;
@@ -42,6 +45,7 @@ typedef struct SendBlockData {
     BlockHandle *handle;
     uint32_t bsize;
     uint32_t remain;
+    gboolean queued; // 已将整个块文件加入输出缓冲区
 
     char store_id[37];
     int repo_version;
@@ -63,6 +67,7 @@ typedef struct SendfileData {
     BlockHandle *handle;
     size_t remain;
     int idx;
+    gboolean queued; // 已将当前块文件加入输出缓冲区
 
     char store_id[37];
     int repo_version;
@@ -114,6 +119,26 @@ typedef struct SendDirData {
     void *saved_cb_arg;
 } SendDirData;
 
+/* A zip archive sent while it's generated by the zip thread pool. */
+typedef struct SendZipStreamData {
+    evhtp_request_t *req;
+    int fd; // 读取压缩包的管道
+    struct event *read_event;
+    gboolean reading; // read_event是否已注册
+    guint64 total_size; // 已发送的字节数
+    struct Progress *progress; // 压缩任务的进度，令牌过期后仍有效
+
+    char *token;
+    char *user;
+    char *token_type;
+    char repo_id[37];
+
+    bufferevent_data_cb saved_read_cb;
+    bufferevent_data_cb saved_write_cb;
+    bufferevent_event_cb saved_event_cb;
+    void *saved_cb_arg;
+} SendZipStreamData;
+
 
 
 extern SeafileSession *seaf;
@@ -202,6 +227,46 @@ free_senddir_data (SendDirData *data)
     g_free (data);
 }
 
+static void
+free_send_zip_stream_data (SendZipStreamData *data)
+{
+    event_free (data->read_event);
+    /* The zip thread gets EPIPE if it's still writing. */
+    close (data->fd);
+
+    zip_download_mgr_release_zip_stream (seaf->zip_download_mgr, data->progress);
+    zip_download_mgr_del_zip_progress (seaf->zip_download_mgr, data->token);
+
+    g_free (data->user);
+    g_free (data->token_type);
+    g_free (data->token);
+    g_free (data);
+}
+
+/*
+ * Queue @size bytes of an unencrypted block to @bev as a file segment, so
+ * libevent sends it with sendfile() and the data never goes through user
+ * space. The write callback runs again once it's all sent. Returns -1 if
+ * the block backend has no local file for the block, the caller should
+ * read and write the data itself then.
+ */
+static int
+send_block_file (struct bufferevent *bev, BlockHandle *handle, guint64 size)
+{
+    int fd;
+
+    fd = seaf_block_manager_dup_block_fd (seaf->block_mgr, handle);
+    if (fd < 0)
+        return -1;
+
+    if (evbuffer_add_file (bufferevent_get_output (bev), fd, 0, size) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    return 0;
+}
+
 static void
 write_block_data_cb (struct bufferevent *bev, void *ctx)
 {
@@ -224,10 +289,18 @@ write_block_data_cb (struct bufferevent *bev, void *ctx)
         }
 
         data->remain = data->bsize;
+
+        if (send_block_file (bev, data->handle, data->bsize) == 0) {
+            data->queued = TRUE;
+            return;
+        }
     }
     handle = data->handle;
 
-    n = seaf_block_manager_read_block(seaf->block_mgr, handle, buf, sizeof(buf));
+    if (data->queued)
+        n = 0;                  /* The whole block file has been sent. */
+    else
+        n = seaf_block_manager_read_block(seaf->block_mgr, handle, buf, sizeof(buf));
     data->remain -= n;
     if (n < 0) {
         seaf_warning ("Error when reading from block %s:%s.\n",
@@ -306,11 +379,17 @@ next:
                 goto err;
             }
             data->enc_init = TRUE;
+        } else if (send_block_file (bev, data->handle, data->remain) == 0) {
+            data->queued = TRUE;
+            return;
         }
     }
     handle = data->handle;
 
-    n = seaf_block_manager_read_block(seaf->block_mgr, handle, buf, sizeof(buf));
+    if (data->queued)
+        n = 0;                  /* The whole block file has been sent. */
+    else
+        n = seaf_block_manager_read_block(seaf->block_mgr, handle, buf, sizeof(buf));
     data->remain -= n;
     if (n < 0) {
         seaf_warning ("Error when reading from block %s.\n", blk_id);
@@ -320,6 +399,7 @@ next:
         seaf_block_manager_close_block (seaf->block_mgr, handle);
         seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
         data->handle = NULL;
+        data->queued = FALSE;
         if (data->crypt != NULL) {
             EVP_CIPHER_CTX_free (data->ctx);
             data->enc_init = FALSE;
@@ -456,6 +536,102 @@ write_dir_data_cb (struct bufferevent *bev, void *ctx)
     }
 }
 
+static void
+finish_zip_stream (SendZipStreamData *data)
+{
+    evhtp_request_t *req = data->req;
+    struct bufferevent *bev = evhtp_request_get_bev (req);
+
+    if (zip_download_mgr_get_zip_stream_status (seaf->zip_download_mgr,
+                                                data->progress) != 1) {
+        /* Don't end the chunked reply, so the client sees the download failed. */
+        seaf_warning ("Failed to generate zip stream for repo %.8s.\n", data->repo_id);
+        evhtp_connection_free (evhtp_request_get_connection (req));
+        free_send_zip_stream_data (data);
+        return;
+    }
+
+    /* Recover evhtp's callbacks */
+    bev->readcb = data->saved_read_cb;
+    bev->writecb = data->saved_write_cb;
+    bev->errorcb = data->saved_event_cb;
+    bev->cbarg = data->saved_cb_arg;
+
+    /* Resume reading incomming requests. */
+    evhtp_request_resume (req);
+
+    evhtp_send_reply_chunk_end (req);
+
+    char *oper = "web-file-download";
+    if (g_strcmp0(data->token_type, "download-dir-link") == 0 ||
+        g_strcmp0(data->token_type, "download-multi-link") == 0)
+        oper = "link-file-download";
+
+    send_statistic_msg(data->repo_id, data->user, oper, data->total_size);
+
+    free_send_zip_stream_data (data);
+}
+
+/* The pipe has more of the archive. */
+static void
+read_zip_stream_cb (evutil_socket_t fd, short what, void *ctx)
+{
+    SendZipStreamData *data = ctx;
+    struct bufferevent *bev = evhtp_request_get_bev (data->req);
+    struct evbuffer *buf;
+    int n;
+
+    buf = evbuffer_new ();
+    n = evbuffer_read (buf, fd, ZIP_STREAM_READ_SIZE);
+    if (n < 0) {
+        evbuffer_free (buf);
+        if (errno == EAGAIN || errno == EINTR)
+            return;
+        seaf_warning ("Failed to read zip stream: %s.\n", strerror (errno));
+        evhtp_connection_free (evhtp_request_get_connection (data->req));
+        free_send_zip_stream_data (data);
+        return;
+    }
+    if (n == 0) {
+        evbuffer_free (buf);
+        finish_zip_stream (data);
+        return;
+    }
+
+    data->total_size += n;
+    evhtp_send_reply_chunk (data->req, buf);
+    evbuffer_free (buf);
+
+    /* The zip thread blocks on the full pipe until the client catches up. */
+    if (evbuffer_get_length (bufferevent_get_output (bev)) >= ZIP_STREAM_HIGH_WATERMARK) {
+        event_del (data->read_event);
+        data->reading = FALSE;
+    }
+}
+
+static void
+write_zip_stream_cb (struct bufferevent *bev, void *ctx)
+{
+    SendZipStreamData *data = ctx;
+
+    /* The output buffer is drained, read on. */
+    if (!data->reading) {
+        event_add (data->read_event, NULL);
+        data->reading = TRUE;
+    }
+}
+
+static void
+zip_stream_event_cb (struct bufferevent *bev, short events, void *ctx)
+{
+    SendZipStreamData *data = ctx;
+
+    data->saved_event_cb (bev, events, data->saved_cb_arg);
+
+    /* Free aux data. */
+    free_send_zip_stream_data (data);
+}
+
 static void
 my_block_event_cb (struct bufferevent *bev, short events, void *ctx)
 {
@@ -677,31 +853,26 @@ get_start_block_handle (const char *store_id, int version, Seafile *file,
                         guint64 start, int *blk_idx)
 {
     BlockHandle *handle = NULL;
-    BlockMetadata *bmd;
+    SeafBlockOffsets *offsets;
     char *blkid;
-    guint64 tolsize = 0;
-    int i = 0;
-
-    for (; i < file->n_blocks; i++) {
-        blkid = file->blk_sha1s[i];
-
-        bmd = seaf_block_manager_stat_block(seaf->block_mgr, store_id,
-                                            version, blkid);
-        if (!bmd)
-            return NULL;
+    guint64 blk_start;
+    int i;
 
-        if (start < tolsize + bmd->size) {
-            g_free (bmd);
-            break;
-        }
-        tolsize += bmd->size;
-        g_free (bmd);
-    }
+    offsets = seaf_fs_manager_get_block_offsets (seaf->fs_mgr, store_id,
+                                                 version, file);
+    if (!offsets)
+        return NULL;
 
     /* beyond the file size */
-    if (i == file->n_blocks)
+    i = seaf_block_offsets_find (offsets, start);
+    if (i < 0) {
+        seaf_block_offsets_unref (offsets);
         return NULL;
+    }
+    blk_start = offsets->offsets[i];
+    seaf_block_offsets_unref (offsets);
 
+    blkid = file->blk_sha1s[i];
     handle = seaf_block_manager_open_block(seaf->block_mgr,
                                            store_id, version,
                                            blkid, BLOCK_READ);
@@ -711,14 +882,16 @@ get_start_block_handle (const char *store_id, int version, Seafile *file,
     }
 
     /* trim the offset in a block */
-    if (start > tolsize) {
-        char *tmp = (char *)malloc(sizeof(*tmp) * (start - tolsize));
+    if (start > blk_start &&
+        seaf_block_manager_seek_block (seaf->block_mgr, handle,
+                                       start - blk_start) < 0) {
+        char *tmp = (char *)malloc(sizeof(*tmp) * (start - blk_start));
         if (!tmp)
             goto err;
 
         int n = seaf_block_manager_read_block(seaf->block_mgr, handle,
-                                              tmp, start-tolsize);
-        if (n != start-tolsize) {
+                                              tmp, start-blk_start);
+        if (n != start-blk_start) {
             seaf_warning ("Failed to read block %s:%s.\n", store_id, blkid);
             free (tmp);
             goto err;
@@ -1106,6 +1279,75 @@ start_download_zip_file (evhtp_request_t *req, const char *token,
     return 0;
 }
 
+/*
+ * Sends the zip while the zip thread pool generates it. The size isn't
+ * known in advance, so the reply is chunked. The archive comes through a
+ * pipe; it's only read while the connection keeps up, so a slow client
+ * holds the zip thread back instead of filling memory.
+ */
+static int
+start_stream_zip_file (evhtp_request_t *req, const char *token,
+                       const char *zipname,
+                       const char *repo_id, const char *user, const char *token_type)
+{
+    char cont_filename[SEAF_PATH_MAX];
+    int fds[2];
+    struct bufferevent *bev = evhtp_request_get_bev (req);
+    struct Progress *progress = NULL;
+    SendZipStreamData *data;
+
+    if (pipe (fds) < 0) {
+        seaf_warning ("Failed to create pipe: %s.\n", strerror(errno));
+        return -1;
+    }
+    if (evutil_make_socket_nonblocking (fds[0]) < 0 ||
+        !(progress = zip_download_mgr_start_zip_stream (seaf->zip_download_mgr,
+                                                        token, fds[1]))) {
+        close (fds[0]);
+        close (fds[1]);
+        return -1;
+    }
+
+    evhtp_headers_add_header(req->headers_out,
+                             evhtp_header_new("Content-Type", "application/zip", 1, 1));
+
+    snprintf(cont_filename, SEAF_PATH_MAX,
+             "attachment;filename=\"%s.zip\"", zipname);
+
+    evhtp_headers_add_header(req->headers_out,
+            evhtp_header_new("Content-Disposition", cont_filename, 1, 1));
+
+    data = g_new0 (SendZipStreamData, 1);
+    data->req = req;
+    data->fd = fds[0];
+    data->progress = progress;
+    data->token = g_strdup (token);
+    data->user = g_strdup (user);
+    data->token_type = g_strdup (token_type);
+    snprintf(data->repo_id, sizeof(data->repo_id), "%s", repo_id);
+    data->read_event = event_new (bufferevent_get_base (bev), data->fd,
+                                  EV_READ | EV_PERSIST, read_zip_stream_cb, data);
+
+    data->saved_read_cb = bev->readcb;
+    data->saved_write_cb = bev->writecb;
+    data->saved_event_cb = bev->errorcb;
+    data->saved_cb_arg = bev->cbarg;
+    bufferevent_setcb (bev,
+                       NULL,
+                       write_zip_stream_cb,
+                       zip_stream_event_cb,
+                       data);
+    /* Block any new request from this connection before finish
+     * handling this request.
+     */
+    evhtp_request_pause (req);
+
+    /* Send out http headers; reading starts once they're written. */
+    evhtp_send_reply_chunk_start (req, EVHTP_RES_OK);
+
+    return 0;
+}
+
 static gboolean
 can_use_cached_content (evhtp_request_t *req)
 {
@@ -1151,6 +1393,7 @@ access_zip_cb (evhtp_request_t *req, void *arg)
     char *repo_id = NULL;
     char *user = NULL;
     char *zip_file_path;
+    gboolean zip_ready;
     char *token_type = NULL;
     const char *error = NULL;
     int error_code;
@@ -1205,8 +1448,15 @@ access_zip_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    zip_file_path = zip_download_mgr_get_zip_file_path (seaf->zip_download_mgr, token);
-    if (!zip_file_path) {
+    if (seaf->http_server->streaming_zip) {
+        // The archive is generated while it's downloaded, there's no file.
+        zip_file_path = NULL;
+        zip_ready = zip_download_mgr_is_zip_stream_pending (seaf->zip_download_mgr, token);
+    } else {
+        zip_file_path = zip_download_mgr_get_zip_file_path (seaf->zip_download_mgr, token);
+        zip_ready = (zip_file_path != NULL);
+    }
+    if (!zip_ready) {
         g_object_get (info, "repo_id", &repo_id, NULL);
         seaf_warning ("Failed to get zip file path for %s in repo %.8s, token:[%s].\n",
                       filename, repo_id, token);
@@ -1224,7 +1474,11 @@ access_zip_cb (evhtp_request_t *req, void *arg)
     g_object_get (info, "username", &user, NULL);
     g_object_get (info, "repo_id", &repo_id, NULL);
     g_object_get (info, "op", &token_type, NULL);
-    int ret = start_download_zip_file (req, token, filename, zip_file_path, repo_id, user, token_type);
+    int ret;
+    if (seaf->http_server->streaming_zip)
+        ret = start_stream_zip_file (req, token, filename, repo_id, user, token_type);
+    else
+        ret = start_download_zip_file (req, token, filename, zip_file_path, repo_id, user, token_type);
     if (ret < 0) {
         error = "Internal server error\n";
         error_code = EVHTP_RES_SERVERR;
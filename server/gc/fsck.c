@@ -72,10 +72,12 @@ check_blocks (const char *file_id, FsckData *fsck_data, gboolean *io_error) // 
     Seafile *seafile;
     int i;
     char *block_id;
+    char **to_verify;
+    gboolean *valid;
+    int n_verify = 0, n_verified;
     int ret = 0;
     int dummy;
 
-    gboolean ok = TRUE;
     SeafRepo *repo = fsck_data->repo;
     const char *store_id = repo->store_id;
     int version = repo->version;
@@ -83,6 +85,9 @@ check_blocks (const char *file_id, FsckData *fsck_data, gboolean *io_error) // 
     seafile = seaf_fs_manager_get_seafile (seaf->fs_mgr, store_id,
                                            version, file_id);
 
+    to_verify = g_new (char *, seafile->n_blocks);
+    valid = g_new0 (gboolean, seafile->n_blocks);
+
     for (i = 0; i < seafile->n_blocks; ++i) {
         block_id = seafile->blk_sha1s[i];
 
@@ -97,33 +102,44 @@ check_blocks (const char *file_id, FsckData *fsck_data, gboolean *io_error) // 
             continue;
         }
 
-        // check block integrity, if not remove it
-        ok = seaf_block_manager_verify_block (seaf->block_mgr,
-                                              store_id, version,
-                                              block_id, io_error);
-        if (!ok) {
-            if (*io_error) {
-                if (ret < 0) {
-                    *io_error = FALSE;
-                }
-                ret = -1;
-                break;
-            } else {
-                if (fsck_data->repair) {
-                    seaf_message ("Repo[%.8s] block %s is damaged, remove it.\n", repo->id, block_id);
-                    seaf_block_manager_remove_block (seaf->block_mgr,
-                                                     store_id, version,
-                                                     block_id);
-                } else {
-                    seaf_message ("Repo[%.8s] block %s is damaged.\n", repo->id, block_id);
-                }
-                ret = -1;
-            }
+        /* Also skips later copies of the block in this file. */
+        g_hash_table_insert (fsck_data->existing_blocks, g_strdup(block_id), &dummy);
+        to_verify[n_verify++] = block_id;
+    }
+
+    // check block integrity, if not remove it
+    // 块是成批读入并行计算SHA1的
+    n_verified = seaf_block_manager_verify_blocks (seaf->block_mgr,
+                                                   store_id, version,
+                                                   to_verify, n_verify,
+                                                   valid);
+    for (i = 0; i < n_verified; ++i) {
+        if (valid[i])
+            continue;
+
+        block_id = to_verify[i];
+        if (fsck_data->repair) {
+            seaf_message ("Repo[%.8s] block %s is damaged, remove it.\n", repo->id, block_id);
+            seaf_block_manager_remove_block (seaf->block_mgr,
+                                             store_id, version,
+                                             block_id);
+        } else {
+            seaf_message ("Repo[%.8s] block %s is damaged.\n", repo->id, block_id);
         }
+        ret = -1;
+    }
 
-        g_hash_table_insert (fsck_data->existing_blocks, g_strdup(block_id), &dummy);
+    if (n_verified < n_verify) {
+        /* Failed to read a block. It's only reported as an io error if
+         * nothing else is wrong with the file. */
+        *io_error = (ret == 0);
+        ret = -1;
+        for (i = n_verified; i < n_verify; ++i)
+            g_hash_table_remove (fsck_data->existing_blocks, to_verify[i]);
     }
 
+    g_free (to_verify);
+    g_free (valid);
     seafile_unref (seafile);
 
     return ret;
@@ -0,0 +1,287 @@
+/* 增量垃圾回收的检查点 */
+
+#include "common.h"
+
+#include "seafile-session.h"
+#include "gc-checkpoint.h"
+#include "utils.h"
+
+#define DEBUG_FLAG SEAFILE_DEBUG_OTHER
+#include "log.h"
+
+#define CHECKPOINT_DIR "gc-checkpoints"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_GROUP "checkpoint" // 检查点信息所在的组，其余各组以仓库id命名
+#define KEY_VERSION "version"
+#define KEY_IDS "ids"
+#define KEY_N_IDS "n_ids"
+#define KEY_TRUNCATE_TIME "truncate_time"
+#define KEY_HEADS "heads"
+
+struct GCCheckpoint {
+    char *store_id;
+    GKeyFile *meta;
+    char *ids_path; // 块id文件，新建的检查点在保存前为NULL
+    guint64 n_ids;
+};
+
+static char *
+checkpoint_dir ()
+{
+    return g_build_filename (seaf->seaf_dir, CHECKPOINT_DIR, NULL);
+}
+
+static char *
+meta_path (const char *store_id)
+{
+    char *dir = checkpoint_dir ();
+    char *name = g_strconcat (store_id, ".ckpt", NULL);
+    char *path = g_build_filename (dir, name, NULL);
+
+    g_free (dir);
+    g_free (name);
+    return path;
+}
+
+GCCheckpoint *
+gc_checkpoint_new (const char *store_id)
+{
+    GCCheckpoint *ckpt = g_new0 (GCCheckpoint, 1);
+
+    ckpt->store_id = g_strdup (store_id);
+    ckpt->meta = g_key_file_new ();
+
+    return ckpt;
+}
+
+void
+gc_checkpoint_free (GCCheckpoint *ckpt)
+{
+    if (!ckpt)
+        return;
+
+    g_free (ckpt->store_id);
+    g_key_file_free (ckpt->meta);
+    g_free (ckpt->ids_path);
+    g_free (ckpt);
+}
+
+GCCheckpoint *
+gc_checkpoint_load (const char *store_id)
+{
+    GCCheckpoint *ckpt;
+    char *path, *ids_name = NULL, *dir;
+    GError *error = NULL;
+    SeafStat st;
+
+    path = meta_path (store_id);
+    if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+        g_free (path);
+        return NULL;
+    }
+
+    ckpt = gc_checkpoint_new (store_id);
+    if (!g_key_file_load_from_file (ckpt->meta, path, G_KEY_FILE_NONE, &error)) {
+        seaf_warning ("Failed to load GC checkpoint %s: %s.\n", path, error->message);
+        g_clear_error (&error);
+        goto error;
+    }
+
+    if (g_key_file_get_integer (ckpt->meta, CHECKPOINT_GROUP,
+                                KEY_VERSION, NULL) != CHECKPOINT_VERSION) {
+        seaf_warning ("Unknown version of GC checkpoint %s.\n", path);
+        goto error;
+    }
+
+    ids_name = g_key_file_get_string (ckpt->meta, CHECKPOINT_GROUP, KEY_IDS, NULL);
+    ckpt->n_ids = g_key_file_get_uint64 (ckpt->meta, CHECKPOINT_GROUP,
+                                         KEY_N_IDS, &error);
+    if (!ids_name || error) {
+        seaf_warning ("Invalid GC checkpoint %s.\n", path);
+        g_clear_error (&error);
+        goto error;
+    }
+
+    dir = checkpoint_dir ();
+    ckpt->ids_path = g_build_filename (dir, ids_name, NULL);
+    g_free (dir);
+
+    /* The ids file is written before the key file, a size mismatch means
+     * it has been damaged since. */
+    if (seaf_stat (ckpt->ids_path, &st) < 0 ||
+        (guint64)st.st_size != ckpt->n_ids * 20) {
+        seaf_warning ("Block ids of GC checkpoint %s are missing or damaged.\n", path);
+        goto error;
+    }
+
+    g_free (ids_name);
+    g_free (path);
+    return ckpt;
+
+error:
+    g_free (ids_name);
+    g_free (path);
+    gc_checkpoint_free (ckpt);
+    return NULL;
+}
+
+GList *
+gc_checkpoint_list_repos (GCCheckpoint *ckpt)
+{
+    char **groups;
+    GList *ret = NULL;
+    int i;
+
+    groups = g_key_file_get_groups (ckpt->meta, NULL);
+    for (i = 0; groups[i] != NULL; ++i) {
+        if (strcmp (groups[i], CHECKPOINT_GROUP) != 0)
+            ret = g_list_prepend (ret, g_strdup (groups[i]));
+    }
+    g_strfreev (groups);
+
+    return ret;
+}
+
+GHashTable *
+gc_checkpoint_get_heads (GCCheckpoint *ckpt, const char *repo_id,
+                         gint64 truncate_time)
+{
+    GHashTable *heads;
+    GError *error = NULL;
+    char **head_ids;
+    gint64 ckpt_truncate_time;
+    int i;
+
+    ckpt_truncate_time = g_key_file_get_int64 (ckpt->meta, repo_id,
+                                               KEY_TRUNCATE_TIME, &error);
+    if (error) {
+        g_clear_error (&error);
+        return NULL;
+    }
+    if (ckpt_truncate_time != truncate_time)
+        return NULL;
+
+    head_ids = g_key_file_get_string_list (ckpt->meta, repo_id, KEY_HEADS,
+                                           NULL, NULL);
+    if (!head_ids)
+        return NULL;
+
+    heads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; head_ids[i] != NULL; ++i) {
+        if (strlen (head_ids[i]) == 40) {
+            char *key = g_strdup (head_ids[i]);
+            g_hash_table_replace (heads, key, key);
+        }
+    }
+    g_strfreev (head_ids);
+
+    return heads;
+}
+
+void
+gc_checkpoint_set_heads (GCCheckpoint *ckpt, const char *repo_id,
+                         gint64 truncate_time, GList *head_ids)
+{
+    const char **list;
+    GList *ptr;
+    int i = 0;
+
+    list = g_new0 (const char *, g_list_length (head_ids) + 1);
+    for (ptr = head_ids; ptr; ptr = ptr->next)
+        list[i++] = ptr->data;
+
+    g_key_file_set_int64 (ckpt->meta, repo_id, KEY_TRUNCATE_TIME, truncate_time);
+    g_key_file_set_string_list (ckpt->meta, repo_id, KEY_HEADS, list, i);
+
+    g_free (list);
+}
+
+const char *
+gc_checkpoint_get_ids_path (GCCheckpoint *ckpt)
+{
+    return ckpt->ids_path;
+}
+
+guint64
+gc_checkpoint_get_n_ids (GCCheckpoint *ckpt)
+{
+    return ckpt->n_ids;
+}
+
+int
+gc_checkpoint_save (GCCheckpoint *ckpt, SortedIdSet *live_ids,
+                    GCCheckpoint *old)
+{
+    char *dir = NULL, *ids_name = NULL, *path = NULL, *data = NULL;
+    GError *error = NULL;
+    gsize len;
+    int ret = 0;
+
+    dir = checkpoint_dir ();
+    if (g_mkdir_with_parents (dir, 0777) < 0) {
+        seaf_warning ("Failed to create %s: %s.\n", dir, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    g_free (ckpt->ids_path);
+    if (old && sorted_id_set_n_added (live_ids) == 0) {
+        /* Nothing new since the last run. */
+        ckpt->ids_path = g_strdup (old->ids_path);
+        ckpt->n_ids = old->n_ids;
+    } else {
+        ids_name = g_strdup_printf ("%s-%"G_GINT64_FORMAT".ids",
+                                    ckpt->store_id, g_get_real_time ());
+        ckpt->ids_path = g_build_filename (dir, ids_name, NULL);
+        if (sorted_id_set_save (live_ids, ckpt->ids_path, &ckpt->n_ids) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    g_key_file_set_integer (ckpt->meta, CHECKPOINT_GROUP, KEY_VERSION,
+                            CHECKPOINT_VERSION);
+    g_free (ids_name);
+    ids_name = g_path_get_basename (ckpt->ids_path);
+    g_key_file_set_string (ckpt->meta, CHECKPOINT_GROUP, KEY_IDS, ids_name);
+    g_key_file_set_uint64 (ckpt->meta, CHECKPOINT_GROUP, KEY_N_IDS, ckpt->n_ids);
+
+    /* g_file_set_contents() replaces the key file atomically, so the
+     * checkpoint always refers to a complete ids file. */
+    path = meta_path (ckpt->store_id);
+    data = g_key_file_to_data (ckpt->meta, &len, NULL);
+    if (!g_file_set_contents (path, data, len, &error)) {
+        seaf_warning ("Failed to save GC checkpoint %s: %s.\n", path, error->message);
+        g_clear_error (&error);
+        if (!old || strcmp (ckpt->ids_path, old->ids_path) != 0)
+            g_unlink (ckpt->ids_path);
+        ret = -1;
+        goto out;
+    }
+
+    if (old && strcmp (ckpt->ids_path, old->ids_path) != 0)
+        g_unlink (old->ids_path);
+
+out:
+    g_free (dir);
+    g_free (ids_name);
+    g_free (path);
+    g_free (data);
+    return ret;
+}
+
+void
+gc_checkpoint_remove (const char *store_id)
+{
+    GCCheckpoint *ckpt;
+    char *path;
+
+    ckpt = gc_checkpoint_load (store_id);
+    if (ckpt)
+        g_unlink (ckpt->ids_path);
+    gc_checkpoint_free (ckpt);
+
+    path = meta_path (store_id);
+    g_unlink (path);
+    g_free (path);
+}
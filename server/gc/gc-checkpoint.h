@@ -0,0 +1,61 @@
+/* 增量垃圾回收的检查点 */
+
+#ifndef GC_CHECKPOINT_H
+#define GC_CHECKPOINT_H
+
+#include <glib.h>
+
+#include "sorted-id-set.h"
+
+/*
+ * A GC checkpoint records, for a block store, the branch heads each repo
+ * (the origin repo and its virtual repos) was traversed from, and the
+ * sorted ids of all blocks they reference. The next GC run only has to
+ * walk the commits created since then.
+ *
+ * Checkpoints are kept in <seafile-data>/gc-checkpoints/: <store_id>.ckpt
+ * is a key file with the heads, <store_id>-<time>.ids the raw block ids.
+ */
+typedef struct GCCheckpoint GCCheckpoint;
+
+GCCheckpoint * // 读取存储的检查点；不存在或损坏时返回NULL
+gc_checkpoint_load (const char *store_id);
+
+GCCheckpoint * // 新建空检查点
+gc_checkpoint_new (const char *store_id);
+
+void
+gc_checkpoint_free (GCCheckpoint *ckpt);
+
+/* Returns the ids of repos in the checkpoint. */
+GList * // 检查点中的仓库
+gc_checkpoint_list_repos (GCCheckpoint *ckpt);
+
+/* Returns the set of branch heads @repo_id was traversed from, or NULL if
+ * the repo isn't in the checkpoint or was traversed with another
+ * truncate time. */
+GHashTable * // 获取仓库的分支头
+gc_checkpoint_get_heads (GCCheckpoint *ckpt, const char *repo_id,
+                         gint64 truncate_time);
+
+void // 记录仓库的分支头
+gc_checkpoint_set_heads (GCCheckpoint *ckpt, const char *repo_id,
+                         gint64 truncate_time, GList *head_ids);
+
+const char * // 块id文件的路径
+gc_checkpoint_get_ids_path (GCCheckpoint *ckpt);
+
+guint64 // 块id数
+gc_checkpoint_get_n_ids (GCCheckpoint *ckpt);
+
+/* Saves @ckpt with the ids in @live_ids, which must be finished. If
+ * @live_ids was built on the ids of @old and nothing was added, the ids
+ * file of @old is reused. The ids file of @old is removed otherwise. */
+int // 保存检查点
+gc_checkpoint_save (GCCheckpoint *ckpt, SortedIdSet *live_ids,
+                    GCCheckpoint *old);
+
+void // 删除存储的检查点
+gc_checkpoint_remove (const char *store_id);
+
+#endif
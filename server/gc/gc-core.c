@@ -2,55 +2,110 @@
 
 #include "common.h"
 
+#include <pthread.h>
+
 #include "seafile-session.h"
 #include "bloom-filter.h"
+#include "sorted-id-set.h"
+#include "gc-checkpoint.h"
+#include "diff-simple.h"
 #include "gc-core.h"
 #include "utils.h"
 
 #define DEBUG_FLAG SEAFILE_DEBUG_OTHER
 #include "log.h"
 
-#define MAX_BF_SIZE (((size_t)1) << 29)   /* 64 MB */
+#define MAX_GC_INDEX_SIZE (((size_t)1) << 30)   /* 1 GB */
+#define DEFAULT_INDEX_FPR 0.01
+#define EXACT_MEM_LIMIT (((size_t)1) << 26)   /* 64 MB for each id set */
+
+#define VISITED_SHARDS 64 // 并行遍历时访问表的分片数
+#define FILE_BATCH_SIZE 64 // 每个任务处理的文件对象数
+#define PROGRESS_INTERVAL 100000 // 每处理这么多对象输出一次进度
+
+/*
+ * With --threads N, up to N repos are collected concurrently, and the fs
+ * trees of each repo are traversed on a shared pool of N threads: every
+ * directory is a task, and files of large directories are split into
+ * batches, so a deep or wide tree keeps all threads busy. The pool is
+ * NULL when running single-threaded.
+ */
+static GThreadPool *traverse_pool; // 遍历文件树的线程池
 
-/* Total number of blocks to be scanned. */
-static guint64 total_blocks;
-static guint64 removed_blocks;
-static guint64 reachable_blocks;
+static double index_fpr = DEFAULT_INDEX_FPR; // 索引的目标假阳性率
 
 /*
- * The number of bits in the bloom filter is 4 times the number of all blocks.
- * Let m be the bits in the bf, n be the number of blocks to be added to the bf
- * (the number of live blocks), and k = 3 (closed to optimal for m/n = 4),
- * the probability of false-positive is
+ * In exact mode, reachable block ids and the ids of all blocks in the store
+ * are both externally sorted (spilled to sorted runs in the tmp dir, then
+ * k-way merged), and a merge join of the two finds exactly the unreachable
+ * blocks. Memory use is bounded by EXACT_MEM_LIMIT per id set regardless
+ * of the size of the store, at the cost of temp disk space (20 bytes per
+ * block id) and sorting time.
+ */
+static gboolean exact_mode; // 精确模式
+
+/*
+ * After each GC of a store whose repos keep full history, a checkpoint
+ * with their branch heads and the ids of all blocks they reference is
+ * saved (see gc-checkpoint.h). The next run starts from those ids, and
+ * for each repo only walks commits created since: files added or changed
+ * relative to the parent commit are indexed, found with diff_trees().
+ * This is exact because with full history nothing reachable from the old
+ * heads becomes garbage.
  *
- *     p = (1 - e^(-kn/m))^k = 0.15
+ * A full pass is done with --full, when there is no checkpoint, when the
+ * history of the repo is limited (commits expire as time goes by, so the
+ * checkpoint would keep their blocks alive), and when a virtual repo of
+ * the checkpoint has been removed.
+ */
+static gboolean full_pass; // 不使用检查点，完整遍历
+
+typedef struct {
+    BlockedBloom *bloom; // 布隆过滤器索引
+    SortedIdSet *live_ids; // 可达块id集合，精确模式或保存检查点时使用
+} GCIndex; // 垃圾回收索引
+
+typedef struct {
+    guint64 total_blocks; // 需要扫描的块数
+    guint64 removed_blocks; // 删除（或可删除）的块数
+    guint64 reachable_blocks; // 可达块数
+    gint64  traversed_fs_objs; // 遍历的文件系统对象数
+    gint64  index_time; // 建立索引阶段的耗时（微秒）
+    gint64  sweep_time; // 扫描块阶段的耗时（微秒）
+    double  index_fpr; // 索引实际的假阳性率
+    guint64 kept_dead_blocks; // 因假阳性而未删除的块数（估计值）
+} GCRepoStats; // 单个仓库的垃圾回收统计
+
+/*
+ * Live blocks are recorded in a blocked bloom filter. It's sized for all
+ * blocks in the store (an upper bound of live blocks) to reach the target
+ * false-positive rate, i.e. about 1-fpr of dead blocks are cleaned up in
+ * each gc operation. With the default 1% rate the index takes about
+ * 1.2 bytes per block: 12MB for 8TB of 1MB blocks.
  *
- * Because m = 4 * total_blocks >= 4 * (live blocks) = 4n, we should have p <= 0.15.
- * Put it another way, we'll clean up at least 85% dead blocks in each gc operation.
+ * The size is capped at MAX_GC_INDEX_SIZE. For stores that big the
+ * rate is higher than the target, the achieved rate is reported.
  * See http://en.wikipedia.org/wiki/Bloom_filter.
- *
- * Supose we have 8TB space, and the avg block size is 1MB, we'll have 8M blocks, then
- * the size of bf is (8M * 4)/8 = 4MB.
- *
- * If total_blocks is a small number (e.g. < 100), we should try to clean all dead blocks.
- * So we set the minimal size of the bf to 1KB.
  */
-static Bloom *
-alloc_gc_index () // 申请垃圾回收索引，是一个布隆过滤器
+static BlockedBloom *
+alloc_gc_index (guint64 total_blocks) // 申请垃圾回收索引，是一个布隆过滤器
 {
-    size_t size;
+    BlockedBloom *index;
 
-    size = (size_t) MAX(total_blocks << 2, 1 << 13);
-    size = MIN (size, MAX_BF_SIZE);
+    index = blocked_bloom_create (total_blocks, index_fpr, MAX_GC_INDEX_SIZE);
+    if (!index)
+        return NULL;
 
-    seaf_message ("GC index size is %u Byte.\n", (int)size >> 3);
+    seaf_message ("GC index size is %"G_GUINT64_FORMAT" Byte, "
+                  "expected false positive rate is %.4f%%.\n",
+                  (guint64)blocked_bloom_size (index), index_fpr * 100);
 
-    return bloom_create (size, 3, 0);
+    return index;
 }
 
 typedef struct {
     SeafRepo *repo; // 仓库
-    Bloom *index; // 索引
+    GCIndex *index; // 索引
     GHashTable *visited; // 访问表
 
     /* > 0: keep a period of history;
@@ -59,38 +114,272 @@ typedef struct {
      */
     gint64 truncate_time; // 截止时间
     gboolean traversed_head; // 遍历头
+    GHashTable *old_heads; // 上次回收时的分支头，增量遍历时不为NULL
 
     int traversed_commits; // 遍历提交数
     gint64 traversed_blocks; // 遍历块数
 
     int verbose; // 输出
     gint64 traversed_fs_objs; // 遍历对象数
+
+    struct ParallelTraverse *pt; // 并行遍历时的上下文
 } GCData; // 垃圾回收数据
 
-static int // 将块加入到索引中
-add_blocks_to_index (SeafFSManager *mgr, GCData *data, const char *file_id)
+typedef struct {
+    pthread_mutex_t lock;
+    GHashTable *table;
+} VisitedShard;
+
+typedef struct ParallelTraverse { // 并行遍历一个仓库的文件树
+    SeafRepo *repo;
+    GCIndex *index;
+    VisitedShard visited[VISITED_SHARDS]; // 按对象id分片的访问表
+
+    pthread_mutex_t lock; // 保护以下各域
+    pthread_cond_t done_cond;
+    int pending; // 尚未完成的任务数
+    int error; // 是否出错；出错后跳过剩余任务
+    gint64 traversed_fs_objs;
+    gint64 traversed_blocks;
+    gint64 next_report; // 下次输出进度时的对象数
+    gint64 start_time;
+} ParallelTraverse;
+
+typedef struct {
+    ParallelTraverse *pt;
+    char *dir_id; // 需要遍历的目录
+    GPtrArray *file_ids; // 或需要加入索引的文件
+} TraverseTask;
+
+static ParallelTraverse *
+parallel_traverse_new (SeafRepo *repo, GCIndex *index)
+{
+    ParallelTraverse *pt = g_new0 (ParallelTraverse, 1);
+    int i;
+
+    pt->repo = repo;
+    pt->index = index;
+    for (i = 0; i < VISITED_SHARDS; ++i) {
+        pthread_mutex_init (&pt->visited[i].lock, NULL);
+        pt->visited[i].table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free, NULL);
+    }
+    pthread_mutex_init (&pt->lock, NULL);
+    pthread_cond_init (&pt->done_cond, NULL);
+    pt->next_report = PROGRESS_INTERVAL;
+    pt->start_time = g_get_monotonic_time ();
+
+    return pt;
+}
+
+static void
+parallel_traverse_free (ParallelTraverse *pt)
 {
-    SeafRepo *repo = data->repo;
-    Bloom *index = data->index;
-    Seafile *seafile;
     int i;
 
+    for (i = 0; i < VISITED_SHARDS; ++i) {
+        pthread_mutex_destroy (&pt->visited[i].lock);
+        g_hash_table_destroy (pt->visited[i].table);
+    }
+    pthread_mutex_destroy (&pt->lock);
+    pthread_cond_destroy (&pt->done_cond);
+    g_free (pt);
+}
+
+/* Returns TRUE if @obj_id hasn't been visited before. */
+static gboolean // 标记对象为已访问
+visit_obj (ParallelTraverse *pt, const char *obj_id)
+{
+    VisitedShard *shard;
+    gboolean added = FALSE;
+    int idx;
+
+    idx = ((g_ascii_xdigit_value (obj_id[0]) << 4) |
+           g_ascii_xdigit_value (obj_id[1])) % VISITED_SHARDS;
+    shard = &pt->visited[idx];
+
+    pthread_mutex_lock (&shard->lock);
+    if (!g_hash_table_lookup (shard->table, obj_id)) {
+        char *key = g_strdup (obj_id);
+        g_hash_table_insert (shard->table, key, key);
+        added = TRUE;
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    return added;
+}
+
+static void // 提交遍历任务
+push_traverse_task (ParallelTraverse *pt, char *dir_id, GPtrArray *file_ids)
+{
+    TraverseTask *task = g_new0 (TraverseTask, 1);
+
+    task->pt = pt;
+    task->dir_id = dir_id;
+    task->file_ids = file_ids;
+
+    pthread_mutex_lock (&pt->lock);
+    ++pt->pending;
+    pthread_mutex_unlock (&pt->lock);
+
+    g_thread_pool_push (traverse_pool, task, NULL);
+}
+
+static void // 任务完成，汇总统计
+finish_traverse_task (ParallelTraverse *pt, gint64 fs_objs, gint64 blocks,
+                      gboolean failed)
+{
+    gint64 elapsed;
+
+    pthread_mutex_lock (&pt->lock);
+
+    pt->traversed_fs_objs += fs_objs;
+    pt->traversed_blocks += blocks;
+    if (failed)
+        pt->error = 1;
+
+    if (pt->traversed_fs_objs >= pt->next_report) {
+        elapsed = g_get_monotonic_time () - pt->start_time;
+        seaf_message ("Repo %.8s: traversed %"G_GINT64_FORMAT" fs objects, "
+                      "%"G_GINT64_FORMAT" blocks (%.0f fs objs/s).\n",
+                      pt->repo->id, pt->traversed_fs_objs, pt->traversed_blocks,
+                      elapsed > 0 ? pt->traversed_fs_objs * 1e6 / elapsed : 0.0);
+        pt->next_report = pt->traversed_fs_objs + PROGRESS_INTERVAL;
+    }
+
+    if (--pt->pending == 0)
+        pthread_cond_broadcast (&pt->done_cond);
+
+    pthread_mutex_unlock (&pt->lock);
+}
+
+static void // 等待仓库的所有遍历任务完成
+wait_traverse_tasks (ParallelTraverse *pt)
+{
+    pthread_mutex_lock (&pt->lock);
+    while (pt->pending > 0)
+        pthread_cond_wait (&pt->done_cond, &pt->lock);
+    pthread_mutex_unlock (&pt->lock);
+}
+
+/* Returns the number of blocks added, or -1 on error. */
+static int // 将文件的块加入到索引中
+add_file_blocks (SeafFSManager *mgr, SeafRepo *repo, GCIndex *index, const char *file_id)
+{
+    Seafile *seafile;
+    int i, n_blocks;
+
     seafile = seaf_fs_manager_get_seafile (mgr, repo->store_id, repo->version, file_id);
     if (!seafile) {
         seaf_warning ("Failed to find file %s:%s.\n", repo->store_id, file_id);
         return -1;
     }
 
+    n_blocks = seafile->n_blocks;
     for (i = 0; i < seafile->n_blocks; ++i) {
-        bloom_add (index, seafile->blk_sha1s[i]); // 以块名（SHA1摘要）索引
-        ++data->traversed_blocks;
+        if (index->bloom)
+            blocked_bloom_add (index->bloom, seafile->blk_sha1s[i]); // 以块名（SHA1摘要）索引
+        if (index->live_ids &&
+            sorted_id_set_add (index->live_ids, seafile->blk_sha1s[i]) < 0) {
+            seaf_warning ("Failed to record block id %s.\n", seafile->blk_sha1s[i]);
+            n_blocks = -1;
+            break;
+        }
     }
 
     seafile_unref (seafile);
 
+    return n_blocks;
+}
+
+static int // 将块加入到索引中
+add_blocks_to_index (SeafFSManager *mgr, GCData *data, const char *file_id)
+{
+    int n_blocks;
+
+    n_blocks = add_file_blocks (mgr, data->repo, data->index, file_id);
+    if (n_blocks < 0)
+        return -1;
+
+    data->traversed_blocks += n_blocks;
+
     return 0;
 }
 
+static void // 线程池中执行的遍历任务
+traverse_task_func (gpointer vtask, gpointer user_data)
+{
+    TraverseTask *task = vtask;
+    ParallelTraverse *pt = task->pt;
+    SeafRepo *repo = pt->repo;
+    SeafDir *dir;
+    SeafDirent *dent;
+    GList *ptr;
+    GPtrArray *batch = NULL;
+    gint64 fs_objs = 0, blocks = 0;
+    gboolean failed = FALSE;
+    guint i;
+    int n;
+
+    /* Don't bother with the rest of the tree once the repo has failed. */
+    if (g_atomic_int_get (&pt->error))
+        goto out;
+
+    if (task->dir_id) {
+        dir = seaf_fs_manager_get_seafdir (seaf->fs_mgr, repo->store_id,
+                                           repo->version, task->dir_id);
+        if (!dir) {
+            seaf_warning ("[fs-mgr]get seafdir %s failed\n", task->dir_id);
+            failed = TRUE;
+            goto out;
+        }
+
+        for (ptr = dir->entries; ptr; ptr = ptr->next) {
+            dent = ptr->data;
+            if (S_ISREG(dent->mode)) {
+                if (memcmp (dent->id, EMPTY_SHA1, 40) == 0 ||
+                    !visit_obj (pt, dent->id))
+                    continue;
+                ++fs_objs;
+                if (!batch)
+                    batch = g_ptr_array_new_with_free_func (g_free);
+                g_ptr_array_add (batch, g_strdup (dent->id));
+                /* Hand full batches to other threads, keep the last one. */
+                if (batch->len >= FILE_BATCH_SIZE) {
+                    push_traverse_task (pt, NULL, batch);
+                    batch = NULL;
+                }
+            } else if (S_ISDIR(dent->mode)) {
+                if (!visit_obj (pt, dent->id))
+                    continue;
+                ++fs_objs;
+                push_traverse_task (pt, g_strdup (dent->id), NULL);
+            }
+        }
+        seaf_dir_free (dir);
+    } else {
+        batch = task->file_ids;
+        task->file_ids = NULL;
+    }
+
+    for (i = 0; batch && i < batch->len; ++i) {
+        n = add_file_blocks (seaf->fs_mgr, repo, pt->index,
+                             g_ptr_array_index (batch, i));
+        if (n < 0) {
+            failed = TRUE;
+            break;
+        }
+        blocks += n;
+    }
+
+out:
+    if (batch)
+        g_ptr_array_free (batch, TRUE);
+    finish_traverse_task (pt, fs_objs, blocks, failed);
+    g_free (task->dir_id);
+    g_free (task);
+}
+
 static gboolean
 fs_callback (SeafFSManager *mgr,
              const char *store_id,
@@ -121,12 +410,90 @@ fs_callback (SeafFSManager *mgr,
     return TRUE;
 }
 
+static int
+diff_files_cb (int n, const char *basedir, SeafDirent *files[], void *vdata) // 增量遍历时处理新增或修改的文件
+{
+    GCData *data = vdata;
+    SeafDirent *old = files[0], *new = files[1];
+    char *key;
+
+    if (!new || memcmp (new->id, EMPTY_SHA1, 40) == 0)
+        return 0;
+    if (old && strcmp (old->id, new->id) == 0)
+        return 0;
+    if (g_hash_table_lookup (data->visited, new->id))
+        return 0;
+
+    key = g_strdup (new->id);
+    g_hash_table_replace (data->visited, key, key);
+    ++data->traversed_fs_objs;
+
+    return add_blocks_to_index (seaf->fs_mgr, data, new->id);
+}
+
+static int
+diff_dirs_cb (int n, const char *basedir, SeafDirent *dirs[], void *vdata,
+              gboolean *recurse) // 增量遍历时处理目录
+{
+    GCData *data = vdata;
+
+    /* Nothing new in removed dirs, nor in dirs that have been traversed. */
+    if (!dirs[1] ||
+        (!dirs[0] && g_hash_table_lookup (data->visited, dirs[1]->id)))
+        *recurse = FALSE;
+
+    return 0;
+}
+
+/* Indexes files added or changed in @commit relative to its first parent.
+ * Files of the parent have been indexed, either in the last GC or when
+ * walking the parent. This also holds for merge commits, whose second
+ * parent is walked as well. */
+static gboolean // 增量遍历一个新提交
+traverse_new_commit (GCData *data, SeafCommit *commit)
+{
+    SeafCommit *parent;
+    DiffOptions opt;
+    const char *roots[2];
+    int ret;
+
+    parent = seaf_commit_manager_get_commit (seaf->commit_mgr,
+                                             data->repo->id, data->repo->version,
+                                             commit->parent_id);
+    if (!parent) {
+        seaf_warning ("Failed to find commit %s:%s.\n",
+                      data->repo->id, commit->parent_id);
+        return FALSE;
+    }
+
+    memset (&opt, 0, sizeof(opt));
+    memcpy (opt.store_id, data->repo->store_id, 36);
+    opt.version = data->repo->version;
+    opt.file_cb = diff_files_cb;
+    opt.dir_cb = diff_dirs_cb;
+    opt.data = data;
+
+    roots[0] = parent->root_id;
+    roots[1] = commit->root_id;
+    ret = diff_trees (2, roots, &opt);
+
+    seaf_commit_unref (parent);
+    return ret == 0;
+}
+
 static gboolean
 traverse_commit (SeafCommit *commit, void *vdata, gboolean *stop) // 遍历一个提交
 {
     GCData *data = vdata;
     int ret;
 
+    if (data->old_heads &&
+        g_hash_table_lookup (data->old_heads, commit->commit_id)) {
+        /* This commit and its ancestors were indexed in the last GC. */
+        *stop = TRUE;
+        return TRUE;
+    }
+
     if (data->truncate_time == 0) // 只遍历头
     {
         *stop = TRUE;
@@ -152,6 +519,25 @@ traverse_commit (SeafCommit *commit, void *vdata, gboolean *stop) // 遍历一
 
     ++data->traversed_commits;
 
+    /* The last commit before truncate time is traversed in full, since
+     * its parent isn't indexed. */
+    if (data->old_heads && !*stop && commit->parent_id)
+        return traverse_new_commit (data, commit);
+
+    if (data->pt) {
+        /* Trees are traversed in the background, commits keep being
+         * walked meanwhile.
+         */
+        if (strcmp (commit->root_id, EMPTY_SHA1) != 0 &&
+            visit_obj (data->pt, commit->root_id)) {
+            pthread_mutex_lock (&data->pt->lock);
+            ++data->pt->traversed_fs_objs;
+            pthread_mutex_unlock (&data->pt->lock);
+            push_traverse_task (data->pt, g_strdup (commit->root_id), NULL);
+        }
+        return TRUE;
+    }
+
     data->traversed_fs_objs = 0;
 
     ret = seaf_fs_manager_traverse_tree (seaf->fs_mgr,
@@ -169,10 +555,16 @@ traverse_commit (SeafCommit *commit, void *vdata, gboolean *stop) // 遍历一
     return TRUE;
 }
 
+/*
+ * With @old_ckpt, only commits created since the heads in the checkpoint
+ * are walked. The heads traversed are recorded in @new_ckpt.
+ */
 static int
-populate_gc_index_for_repo (SeafRepo *repo, Bloom *index, int verbose) // 统计仓库垃圾回收索引
+populate_gc_index_for_repo (SeafRepo *repo, GCIndex *index, int verbose,
+                            GCRepoStats *stats,
+                            GCCheckpoint *old_ckpt, GCCheckpoint *new_ckpt) // 统计仓库垃圾回收索引
 {
-    GList *branches, *ptr;
+    GList *branches, *ptr, *head_ids = NULL;
     SeafBranch *branch;
     GCData *data;
     int ret = 0;
@@ -188,14 +580,26 @@ populate_gc_index_for_repo (SeafRepo *repo, Bloom *index, int verbose) // 统计
         return -1;
     }
 
+    gint64 truncate_time = seaf_repo_manager_get_repo_truncate_time (repo->manager,
+                                                                     repo->id);
+
     data = g_new0(GCData, 1);
     data->repo = repo;
     data->index = index;
-    data->visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
     data->verbose = verbose;
-
-    gint64 truncate_time = seaf_repo_manager_get_repo_truncate_time (repo->manager,
-                                                                     repo->id);
+    if (old_ckpt) {
+        data->old_heads = gc_checkpoint_get_heads (old_ckpt, repo->id, truncate_time);
+        if (data->old_heads)
+            seaf_message ("Only walking commits since the last GC.\n");
+        else
+            seaf_message ("Repo %.8s isn't in the GC checkpoint, walking all commits.\n",
+                          repo->id);
+    }
+    /* Few objects are new since the last GC, walk them in this thread. */
+    if (traverse_pool && !data->old_heads)
+        data->pt = parallel_traverse_new (repo, index);
+    else
+        data->visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
     if (truncate_time > 0) {
         seaf_repo_manager_set_repo_valid_since (repo->manager,
                                                 repo->id,
@@ -216,6 +620,7 @@ populate_gc_index_for_repo (SeafRepo *repo, Bloom *index, int verbose) // 统计
 
     for (ptr = branches; ptr != NULL; ptr = ptr->next) { // 遍历每个分支
         branch = ptr->data;
+        head_ids = g_list_prepend (head_ids, g_strdup (branch->commit_id));
         gboolean res = seaf_commit_manager_traverse_commit_tree (seaf->commit_mgr,
                                                                  repo->id,
                                                                  repo->version,
@@ -230,31 +635,133 @@ populate_gc_index_for_repo (SeafRepo *repo, Bloom *index, int verbose) // 统计
         }
     }
 
+    /* Pending tasks refer to data->pt, wait for them even on error. */
+    if (data->pt) {
+        wait_traverse_tasks (data->pt);
+        if (data->pt->error)
+            ret = -1;
+        data->traversed_blocks = data->pt->traversed_blocks;
+        data->traversed_fs_objs = data->pt->traversed_fs_objs;
+        parallel_traverse_free (data->pt);
+        stats->traversed_fs_objs += data->traversed_fs_objs;
+    }
+
     seaf_message ("Traversed %d commits, %"G_GINT64_FORMAT" blocks.\n",
                   data->traversed_commits, data->traversed_blocks);
-    reachable_blocks += data->traversed_blocks;
+    stats->reachable_blocks += data->traversed_blocks;
+
+    if (ret == 0 && new_ckpt)
+        gc_checkpoint_set_heads (new_ckpt, repo->id, truncate_time, head_ids);
 
     g_list_free (branches);
-    g_hash_table_destroy (data->visited);
+    string_list_free (head_ids);
+    if (data->visited)
+        g_hash_table_destroy (data->visited);
+    if (data->old_heads)
+        g_hash_table_destroy (data->old_heads);
     g_free (data);
 
     return ret;
 }
 
 typedef struct {
-    Bloom *index;
+    GCIndex *index;
     int dry_run;
+    GCRepoStats *stats;
+    guint64 scanned_blocks; // 已扫描块数
+    gint64 start_time;
+    SortedIdSet *all_ids; // 精确模式下存储中所有块的id
+    int error;
 } CheckBlocksData; // 检查块数据
 
+static void // 输出扫描进度
+report_scan_progress (CheckBlocksData *data, const char *store_id)
+{
+    gint64 elapsed;
+
+    if (++data->scanned_blocks % PROGRESS_INTERVAL == 0) {
+        elapsed = g_get_monotonic_time () - data->start_time;
+        seaf_message ("Store %.8s: scanned %"G_GUINT64_FORMAT"/%"G_GUINT64_FORMAT
+                      " blocks (%.0f blocks/s).\n",
+                      store_id, data->scanned_blocks, data->stats->total_blocks,
+                      elapsed > 0 ? data->scanned_blocks * 1e6 / elapsed : 0.0);
+    }
+}
+
+static gboolean
+collect_block_id (const char *store_id, int version,
+                  const char *block_id, void *vdata) // 精确模式下记录块id
+{
+    CheckBlocksData *data = vdata;
+
+    report_scan_progress (data, store_id);
+
+    if (sorted_id_set_add (data->all_ids, block_id) < 0) {
+        seaf_warning ("Failed to record block id %s.\n", block_id);
+        data->error = -1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Merge join the sorted ids of all blocks with the sorted live ids. */
+static int // 精确模式下删除不可达的块
+remove_unreachable_blocks (SeafRepo *repo, CheckBlocksData *data)
+{
+    SortedIdIter *all_iter = NULL, *live_iter = NULL;
+    unsigned char id[20], live_id[20];
+    char block_id[41];
+    int has_live, ret;
+
+    if (sorted_id_set_finish (data->all_ids) < 0 ||
+        sorted_id_set_finish (data->index->live_ids) < 0)
+        return -1;
+
+    all_iter = sorted_id_set_iter (data->all_ids);
+    live_iter = sorted_id_set_iter (data->index->live_ids);
+    if (!all_iter || !live_iter) {
+        ret = -1;
+        goto out;
+    }
+
+    has_live = sorted_id_iter_next (live_iter, live_id);
+    while ((ret = sorted_id_iter_next (all_iter, id)) > 0) {
+        while (has_live > 0 && memcmp (live_id, id, 20) < 0)
+            has_live = sorted_id_iter_next (live_iter, live_id);
+        if (has_live < 0) {
+            ret = -1;
+            break;
+        }
+        if (has_live > 0 && memcmp (live_id, id, 20) == 0)
+            continue;
+
+        ++data->stats->removed_blocks;
+        if (!data->dry_run) {
+            rawdata_to_hex (id, block_id, 20);
+            seaf_block_manager_remove_block (seaf->block_mgr,
+                                             repo->store_id, repo->version,
+                                             block_id);
+        }
+    }
+
+out:
+    sorted_id_iter_free (all_iter);
+    sorted_id_iter_free (live_iter);
+    return ret;
+}
+
 static gboolean
 check_block_liveness (const char *store_id, int version,
                       const char *block_id, void *vdata) // 判断块是否活跃
 {
     CheckBlocksData *data = vdata;
-    Bloom *index = data->index;
+    GCIndex *index = data->index;
 
-    if (!bloom_test (index, block_id)) { // 不活跃
-        ++removed_blocks;
+    report_scan_progress (data, store_id);
+
+    if (!blocked_bloom_test (index->bloom, block_id)) { // 不活跃
+        ++data->stats->removed_blocks;
         if (!data->dry_run)
             seaf_block_manager_remove_block (seaf->block_mgr,
                                              store_id, version,
@@ -265,7 +772,9 @@ check_block_liveness (const char *store_id, int version,
 }
 
 static int // 统计虚拟仓库垃圾回收索引
-populate_gc_index_for_virtual_repos (SeafRepo *repo, Bloom *index, int verbose)
+populate_gc_index_for_virtual_repos (SeafRepo *repo, GCIndex *index, int verbose,
+                                     GCRepoStats *stats,
+                                     GCCheckpoint *old_ckpt, GCCheckpoint *new_ckpt)
 {
     GList *vrepo_ids = NULL, *ptr;
     char *repo_id;
@@ -283,7 +792,8 @@ populate_gc_index_for_virtual_repos (SeafRepo *repo, Bloom *index, int verbose)
             goto out;
         }
 
-        ret = populate_gc_index_for_repo (vrepo, index, verbose);
+        ret = populate_gc_index_for_repo (vrepo, index, verbose, stats,
+                                          old_ckpt, new_ckpt);
         seaf_repo_unref (vrepo);
         if (ret < 0)
             goto out;
@@ -294,23 +804,102 @@ out:
     return ret;
 }
 
+static GCCheckpoint * // 加载可以用于增量回收的检查点
+load_usable_checkpoint (SeafRepo *repo)
+{
+    GCCheckpoint *ckpt;
+    GList *repo_ids, *ptr;
+    GHashTable *heads;
+    const char *repo_id;
+    gint64 truncate_time;
+    gboolean usable = TRUE;
+
+    ckpt = gc_checkpoint_load (repo->store_id);
+    if (!ckpt) {
+        seaf_message ("No GC checkpoint, doing a full pass.\n");
+        return NULL;
+    }
+
+    /* Blocks only referenced by a removed virtual repo, or by history that
+     * has been truncated since, would be kept. */
+    repo_ids = gc_checkpoint_list_repos (ckpt);
+    for (ptr = repo_ids; ptr; ptr = ptr->next) {
+        repo_id = ptr->data;
+        if (strcmp (repo_id, repo->id) != 0 &&
+            !seaf_repo_manager_repo_exists (seaf->repo_mgr, repo_id)) {
+            seaf_message ("Sub-repo %.8s has been removed since the last GC, "
+                          "doing a full pass.\n", repo_id);
+            usable = FALSE;
+            break;
+        }
+
+        truncate_time = seaf_repo_manager_get_repo_truncate_time (seaf->repo_mgr,
+                                                                  repo_id);
+        heads = gc_checkpoint_get_heads (ckpt, repo_id, truncate_time);
+        if (!heads) {
+            seaf_message ("History of repo %.8s has changed since the last GC, "
+                          "doing a full pass.\n", repo_id);
+            usable = FALSE;
+            break;
+        }
+        g_hash_table_destroy (heads);
+    }
+    string_list_free (repo_ids);
+
+    if (!usable) {
+        gc_checkpoint_free (ckpt);
+        return NULL;
+    }
+    return ckpt;
+}
+
+static int // 将检查点中的块id加入索引
+add_checkpoint_to_index (GCCheckpoint *ckpt, GCIndex *index, GCRepoStats *stats)
+{
+    const char *path = gc_checkpoint_get_ids_path (ckpt);
+    SortedIdIter *iter;
+    unsigned char id[20];
+    char block_id[41];
+    int ret = 0;
+
+    if (sorted_id_set_add_file (index->live_ids, path) < 0)
+        return -1;
+
+    if (index->bloom) {
+        iter = sorted_id_iter_open (path);
+        if (!iter)
+            return -1;
+        while ((ret = sorted_id_iter_next (iter, id)) > 0) {
+            rawdata_to_hex (id, block_id, 20);
+            blocked_bloom_add (index->bloom, block_id);
+        }
+        sorted_id_iter_free (iter);
+        if (ret < 0)
+            return -1;
+    }
+
+    stats->reachable_blocks += gc_checkpoint_get_n_ids (ckpt);
+    return 0;
+}
+
 int // 对版本1的仓库垃圾回收
-gc_v1_repo (SeafRepo *repo, int dry_run, int verbose) // dry_run表示是否真的进行垃圾回收，verbose表示是否输出
+gc_v1_repo (SeafRepo *repo, int dry_run, int verbose, GCRepoStats *stats) // dry_run表示是否真的进行垃圾回收，verbose表示是否输出
 {
-    Bloom *index;
+    GCIndex index;
+    GCCheckpoint *old_ckpt = NULL, *new_ckpt = NULL;
     int ret;
+    gint64 start;
 
-    total_blocks = seaf_block_manager_get_block_number (seaf->block_mgr,
-                                                        repo->store_id, repo->version);
-    removed_blocks = 0;
-    reachable_blocks = 0;
+    stats->total_blocks = seaf_block_manager_get_block_number (seaf->block_mgr,
+                                                               repo->store_id, repo->version);
 
-    if (total_blocks == 0) {
+    if (stats->total_blocks == 0) {
         seaf_message ("No blocks. Skip GC.\n\n");
         return 0;
     }
 
-    seaf_message ("GC started. Total block number is %"G_GUINT64_FORMAT".\n", total_blocks);
+    seaf_message ("GC started. Total block number is %"G_GUINT64_FORMAT".\n",
+                  stats->total_blocks);
 
     /*
      * Store the index of live blocks in bloom filter to save memory.
@@ -318,60 +907,141 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int verbose) // dry_run表示是否真
      * may skip some garbage blocks, but we won't delete
      * blocks that are still alive.
      */
-    index = alloc_gc_index ();
-    if (!index) {
-        seaf_warning ("GC: Failed to allocate index.\n");
-        return -1;
+    memset (&index, 0, sizeof(index));
+    if (!exact_mode) {
+        index.bloom = alloc_gc_index (stats->total_blocks);
+        if (!index.bloom) {
+            seaf_warning ("GC: Failed to allocate index.\n");
+            return -1;
+        }
     }
 
+    /* Virtual repos have the history limit of the origin repo. */
+    if (seaf_repo_manager_get_repo_history_limit (seaf->repo_mgr, repo->id) < 0) {
+        new_ckpt = gc_checkpoint_new (repo->store_id);
+        if (!full_pass)
+            old_ckpt = load_usable_checkpoint (repo);
+    } else if (!dry_run) {
+        gc_checkpoint_remove (repo->store_id);
+    }
+
+    if (exact_mode || new_ckpt)
+        index.live_ids = sorted_id_set_new (seaf->tmp_file_dir, EXACT_MEM_LIMIT);
+
     seaf_message ("Populating index.\n");
 
-    ret = populate_gc_index_for_repo (repo, index, verbose); // 仓库进行统计垃圾回收
+    start = g_get_monotonic_time ();
+
+    if (old_ckpt) {
+        ret = add_checkpoint_to_index (old_ckpt, &index, stats);
+        if (ret < 0) {
+            seaf_warning ("GC: Failed to load block ids of the checkpoint.\n");
+            goto out;
+        }
+    }
+
+    ret = populate_gc_index_for_repo (repo, &index, verbose, stats,
+                                      old_ckpt, new_ckpt); // 仓库进行统计垃圾回收
     if (ret < 0)
         goto out;
 
     /* Since virtual repos share fs and block store with the origin repo,
      * it's necessary to do GC for them together.
      */
-    ret = populate_gc_index_for_virtual_repos (repo, index, verbose); // 虚拟仓库进行统计垃圾回收
+    ret = populate_gc_index_for_virtual_repos (repo, &index, verbose, stats,
+                                               old_ckpt, new_ckpt); // 虚拟仓库进行统计垃圾回收
     if (ret < 0)
         goto out;
 
+    stats->index_time = g_get_monotonic_time () - start;
+    if (index.bloom)
+        stats->index_fpr = blocked_bloom_fpr (index.bloom);
+    seaf_message ("Repo %.8s: index populated in %.1fs, "
+                  "%"G_GUINT64_FORMAT" reachable blocks, "
+                  "false positive rate is %.4f%%.\n",
+                  repo->id, stats->index_time / 1e6, stats->reachable_blocks,
+                  stats->index_fpr * 100);
+
     if (!dry_run)
         seaf_message ("Scanning and deleting unused blocks.\n");
     else
         seaf_message ("Scanning unused blocks.\n");
 
     CheckBlocksData data;
-    data.index = index;
+    memset (&data, 0, sizeof(data));
+    data.index = &index;
     data.dry_run = dry_run;
-
-    ret = seaf_block_manager_foreach_block (seaf->block_mgr,
-                                            repo->store_id, repo->version,
-                                            check_block_liveness,
-                                            &data); // 检查块是否活跃
+    data.stats = stats;
+    data.start_time = start = g_get_monotonic_time ();
+
+    if (!exact_mode) {
+        ret = seaf_block_manager_foreach_block (seaf->block_mgr,
+                                                repo->store_id, repo->version,
+                                                check_block_liveness,
+                                                &data); // 检查块是否活跃
+    } else {
+        data.all_ids = sorted_id_set_new (seaf->tmp_file_dir, EXACT_MEM_LIMIT);
+        ret = seaf_block_manager_foreach_block (seaf->block_mgr,
+                                                repo->store_id, repo->version,
+                                                collect_block_id,
+                                                &data);
+        if (ret == 0 && data.error == 0)
+            ret = remove_unreachable_blocks (repo, &data);
+        else
+            ret = -1;
+        sorted_id_set_free (data.all_ids);
+    }
     if (ret < 0) {
         seaf_warning ("GC: Failed to clean dead blocks.\n");
         goto out;
     }
 
-    ret = removed_blocks;
+    stats->sweep_time = g_get_monotonic_time () - start;
+    seaf_message ("Repo %.8s: scanned %"G_GUINT64_FORMAT" blocks in %.1fs "
+                  "(%.0f blocks/s).\n",
+                  repo->id, data.scanned_blocks, stats->sweep_time / 1e6,
+                  stats->sweep_time > 0 ? data.scanned_blocks * 1e6 / stats->sweep_time : 0.0);
+
+    ret = stats->removed_blocks;
+
+    /* Each dead block is kept with probability fpr, so about
+     * removed * fpr / (1 - fpr) dead blocks are left behind.
+     */
+    if (!exact_mode) {
+        if (stats->index_fpr < 1.0)
+            stats->kept_dead_blocks = (guint64)(stats->removed_blocks * stats->index_fpr /
+                                                (1.0 - stats->index_fpr) + 0.5);
+        seaf_message ("Repo %.8s: about %"G_GUINT64_FORMAT" unused blocks are missed "
+                      "because of index false positives.\n",
+                      repo->id, stats->kept_dead_blocks);
+    }
 
     if (!dry_run)
         seaf_message ("GC finished. %"G_GUINT64_FORMAT" blocks total, "
                       "about %"G_GUINT64_FORMAT" reachable blocks, "
                       "%"G_GUINT64_FORMAT" blocks are removed.\n",
-                      total_blocks, reachable_blocks, removed_blocks);
+                      stats->total_blocks, stats->reachable_blocks, stats->removed_blocks);
     else
         seaf_message ("GC finished. %"G_GUINT64_FORMAT" blocks total, "
                       "about %"G_GUINT64_FORMAT" reachable blocks, "
                       "%"G_GUINT64_FORMAT" blocks can be removed.\n",
-                      total_blocks, reachable_blocks, removed_blocks);
+                      stats->total_blocks, stats->reachable_blocks, stats->removed_blocks);
+
+    /* The checkpoint is only useful for the next GC, don't fail this one. */
+    if (new_ckpt && !dry_run) {
+        if (sorted_id_set_finish (index.live_ids) < 0 ||
+            gc_checkpoint_save (new_ckpt, index.live_ids, old_ckpt) < 0)
+            seaf_warning ("GC: Failed to save checkpoint for repo %.8s.\n", repo->id);
+    }
 
 out:
     printf ("\n");
 
-    bloom_destroy (index);
+    if (index.bloom)
+        blocked_bloom_destroy (index.bloom);
+    sorted_id_set_free (index.live_ids);
+    gc_checkpoint_free (old_ckpt);
+    gc_checkpoint_free (new_ckpt);
     return ret;
 }
 
@@ -393,6 +1063,7 @@ delete_garbaged_repos (int dry_run)
                 seaf_commit_manager_remove_store (seaf->commit_mgr, repo_id);
                 seaf_fs_manager_remove_store (seaf->fs_mgr, repo_id);
                 seaf_block_manager_remove_store (seaf->block_mgr, repo_id);
+                gc_checkpoint_remove (repo_id);
             } else {
                 seaf_message ("Repo %.8s can be GC'ed.\n", repo_id);
             }
@@ -405,77 +1076,360 @@ delete_garbaged_repos (int dry_run)
     g_list_free (del_repos);
 }
 
+typedef struct {
+    int dry_run;
+    int verbose;
+
+    pthread_mutex_t lock; // 保护以下各域
+    GList *corrupt_repos; // 被污染的仓库（已损坏）
+    GList *del_block_repos; // 删除块的仓库
+    int n_repos; // 已回收的仓库数
+    GCRepoStats total; // 所有仓库的统计之和
+} GCRunData; // 一次垃圾回收的数据
+
+static void // 对一个仓库进行垃圾回收
+gc_repo (char *repo_id, GCRunData *run)
+{
+    SeafRepo *repo;
+    GCRepoStats stats;
+    int gc_ret;
+
+    repo = seaf_repo_manager_get_repo_ex (seaf->repo_mgr, repo_id);
+
+    g_free (repo_id);
+
+    if (!repo)
+        return;
+
+    if (repo->is_corrupted) {
+        pthread_mutex_lock (&run->lock);
+        run->corrupt_repos = g_list_prepend (run->corrupt_repos, g_strdup(repo->id));
+        pthread_mutex_unlock (&run->lock);
+        seaf_message ("Repo %s is damaged, skip GC.\n\n", repo->id);
+        seaf_repo_unref (repo);
+        return;
+    }
+
+    if (!repo->is_virtual) {
+        seaf_message ("GC version %d repo %s(%s)\n",
+                      repo->version, repo->name, repo->id);
+        memset (&stats, 0, sizeof(stats));
+        gc_ret = gc_v1_repo (repo, run->dry_run, run->verbose, &stats);
+
+        pthread_mutex_lock (&run->lock);
+        if (gc_ret < 0) {
+            run->corrupt_repos = g_list_prepend (run->corrupt_repos, g_strdup(repo->id));
+        } else if (run->dry_run && gc_ret) {
+            run->del_block_repos = g_list_prepend (run->del_block_repos, g_strdup(repo->id));
+        }
+        ++run->n_repos;
+        run->total.total_blocks += stats.total_blocks;
+        run->total.removed_blocks += stats.removed_blocks;
+        run->total.reachable_blocks += stats.reachable_blocks;
+        run->total.traversed_fs_objs += stats.traversed_fs_objs;
+        run->total.index_time += stats.index_time;
+        run->total.sweep_time += stats.sweep_time;
+        run->total.kept_dead_blocks += stats.kept_dead_blocks;
+        pthread_mutex_unlock (&run->lock);
+    }
+    seaf_repo_unref (repo);
+}
+
+static void
+gc_repo_with_thread_pool (gpointer data, gpointer user_data) // 通过线程池
+{
+    gc_repo ((char *)data, (GCRunData *)user_data);
+}
+
 int // 运行垃圾回收
-gc_core_run (GList *repo_id_list, int dry_run, int verbose)
+gc_core_run (GList *repo_id_list, int dry_run, int verbose, int thread_num,
+             double fpr, int exact, int full)
 {
     GList *ptr;
-    SeafRepo *repo;
-    GList *corrupt_repos = NULL; // 被污染的仓库（已损坏）
-    GList *del_block_repos = NULL; // 删除块的仓库
+    GThreadPool *repo_pool = NULL;
+    GCRunData run;
     gboolean del_garbage = FALSE;
-    int gc_ret;
     char *repo_id;
+    gint64 start = g_get_monotonic_time ();
+    double elapsed;
+
+    if (fpr > 0.0 && fpr < 1.0)
+        index_fpr = fpr;
+    exact_mode = exact;
+    full_pass = full;
+
+    memset (&run, 0, sizeof(run));
+    run.dry_run = dry_run;
+    run.verbose = verbose;
+    pthread_mutex_init (&run.lock, NULL);
 
     if (repo_id_list == NULL) {
         repo_id_list = seaf_repo_manager_get_repo_id_list (seaf->repo_mgr);
         del_garbage = TRUE;
     }
 
-    for (ptr = repo_id_list; ptr; ptr = ptr->next) { // 遍历各个仓库
-        repo = seaf_repo_manager_get_repo_ex (seaf->repo_mgr, (const gchar *)ptr->data);
-
-        g_free (ptr->data);
-
-        if (!repo)
-            continue;
-
-        if (repo->is_corrupted) {
-            corrupt_repos = g_list_prepend (corrupt_repos, g_strdup(repo->id));
-            seaf_message ("Repo %s is damaged, skip GC.\n\n", repo->id);
-            continue;
+    if (thread_num > 1) {
+        traverse_pool = g_thread_pool_new (traverse_task_func, NULL,
+                                           thread_num, FALSE, NULL);
+        repo_pool = g_thread_pool_new (gc_repo_with_thread_pool, &run,
+                                       thread_num, FALSE, NULL);
+        if (!traverse_pool || !repo_pool) {
+            seaf_warning ("Failed to create gc thread pool.\n");
+            if (traverse_pool)
+                g_thread_pool_free (traverse_pool, FALSE, TRUE);
+            if (repo_pool)
+                g_thread_pool_free (repo_pool, FALSE, TRUE);
+            traverse_pool = NULL;
+            repo_pool = NULL;
+        } else {
+            seaf_message ("GC with %d threads.\n", thread_num);
         }
+    }
 
-        if (!repo->is_virtual) {
-            seaf_message ("GC version %d repo %s(%s)\n",
-                          repo->version, repo->name, repo->id);
-            gc_ret = gc_v1_repo (repo, dry_run, verbose);
-            if (gc_ret < 0) {
-                corrupt_repos = g_list_prepend (corrupt_repos, g_strdup(repo->id));
-            } else if (dry_run && gc_ret) {
-                del_block_repos = g_list_prepend (del_block_repos, g_strdup(repo->id));
-            }
-        }
-        seaf_repo_unref (repo);
+    for (ptr = repo_id_list; ptr; ptr = ptr->next) { // 遍历各个仓库
+        if (repo_pool)
+            g_thread_pool_push (repo_pool, ptr->data, NULL);
+        else
+            gc_repo (ptr->data, &run);
     }
     g_list_free (repo_id_list);
 
+    if (repo_pool) {
+        /* Repos must be done before the traverse pool goes away. */
+        g_thread_pool_free (repo_pool, FALSE, TRUE);
+        g_thread_pool_free (traverse_pool, FALSE, TRUE);
+        traverse_pool = NULL;
+    }
+
     if (del_garbage) {
         delete_garbaged_repos (dry_run);
     }
 
+    elapsed = (g_get_monotonic_time () - start) / 1e6;
+
     seaf_message ("=== GC is finished ===\n");
 
-    if (corrupt_repos) {
+    seaf_message ("GC'ed %d repos in %.1fs. "
+                  "Index: %"G_GINT64_FORMAT" fs objects, %"G_GUINT64_FORMAT" reachable blocks "
+                  "(%.1fs summed over repos). "
+                  "Sweep: %"G_GUINT64_FORMAT" blocks scanned, %"G_GUINT64_FORMAT" %s "
+                  "(%.1fs summed over repos, %.0f blocks/s overall). "
+                  "About %"G_GUINT64_FORMAT" unused blocks missed because of "
+                  "index false positives.\n",
+                  run.n_repos, elapsed,
+                  run.total.traversed_fs_objs, run.total.reachable_blocks,
+                  run.total.index_time / 1e6,
+                  run.total.total_blocks, run.total.removed_blocks,
+                  dry_run ? "can be removed" : "removed",
+                  run.total.sweep_time / 1e6,
+                  elapsed > 0 ? run.total.total_blocks / elapsed : 0.0,
+                  run.total.kept_dead_blocks);
+
+    if (run.corrupt_repos) {
         seaf_message ("The following repos are damaged. "
                       "You can run seaf-fsck to fix them.\n");
-        for (ptr = corrupt_repos; ptr; ptr = ptr->next) {
+        for (ptr = run.corrupt_repos; ptr; ptr = ptr->next) {
             repo_id = ptr->data;
             seaf_message ("%s\n", repo_id);
             g_free (repo_id);
         }
-        g_list_free (corrupt_repos);
+        g_list_free (run.corrupt_repos);
     }
 
-    if (del_block_repos) {
+    if (run.del_block_repos) {
         printf("\n");
         seaf_message ("The following repos have blocks to be removed:\n");
-        for (ptr = del_block_repos; ptr; ptr = ptr->next) {
+        for (ptr = run.del_block_repos; ptr; ptr = ptr->next) {
             repo_id = ptr->data;
             seaf_message ("%s\n", repo_id);
             g_free (repo_id);
         }
-        g_list_free (del_block_repos);
+        g_list_free (run.del_block_repos);
+    }
+
+    pthread_mutex_destroy (&run.lock);
+
+    return 0;
+}
+
+/* Benchmark. */
+
+static inline guint64
+splitmix64 (guint64 *state)
+{
+    guint64 z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* The i-th synthetic block id. Every 10th block is unused. */
+static void
+bench_block_id (guint64 i, char *block_id)
+{
+    guint64 state = i, words[3];
+
+    words[0] = splitmix64 (&state);
+    words[1] = splitmix64 (&state);
+    words[2] = splitmix64 (&state);
+    rawdata_to_hex ((unsigned char *)words, block_id, 20);
+}
+
+#define BENCH_IS_LIVE(i) ((i) % 10 != 0)
+/* Files share blocks, so some live ids are added more than once. */
+#define BENCH_IS_SHARED(i) ((i) % 7 == 0)
+
+static void
+bench_report (const char *mode, const char *phase, guint64 n, gint64 usec)
+{
+    printf ("%-6s %-8s %12"G_GUINT64_FORMAT" ids %10.3f s %12.0f ids/s\n",
+            mode, phase, n, usec / 1e6, usec > 0 ? n * 1e6 / usec : 0.0);
+}
+
+static int
+bench_bloom (guint64 n_blocks, guint64 n_dead)
+{
+    BlockedBloom *bloom;
+    char block_id[41];
+    guint64 i, n_live = 0, found = 0;
+    gint64 start;
+
+    bloom = blocked_bloom_create (n_blocks, index_fpr, MAX_GC_INDEX_SIZE);
+    if (!bloom)
+        return -1;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n_blocks; ++i) {
+        if (!BENCH_IS_LIVE(i))
+            continue;
+        bench_block_id (i, block_id);
+        blocked_bloom_add (bloom, block_id);
+        ++n_live;
+        if (BENCH_IS_SHARED(i)) {
+            blocked_bloom_add (bloom, block_id);
+            ++n_live;
+        }
+    }
+    bench_report ("bloom", "index", n_live, g_get_monotonic_time () - start);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n_blocks; ++i) {
+        bench_block_id (i, block_id);
+        if (!blocked_bloom_test (bloom, block_id)) {
+            if (BENCH_IS_LIVE(i)) {
+                fprintf (stderr, "Live block %s is not in the index.\n", block_id);
+                blocked_bloom_destroy (bloom);
+                return -1;
+            }
+            ++found;
+        }
+    }
+    bench_report ("bloom", "sweep", n_blocks, g_get_monotonic_time () - start);
+
+    printf ("bloom: memory %.1f MB, disk 0 MB, %"G_GUINT64_FORMAT" of %"G_GUINT64_FORMAT
+            " unused blocks found, %"G_GUINT64_FORMAT" missed (%.3f%%)\n",
+            blocked_bloom_size (bloom) / 1048576.0, found, n_dead,
+            n_dead - found, n_dead > 0 ? (n_dead - found) * 100.0 / n_dead : 0.0);
+
+    blocked_bloom_destroy (bloom);
+    return 0;
+}
+
+static int
+bench_exact (guint64 n_blocks, guint64 n_dead, const char *tmp_dir)
+{
+    GCIndex index;
+    CheckBlocksData data;
+    GCRepoStats stats;
+    SeafRepo repo;
+    char block_id[41];
+    guint64 i, disk_usage;
+    gint64 start;
+    int ret = -1;
+
+    memset (&index, 0, sizeof(index));
+    memset (&data, 0, sizeof(data));
+    memset (&stats, 0, sizeof(stats));
+    memset (&repo, 0, sizeof(repo));
+
+    index.live_ids = sorted_id_set_new (tmp_dir, EXACT_MEM_LIMIT);
+    data.all_ids = sorted_id_set_new (tmp_dir, EXACT_MEM_LIMIT);
+    data.index = &index;
+    data.stats = &stats;
+    /* Nothing is removed from the synthetic store. */
+    data.dry_run = TRUE;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n_blocks; ++i) {
+        if (!BENCH_IS_LIVE(i))
+            continue;
+        bench_block_id (i, block_id);
+        if (sorted_id_set_add (index.live_ids, block_id) < 0 ||
+            (BENCH_IS_SHARED(i) && sorted_id_set_add (index.live_ids, block_id) < 0))
+            goto out;
+    }
+    bench_report ("exact", "index", sorted_id_set_n_added (index.live_ids),
+                  g_get_monotonic_time () - start);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n_blocks; ++i) {
+        bench_block_id (i, block_id);
+        if (sorted_id_set_add (data.all_ids, block_id) < 0)
+            goto out;
+    }
+    bench_report ("exact", "list", n_blocks, g_get_monotonic_time () - start);
+
+    start = g_get_monotonic_time ();
+    if (sorted_id_set_finish (index.live_ids) < 0 ||
+        sorted_id_set_finish (data.all_ids) < 0)
+        goto out;
+    bench_report ("exact", "merge", n_blocks, g_get_monotonic_time () - start);
+    disk_usage = sorted_id_set_disk_usage (index.live_ids) +
+        sorted_id_set_disk_usage (data.all_ids);
+
+    start = g_get_monotonic_time ();
+    if (remove_unreachable_blocks (&repo, &data) < 0)
+        goto out;
+    bench_report ("exact", "join", n_blocks, g_get_monotonic_time () - start);
+
+    printf ("exact: memory %.1f MB, disk %.1f MB, %"G_GUINT64_FORMAT" of %"G_GUINT64_FORMAT
+            " unused blocks found, %"G_GUINT64_FORMAT" missed\n",
+            2 * EXACT_MEM_LIMIT / 1048576.0, disk_usage / 1048576.0,
+            stats.removed_blocks, n_dead, n_dead - MIN (n_dead, stats.removed_blocks));
+    if (stats.removed_blocks != n_dead) {
+        fprintf (stderr, "Exact mode found %"G_GUINT64_FORMAT" unused blocks, "
+                 "expected %"G_GUINT64_FORMAT".\n", stats.removed_blocks, n_dead);
+        goto out;
     }
+    ret = 0;
+
+out:
+    sorted_id_set_free (index.live_ids);
+    sorted_id_set_free (data.all_ids);
+    return ret;
+}
+
+/*
+ * Runs the index and sweep phases of both modes on @n_blocks synthetic
+ * block ids, 10% of which are unused. Traversing fs objects and listing
+ * the block store are left out, they cost the same in both modes.
+ */
+int
+gc_core_benchmark (guint64 n_blocks, double fpr, const char *tmp_dir)
+{
+    guint64 n_dead = (n_blocks + 9) / 10;
+
+    if (fpr > 0.0 && fpr < 1.0)
+        index_fpr = fpr;
+
+    printf ("%"G_GUINT64_FORMAT" blocks, %"G_GUINT64_FORMAT" unused, "
+            "target false positive rate %.4f%%\n",
+            n_blocks, n_dead, index_fpr * 100);
+
+    if (bench_bloom (n_blocks, n_dead) < 0)
+        return -1;
+    if (bench_exact (n_blocks, n_dead, tmp_dir) < 0)
+        return -1;
 
     return 0;
 }
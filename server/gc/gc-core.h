@@ -1,7 +1,19 @@
 #ifndef GC_CORE_H
 #define GC_CORE_H
 
-int gc_core_run (GList *repo_id_list, int dry_run, int verbose); // 垃圾仓库回收
+/* With @thread_num > 1, repos are collected and fs trees are traversed
+ * in parallel. @fpr is the target false positive rate of the live block
+ * index, 0 for the default. With @exact, live and stored block ids are
+ * sorted on disk and joined instead, so that all unused blocks are found.
+ * With @full, checkpoints of the last run are ignored and all commits are
+ * traversed. */
+int gc_core_run (GList *repo_id_list, int dry_run, int verbose, int thread_num,
+                 double fpr, int exact, int full); // 垃圾仓库回收
+
+/* Compares the bloom index with exact mode on @n_blocks synthetic block ids,
+ * using @tmp_dir for the sorted runs. */
+int
+gc_core_benchmark (guint64 n_blocks, double fpr, const char *tmp_dir); // 性能对比
 
 void
 delete_garbaged_repos (int dry_run); // 移除垃圾仓库
@@ -0,0 +1,379 @@
+/* 转换fs对象的存储格式，以及对比两种格式的解码性能 */
+
+#include "common.h"
+#include "log.h"
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "seafile-session.h"
+#include "fs-binary.h"
+
+#include "utils.h"
+
+static char *ccnet_dir = NULL;
+static char *seafile_dir = NULL;
+static char *central_config_dir = NULL;
+
+SeafileSession *seaf;
+
+static const char *short_opts = "hvfjb:c:d:F:";
+static const struct option long_opts[] = {
+    { "help", no_argument, NULL, 'h', },
+    { "version", no_argument, NULL, 'v', },
+    { "force", no_argument, NULL, 'f', },
+    { "to-json", no_argument, NULL, 'j', },
+    { "benchmark", required_argument, NULL, 'b', },
+    { "config-file", required_argument, NULL, 'c', },
+    { "central-config-dir", required_argument, NULL, 'F' },
+    { "seafdir", required_argument, NULL, 'd', },
+    { 0, 0, 0, 0, },
+};
+
+static void usage ()
+{
+    fprintf (stderr,
+             "usage: seaf-convert-fs [-j] [-c config_dir] [-d seafile_dir] "
+             "[repo_id_1 [repo_id_2 ...]]\n"
+             "       seaf-convert-fs -b n_dirents\n");
+}
+
+#ifdef __linux__
+
+/* Compare the owner uid of the seafile-data dir with the current uid. */
+static gboolean
+check_user (const char *seafile_dir, uid_t *current_user, uid_t *seafile_user)
+{
+    struct stat st;
+    uid_t euid;
+
+    if (stat (seafile_dir, &st) < 0) {
+        seaf_warning ("Failed to stat seafile data dir %s: %s\n",
+                      seafile_dir, strerror(errno));
+        return FALSE;
+    }
+
+    euid = geteuid();
+
+    *current_user = euid;
+    *seafile_user = st.st_uid;
+
+    return (euid == st.st_uid);
+}
+
+#endif  /* __linux__ */
+
+static gboolean
+collect_obj_id (const char *repo_id, int version,
+                const char *obj_id, void *user_data)
+{
+    GList **ids = user_data;
+
+    *ids = g_list_prepend (*ids, g_strdup (obj_id));
+    return TRUE;
+}
+
+static int // 转换一个仓库的所有fs对象
+convert_repo (SeafRepo *repo, gboolean to_binary)
+{
+    GList *ids = NULL, *ptr;
+    gint64 n_converted = 0, n_kept = 0, n_failed = 0;
+    int rc;
+
+    /* Objects are collected first, the pack backend appends converted
+     * objects to the packs being iterated.
+     */
+    if (seaf_obj_store_foreach_obj (seaf->fs_mgr->obj_store, repo->store_id,
+                                    repo->version, collect_obj_id, &ids) < 0) {
+        seaf_warning ("Failed to list fs objects of %s.\n", repo->store_id);
+        string_list_free (ids);
+        return -1;
+    }
+
+    for (ptr = ids; ptr; ptr = ptr->next) {
+        rc = seaf_fs_manager_convert_object (seaf->fs_mgr, repo->store_id,
+                                             repo->version, ptr->data, to_binary);
+        if (rc > 0)
+            ++n_converted;
+        else if (rc == 0)
+            ++n_kept;
+        else
+            ++n_failed;
+    }
+    string_list_free (ids);
+
+    seaf_message ("Converted %"G_GINT64_FORMAT" objects of %s, "
+                  "%"G_GINT64_FORMAT" unchanged, %"G_GINT64_FORMAT" failed.\n",
+                  n_converted, repo->store_id, n_kept, n_failed);
+
+    return n_failed > 0 ? -1 : 0;
+}
+
+static int // 转换
+convert_repos (GList *repo_ids, gboolean to_binary)
+{
+    GList *ptr;
+    SeafRepo *repo;
+    int n_failed = 0;
+
+    for (ptr = repo_ids; ptr; ptr = ptr->next) {
+        repo = seaf_repo_manager_get_repo (seaf->repo_mgr, ptr->data);
+        if (!repo) {
+            seaf_warning ("Failed to get repo %s.\n", (char *)ptr->data);
+            ++n_failed;
+            continue;
+        }
+
+        /* Virtual repos share the fs store of their origin. */
+        if (!repo->is_virtual && repo->version > 0 &&
+            convert_repo (repo, to_binary) < 0)
+            ++n_failed;
+        seaf_repo_unref (repo);
+    }
+
+    return n_failed > 0 ? -1 : 0;
+}
+
+/* Benchmark. */
+
+#define BENCH_ROUNDS 5
+
+static GList * // 生成目录项
+gen_dirents (int n)
+{
+    GList *entries = NULL;
+    unsigned char sha1[20];
+    char id[41], name[64];
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        calculate_sha1 (sha1, (const char *)&i, sizeof(i));
+        rawdata_to_hex (sha1, id, 20);
+        snprintf (name, sizeof(name), "document-%08d-%s.txt", i, id + 32);
+        entries = g_list_prepend (entries,
+                                  seaf_dirent_new (1, id, S_IFREG, name,
+                                                   1600000000 + i,
+                                                   "someone@example.com",
+                                                   g_random_int_range (0, 1 << 30)));
+    }
+
+    /* Prepending leaves the names in descending order, as in dir objects. */
+    return entries;
+}
+
+static guint8 *
+encode_binary (SeafDir *dir, int compression, int *len)
+{
+    SeafFSBinWriter *w;
+    GList *ptr;
+    SeafDirent *dent;
+
+    w = seaf_fs_bin_writer_new (SEAF_METADATA_TYPE_DIR, dir->version);
+    seaf_fs_bin_put_n_dirents (w, g_list_length (dir->entries));
+    for (ptr = dir->entries; ptr; ptr = ptr->next) {
+        dent = ptr->data;
+        seaf_fs_bin_put_dirent (w, dent->mode, dent->id, dent->name, dent->name_len,
+                                dent->mtime, dent->modifier, dent->size);
+    }
+
+    return seaf_fs_bin_writer_finish (w, compression, len);
+}
+
+/* Only walks the dirents, the way a lookup by name needs them. */
+static int
+scan_binary (guint8 *data, int len)
+{
+    SeafFSBinReader r;
+    SeafFSBinDirent dent;
+    int n = 0;
+
+    if (seaf_fs_bin_reader_init (&r, data, len) < 0)
+        return -1;
+    while (seaf_fs_bin_reader_next_dirent (&r, &dent) > 0)
+        ++n;
+    seaf_fs_bin_reader_clear (&r);
+
+    return n;
+}
+
+/*
+ * Decodes @data BENCH_ROUNDS times in a child process, and reports the
+ * average time and how much the peak RSS grew while decoding, which
+ * includes the transient json tree.
+ */
+static void
+bench_decode (const char *name, const char *dir_id, guint8 *data, int len,
+              gboolean scan_only, int n_dirents)
+{
+    struct rusage before, after;
+    gint64 start, usec;
+    SeafDir *dir;
+    pid_t pid;
+    int i, n;
+
+    fflush (stdout);
+    pid = fork ();
+    if (pid < 0) {
+        fprintf (stderr, "Failed to fork: %s.\n", strerror(errno));
+        return;
+    }
+    if (pid > 0) {
+        waitpid (pid, NULL, 0);
+        return;
+    }
+
+    getrusage (RUSAGE_SELF, &before);
+    start = g_get_monotonic_time ();
+    for (i = 0; i < BENCH_ROUNDS; ++i) {
+        if (scan_only) {
+            n = scan_binary (data, len);
+        } else {
+            dir = seaf_dir_from_data (dir_id, data, len, TRUE);
+            n = dir ? g_list_length (dir->entries) : -1;
+            seaf_dir_free (dir);
+        }
+        if (n != n_dirents)
+            fprintf (stderr, "%s: decoded %d dirents, expected %d.\n",
+                     name, n, n_dirents);
+    }
+    usec = (g_get_monotonic_time () - start) / BENCH_ROUNDS;
+    getrusage (RUSAGE_SELF, &after);
+
+    printf ("%-12s %10d bytes %10.3f ms %10ld KB peak rss growth\n",
+            name, len, usec / 1e3, after.ru_maxrss - before.ru_maxrss);
+    fflush (stdout);
+    _exit (0);
+}
+
+static int // 性能对比
+run_benchmark (int n_dirents)
+{
+    SeafDir *dir;
+    guint8 *bin, *bin_raw;
+    int bin_len, bin_raw_len;
+
+    dir = seaf_dir_new (NULL, gen_dirents (n_dirents), 1);
+
+    bin = encode_binary (dir, SEAF_FS_BIN_COMPRESS_ZLIB, &bin_len);
+    bin_raw = encode_binary (dir, SEAF_FS_BIN_COMPRESS_NONE, &bin_raw_len);
+    if (!bin || !bin_raw) {
+        fprintf (stderr, "Failed to encode dir.\n");
+        return -1;
+    }
+
+    printf ("Decoding a dir of %d dirents, average of %d rounds:\n",
+            n_dirents, BENCH_ROUNDS);
+    bench_decode ("json", dir->dir_id, dir->ondisk, dir->ondisk_size,
+                  FALSE, n_dirents);
+    bench_decode ("binary", dir->dir_id, bin, bin_len, FALSE, n_dirents);
+    bench_decode ("binary-raw", dir->dir_id, bin_raw, bin_raw_len, FALSE, n_dirents);
+    bench_decode ("binary-scan", dir->dir_id, bin, bin_len, TRUE, n_dirents);
+#ifdef HAVE_ZSTD
+    guint8 *bin_zstd;
+    int bin_zstd_len;
+
+    bin_zstd = encode_binary (dir, SEAF_FS_BIN_COMPRESS_ZSTD, &bin_zstd_len);
+    if (bin_zstd) {
+        bench_decode ("binary-zstd", dir->dir_id, bin_zstd, bin_zstd_len,
+                      FALSE, n_dirents);
+        g_free (bin_zstd);
+    }
+#endif
+
+    g_free (bin);
+    g_free (bin_raw);
+    seaf_dir_free (dir);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int c;
+    gboolean force = FALSE;
+    gboolean to_binary = TRUE;
+    int n_bench_dirents = 0;
+
+    ccnet_dir = DEFAULT_CONFIG_DIR;
+
+    while ((c = getopt_long(argc, argv,
+                short_opts, long_opts, NULL)) != EOF) {
+        switch (c) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'v':
+            exit(-1);
+            break;
+        case 'f':
+            force = TRUE;
+            break;
+        case 'j':
+            to_binary = FALSE;
+            break;
+        case 'b':
+            n_bench_dirents = atoi(optarg);
+            break;
+        case 'c':
+            ccnet_dir = strdup(optarg);
+            break;
+        case 'd':
+            seafile_dir = strdup(optarg);
+            break;
+        case 'F':
+            central_config_dir = strdup(optarg);
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+
+    if (seafile_log_init ("-", "info", "debug") < 0) {
+        seaf_warning ("Failed to init log.\n");
+        exit (1);
+    }
+
+    if (n_bench_dirents > 0) {
+        if (run_benchmark (n_bench_dirents) < 0)
+            exit (1);
+        return 0;
+    }
+
+    if (seafile_dir == NULL)
+        seafile_dir = g_build_filename (ccnet_dir, "seafile-data", NULL);
+
+#ifdef __linux__
+    uid_t current_user, seafile_user;
+    if (!force && !check_user (seafile_dir, &current_user, &seafile_user)) {
+        seaf_message ("Current user (%u) is not the user for running "
+                      "seafile server (%u). Unable to convert objects.\n",
+                      current_user, seafile_user);
+        exit(1);
+    }
+#endif
+
+    seaf = seafile_session_new(central_config_dir, seafile_dir, ccnet_dir,
+                               TRUE);
+    if (!seaf) {
+        seaf_warning ("Failed to create seafile session.\n");
+        exit (1);
+    }
+
+    GList *repo_ids = NULL;
+    int i;
+    for (i = optind; i < argc; i++)
+        repo_ids = g_list_append (repo_ids, g_strdup(argv[i]));
+    if (!repo_ids)
+        repo_ids = seaf_repo_manager_get_repo_id_list (seaf->repo_mgr);
+
+    if (convert_repos (repo_ids, to_binary) < 0)
+        exit (1);
+
+    return 0;
+}
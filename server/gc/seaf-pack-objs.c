@@ -0,0 +1,362 @@
+/* 将松散的fs对象迁移到打包文件中并回收打包文件中的无用空间，以及对比两种后台的性能 */
+
+#include "common.h"
+#include "log.h"
+
+#include <getopt.h>
+
+#include "seafile-session.h"
+#include "obj-backend.h"
+
+#include "utils.h"
+
+static char *ccnet_dir = NULL;
+static char *seafile_dir = NULL;
+static char *central_config_dir = NULL;
+
+SeafileSession *seaf;
+
+extern ObjBackend *
+obj_backend_fs_new (const char *seaf_dir, const char *obj_type);
+
+extern ObjBackend *
+obj_backend_pack_new (const char *seaf_dir, const char *obj_type,
+                      gint64 max_pack_size);
+
+static const char *short_opts = "hvfkb:c:d:F:";
+static const struct option long_opts[] = {
+    { "help", no_argument, NULL, 'h', },
+    { "version", no_argument, NULL, 'v', },
+    { "force", no_argument, NULL, 'f', },
+    { "keep-loose", no_argument, NULL, 'k', },
+    { "benchmark", required_argument, NULL, 'b', },
+    { "config-file", required_argument, NULL, 'c', },
+    { "central-config-dir", required_argument, NULL, 'F' },
+    { "seafdir", required_argument, NULL, 'd', },
+    { 0, 0, 0, 0, },
+};
+
+static void usage ()
+{
+    fprintf (stderr,
+             "usage: seaf-pack-objs [-k] [-c config_dir] [-d seafile_dir] "
+             "[repo_id_1 [repo_id_2 ...]]\n"
+             "       seaf-pack-objs -b n_objects [-d work_dir]\n");
+}
+
+#ifdef __linux__
+
+/* Compare the owner uid of the seafile-data dir with the current uid. */
+static gboolean
+check_user (const char *seafile_dir, uid_t *current_user, uid_t *seafile_user)
+{
+    struct stat st;
+    uid_t euid;
+
+    if (stat (seafile_dir, &st) < 0) {
+        seaf_warning ("Failed to stat seafile data dir %s: %s\n",
+                      seafile_dir, strerror(errno));
+        return FALSE;
+    }
+
+    euid = geteuid();
+
+    *current_user = euid;
+    *seafile_user = st.st_uid;
+
+    return (euid == st.st_uid);
+}
+
+#endif  /* __linux__ */
+
+static void
+add_stores_in_dir (const char *seafile_dir, const char *dir_name, GHashTable *ids)
+{
+    char *path = g_build_filename (seafile_dir, "storage", dir_name, NULL);
+    GDir *dir;
+    const char *dname;
+
+    dir = g_dir_open (path, 0, NULL);
+    if (dir) {
+        while ((dname = g_dir_read_name (dir)) != NULL) {
+            if (is_uuid_valid (dname))
+                g_hash_table_add (ids, g_strdup (dname));
+        }
+        g_dir_close (dir);
+    }
+    g_free (path);
+}
+
+/* Returns the ids of all stores that have loose or packed fs objects. */
+static GList * // 获取所有存在fs对象的存储
+list_stores (const char *seafile_dir)
+{
+    GHashTable *ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    GHashTableIter iter;
+    gpointer key;
+    GList *ret = NULL;
+
+    add_stores_in_dir (seafile_dir, "fs", ids);
+    add_stores_in_dir (seafile_dir, "fs-packs", ids);
+
+    g_hash_table_iter_init (&iter, ids);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        ret = g_list_prepend (ret, g_strdup (key));
+
+    g_hash_table_destroy (ids);
+    return g_list_sort (ret, (GCompareFunc)strcmp);
+}
+
+/*
+ * Pack loose objects of each store, then rewrite its packs that are
+ * mostly deleted or overwritten objects.
+ */
+static int // 迁移并回收空间
+pack_stores (GList *store_ids, gboolean remove_loose)
+{
+    GList *ptr;
+    const char *store_id;
+    gint64 n_packed, n_freed;
+    int n_failed = 0;
+
+    for (ptr = store_ids; ptr; ptr = ptr->next) {
+        store_id = ptr->data;
+        n_packed = 0;
+        if (seaf_obj_store_pack_loose_objs (seaf->fs_mgr->obj_store, store_id,
+                                            remove_loose, &n_packed) < 0) {
+            seaf_warning ("Failed to pack objects of %s.\n", store_id);
+            ++n_failed;
+            continue;
+        }
+        seaf_message ("Packed %"G_GINT64_FORMAT" objects of %s.\n",
+                      n_packed, store_id);
+
+        n_freed = 0;
+        if (seaf_obj_store_repack (seaf->fs_mgr->obj_store, store_id, &n_freed) < 0) {
+            seaf_warning ("Failed to repack objects of %s.\n", store_id);
+            ++n_failed;
+            continue;
+        }
+        if (n_freed > 0)
+            seaf_message ("Freed %"G_GINT64_FORMAT" bytes in packs of %s.\n",
+                          n_freed, store_id);
+    }
+
+    return n_failed > 0 ? -1 : 0;
+}
+
+/* Benchmark. */
+
+typedef struct BenchObj {
+    char  id[41];
+    void *data;
+    int   len;
+} BenchObj;
+
+static gboolean
+count_obj_cb (const char *repo_id, int version,
+              const char *obj_id, void *user_data)
+{
+    ++*(gint64 *)user_data;
+    return TRUE;
+}
+
+static void
+print_rate (const char *bend_name, const char *op, gint64 n, gint64 usec)
+{
+    printf ("%-10s %-8s %10"G_GINT64_FORMAT" objs %10.3f s %12.0f objs/s\n",
+            bend_name, op, n, usec / 1e6,
+            usec > 0 ? n * 1e6 / usec : 0.0);
+}
+
+static void // 对一个后台进行写、读、遍历测试
+bench_backend (const char *bend_name, ObjBackend *bend, const char *store_id,
+               BenchObj *objs, int n)
+{
+    gint64 start, n_found = 0;
+    int i, len;
+    void *data;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; ++i)
+        bend->write (bend, store_id, 1, objs[i].id, objs[i].data, objs[i].len, FALSE);
+    print_rate (bend_name, "write", n, g_get_monotonic_time () - start);
+
+    /* Objects are read back in a random order, the way directory
+     * listings and checkouts jump across fs objects.
+     */
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; ++i) {
+        BenchObj *obj = &objs[g_random_int_range (0, n)];
+        if (bend->read (bend, store_id, 1, obj->id, &data, &len) < 0 ||
+            len != obj->len || memcmp (data, obj->data, len) != 0) {
+            fprintf (stderr, "%s: object %s read back incorrectly.\n",
+                     bend_name, obj->id);
+        } else {
+            g_free (data);
+        }
+    }
+    print_rate (bend_name, "read", n, g_get_monotonic_time () - start);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; ++i)
+        bend->exists (bend, store_id, 1, objs[g_random_int_range (0, n)].id);
+    print_rate (bend_name, "exists", n, g_get_monotonic_time () - start);
+
+    start = g_get_monotonic_time ();
+    bend->foreach_obj (bend, store_id, 1, count_obj_cb, &n_found);
+    print_rate (bend_name, "foreach", n_found, g_get_monotonic_time () - start);
+    if (n_found != n)
+        fprintf (stderr, "%s: found %"G_GINT64_FORMAT" objects, expected %d.\n",
+                 bend_name, n_found, n);
+
+    bend->remove_store (bend, store_id);
+}
+
+/*
+ * Writes @n synthetic fs objects to both backends under @work_dir and
+ * measures writes, random reads, exists checks and foreach. Reads are
+ * served from the page cache; drop caches between runs to measure cold
+ * reads.
+ */
+static int // 性能对比
+run_benchmark (const char *work_dir, int n)
+{
+    char *bench_dir;
+    ObjBackend *fs_bend, *pack_bend;
+    BenchObj *objs;
+    char *store_id;
+    unsigned char sha1[20];
+    int i, j;
+
+    bench_dir = g_build_filename (work_dir, "pack-benchmark", NULL);
+    if (g_mkdir_with_parents (bench_dir, 0777) < 0) {
+        fprintf (stderr, "Failed to create %s: %s.\n", bench_dir, strerror(errno));
+        g_free (bench_dir);
+        return -1;
+    }
+
+    fs_bend = obj_backend_fs_new (bench_dir, "fs");
+    pack_bend = obj_backend_pack_new (bench_dir, "fs-bench", 0);
+    if (!fs_bend || !pack_bend) {
+        fprintf (stderr, "Failed to create backends.\n");
+        g_free (bench_dir);
+        return -1;
+    }
+
+    /* Sizes of typical fs objects: small dirents lists and file objects
+     * with a handful of block ids.
+     */
+    objs = g_new0 (BenchObj, n);
+    for (i = 0; i < n; ++i) {
+        objs[i].len = g_random_int_range (100, 1200);
+        objs[i].data = g_malloc (objs[i].len);
+        for (j = 0; j < objs[i].len; ++j)
+            ((unsigned char *)objs[i].data)[j] = g_random_int_range (0, 256);
+        calculate_sha1 (sha1, objs[i].data, objs[i].len);
+        rawdata_to_hex (sha1, objs[i].id, 20);
+    }
+
+    store_id = gen_uuid ();
+    bench_backend ("loose", fs_bend, store_id, objs, n);
+    bench_backend ("pack", pack_bend, store_id, objs, n);
+
+    for (i = 0; i < n; ++i)
+        g_free (objs[i].data);
+    g_free (objs);
+    g_free (store_id);
+    g_free (bench_dir);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int c;
+    gboolean force = FALSE;
+    gboolean remove_loose = TRUE;
+    int n_bench_objs = 0;
+
+    ccnet_dir = DEFAULT_CONFIG_DIR;
+
+    while ((c = getopt_long(argc, argv,
+                short_opts, long_opts, NULL)) != EOF) {
+        switch (c) {
+        case 'h':
+            usage();
+            exit(0);
+        case 'v':
+            exit(-1);
+            break;
+        case 'f':
+            force = TRUE;
+            break;
+        case 'k':
+            remove_loose = FALSE;
+            break;
+        case 'b':
+            n_bench_objs = atoi(optarg);
+            break;
+        case 'c':
+            ccnet_dir = strdup(optarg);
+            break;
+        case 'd':
+            seafile_dir = strdup(optarg);
+            break;
+        case 'F':
+            central_config_dir = strdup(optarg);
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+
+    if (seafile_log_init ("-", "info", "debug") < 0) {
+        seaf_warning ("Failed to init log.\n");
+        exit (1);
+    }
+
+    if (n_bench_objs > 0) {
+        if (run_benchmark (seafile_dir ? seafile_dir : g_get_tmp_dir(),
+                           n_bench_objs) < 0)
+            exit (1);
+        return 0;
+    }
+
+    if (seafile_dir == NULL)
+        seafile_dir = g_build_filename (ccnet_dir, "seafile-data", NULL);
+
+#ifdef __linux__
+    uid_t current_user, seafile_user;
+    if (!force && !check_user (seafile_dir, &current_user, &seafile_user)) {
+        seaf_message ("Current user (%u) is not the user for running "
+                      "seafile server (%u). Unable to pack objects.\n",
+                      current_user, seafile_user);
+        exit(1);
+    }
+#endif
+
+    seaf = seafile_session_new(central_config_dir, seafile_dir, ccnet_dir,
+                               FALSE);
+    if (!seaf) {
+        seaf_warning ("Failed to create seafile session.\n");
+        exit (1);
+    }
+
+    GList *store_ids = NULL;
+    int i;
+    for (i = optind; i < argc; i++)
+        store_ids = g_list_append (store_ids, g_strdup(argv[i]));
+    if (!store_ids)
+        store_ids = list_stores (seafile_dir);
+
+    if (pack_stores (store_ids, remove_loose) < 0)
+        exit (1);
+
+    return 0;
+}
@@ -16,7 +16,7 @@ static char *central_config_dir = NULL;
 
 SeafileSession *seaf;
 
-static const char *short_opts = "hvc:d:VDrF:";
+static const char *short_opts = "hvc:d:VDrF:t:p:eb:f";
 static const struct option long_opts[] = {
     { "help", no_argument, NULL, 'h', },
     { "version", no_argument, NULL, 'v', },
@@ -26,6 +26,11 @@ static const struct option long_opts[] = {
     { "verbose", no_argument, NULL, 'V' },
     { "dry-run", no_argument, NULL, 'D' },
     { "rm-deleted", no_argument, NULL, 'r' },
+    { "threads", required_argument, NULL, 't' },
+    { "fpr", required_argument, NULL, 'p' },
+    { "exact", no_argument, NULL, 'e' },
+    { "benchmark", required_argument, NULL, 'b' },
+    { "full", no_argument, NULL, 'f' },
     { 0, 0, 0, 0 },
 };
 
@@ -37,7 +42,16 @@ static void usage ()
              "Additional options:\n"
              "-r, --rm-deleted: remove garbaged repos\n"
              "-D, --dry-run: report blocks that can be remove, but not remove them\n"
-             "-V, --verbose: verbose output messages\n");
+             "-V, --verbose: verbose output messages\n"
+             "-t, --threads: number of threads to collect repos and traverse them with\n"
+             "-p, --fpr: target false positive rate of the live block index, "
+             "i.e. the ratio of unused blocks left behind (default 0.01)\n"
+             "-e, --exact: find all unused blocks by sorting block ids on disk, "
+             "slower but with bounded memory and no false positives\n"
+             "-f, --full: traverse all commits instead of the ones created "
+             "since the last GC\n"
+             "-b, --benchmark n_blocks: compare the bloom index with exact mode "
+             "on synthetic block ids, temp files are written to -d dir\n");
 }
 
 #ifdef WIN32
@@ -73,6 +87,11 @@ main(int argc, char *argv[])
     int verbose = 0;
     int dry_run = 0;
     int rm_garbage = 0;
+    int thread_num = 1;
+    double fpr = 0.0;
+    int exact = 0;
+    int full = 0;
+    gint64 n_bench_blocks = 0;
 
 #ifdef WIN32
     argv = get_argv_utf8 (&argc);
@@ -107,6 +126,21 @@ main(int argc, char *argv[])
         case 'r':
             rm_garbage = 1;
             break;
+        case 't':
+            thread_num = atoi(optarg);
+            break;
+        case 'p':
+            fpr = atof(optarg);
+            break;
+        case 'e':
+            exact = 1;
+            break;
+        case 'b':
+            n_bench_blocks = g_ascii_strtoll (optarg, NULL, 10);
+            break;
+        case 'f':
+            full = 1;
+            break;
         default:
             usage();
             exit(-1);
@@ -122,6 +156,13 @@ main(int argc, char *argv[])
         exit (1);
     }
 
+    if (n_bench_blocks > 0) {
+        if (gc_core_benchmark (n_bench_blocks, fpr,
+                               seafile_dir ? seafile_dir : g_get_tmp_dir()) < 0)
+            exit (1);
+        return 0;
+    }
+
     if (seafile_dir == NULL)
         seafile_dir = g_build_filename (ccnet_dir, "seafile-data", NULL);
     
@@ -141,7 +182,7 @@ main(int argc, char *argv[])
     for (i = optind; i < argc; i++)
         repo_id_list = g_list_append (repo_id_list, g_strdup(argv[i]));
 
-    gc_core_run (repo_id_list, dry_run, verbose);
+    gc_core_run (repo_id_list, dry_run, verbose, thread_num, fpr, exact, full);
 
     return 0;
 }
@@ -0,0 +1,493 @@
+/* 基于外部排序的对象id集合 */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "utils.h"
+#include "sorted-id-set.h"
+
+#define DEBUG_FLAG SEAFILE_DEBUG_OTHER
+#include "log.h"
+
+#define ID_LEN 20
+#define MAX_MERGE_FANIN 64 // 一次合并的最大顺串数
+#define RUN_BUF_SIZE (1 << 16) // 每个顺串的读写缓冲大小
+
+struct SortedIdSet {
+    char *tmp_dir;
+
+    pthread_mutex_t lock; // 保护以下各域
+    unsigned char *buf; // 内存缓冲
+    size_t n_buf; // 缓冲中的id数
+    size_t cap; // 缓冲能容纳的id数
+    GPtrArray *runs; // 顺串文件路径
+    GPtrArray *inputs; // 外部的有序id文件，不会被合并或删除
+    guint64 n_added;
+    guint64 disk_usage;
+    gboolean finished;
+};
+
+typedef struct {
+    FILE *fp;
+    unsigned char cur[ID_LEN]; // 当前id
+} RunReader;
+
+struct SortedIdIter {
+    RunReader *readers;
+    int n_readers;
+    int *heap; // 以当前id为键的最小堆，存reader的下标
+    int heap_len;
+    unsigned char last[ID_LEN]; // 上一个返回的id，用于去重
+    gboolean has_last;
+};
+
+static int
+compare_ids (const void *a, const void *b)
+{
+    return memcmp (a, b, ID_LEN);
+}
+
+SortedIdSet *
+sorted_id_set_new (const char *tmp_dir, size_t mem_limit)
+{
+    SortedIdSet *set = g_new0 (SortedIdSet, 1);
+
+    set->tmp_dir = g_strdup (tmp_dir);
+    pthread_mutex_init (&set->lock, NULL);
+    set->cap = MAX (mem_limit / ID_LEN, 1024);
+    set->buf = g_malloc (set->cap * ID_LEN);
+    set->runs = g_ptr_array_new_with_free_func (g_free);
+    set->inputs = g_ptr_array_new_with_free_func (g_free);
+
+    return set;
+}
+
+void
+sorted_id_set_free (SortedIdSet *set)
+{
+    guint i;
+
+    if (!set)
+        return;
+
+    for (i = 0; i < set->runs->len; ++i)
+        g_unlink (g_ptr_array_index (set->runs, i));
+    g_ptr_array_free (set->runs, TRUE);
+    g_ptr_array_free (set->inputs, TRUE);
+    pthread_mutex_destroy (&set->lock);
+    g_free (set->buf);
+    g_free (set->tmp_dir);
+    g_free (set);
+}
+
+static FILE * // 在临时目录中新建顺串文件
+create_run_file (SortedIdSet *set, char **ret_path)
+{
+    char *path;
+    int fd;
+    FILE *fp;
+
+    path = g_build_filename (set->tmp_dir, "gc-ids-XXXXXX", NULL);
+    fd = g_mkstemp (path);
+    if (fd < 0) {
+        seaf_warning ("Failed to create temp file %s: %s.\n", path, strerror(errno));
+        g_free (path);
+        return NULL;
+    }
+
+    fp = fdopen (fd, "wb");
+    if (!fp) {
+        seaf_warning ("Failed to open temp file %s: %s.\n", path, strerror(errno));
+        close (fd);
+        g_unlink (path);
+        g_free (path);
+        return NULL;
+    }
+    setvbuf (fp, NULL, _IOFBF, RUN_BUF_SIZE);
+
+    *ret_path = path;
+    return fp;
+}
+
+static int // 关闭顺串文件，并记录
+close_run_file (SortedIdSet *set, FILE *fp, char *path, guint64 n_ids)
+{
+    if (fclose (fp) != 0) {
+        seaf_warning ("Failed to write temp file %s: %s.\n", path, strerror(errno));
+        g_unlink (path);
+        g_free (path);
+        return -1;
+    }
+
+    g_ptr_array_add (set->runs, path);
+    set->disk_usage += n_ids * ID_LEN;
+    return 0;
+}
+
+/* Sort and deduplicate the buffer, and write it to a new run.
+ * Must be called with set->lock held. */
+static int // 将内存缓冲写成一个有序顺串
+spill_buffer (SortedIdSet *set)
+{
+    FILE *fp;
+    char *path;
+    size_t i, n = 0;
+
+    if (set->n_buf == 0)
+        return 0;
+
+    qsort (set->buf, set->n_buf, ID_LEN, compare_ids);
+
+    fp = create_run_file (set, &path);
+    if (!fp)
+        return -1;
+
+    for (i = 0; i < set->n_buf; ++i) {
+        if (i > 0 && memcmp (set->buf + i * ID_LEN, set->buf + (i - 1) * ID_LEN, ID_LEN) == 0)
+            continue;
+        if (fwrite (set->buf + i * ID_LEN, ID_LEN, 1, fp) != 1) {
+            seaf_warning ("Failed to write temp file %s: %s.\n", path, strerror(errno));
+            fclose (fp);
+            g_unlink (path);
+            g_free (path);
+            return -1;
+        }
+        ++n;
+    }
+
+    set->n_buf = 0;
+    return close_run_file (set, fp, path, n);
+}
+
+int
+sorted_id_set_add (SortedIdSet *set, const char *id)
+{
+    int ret = 0;
+
+    pthread_mutex_lock (&set->lock);
+
+    if (set->finished) {
+        pthread_mutex_unlock (&set->lock);
+        return -1;
+    }
+
+    hex_to_rawdata (id, set->buf + set->n_buf * ID_LEN, ID_LEN);
+    ++set->n_buf;
+    ++set->n_added;
+    if (set->n_buf == set->cap)
+        ret = spill_buffer (set);
+
+    pthread_mutex_unlock (&set->lock);
+
+    return ret;
+}
+
+int
+sorted_id_set_add_file (SortedIdSet *set, const char *path)
+{
+    int ret = 0;
+
+    pthread_mutex_lock (&set->lock);
+    if (set->finished)
+        ret = -1;
+    else
+        g_ptr_array_add (set->inputs, g_strdup (path));
+    pthread_mutex_unlock (&set->lock);
+
+    return ret;
+}
+
+guint64
+sorted_id_set_n_added (SortedIdSet *set)
+{
+    return set->n_added;
+}
+
+guint64
+sorted_id_set_disk_usage (SortedIdSet *set)
+{
+    return set->disk_usage;
+}
+
+/* Iterator. */
+
+static int // 读取顺串的下一个id；1为成功，0为结束，-1为出错
+reader_advance (RunReader *reader)
+{
+    if (fread (reader->cur, ID_LEN, 1, reader->fp) == 1)
+        return 1;
+    if (ferror (reader->fp)) {
+        seaf_warning ("Failed to read temp file: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static inline int
+heap_less (SortedIdIter *iter, int a, int b)
+{
+    return memcmp (iter->readers[iter->heap[a]].cur,
+                   iter->readers[iter->heap[b]].cur, ID_LEN) < 0;
+}
+
+static void
+heap_sift_down (SortedIdIter *iter, int i)
+{
+    int child, tmp;
+
+    while ((child = 2 * i + 1) < iter->heap_len) {
+        if (child + 1 < iter->heap_len && heap_less (iter, child + 1, child))
+            ++child;
+        if (!heap_less (iter, child, i))
+            break;
+        tmp = iter->heap[i];
+        iter->heap[i] = iter->heap[child];
+        iter->heap[child] = tmp;
+        i = child;
+    }
+}
+
+static SortedIdIter * // 创建合并若干顺串的迭代器
+iter_new (char **paths, int n_paths)
+{
+    SortedIdIter *iter = g_new0 (SortedIdIter, 1);
+    RunReader *reader;
+    int i, ret;
+
+    iter->readers = g_new0 (RunReader, n_paths);
+    iter->heap = g_new0 (int, n_paths);
+
+    for (i = 0; i < n_paths; ++i) {
+        reader = &iter->readers[iter->n_readers];
+        reader->fp = g_fopen (paths[i], "rb");
+        if (!reader->fp) {
+            seaf_warning ("Failed to open temp file %s: %s.\n", paths[i], strerror(errno));
+            goto error;
+        }
+        setvbuf (reader->fp, NULL, _IOFBF, RUN_BUF_SIZE);
+        ++iter->n_readers;
+
+        ret = reader_advance (reader);
+        if (ret < 0)
+            goto error;
+        if (ret > 0)
+            iter->heap[iter->heap_len++] = iter->n_readers - 1;
+    }
+
+    for (i = iter->heap_len / 2 - 1; i >= 0; --i)
+        heap_sift_down (iter, i);
+
+    return iter;
+
+error:
+    sorted_id_iter_free (iter);
+    return NULL;
+}
+
+int
+sorted_id_iter_next (SortedIdIter *iter, unsigned char *id)
+{
+    RunReader *reader;
+    int ret;
+
+    while (iter->heap_len > 0) {
+        reader = &iter->readers[iter->heap[0]];
+        memcpy (id, reader->cur, ID_LEN);
+
+        ret = reader_advance (reader);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            iter->heap[0] = iter->heap[--iter->heap_len];
+        heap_sift_down (iter, 0);
+
+        /* Runs are deduplicated, but the same id may be in several runs. */
+        if (iter->has_last && memcmp (id, iter->last, ID_LEN) == 0)
+            continue;
+        memcpy (iter->last, id, ID_LEN);
+        iter->has_last = TRUE;
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+sorted_id_iter_free (SortedIdIter *iter)
+{
+    int i;
+
+    if (!iter)
+        return;
+
+    for (i = 0; i < iter->n_readers; ++i)
+        fclose (iter->readers[i].fp);
+    g_free (iter->readers);
+    g_free (iter->heap);
+    g_free (iter);
+}
+
+/* Merge the first @n runs into one. */
+static int // 合并顺串
+merge_runs (SortedIdSet *set, int n)
+{
+    SortedIdIter *iter;
+    unsigned char id[ID_LEN];
+    FILE *fp;
+    char *path;
+    guint64 n_ids = 0;
+    int i, ret;
+
+    iter = iter_new ((char **)set->runs->pdata, n);
+    if (!iter)
+        return -1;
+
+    fp = create_run_file (set, &path);
+    if (!fp) {
+        sorted_id_iter_free (iter);
+        return -1;
+    }
+
+    while ((ret = sorted_id_iter_next (iter, id)) > 0) {
+        if (fwrite (id, ID_LEN, 1, fp) != 1) {
+            seaf_warning ("Failed to write temp file %s: %s.\n", path, strerror(errno));
+            ret = -1;
+            break;
+        }
+        ++n_ids;
+    }
+    sorted_id_iter_free (iter);
+
+    if (ret < 0) {
+        fclose (fp);
+        g_unlink (path);
+        g_free (path);
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        SeafStat st;
+        const char *run = g_ptr_array_index (set->runs, i);
+        if (seaf_stat (run, &st) == 0)
+            set->disk_usage -= st.st_size;
+        g_unlink (run);
+    }
+    g_ptr_array_remove_range (set->runs, 0, n);
+
+    return close_run_file (set, fp, path, n_ids);
+}
+
+int
+sorted_id_set_finish (SortedIdSet *set)
+{
+    int ret = 0;
+
+    pthread_mutex_lock (&set->lock);
+
+    if (set->finished)
+        goto out;
+    set->finished = TRUE;
+
+    ret = spill_buffer (set);
+    g_free (set->buf);
+    set->buf = NULL;
+    if (ret < 0)
+        goto out;
+
+    /* Bound the number of files open at once when iterating. */
+    while (set->runs->len > MAX_MERGE_FANIN) {
+        ret = merge_runs (set, MAX_MERGE_FANIN);
+        if (ret < 0)
+            goto out;
+    }
+
+out:
+    pthread_mutex_unlock (&set->lock);
+    return ret;
+}
+
+SortedIdIter *
+sorted_id_set_iter (SortedIdSet *set)
+{
+    GPtrArray *paths;
+    SortedIdIter *iter;
+    guint i;
+
+    if (!set->finished) {
+        seaf_warning ("Id set must be finished before iterating.\n");
+        return NULL;
+    }
+
+    paths = g_ptr_array_sized_new (set->runs->len + set->inputs->len);
+    for (i = 0; i < set->runs->len; ++i)
+        g_ptr_array_add (paths, g_ptr_array_index (set->runs, i));
+    for (i = 0; i < set->inputs->len; ++i)
+        g_ptr_array_add (paths, g_ptr_array_index (set->inputs, i));
+
+    iter = iter_new ((char **)paths->pdata, paths->len);
+    g_ptr_array_free (paths, TRUE);
+
+    return iter;
+}
+
+SortedIdIter *
+sorted_id_iter_open (const char *path)
+{
+    char *paths[1] = { (char *)path };
+
+    return iter_new (paths, 1);
+}
+
+int
+sorted_id_set_save (SortedIdSet *set, const char *path, guint64 *n_ids)
+{
+    SortedIdIter *iter;
+    unsigned char id[ID_LEN];
+    char *tmp_path;
+    FILE *fp;
+    int ret;
+
+    iter = sorted_id_set_iter (set);
+    if (!iter)
+        return -1;
+
+    *n_ids = 0;
+    tmp_path = g_strconcat (path, ".tmp", NULL);
+    fp = g_fopen (tmp_path, "wb");
+    if (!fp) {
+        seaf_warning ("Failed to open %s: %s.\n", tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+    setvbuf (fp, NULL, _IOFBF, RUN_BUF_SIZE);
+
+    while ((ret = sorted_id_iter_next (iter, id)) > 0) {
+        if (fwrite (id, ID_LEN, 1, fp) != 1) {
+            ret = -1;
+            break;
+        }
+        ++*n_ids;
+    }
+
+    if (fflush (fp) != 0 || fsync (fileno (fp)) < 0)
+        ret = -1;
+    if (fclose (fp) != 0)
+        ret = -1;
+    if (ret < 0) {
+        seaf_warning ("Failed to write %s: %s.\n", tmp_path, strerror(errno));
+        g_unlink (tmp_path);
+        goto out;
+    }
+
+    if (g_rename (tmp_path, path) < 0) {
+        seaf_warning ("Failed to rename %s: %s.\n", tmp_path, strerror(errno));
+        g_unlink (tmp_path);
+        ret = -1;
+    }
+
+out:
+    sorted_id_iter_free (iter);
+    g_free (tmp_path);
+    return ret;
+}
@@ -0,0 +1,62 @@
+/* 基于外部排序的对象id集合 */
+
+#ifndef SORTED_ID_SET_H
+#define SORTED_ID_SET_H
+
+#include <glib.h>
+
+/*
+ * A set of 40-char hex SHA1 ids with bounded memory. Ids are buffered in
+ * memory and spilled to sorted runs in a temp dir when the buffer is full.
+ * After sorted_id_set_finish(), ids can be read back in sorted order with
+ * duplicates removed, by k-way merging the runs.
+ *
+ * sorted_id_set_add() can be called from multiple threads.
+ */
+typedef struct SortedIdSet SortedIdSet;
+typedef struct SortedIdIter SortedIdIter;
+
+SortedIdSet * // 创建；mem_limit为内存缓冲的字节数
+sorted_id_set_new (const char *tmp_dir, size_t mem_limit);
+
+void // 释放，同时删除临时文件
+sorted_id_set_free (SortedIdSet *set);
+
+int // 加入一个id
+sorted_id_set_add (SortedIdSet *set, const char *id);
+
+/* No more ids can be added after finishing. */
+int // 结束写入
+sorted_id_set_finish (SortedIdSet *set);
+
+/* Adds the ids in @path, a file of sorted and deduplicated raw ids such as
+ * one written by sorted_id_set_save(). The file is only read, and must be
+ * kept until the set is freed. */
+int // 加入一个有序id文件
+sorted_id_set_add_file (SortedIdSet *set, const char *path);
+
+guint64 // 加入的id数（含重复，不含有序文件中的）
+sorted_id_set_n_added (SortedIdSet *set);
+
+guint64 // 临时文件占用的字节数
+sorted_id_set_disk_usage (SortedIdSet *set);
+
+SortedIdIter * // 按顺序遍历
+sorted_id_set_iter (SortedIdSet *set);
+
+/* Atomically writes the sorted ids of a finished set to @path. */
+int // 保存到文件
+sorted_id_set_save (SortedIdSet *set, const char *path, guint64 *n_ids);
+
+SortedIdIter * // 遍历一个有序id文件
+sorted_id_iter_open (const char *path);
+
+/* Returns 1 and sets @id (20 raw bytes) to the next id, 0 at the end,
+ * -1 on error. */
+int // 下一个id
+sorted_id_iter_next (SortedIdIter *iter, unsigned char *id);
+
+void
+sorted_id_iter_free (SortedIdIter *iter);
+
+#endif
@@ -5,12 +5,14 @@
 #include <jansson.h>
 #include <locale.h>
 #include <sys/types.h>
+#include <fcntl.h>
 
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include <event2/event.h>
 #else
 #include <event.h>
 #endif
+#include <event2/thread.h>
 
 #include <evhtp.h>
 
@@ -32,9 +34,12 @@
 #define DEFAULT_BIND_HOST "0.0.0.0"
 #define DEFAULT_BIND_PORT 8082
 #define DEFAULT_WORKER_THREADS 10
+#define DEFAULT_IO_THREADS 16
 #define DEFAULT_MAX_DOWNLOAD_DIR_SIZE 100 * ((gint64)1 << 20) /* 100MB */
 #define DEFAULT_MAX_INDEXING_THREADS 1
+#define DEFAULT_MAX_ZIP_PACK_THREADS 8
 #define DEFAULT_MAX_INDEX_PROCESSING_THREADS 3
+#define DEFAULT_STREAM_INDEX_THREADS 4
 #define DEFAULT_FIXED_BLOCK_SIZE ((gint64)1 << 23) /* 8MB */
 #define DEFAULT_CLUSTER_SHARED_TEMP_FILE_MODE 0600
 
@@ -51,12 +56,18 @@
 
 #define CLEANING_INTERVAL_SEC 300	/* 5 minutes */
 #define TOKEN_EXPIRE_TIME 7200	    /* 2 hours */
-#define PERM_EXPIRE_TIME 7200       /* 2 hours */
 #define VIRINFO_EXPIRE_TIME 7200       /* 2 hours */
 
 #define FS_ID_LIST_MAX_WORKERS 3
 #define FS_ID_LIST_TOKEN_LEN 36
 
+#define HEAD_CACHE_TTL 60                   /* 1 minute */
+#define HEAD_WATCH_DEFAULT_TIMEOUT 60
+#define HEAD_WATCH_MAX_TIMEOUT 120
+#define HEAD_WATCH_MAX_REPOS 1000           /* Per request */
+#define HEAD_WATCH_MAX_WATCHES 10000        /* Waiting requests */
+#define HEAD_WATCH_QUERY_BATCH 200
+
 struct _HttpServer {
     evbase_t *evbase;
     evhtp_t *evhtp;
@@ -65,9 +76,6 @@ struct _HttpServer {
     GHashTable *token_cache;
     pthread_mutex_t token_cache_lock; /* token -> username */
 
-    GHashTable *perm_cache;
-    pthread_mutex_t perm_cache_lock; /* repo_id:username -> permission */
-
     GHashTable *vir_repo_info_cache;
     pthread_mutex_t vir_repo_info_cache_lock;
 
@@ -77,6 +85,13 @@ struct _HttpServer {
 
     GHashTable *fs_obj_ids;
     pthread_mutex_t fs_obj_ids_lock;
+
+    GThreadPool *io_pool; // 阻塞I/O线程池，io_threads为0时为NULL
+
+    GHashTable *repo_heads;     /* repo_id -> RepoHead */
+    GHashTable *head_watches;   /* repo_id -> list of HeadWatch */
+    int n_head_watches;         /* Registered watches */
+    pthread_mutex_t head_watch_lock;
 };
 typedef struct _HttpServer HttpServer;
 
@@ -95,11 +110,6 @@ typedef struct TokenInfo {
     gint64 expire_time;
 } TokenInfo;
 
-typedef struct PermInfo {
-    char *perm;
-    gint64 expire_time;
-} PermInfo;
-
 typedef struct VirRepoInfo {
     char *store_id;
     gint64 expire_time;
@@ -120,6 +130,7 @@ const char *OP_PERM_CHECK_REGEX = "^/repo/[\\da-z]{8}-[\\da-z]{4}-[\\da-z]{4}-[\
 const char *GET_CHECK_QUOTA_REGEX = "^/repo/[\\da-z]{8}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{12}/quota-check/.*";
 const char *HEAD_COMMIT_OPER_REGEX = "^/repo/[\\da-z]{8}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{12}/commit/HEAD";
 const char *GET_HEAD_COMMITS_MULTI_REGEX = "^/repo/head-commits-multi";
+const char *GET_HEAD_COMMITS_WATCH_REGEX = "^/repo/head-commits-watch";
 const char *COMMIT_OPER_REGEX = "^/repo/[\\da-z]{8}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{12}/commit/[\\da-z]{40}";
 const char *PUT_COMMIT_INFO_REGEX = "^/repo/[\\da-z]{8}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{12}/commit/[\\da-z]{40}";
 const char *GET_FS_OBJ_ID_REGEX = "^/repo/[\\da-z]{8}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{4}-[\\da-z]{12}/fs-id-list/.*";
@@ -143,11 +154,15 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
     char *host = NULL;
     int port = 0;
     int worker_threads;
+    int io_threads;
     int web_token_expire_time;
     int fixed_block_size_mb;
     char *encoding;
+    char *compression;
+    int zip_pack_threads;
     int max_indexing_threads;
     int max_index_processing_threads;
+    int stream_index_threads;
     char *cluster_shared_temp_file_mode = NULL;
 
     host = fileserver_config_get_string (session->config, HOST, &error);
@@ -191,6 +206,19 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
     }
     seaf_message ("fileserver: worker_threads = %d\n", htp_server->worker_threads);
 
+    io_threads = fileserver_config_get_integer (session->config, "io_threads",
+                                                &error);
+    if (error) {
+        htp_server->io_threads = DEFAULT_IO_THREADS;
+        g_clear_error (&error);
+    } else {
+        if (io_threads < 0)
+            htp_server->io_threads = DEFAULT_IO_THREADS;
+        else
+            htp_server->io_threads = io_threads;
+    }
+    seaf_message ("fileserver: io_threads = %d\n", htp_server->io_threads);
+
     fixed_block_size_mb = fileserver_config_get_integer (session->config,
                                                   "fixed_block_size",
                                                   &error);
@@ -206,6 +234,16 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
     seaf_message ("fileserver: fixed_block_size = %"G_GINT64_FORMAT"\n",
                   htp_server->fixed_block_size);
 
+    /* Only affects content defined chunking, i.e. version 0 repos. */
+    htp_server->use_fastcdc = fileserver_config_get_boolean (session->config,
+                                                             "use_fastcdc",
+                                                             &error);
+    if (error) {
+        htp_server->use_fastcdc = FALSE;
+        g_clear_error (&error);
+    }
+    seaf_message ("fileserver: use_fastcdc = %d\n", htp_server->use_fastcdc);
+
     web_token_expire_time = fileserver_config_get_integer (session->config,
                                                 "web_token_expire_time",
                                                 &error);
@@ -251,6 +289,21 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
     seaf_message ("fileserver: max_index_processing_threads= %d\n",
                   htp_server->max_index_processing_threads);
 
+    stream_index_threads = fileserver_config_get_integer (session->config,
+                                                          "stream_index_threads",
+                                                          &error);
+    if (error) {
+        htp_server->stream_index_threads = DEFAULT_STREAM_INDEX_THREADS;
+        g_clear_error (&error);
+    } else {
+        if (stream_index_threads <= 0)
+            htp_server->stream_index_threads = DEFAULT_STREAM_INDEX_THREADS;
+        else
+            htp_server->stream_index_threads = stream_index_threads;
+    }
+    seaf_message ("fileserver: stream_index_threads = %d\n",
+                  htp_server->stream_index_threads);
+
     cluster_shared_temp_file_mode = fileserver_config_get_string (session->config,
                                                                   "cluster_shared_temp_file_mode",
                                                                   &error);
@@ -283,22 +336,41 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
         /* No windows specific encoding is specified. Set the ZIP_UTF8 flag. */
         setlocale (LC_ALL, "en_US.UTF-8");
     }
+
+    htp_server->streaming_zip = g_key_file_get_boolean (session->config,
+                                                        "zip", "streaming",
+                                                        NULL);
+    seaf_message ("fileserver: zip streaming = %d\n", htp_server->streaming_zip);
+
+    compression = g_key_file_get_string (session->config,
+                                         "zip", "compression", NULL);
+    if (g_strcmp0 (compression, "store") == 0)
+        htp_server->zip_store = TRUE;
+    else if (compression && g_strcmp0 (compression, "deflate") != 0)
+        seaf_warning ("Unknown zip compression %s, use deflate.\n", compression);
+    g_free (compression);
+
+    zip_pack_threads = g_key_file_get_integer (session->config,
+                                               "zip", "pack_threads", &error);
+    if (error) {
+        g_clear_error (&error);
+        zip_pack_threads = 0;
+    }
+    if (zip_pack_threads <= 0)
+        zip_pack_threads = CLAMP (sysconf (_SC_NPROCESSORS_ONLN), 1,
+                                  DEFAULT_MAX_ZIP_PACK_THREADS);
+    htp_server->zip_pack_threads = zip_pack_threads;
+    seaf_message ("fileserver: zip pack_threads = %d\n", htp_server->zip_pack_threads);
 }
 
 static int
-validate_token (HttpServer *htp_server, evhtp_request_t *req,
-                const char *repo_id, char **username,
-                gboolean skip_cache)
+check_token (HttpServer *htp_server, const char *token,
+             const char *repo_id, char **username,
+             gboolean skip_cache)
 {
     char *email = NULL;
     TokenInfo *token_info;
 
-    const char *token = evhtp_kv_find (req->headers_in, "Seafile-Repo-Token");
-    if (token == NULL) {
-        evhtp_send_reply (req, EVHTP_RES_BADREQ);
-        return EVHTP_RES_BADREQ;
-    }
-
     if (!skip_cache) {
         pthread_mutex_lock (&htp_server->token_cache_lock);
 
@@ -336,83 +408,40 @@ validate_token (HttpServer *htp_server, evhtp_request_t *req,
     return EVHTP_RES_OK;
 }
 
-static PermInfo *
-lookup_perm_cache (HttpServer *htp_server, const char *repo_id, const char *username)
-{
-    PermInfo *ret = NULL;
-    char *key = g_strdup_printf ("%s:%s", repo_id, username);
-
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    ret = g_hash_table_lookup (htp_server->perm_cache, key);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
-    g_free (key);
-
-    return ret;
-}
-
-static void
-insert_perm_cache (HttpServer *htp_server,
-                   const char *repo_id, const char *username,
-                   PermInfo *perm)
-{
-    char *key = g_strdup_printf ("%s:%s", repo_id, username);
-
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    g_hash_table_insert (htp_server->perm_cache, key, perm);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
-}
-
-static void
-remove_perm_cache (HttpServer *htp_server,
-                   const char *repo_id, const char *username)
+static int
+validate_token (HttpServer *htp_server, evhtp_request_t *req,
+                const char *repo_id, char **username,
+                gboolean skip_cache)
 {
-    char *key = g_strdup_printf ("%s:%s", repo_id, username);
-
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    g_hash_table_remove (htp_server->perm_cache, key);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
+    const char *token = evhtp_kv_find (req->headers_in, "Seafile-Repo-Token");
+    if (token == NULL) {
+        evhtp_send_reply (req, EVHTP_RES_BADREQ);
+        return EVHTP_RES_BADREQ;
+    }
 
-    g_free (key);
+    return check_token (htp_server, token, repo_id, username, skip_cache);
 }
 
 static int
-check_permission (HttpServer *htp_server, const char *repo_id, const char *username,
-                  const char *op, gboolean skip_cache)
+check_permission (const char *repo_id, const char *username, const char *op)
 {
-    PermInfo *perm_info = NULL;
-
-    if (!skip_cache)
-        perm_info = lookup_perm_cache (htp_server, repo_id, username);
-
-    if (perm_info) {
-        if (strcmp(perm_info->perm, "r") == 0 && strcmp(op, "upload") == 0)
-            return EVHTP_RES_FORBIDDEN;
-        return EVHTP_RES_OK;
-    }
-
     if (strcmp(op, "upload") == 0) {
         int status = seaf_repo_manager_get_repo_status(seaf->repo_mgr, repo_id);
         if (status != REPO_STATUS_NORMAL && status != -1)
             return EVHTP_RES_FORBIDDEN;
     }
 
+    /* Answered from the permission index, see repo-perm.c. */
     char *perm = seaf_repo_manager_check_permission (seaf->repo_mgr,
                                                      repo_id, username, NULL);
-    if (perm) {
-        perm_info = g_new0 (PermInfo, 1);
-        /* Take the reference of perm. */
-        perm_info->perm = perm;
-        perm_info->expire_time = (gint64)time(NULL) + PERM_EXPIRE_TIME;
-        insert_perm_cache (htp_server, repo_id, username, perm_info);
-
-        if ((strcmp (perm, "r") == 0 && strcmp (op, "upload") == 0))
-            return EVHTP_RES_FORBIDDEN;
-        return EVHTP_RES_OK;
-    }
+    if (!perm)
+        return EVHTP_RES_FORBIDDEN;
 
-    /* Invalidate cache if perm not found in db. */
-    remove_perm_cache (htp_server, repo_id, username);
-    return EVHTP_RES_FORBIDDEN;
+    int ret = EVHTP_RES_OK;
+    if (strcmp (perm, "r") == 0 && strcmp (op, "upload") == 0)
+        ret = EVHTP_RES_FORBIDDEN;
+    g_free (perm);
+    return ret;
 }
 
 static gboolean
@@ -731,7 +760,7 @@ get_check_permission_cb (evhtp_request_t *req, void *arg)
     /* We shall actually check the permission from database, don't rely on
      * the cache here.
      */
-    int perm_status = check_permission (htp_server, repo_id, username, op, TRUE);
+    int perm_status = check_permission (repo_id, username, op);
     if (perm_status == EVHTP_RES_FORBIDDEN) {
         evhtp_send_reply (req, EVHTP_RES_FORBIDDEN);
         goto out;
@@ -839,6 +868,126 @@ out:
     g_strfreev (parts);
 }
 
+/*
+ * Blocking work of sync requests (block and fs object reads, DB queries)
+ * runs in the io_threads pool instead of on the event loop threads, so a
+ * slow disk or database only delays the requests waiting on it rather than
+ * every connection served by the same loop. The request is paused while
+ * its job runs. The job only fills its own output buffer and reply status;
+ * the reply is sent from the loop the request belongs to.
+ */
+typedef struct HttpIOJob HttpIOJob;
+typedef void (*HttpIOFunc) (HttpIOJob *job);
+
+struct HttpIOJob {
+    HttpServer *htp_server;
+    evhtp_request_t *req; // 任务完成前请求已被释放时为NULL
+    struct event_base *evbase; // 请求所在的事件循环
+    HttpIOFunc func;
+    char **parts; // 请求路径
+    char *token; // Seafile-Repo-Token，可为NULL
+    void *data; // 请求内容等参数
+    GDestroyNotify free_data;
+    struct evbuffer *out; // 响应内容
+    int status; // 响应状态码
+};
+
+static void
+free_io_job (HttpIOJob *job)
+{
+    g_strfreev (job->parts);
+    g_free (job->token);
+    if (job->free_data)
+        job->free_data (job->data);
+    evbuffer_free (job->out);
+    g_free (job);
+}
+
+static int
+io_job_check_token (HttpIOJob *job, const char *repo_id, char **username)
+{
+    if (!job->token)
+        return EVHTP_RES_BADREQ;
+    return check_token (job->htp_server, job->token, repo_id, username, FALSE);
+}
+
+static evhtp_res
+io_job_request_fini_cb (evhtp_request_t *req, void *arg)
+{
+    HttpIOJob *job = arg;
+
+    /* The connection is gone, the result will be dropped. */
+    job->req = NULL;
+    return EVHTP_RES_OK;
+}
+
+static void
+io_job_done_cb (evutil_socket_t sock, short what, void *arg)
+{
+    HttpIOJob *job = arg;
+    evhtp_request_t *req = job->req;
+
+    if (req) {
+        evhtp_unset_hook (&req->hooks, evhtp_hook_on_request_fini);
+        evbuffer_add_buffer (req->buffer_out, job->out);
+        evhtp_send_reply (req, job->status);
+        evhtp_request_resume (req);
+    }
+
+    free_io_job (job);
+}
+
+static void
+io_job_worker (gpointer data, gpointer user_data)
+{
+    HttpIOJob *job = data;
+
+    job->func (job);
+
+    /* event_base_once() wakes up the loop of the request. */
+    if (event_base_once (job->evbase, -1, EV_TIMEOUT,
+                         io_job_done_cb, job, NULL) < 0) {
+        seaf_warning ("Failed to schedule reply of http request.\n");
+    }
+}
+
+/* Runs @func for @req in the I/O thread pool and sends the reply it set
+ * when it's done. Takes ownership of @data. */
+static void
+run_io_job (HttpServer *htp_server, evhtp_request_t *req,
+            HttpIOFunc func, void *data, GDestroyNotify free_data)
+{
+    HttpIOJob *job = g_new0 (HttpIOJob, 1);
+    const char *token;
+
+    job->htp_server = htp_server;
+    job->req = req;
+    job->func = func;
+    job->parts = g_strsplit (req->uri->path->full + 1, "/", 0);
+    token = evhtp_kv_find (req->headers_in, "Seafile-Repo-Token");
+    job->token = g_strdup (token);
+    job->data = data;
+    job->free_data = free_data;
+    job->out = evbuffer_new ();
+    job->status = EVHTP_RES_SERVERR;
+
+    if (!htp_server->io_pool) {
+        func (job);
+        evbuffer_add_buffer (req->buffer_out, job->out);
+        evhtp_send_reply (req, job->status);
+        free_io_job (job);
+        return;
+    }
+
+    job->evbase = bufferevent_get_base (evhtp_request_get_bev (req));
+    evhtp_set_hook (&req->hooks, evhtp_hook_on_request_fini,
+                    io_job_request_fini_cb, job);
+    /* Don't read the next request of this connection before replying. */
+    evhtp_request_pause (req);
+
+    g_thread_pool_push (htp_server->io_pool, job, NULL);
+}
+
 static gboolean
 get_branch (SeafDBRow *row, void *vid)
 {
@@ -852,11 +1001,9 @@ get_branch (SeafDBRow *row, void *vid)
 }
 
 static void
-get_head_commit_cb (evhtp_request_t *req, void *arg)
+get_head_commit_job (HttpIOJob *job)
 {
-    HttpServer *htp_server = arg;
-    char **parts = g_strsplit (req->uri->path->full + 1, "/", 0);
-    char *repo_id = parts[1];
+    char *repo_id = job->parts[1];
     gboolean db_err = FALSE, exists = TRUE;
     int token_status;
     char commit_id[41];
@@ -867,19 +1014,19 @@ get_head_commit_cb (evhtp_request_t *req, void *arg)
     if (!exists) {
         if (db_err) {
             seaf_warning ("DB error when check repo existence.\n");
-            evbuffer_add_printf (req->buffer_out,
+            evbuffer_add_printf (job->out,
                                  "{\"is_corrupted\": 1}");
-            evhtp_send_reply (req, EVHTP_RES_OK);
-            goto out;
+            job->status = EVHTP_RES_OK;
+            return;
         }
-        evhtp_send_reply (req, SEAF_HTTP_RES_REPO_DELETED);
-        goto out;
+        job->status = SEAF_HTTP_RES_REPO_DELETED;
+        return;
     }
 
-    token_status = validate_token (htp_server, req, repo_id, NULL, FALSE);
+    token_status = io_job_check_token (job, repo_id, NULL);
     if (token_status != EVHTP_RES_OK) {
-        evhtp_send_reply (req, token_status);
-        goto out;
+        job->status = token_status;
+        return;
     }
 
     commit_id[0] = 0;
@@ -889,24 +1036,27 @@ get_head_commit_cb (evhtp_request_t *req, void *arg)
                                        get_branch, commit_id,
                                        1, "string", repo_id) < 0) {
         seaf_warning ("DB error when get branch master.\n");
-        evbuffer_add_printf (req->buffer_out,
+        evbuffer_add_printf (job->out,
                              "{\"is_corrupted\": 1}");
-        evhtp_send_reply (req, EVHTP_RES_OK);
-        goto out;
+        job->status = EVHTP_RES_OK;
+        return;
     }
 
     if (commit_id[0] == 0) {
-        evhtp_send_reply (req, SEAF_HTTP_RES_REPO_DELETED);
-        goto out;
+        job->status = SEAF_HTTP_RES_REPO_DELETED;
+        return;
     }
 
-    evbuffer_add_printf (req->buffer_out,
+    evbuffer_add_printf (job->out,
                          "{\"is_corrupted\": 0, \"head_commit_id\": \"%s\"}",
                          commit_id);
-    evhtp_send_reply (req, EVHTP_RES_OK);
+    job->status = EVHTP_RES_OK;
+}
 
-out:
-    g_strfreev (parts);
+static void
+get_head_commit_cb (evhtp_request_t *req, void *arg)
+{
+    run_io_job (arg, req, get_head_commit_job, NULL, NULL);
 }
 
 static char *
@@ -1081,8 +1231,7 @@ put_update_branch_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    int perm_status = check_permission (htp_server, repo_id, username,
-                                        "upload", FALSE);
+    int perm_status = check_permission (repo_id, username, "upload");
     if (perm_status == EVHTP_RES_FORBIDDEN) {
         evhtp_send_reply (req, EVHTP_RES_FORBIDDEN);
         goto out;
@@ -1260,6 +1409,408 @@ out:
         free (data);
 }
 
+/*
+ * Long-poll for head changes.
+ *
+ * POST /repo/head-commits-watch?timeout=N with {"repo_id": "commit_id", ...},
+ * the heads a client has. If any head is different, the current heads of
+ * the changed repos are returned right away. Otherwise the request waits
+ * until one of the repos is updated or N seconds pass, and returns {} on
+ * timeout.
+ *
+ * Heads are cached from the branch updates of this server, see
+ * seaf_http_server_notify_head_changed(), so waiting clients don't query
+ * the db. Cached heads older than HEAD_CACHE_TTL are read from the db again
+ * when a watch starts, to catch updates made by other programs.
+ *
+ * The endpoint needs no token, so a request may watch at most
+ * HEAD_WATCH_MAX_REPOS repos (400 otherwise), and at most
+ * HEAD_WATCH_MAX_WATCHES requests wait at once (503 otherwise).
+ */
+
+typedef struct RepoHead {
+    char commit_id[41];
+    gint64 mtime;
+} RepoHead;
+
+typedef struct HeadWatch {
+    HttpServer *htp_server;
+    evhtp_request_t *req;       // 连接断开后为NULL
+    struct event_base *evbase;
+    struct event *timer;
+    GHashTable *known;          /* repo_id -> commit_id the client has */
+    json_t *changed;
+    gboolean done;              // 已从head_watches中移除
+} HeadWatch;
+
+static void
+free_head_watch (HeadWatch *watch)
+{
+    if (watch->timer)
+        event_free (watch->timer);
+    g_hash_table_destroy (watch->known);
+    json_decref (watch->changed);
+    g_free (watch);
+}
+
+/* Called with head_watch_lock held. */
+static void
+unregister_head_watch (HeadWatch *watch)
+{
+    HttpServer *htp_server = watch->htp_server;
+    GHashTableIter iter;
+    gpointer key;
+    GList *watches;
+
+    watch->done = TRUE;
+    --htp_server->n_head_watches;
+
+    g_hash_table_iter_init (&iter, watch->known);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        watches = g_hash_table_lookup (htp_server->head_watches, key);
+        watches = g_list_remove (watches, watch);
+        if (watches)
+            g_hash_table_insert (htp_server->head_watches, g_strdup (key), watches);
+        else
+            g_hash_table_remove (htp_server->head_watches, key);
+    }
+}
+
+static void
+reply_head_watch (HeadWatch *watch)
+{
+    evhtp_request_t *req = watch->req;
+    char *data;
+
+    if (!req)
+        return;
+
+    evhtp_unset_hook (&req->hooks, evhtp_hook_on_request_fini);
+    data = json_dumps (watch->changed, JSON_COMPACT);
+    evbuffer_add (req->buffer_out, data, strlen (data));
+    evhtp_send_reply (req, EVHTP_RES_OK);
+    evhtp_request_resume (req);
+    free (data);
+}
+
+static void
+head_watch_fire_cb (evutil_socket_t sock, short what, void *arg)
+{
+    HeadWatch *watch = arg;
+
+    reply_head_watch (watch);
+    free_head_watch (watch);
+}
+
+static void
+head_watch_timeout_cb (evutil_socket_t sock, short what, void *arg)
+{
+    HeadWatch *watch = arg;
+    HttpServer *htp_server = watch->htp_server;
+
+    pthread_mutex_lock (&htp_server->head_watch_lock);
+    if (watch->done) {
+        /* A head changed just now, head_watch_fire_cb() replies. */
+        pthread_mutex_unlock (&htp_server->head_watch_lock);
+        return;
+    }
+    unregister_head_watch (watch);
+    pthread_mutex_unlock (&htp_server->head_watch_lock);
+
+    reply_head_watch (watch);
+    free_head_watch (watch);
+}
+
+static evhtp_res
+head_watch_request_fini_cb (evhtp_request_t *req, void *arg)
+{
+    HeadWatch *watch = arg;
+    HttpServer *htp_server = watch->htp_server;
+
+    pthread_mutex_lock (&htp_server->head_watch_lock);
+    if (watch->done) {
+        watch->req = NULL;
+        pthread_mutex_unlock (&htp_server->head_watch_lock);
+        return EVHTP_RES_OK;
+    }
+    unregister_head_watch (watch);
+    pthread_mutex_unlock (&htp_server->head_watch_lock);
+
+    free_head_watch (watch);
+    return EVHTP_RES_OK;
+}
+
+/* Completes @watch with @repo_id moved to @commit_id, from any thread.
+ * Called with head_watch_lock held.
+ */
+static void
+fire_head_watch (HeadWatch *watch, const char *repo_id, const char *commit_id)
+{
+    unregister_head_watch (watch);
+    json_object_set_new (watch->changed, repo_id, json_string (commit_id));
+
+    /* event_base_once() wakes up the loop of the request. */
+    if (event_base_once (watch->evbase, -1, EV_TIMEOUT,
+                         head_watch_fire_cb, watch, NULL) < 0)
+        seaf_warning ("Failed to schedule reply of head watch.\n");
+}
+
+static void
+set_repo_head_locked (HttpServer *htp_server, const char *repo_id,
+                      const char *commit_id, gint64 mtime)
+{
+    RepoHead *head = g_hash_table_lookup (htp_server->repo_heads, repo_id);
+
+    if (!head) {
+        head = g_new0 (RepoHead, 1);
+        g_hash_table_insert (htp_server->repo_heads, g_strdup (repo_id), head);
+    } else if (head->mtime > mtime) {
+        /* Read from the db before a newer update. */
+        return;
+    }
+    g_strlcpy (head->commit_id, commit_id, sizeof(head->commit_id));
+    head->mtime = mtime;
+}
+
+void
+seaf_http_server_notify_head_changed (HttpServerStruct *server,
+                                      const char *repo_id,
+                                      const char *commit_id)
+{
+    HttpServer *htp_server = server->priv;
+    GList *watches, *ptr;
+
+    pthread_mutex_lock (&htp_server->head_watch_lock);
+
+    set_repo_head_locked (htp_server, repo_id, commit_id, g_get_monotonic_time ());
+
+    watches = g_list_copy (g_hash_table_lookup (htp_server->head_watches, repo_id));
+    for (ptr = watches; ptr; ptr = ptr->next) {
+        HeadWatch *watch = ptr->data;
+        if (g_strcmp0 (g_hash_table_lookup (watch->known, repo_id), commit_id) != 0)
+            fire_head_watch (watch, repo_id, commit_id);
+    }
+    g_list_free (watches);
+
+    pthread_mutex_unlock (&htp_server->head_watch_lock);
+}
+
+static gboolean
+collect_repo_heads (SeafDBRow *row, void *data)
+{
+    GHashTable *heads = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *commit_id = seaf_db_row_get_column_text (row, 1);
+
+    if (repo_id && commit_id)
+        g_hash_table_replace (heads, g_strdup (repo_id), g_strdup (commit_id));
+
+    return TRUE;
+}
+
+/* Reads the heads of @repo_ids, which are valid uuids, from the db. */
+static GHashTable *
+load_repo_heads (GList *repo_ids)
+{
+    GHashTable *heads;
+    GString *sql = g_string_new ("");
+    GList *ptr = repo_ids;
+    int n;
+
+    heads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    while (ptr) {
+        g_string_assign (sql, "SELECT repo_id, commit_id FROM Branch WHERE name='master' "
+                         "AND repo_id IN (");
+        for (n = 0; ptr && n < HEAD_WATCH_QUERY_BATCH; ptr = ptr->next, ++n)
+            g_string_append_printf (sql, n == 0 ? "'%s'" : ",'%s'",
+                                    (char *)ptr->data);
+        g_string_append (sql, ")");
+
+        if (seaf_db_statement_foreach_row (seaf->db, sql->str,
+                                           collect_repo_heads, heads, 0) < 0) {
+            g_hash_table_destroy (heads);
+            heads = NULL;
+            break;
+        }
+    }
+    g_string_free (sql, TRUE);
+
+    return heads;
+}
+
+static json_t *
+load_json_body (evhtp_request_t *req)
+{
+    size_t len = evbuffer_get_length (req->buffer_in);
+    json_error_t jerror;
+    json_t *body;
+    char *data;
+
+    if (len == 0)
+        return NULL;
+
+    data = g_new0 (char, len);
+    evbuffer_remove (req->buffer_in, data, len);
+    body = json_loadb (data, len, 0, &jerror);
+    g_free (data);
+
+    if (!body)
+        seaf_warning ("Failed to load json body: %s\n", jerror.text);
+    return body;
+}
+
+static void
+head_commits_watch_cb (evhtp_request_t *req, void *arg)
+{
+    HttpServer *htp_server = arg;
+    HeadWatch *watch;
+    json_t *body;
+    void *iter_obj;
+    const char *repo_id, *commit_id;
+    const char *timeout_str;
+    GList *stale = NULL, *ptr;
+    GHashTable *heads = NULL;
+    GHashTableIter iter;
+    gpointer key, known;
+    RepoHead *head;
+    struct timeval tv;
+    gint64 start;
+    int timeout = HEAD_WATCH_DEFAULT_TIMEOUT;
+
+    timeout_str = evhtp_kv_find (req->uri->query, "timeout");
+    if (timeout_str)
+        timeout = CLAMP (atoi (timeout_str), 1, HEAD_WATCH_MAX_TIMEOUT);
+
+    body = load_json_body (req);
+    if (!body || !json_is_object (body) || json_object_size (body) == 0 ||
+        json_object_size (body) > HEAD_WATCH_MAX_REPOS) {
+        evhtp_send_reply (req, EVHTP_RES_BADREQ);
+        if (body)
+            json_decref (body);
+        return;
+    }
+
+    watch = g_new0 (HeadWatch, 1);
+    watch->htp_server = htp_server;
+    watch->req = req;
+    watch->evbase = bufferevent_get_base (evhtp_request_get_bev (req));
+    watch->known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    watch->changed = json_object ();
+
+    for (iter_obj = json_object_iter (body); iter_obj;
+         iter_obj = json_object_iter_next (body, iter_obj)) {
+        repo_id = json_object_iter_key (iter_obj);
+        commit_id = json_string_value (json_object_iter_value (iter_obj));
+        /* Make sure ids are in UUID format, they are put in the sql text. */
+        if (!is_uuid_valid (repo_id) || !commit_id ||
+            !is_object_id_valid (commit_id)) {
+            json_decref (body);
+            free_head_watch (watch);
+            evhtp_send_reply (req, EVHTP_RES_BADREQ);
+            return;
+        }
+        g_hash_table_replace (watch->known, g_strdup (repo_id), g_strdup (commit_id));
+    }
+    json_decref (body);
+
+    /* Register first, so updates made while the db is read are not lost. */
+    start = g_get_monotonic_time ();
+    pthread_mutex_lock (&htp_server->head_watch_lock);
+    if (htp_server->n_head_watches >= HEAD_WATCH_MAX_WATCHES) {
+        pthread_mutex_unlock (&htp_server->head_watch_lock);
+        seaf_warning ("Too many head commit watches.\n");
+        free_head_watch (watch);
+        evhtp_send_reply (req, EVHTP_RES_SERVUNAVAIL);
+        return;
+    }
+    ++htp_server->n_head_watches;
+    g_hash_table_iter_init (&iter, watch->known);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        GList *watches = g_hash_table_lookup (htp_server->head_watches, key);
+        g_hash_table_insert (htp_server->head_watches, g_strdup (key),
+                             g_list_prepend (watches, watch));
+
+        head = g_hash_table_lookup (htp_server->repo_heads, key);
+        if (!head || start - head->mtime > HEAD_CACHE_TTL * G_USEC_PER_SEC)
+            stale = g_list_prepend (stale, key);
+    }
+    pthread_mutex_unlock (&htp_server->head_watch_lock);
+
+    if (stale) {
+        heads = load_repo_heads (stale);
+        if (!heads) {
+            g_list_free (stale);
+            pthread_mutex_lock (&htp_server->head_watch_lock);
+            if (watch->done) {
+                /* head_watch_fire_cb() will reply. */
+                watch->req = NULL;
+                pthread_mutex_unlock (&htp_server->head_watch_lock);
+            } else {
+                unregister_head_watch (watch);
+                pthread_mutex_unlock (&htp_server->head_watch_lock);
+                free_head_watch (watch);
+            }
+            evhtp_send_reply (req, EVHTP_RES_SERVERR);
+            return;
+        }
+    }
+
+    pthread_mutex_lock (&htp_server->head_watch_lock);
+
+    if (heads) {
+        for (ptr = stale; ptr; ptr = ptr->next) {
+            known = g_hash_table_lookup (heads, ptr->data);
+            head = g_hash_table_lookup (htp_server->repo_heads, ptr->data);
+            if (known)
+                set_repo_head_locked (htp_server, ptr->data, known, start);
+            else if (head && head->mtime <= start)
+                /* The repo is deleted. */
+                g_hash_table_remove (htp_server->repo_heads, ptr->data);
+        }
+        g_list_free (stale);
+        g_hash_table_destroy (heads);
+    }
+
+    if (watch->done) {
+        /* A head changed while the db was read. */
+        evhtp_set_hook (&req->hooks, evhtp_hook_on_request_fini,
+                        head_watch_request_fini_cb, watch);
+        evhtp_request_pause (req);
+        pthread_mutex_unlock (&htp_server->head_watch_lock);
+        return;
+    }
+
+    /* Deleted repos have no head and are only reported if they come back. */
+    g_hash_table_iter_init (&iter, watch->known);
+    while (g_hash_table_iter_next (&iter, &key, &known)) {
+        head = g_hash_table_lookup (htp_server->repo_heads, key);
+        if (head && strcmp (head->commit_id, known) != 0)
+            json_object_set_new (watch->changed, key, json_string (head->commit_id));
+    }
+    if (json_object_size (watch->changed) > 0) {
+        unregister_head_watch (watch);
+        pthread_mutex_unlock (&htp_server->head_watch_lock);
+        char *data = json_dumps (watch->changed, JSON_COMPACT);
+        evbuffer_add (req->buffer_out, data, strlen (data));
+        evhtp_send_reply (req, EVHTP_RES_OK);
+        free (data);
+        free_head_watch (watch);
+        return;
+    }
+
+    watch->timer = evtimer_new (watch->evbase, head_watch_timeout_cb, watch);
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    evtimer_add (watch->timer, &tv);
+    evhtp_set_hook (&req->hooks, evhtp_hook_on_request_fini,
+                    head_watch_request_fini_cb, watch);
+    /* Don't read the next request of this connection before replying. */
+    evhtp_request_pause (req);
+
+    pthread_mutex_unlock (&htp_server->head_watch_lock);
+}
+
 static void
 get_commit_info_cb (evhtp_request_t *req, void *arg)
 {
@@ -1309,8 +1860,7 @@ put_commit_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    int perm_status = check_permission (htp_server, repo_id, username,
-                                        "upload", FALSE);
+    int perm_status = check_permission (repo_id, username, "upload");
     if (perm_status == EVHTP_RES_FORBIDDEN) {
         evhtp_send_reply (req, EVHTP_RES_FORBIDDEN);
         goto out;
@@ -1830,35 +2380,30 @@ out:
 }
 
 static void
-get_block_cb (evhtp_request_t *req, void *arg)
+get_block_job (HttpIOJob *job)
 {
-    const char *repo_id = NULL;
-    char *block_id = NULL;
+    const char *repo_id = job->parts[1];
+    const char *block_id = job->parts[3];
     char *store_id = NULL;
-    HttpServer *htp_server = arg;
     BlockMetadata *blk_meta = NULL;
     char *username = NULL;
 
-    char **parts = g_strsplit (req->uri->path->full + 1, "/", 0);
-    repo_id = parts[1];
-    block_id = parts[3];
-
-    int token_status = validate_token (htp_server, req, repo_id, &username, FALSE);
+    int token_status = io_job_check_token (job, repo_id, &username);
     if (token_status != EVHTP_RES_OK) {
-        evhtp_send_reply (req, token_status);
+        job->status = token_status;
         goto out;
     }
 
-    store_id = get_repo_store_id (htp_server, repo_id);
+    store_id = get_repo_store_id (job->htp_server, repo_id);
     if (!store_id) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
         goto out;
     }
 
     blk_meta = seaf_block_manager_stat_block (seaf->block_mgr,
                                               store_id, 1, block_id);
     if (blk_meta == NULL || blk_meta->size <= 0) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
         goto out;
     }
 
@@ -1867,13 +2412,33 @@ get_block_cb (evhtp_request_t *req, void *arg)
                                                store_id, 1, block_id, BLOCK_READ);
     if (!blk_handle) {
         seaf_warning ("Failed to open block %.8s:%s.\n", store_id, block_id);
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
         goto out;
     }
 
+    /* Let libevent sendfile() the block straight from its file. The
+     * loop thread does the copy, so start reading the block into the page
+     * cache here. */
+    int fd = seaf_block_manager_dup_block_fd (seaf->block_mgr, blk_handle);
+    if (fd >= 0) {
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise (fd, 0, blk_meta->size, POSIX_FADV_WILLNEED);
+#endif
+        if (evbuffer_add_file (job->out, fd, 0, blk_meta->size) < 0) {
+            close (fd);
+            seaf_warning ("Failed to send block %.8s:%s.\n", store_id, block_id);
+            job->status = EVHTP_RES_SERVERR;
+            goto free_handle;
+        }
+        job->status = EVHTP_RES_OK;
+        send_statistic_msg (store_id, username, "sync-file-download",
+                            (guint64)blk_meta->size);
+        goto free_handle;
+    }
+
     void *block_con = g_new0 (char, blk_meta->size);
     if (!block_con) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
         seaf_warning ("Failed to allocate %d bytes memeory.\n", blk_meta->size);
         goto free_handle;
     }
@@ -1883,10 +2448,10 @@ get_block_cb (evhtp_request_t *req, void *arg)
                                                blk_meta->size);
     if (rsize != blk_meta->size) {
         seaf_warning ("Failed to read block %.8s:%s.\n", store_id, block_id);
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
     } else {
-        evbuffer_add (req->buffer_out, block_con, blk_meta->size);
-        evhtp_send_reply (req, EVHTP_RES_OK);
+        evbuffer_add (job->out, block_con, blk_meta->size);
+        job->status = EVHTP_RES_OK;
     }
     g_free (block_con);
     send_statistic_msg (store_id, username, "sync-file-download", (guint64)rsize);
@@ -1899,7 +2464,12 @@ out:
     g_free (username);
     g_free (blk_meta);
     g_free (store_id);
-    g_strfreev (parts);
+}
+
+static void
+get_block_cb (evhtp_request_t *req, void *arg)
+{
+    run_io_job (arg, req, get_block_job, NULL, NULL);
 }
 
 static void
@@ -1923,8 +2493,7 @@ put_send_block_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    int perm_status = check_permission (htp_server, repo_id, username,
-                                        "upload", FALSE);
+    int perm_status = check_permission (repo_id, username, "upload");
     if (perm_status == EVHTP_RES_FORBIDDEN) {
         evhtp_send_reply (req, EVHTP_RES_FORBIDDEN);
         goto out;
@@ -2009,88 +2578,110 @@ block_oper_cb (evhtp_request_t *req, void *arg)
     }
 }
 
+typedef struct CheckExistData {
+    CheckExistType type;
+    json_t *obj_array; // 请求的id列表，解析失败时为NULL
+} CheckExistData;
+
 static void
-post_check_exist_cb (evhtp_request_t *req, void *arg, CheckExistType type)
+free_check_exist_data (CheckExistData *data)
 {
-    HttpServer *htp_server = arg;
-    char **parts = g_strsplit (req->uri->path->full + 1, "/", 0);
-    char *repo_id = parts[1];
+    if (data->obj_array)
+        json_decref (data->obj_array);
+    g_free (data);
+}
+
+static void
+post_check_exist_job (HttpIOJob *job)
+{
+    const char *repo_id = job->parts[1];
+    CheckExistData *data = job->data;
+    json_t *obj_array = data->obj_array;
     char *store_id = NULL;
+    const char **obj_ids = NULL;
+    gboolean *exists = NULL;
+    json_t *needed_objs = NULL;
+    int array_size, n_ids = 0, i, ret;
 
-    int token_status = validate_token (htp_server, req, repo_id, NULL, FALSE);
+    int token_status = io_job_check_token (job, repo_id, NULL);
     if (token_status != EVHTP_RES_OK) {
-        evhtp_send_reply (req, token_status);
+        job->status = token_status;
         goto out;
     }
 
-    store_id = get_repo_store_id (htp_server, repo_id);
+    store_id = get_repo_store_id (job->htp_server, repo_id);
     if (!store_id) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
         goto out;
     }
 
-    size_t list_len = evbuffer_get_length (req->buffer_in);
-    if (list_len == 0) {
-        evhtp_send_reply (req, EVHTP_RES_BADREQ);
+    if (!obj_array) {
+        job->status = EVHTP_RES_BADREQ;
         goto out;
     }
 
-    char *obj_list_con = g_new0 (char, list_len);
-    if (!obj_list_con) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
-        seaf_warning ("Failed to allocate %zu bytes memory.\n", list_len);
-        goto out;
+    /* All ids are checked in one batch, the backends overlap the syscalls. */
+    array_size = json_array_size (obj_array);
+    obj_ids = g_new (const char *, array_size);
+    for (i = 0; i < array_size; ++i) {
+        const char *obj_id = json_string_value (json_array_get (obj_array, i));
+        if (is_object_id_valid (obj_id))
+            obj_ids[n_ids++] = obj_id;
     }
 
-    json_error_t jerror;
-    evbuffer_remove (req->buffer_in, obj_list_con, list_len);
-    json_t *obj_array = json_loadb (obj_list_con, list_len, 0, &jerror);
-    g_free (obj_list_con);
-
-    if (!obj_array) {
-        seaf_warning ("dump obj_id to json failed, error: %s\n", jerror.text);
-        evhtp_send_reply (req, EVHTP_RES_BADREQ);
-        return;
+    exists = g_new0 (gboolean, n_ids);
+    if (data->type == CHECK_FS_EXIST)
+        ret = seaf_fs_manager_objects_exist (seaf->fs_mgr, store_id, 1,
+                                             obj_ids, n_ids, exists);
+    else
+        ret = seaf_block_manager_blocks_exist (seaf->block_mgr, store_id, 1,
+                                               obj_ids, n_ids, exists);
+    if (ret < 0) {
+        seaf_warning ("Failed to check objects of %s.\n", store_id);
+        job->status = EVHTP_RES_SERVERR;
+        goto out;
     }
 
-    json_t *obj = NULL;
-    gboolean ret = TRUE;
-    const char *obj_id = NULL;
-    int index = 0;
-
-    int array_size = json_array_size (obj_array);
-    json_t *needed_objs = json_array();
-
-    for (; index < array_size; ++index) {
-        obj = json_array_get (obj_array, index);
-        obj_id = json_string_value (obj);
-        if (!is_object_id_valid (obj_id))
-            continue;
-
-        if (type == CHECK_FS_EXIST) {
-            ret = seaf_fs_manager_object_exists (seaf->fs_mgr, store_id, 1,
-                                                 obj_id);
-        } else if (type == CHECK_BLOCK_EXIST) {
-            ret = seaf_block_manager_block_exists (seaf->block_mgr, store_id, 1,
-                                                   obj_id);
-        }
-
-        if (!ret) {
-            json_array_append (needed_objs, obj);
-        }
+    needed_objs = json_array ();
+    for (i = 0; i < n_ids; ++i) {
+        if (!exists[i])
+            json_array_append_new (needed_objs, json_string (obj_ids[i]));
     }
 
     char *ret_array = json_dumps (needed_objs, JSON_COMPACT);
-    evbuffer_add (req->buffer_out, ret_array, strlen (ret_array));
-    evhtp_send_reply (req, EVHTP_RES_OK);
-
+    evbuffer_add (job->out, ret_array, strlen (ret_array));
+    job->status = EVHTP_RES_OK;
     g_free (ret_array);
-    json_decref (needed_objs);
-    json_decref (obj_array);
 
 out:
+    if (needed_objs)
+        json_decref (needed_objs);
+    g_free (obj_ids);
+    g_free (exists);
     g_free (store_id);
-    g_strfreev (parts);
+}
+
+static void
+post_check_exist_cb (evhtp_request_t *req, void *arg, CheckExistType type)
+{
+    CheckExistData *data = g_new0 (CheckExistData, 1);
+    json_error_t jerror;
+
+    data->type = type;
+
+    /* The request body is parsed here, jobs don't touch the request. */
+    size_t list_len = evbuffer_get_length (req->buffer_in);
+    if (list_len > 0) {
+        char *obj_list_con = g_new0 (char, list_len);
+        evbuffer_remove (req->buffer_in, obj_list_con, list_len);
+        data->obj_array = json_loadb (obj_list_con, list_len, 0, &jerror);
+        if (!data->obj_array)
+            seaf_warning ("dump obj_id to json failed, error: %s\n", jerror.text);
+        g_free (obj_list_con);
+    }
+
+    run_io_job (arg, req, post_check_exist_job, data,
+                (GDestroyNotify)free_check_exist_data);
 }
 
 static void
@@ -2121,8 +2712,7 @@ post_recv_fs_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    int perm_status = check_permission (htp_server, repo_id, username,
-                                        "upload", FALSE);
+    int perm_status = check_permission (repo_id, username, "upload");
     if (perm_status == EVHTP_RES_FORBIDDEN) {
         evhtp_send_reply (req, EVHTP_RES_FORBIDDEN);
         goto out;
@@ -2203,47 +2793,26 @@ out:
 #define MAX_OBJECT_PACK_SIZE (1 << 20) /* 1MB */
 
 static void
-post_pack_fs_cb (evhtp_request_t *req, void *arg)
+post_pack_fs_job (HttpIOJob *job)
 {
-    HttpServer *htp_server = arg;
-    char **parts = g_strsplit (req->uri->path->full + 1, "/", 0);
-    const char *repo_id = parts[1];
+    const char *repo_id = job->parts[1];
+    json_t *fs_id_array = job->data;
     char *store_id = NULL;
 
-    int token_status = validate_token (htp_server, req, repo_id, NULL, FALSE);
+    int token_status = io_job_check_token (job, repo_id, NULL);
     if (token_status != EVHTP_RES_OK) {
-        evhtp_send_reply (req, token_status);
+        job->status = token_status;
         goto out;
     }
 
-    store_id = get_repo_store_id (htp_server, repo_id);
+    store_id = get_repo_store_id (job->htp_server, repo_id);
     if (!store_id) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        job->status = EVHTP_RES_SERVERR;
         goto out;
     }
 
-    int fs_id_list_len = evbuffer_get_length (req->buffer_in);
-    if (fs_id_list_len == 0) {
-        evhtp_send_reply (req, EVHTP_RES_BADREQ);
-        goto out;
-    }
-
-    char *fs_id_list = g_new0 (char, fs_id_list_len);
-    if (!fs_id_list) {
-        evhtp_send_reply (req, EVHTP_RES_SERVERR);
-        seaf_warning ("Failed to allocate %d bytes memory.\n", fs_id_list_len);
-        goto out;
-    }
-
-    json_error_t jerror;
-    evbuffer_remove (req->buffer_in, fs_id_list, fs_id_list_len);
-    json_t *fs_id_array = json_loadb (fs_id_list, fs_id_list_len, 0, &jerror);
-
-    g_free (fs_id_list);
-
     if (!fs_id_array) {
-        seaf_warning ("dump fs obj_id from json failed, error: %s\n", jerror.text);
-        evhtp_send_reply (req, EVHTP_RES_BADREQ);
+        job->status = EVHTP_RES_BADREQ;
         goto out;
     }
 
@@ -2263,22 +2832,22 @@ post_pack_fs_cb (evhtp_request_t *req, void *arg)
 
         if (!is_object_id_valid (obj_id)) {
             seaf_warning ("Invalid fs id %s.\n", obj_id);
-            evhtp_send_reply (req, EVHTP_RES_BADREQ);
-            json_decref (fs_id_array);
+            evbuffer_drain (job->out, evbuffer_get_length (job->out));
+            job->status = EVHTP_RES_BADREQ;
             goto out;
         }
-        if (seaf_obj_store_read_obj (seaf->fs_mgr->obj_store, store_id, 1,
-                                     obj_id, &fs_data, &data_len) < 0) {
+        if (seaf_fs_manager_read_json_object (seaf->fs_mgr, store_id, 1,
+                                              obj_id, &fs_data, &data_len) < 0) {
             seaf_warning ("Failed to read seafile object %s:%s.\n", store_id, obj_id);
-            evhtp_send_reply (req, EVHTP_RES_SERVERR);
-            json_decref (fs_id_array);
+            evbuffer_drain (job->out, evbuffer_get_length (job->out));
+            job->status = EVHTP_RES_SERVERR;
             goto out;
         }
 
-        evbuffer_add (req->buffer_out, obj_id, 40);
+        evbuffer_add (job->out, obj_id, 40);
         data_len_net = htonl (data_len);
-        evbuffer_add (req->buffer_out, &data_len_net, 4);
-        evbuffer_add (req->buffer_out, fs_data, data_len);
+        evbuffer_add (job->out, &data_len_net, 4);
+        evbuffer_add (job->out, fs_data, data_len);
 
         total_size += data_len;
         g_free (fs_data);
@@ -2287,12 +2856,31 @@ post_pack_fs_cb (evhtp_request_t *req, void *arg)
             break;
     }
 
-    evhtp_send_reply (req, EVHTP_RES_OK);
+    job->status = EVHTP_RES_OK;
 
-    json_decref (fs_id_array);
 out:
     g_free (store_id);
-    g_strfreev (parts);
+}
+
+static void
+post_pack_fs_cb (evhtp_request_t *req, void *arg)
+{
+    json_t *fs_id_array = NULL;
+    json_error_t jerror;
+
+    /* The request body is parsed here, jobs don't touch the request. */
+    int fs_id_list_len = evbuffer_get_length (req->buffer_in);
+    if (fs_id_list_len > 0) {
+        char *fs_id_list = g_new0 (char, fs_id_list_len);
+        evbuffer_remove (req->buffer_in, fs_id_list, fs_id_list_len);
+        fs_id_array = json_loadb (fs_id_list, fs_id_list_len, 0, &jerror);
+        if (!fs_id_array)
+            seaf_warning ("dump fs obj_id from json failed, error: %s\n", jerror.text);
+        g_free (fs_id_list);
+    }
+
+    run_io_job (arg, req, post_pack_fs_job, fs_id_array,
+                (GDestroyNotify)json_decref);
 }
 
 static void
@@ -2361,130 +2949,12 @@ out:
     g_strfreev (parts);
 }
 
-static json_t *
-fill_obj_from_seafilerepo (SeafileRepo *srepo, GHashTable *table)
-{
-    int version = 0;
-    char *repo_id = NULL;
-    char *commit_id = NULL;
-    char *repo_name = NULL;
-    char *permission = NULL;
-    char *owner = NULL;
-    gint64 last_modify = 0;
-    json_t *obj = NULL;
-
-    g_object_get (srepo, "version", &version,
-                         "id", &repo_id,
-                         "head_cmmt_id", &commit_id,
-                         "name", &repo_name,
-                         "last_modify", &last_modify,
-                         "permission", &permission,
-                         "user", &owner,
-                         NULL);
-
-    if (!repo_id)
-        goto out;
-    //the repo_id will be free when the table is destroyed.
-    if (g_hash_table_lookup (table, repo_id)) {
-        g_free (repo_id);
-        goto out;
-    }
-    g_hash_table_insert (table, repo_id, repo_id);
-    obj = json_object ();
-    json_object_set_new (obj, "version", json_integer (version));
-    json_object_set_new (obj, "id", json_string (repo_id));
-    json_object_set_new (obj, "head_commit_id", json_string (commit_id));
-    json_object_set_new (obj, "name", json_string (repo_name));
-    json_object_set_new (obj, "mtime", json_integer (last_modify));
-    json_object_set_new (obj, "permission", json_string (permission));
-    json_object_set_new (obj, "owner", json_string (owner));
-
-out:
-    g_free (commit_id);
-    g_free (repo_name);
-    g_free (permission);
-    g_free (owner);
-    return obj;
-}
-
-static GHashTable *
-filter_group_repos (GList *repos)
-{
-    if (!repos)
-        return NULL;
-
-    SeafileRepo *srepo = NULL;
-    SeafileRepo *srepo_tmp = NULL;
-    GList *iter;
-    GHashTable *table = NULL;
-    char *permission = NULL;
-    char *permission_prev = NULL;
-    char *repo_id = NULL;
-
-    table = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                   g_free,
-                                   NULL);
-
-    for (iter = repos; iter; iter = iter->next) {
-        srepo = iter->data;
-        g_object_get (srepo, "id", &repo_id,
-                             "permission", &permission,
-                             NULL);
-        srepo_tmp = g_hash_table_lookup (table, repo_id);
-        if (srepo_tmp) {
-            g_object_get (srepo_tmp, "permission", &permission_prev,
-                          NULL);
-            if (g_strcmp0 (permission, "rw") == 0 && g_strcmp0 (permission_prev, "r") == 0) {
-                g_object_unref (srepo_tmp);
-                g_hash_table_remove (table, repo_id);
-                g_hash_table_insert (table, g_strdup (repo_id), srepo);
-            } else {
-                g_object_unref (srepo);
-            }
-            g_free (permission_prev);
-        } else {
-            g_hash_table_insert (table, g_strdup (repo_id), srepo);
-        }
-    }
-
-    g_free (repo_id);
-    g_free (permission);
-    return table;
-}
-
-static void
-group_repos_to_json (json_t *repo_array, GHashTable *group_repos,
-                     GHashTable *obtained_repos)
-{
-    GHashTableIter iter;
-    gpointer key, value;
-    SeafileRepo *srepo = NULL;
-    json_t *obj;
-
-    g_hash_table_iter_init (&iter, group_repos);
-    while (g_hash_table_iter_next (&iter, &key, &value)) {
-        srepo = value;
-        obj = fill_obj_from_seafilerepo (srepo, obtained_repos);
-        if (!obj) {
-            g_object_unref (srepo);
-            continue;
-        }
-        json_object_set_new (obj, "type", json_string ("grepo"));
-
-        json_array_append_new (repo_array, obj);
-        g_object_unref (srepo);
-    }
-}
-
 static void
 get_accessible_repo_list_cb (evhtp_request_t *req, void *arg)
 {
-    GList *iter;
     HttpServer *htp_server = (HttpServer *)arg;
-    SeafRepo *repo = NULL;
     char *user = NULL;
-    GList *repos = NULL;
-    int org_id = -1;
+    json_t *repo_array;
     const char *repo_id = evhtp_kv_find (req->uri->query, "repo_id");
 
     if (!repo_id || !is_uuid_valid (repo_id)) {
@@ -2499,107 +2969,12 @@ get_accessible_repo_list_cb (evhtp_request_t *req, void *arg)
         return;
     }
 
-    json_t *obj;
-    json_t *repo_array = json_array ();
-
-    gboolean db_err = FALSE;
-    GHashTable *obtained_repos = NULL;
-    char *repo_id_tmp = NULL;
-    obtained_repos = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                            g_free,
-                                            NULL);
-    //get personal repo list
-    repos = seaf_repo_manager_get_repos_by_owner (seaf->repo_mgr, user, 0, -1, -1, &db_err);
-    if (db_err)
-        goto out;
-
-    for (iter = repos; iter; iter = iter->next) {
-        repo = iter->data;
-
-        if (!repo->is_corrupted) {
-            if (!g_hash_table_lookup (obtained_repos, repo->id)) {
-                repo_id_tmp = g_strdup (repo->id);
-                g_hash_table_insert (obtained_repos, repo_id_tmp, repo_id_tmp);
-            }
-            obj = json_object ();
-            json_object_set_new (obj, "version", json_integer (repo->version));
-            json_object_set_new (obj, "id", json_string (repo->id));
-            json_object_set_new (obj, "head_commit_id", json_string (repo->head->commit_id));
-            json_object_set_new (obj, "name", json_string (repo->name));
-            json_object_set_new (obj, "mtime", json_integer (repo->last_modify));
-            json_object_set_new (obj, "permission", json_string ("rw"));
-            json_object_set_new (obj, "type", json_string ("repo"));
-            json_object_set_new (obj, "owner", json_string (user));
-
-            json_array_append_new (repo_array, obj);
-        }
-        seaf_repo_unref (repo);
-    }
-    g_list_free (repos);
-
-    GError *error = NULL;
-    SeafileRepo *srepo = NULL;
-    //get shared repo list
-    repos = seaf_share_manager_list_share_repos (seaf->share_mgr, user, "to_email", -1, -1, &db_err);
-    if (db_err)
-        goto out;
-
-    for (iter = repos; iter; iter = iter->next) {
-        srepo = iter->data;
-        obj = fill_obj_from_seafilerepo (srepo, obtained_repos);
-        if (!obj) {
-            g_object_unref (srepo);
-            continue;
-        }
-        json_object_set_new (obj, "type", json_string ("srepo"));
-
-        json_array_append_new (repo_array, obj);
-        g_object_unref (srepo);
-    }
-    g_list_free (repos);
-
-    //get group repo list
-    GHashTable *group_repos = NULL;
-    repos = seaf_get_group_repos_by_user (seaf->repo_mgr, user, org_id, &error);
-    if (error) {
-        g_clear_error (&error);
-        goto out;
-    }
-
-    if (repos) {
-        group_repos = filter_group_repos (repos);
-        group_repos_to_json (repo_array, group_repos, obtained_repos);
-        g_hash_table_destroy (group_repos);
-        g_list_free (repos);
-    }
-
-    //get inner public repo list
-    repos = seaf_repo_manager_list_inner_pub_repos (seaf->repo_mgr, &db_err);
-    if (db_err)
-        goto out;
-
-    for (iter = repos; iter; iter = iter->next) {
-        srepo = iter->data;
-        obj = fill_obj_from_seafilerepo (srepo, obtained_repos);
-        if (!obj) {
-            g_object_unref (srepo);
-            continue;
-        }
-        json_object_set_new (obj, "type", json_string ("grepo"));
-        json_object_set (obj, "owner", json_string ("Organization"));
-
-        json_array_append_new (repo_array, obj);
-        g_object_unref (srepo);
-    }
-    g_list_free (repos);
-
-out:
-    g_hash_table_destroy (obtained_repos);
-
-    if (db_err) {
-        json_decref (repo_array);
+    /* Owned, shared, group and public repos, without loading head commits. */
+    repo_array = seaf_repo_manager_get_accessible_repos (seaf->repo_mgr, user);
+    if (!repo_array) {
         seaf_warning ("DB error when get accessible repo list.\n");
         evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        g_free (user);
         return;
     }
 
@@ -2609,6 +2984,7 @@ out:
 
     g_free (json_str);
     json_decref (repo_array);
+    g_free (user);
 }
 
 static void
@@ -2636,6 +3012,10 @@ http_request_init (HttpServerStruct *server)
                         GET_HEAD_COMMITS_MULTI_REGEX, head_commits_multi_cb,
                         priv);
 
+    evhtp_set_regex_cb (priv->evhtp,
+                        GET_HEAD_COMMITS_WATCH_REGEX, head_commits_watch_cb,
+                        priv);
+
     evhtp_set_regex_cb (priv->evhtp,
                         COMMIT_OPER_REGEX, commit_oper_cb,
                         priv);
@@ -2715,25 +3095,6 @@ is_token_expire (gpointer key, gpointer value, gpointer arg)
     return FALSE;
 }
 
-static void
-perm_cache_value_free (gpointer data)
-{
-    PermInfo *perm_info = data;
-    g_free (perm_info->perm);
-    g_free (perm_info);
-}
-
-static gboolean
-is_perm_expire (gpointer key, gpointer value, gpointer arg)
-{
-    PermInfo *perm_info = (PermInfo *)value;
-
-    if(perm_info && perm_info->expire_time <= (gint64)time(NULL)) {
-        return TRUE;
-    }
-
-    return FALSE;
-}
 
 static gboolean
 is_vir_repo_info_expire (gpointer key, gpointer value, gpointer arg)
@@ -2761,6 +3122,16 @@ free_vir_repo_info (gpointer data)
     g_free (vinfo);
 }
 
+static gboolean
+is_repo_head_expire (gpointer key, gpointer value, gpointer arg)
+{
+    HttpServer *htp_server = arg;
+    RepoHead *head = value;
+
+    return (g_get_monotonic_time () - head->mtime > HEAD_CACHE_TTL * G_USEC_PER_SEC &&
+            !g_hash_table_lookup (htp_server->head_watches, key));
+}
+
 static void
 remove_expire_cache_cb (evutil_socket_t sock, short type, void *data)
 {
@@ -2770,14 +3141,15 @@ remove_expire_cache_cb (evutil_socket_t sock, short type, void *data)
     g_hash_table_foreach_remove (htp_server->token_cache, is_token_expire, NULL);
     pthread_mutex_unlock (&htp_server->token_cache_lock);
 
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    g_hash_table_foreach_remove (htp_server->perm_cache, is_perm_expire, NULL);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
-
     pthread_mutex_lock (&htp_server->vir_repo_info_cache_lock);
     g_hash_table_foreach_remove (htp_server->vir_repo_info_cache,
                                  is_vir_repo_info_expire, NULL);
     pthread_mutex_unlock (&htp_server->vir_repo_info_cache_lock);
+
+    pthread_mutex_lock (&htp_server->head_watch_lock);
+    g_hash_table_foreach_remove (htp_server->repo_heads,
+                                 is_repo_head_expire, htp_server);
+    pthread_mutex_unlock (&htp_server->head_watch_lock);
 }
 
 static void *
@@ -2786,6 +3158,12 @@ http_server_run (void *arg)
     HttpServerStruct *server = arg;
     HttpServer *priv = server->priv;
 
+    /* Replies of I/O jobs are scheduled onto the loops from other threads. */
+    if (evthread_use_pthreads () < 0) {
+        seaf_warning ("Failed to enable libevent thread support.\n");
+        exit(-1);
+    }
+
     priv->evbase = event_base_new();
     priv->evhtp = evhtp_new(priv->evbase, NULL);
 
@@ -2830,10 +3208,6 @@ seaf_http_server_new (struct _SeafileSession *session)
                                                g_free, token_cache_value_free);
     pthread_mutex_init (&priv->token_cache_lock, NULL);
 
-    priv->perm_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                              g_free, perm_cache_value_free);
-    pthread_mutex_init (&priv->perm_cache_lock, NULL);
-
     priv->vir_repo_info_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                        g_free, free_vir_repo_info);
     pthread_mutex_init (&priv->vir_repo_info_cache_lock, NULL);
@@ -2847,6 +3221,16 @@ seaf_http_server_new (struct _SeafileSession *session)
                                               g_free, free_obj_cal_result);
     pthread_mutex_init (&priv->fs_obj_ids_lock, NULL);
 
+    if (server->io_threads > 0)
+        priv->io_pool = g_thread_pool_new (io_job_worker, NULL,
+                                           server->io_threads, FALSE, NULL);
+
+    priv->repo_heads = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_free);
+    priv->head_watches = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    pthread_mutex_init (&priv->head_watch_lock, NULL);
+
     server->seaf_session = session;
     server->priv = priv;
 
@@ -16,11 +16,17 @@ struct _HttpServerStruct {
     int bind_port; // 绑定端口
     char *http_temp_dir;        /* temp dir for file upload */ // 临时目录
     char *windows_encoding; // ZIP编码
+    gboolean streaming_zip; // 下载目录时边打包边发送，不生成临时文件
+    gboolean zip_store; // ZIP中的文件只存储不压缩
+    int zip_pack_threads; // 打包ZIP时读取、解密、压缩块的线程数
     gint64 fixed_block_size; // 分块大小，默认8MB
+    gboolean use_fastcdc; // 可变长度分块使用FastCDC
     int web_token_expire_time; // 令牌过期时间
     int max_indexing_threads; // 最大索引线程数
     int worker_threads; // 工作线程数
+    int io_threads; // 阻塞I/O线程数
     int max_index_processing_threads; // 最大索引处理线程数
+    int stream_index_threads; // 边上传边索引时写块的线程数，所有上传共用
     int cluster_shared_temp_file_mode; // 集群共享临时文件模式
 };
 
@@ -36,6 +42,12 @@ int
 seaf_http_server_invalidate_tokens (HttpServerStruct *htp_server,
                                     const GList *tokens);
 
+/* Wakes up the clients waiting on /repo/head-commits-watch for @repo_id. */
+void
+seaf_http_server_notify_head_changed (HttpServerStruct *htp_server,
+                                      const char *repo_id,
+                                      const char *commit_id);
+
 void
 send_statistic_msg (const char *repo_id, char *user, char *operation, guint64 bytes);
 
@@ -12,18 +12,64 @@
 #include "seafile-session.h"
 #include "pack-dir.h"
 
-#include <archive.h>
-#include <archive_entry.h>
+#include <pthread.h>
+#include <zlib.h>
 #include <iconv.h>
 
+#include "zip-writer.h"
+
 #ifdef WIN32
 #define S_IFLNK    0120000 /* Symbolic link */
 #define S_ISLNK(x) (((x) & S_IFMT) == S_IFLNK)
 #endif
 
 
+/*
+ * Packing is a pipeline. Every block of every file is a job: a pool of
+ * threads reads, decrypts and compresses blocks of upcoming files in
+ * parallel, while the packing thread writes the finished jobs into the
+ * archive in order. Blocks are deflated independently, each piece ending
+ * on a byte boundary, and the pieces of a file are concatenated into one
+ * deflate stream (the way pigz does it); the CRCs of the pieces are
+ * combined. At most PACK_JOBS_PER_THREAD jobs per thread are in flight,
+ * which bounds the memory used to a few blocks per thread.
+ *
+ * A streamed archive is written at the pace of its client and many may be
+ * downloaded at once, so it uses at most MAX_STREAM_PACK_THREADS threads.
+ */
+
+#define PACK_JOBS_PER_THREAD 2
+#define MAX_STREAM_PACK_THREADS 2
+
+/* A file or empty directory in the archive. */
+typedef struct PackEntry {
+    int ref; // 只在打包线程中修改
+    char *name;
+    gboolean utf8;
+    guint32 mode;
+    guint64 size;
+    int method;
+    gboolean is_dir;
+    gboolean count_progress; // 写完后计入progress->zipped
+} PackEntry;
+
+typedef struct PackJob {
+    PackEntry *entry;
+    char block_id[41]; // 没有块时为空
+    gboolean first; // 条目的第一个任务
+    gboolean last; // 条目的最后一个任务
+
+    /* Results, valid once done is set. */
+    char *out;
+    int out_len;
+    guint32 crc;
+    int size; // 解密后的长度
+    int status;
+    gboolean done;
+} PackJob;
+
 typedef struct {
-    struct archive *a;
+    ZipWriter *zip;
     SeafileCrypt *crypt;
     const char *top_dir_name;
     gboolean is_windows;
@@ -32,6 +78,18 @@ typedef struct {
     int repo_version;
     int tmp_fd;
     char *tmp_zip_file;
+    Progress *progress;
+
+    GThreadPool *pool;
+    GQueue *jobs; // 按在压缩包中的顺序，尚未写入的任务
+    guint max_jobs;
+    pthread_mutex_t lock; // 保护任务的结果
+    pthread_cond_t job_done;
+    gint failed; // 出错后工作线程跳过剩余的任务
+
+    /* The file entry being written */
+    guint32 crc;
+    guint64 written;
 } PackDirData;
 
 static char *
@@ -63,34 +121,266 @@ do_iconv (char *fromcode, char *tocode, char *in)
     return g_strndup(out, outlen);
 }
 
+static PackEntry *
+pack_entry_new (PackDirData *data, const char *pathname, guint32 mode)
+{
+    PackEntry *entry;
+    char *name;
+    gboolean utf8 = TRUE;
+
+    /* File name fixup for WinRAR */
+    if (data->is_windows && seaf->http_server->windows_encoding) {
+        name = do_iconv ("UTF-8", seaf->http_server->windows_encoding,
+                         (char *)pathname);
+        if (!name) {
+            seaf_warning ("Failed to convert file name to %s\n",
+                          seaf->http_server->windows_encoding);
+            return NULL;
+        }
+        utf8 = FALSE;
+    } else {
+        name = g_strdup (pathname);
+    }
+
+    entry = g_new0 (PackEntry, 1);
+    entry->ref = 1;
+    entry->name = name;
+    entry->utf8 = utf8;
+    entry->mode = mode;
+
+    return entry;
+}
+
+static void
+pack_entry_unref (PackEntry *entry)
+{
+    if (--entry->ref > 0)
+        return;
+
+    g_free (entry->name);
+    g_free (entry);
+}
+
+static void
+free_pack_job (PackJob *job)
+{
+    pack_entry_unref (job->entry);
+    g_free (job->out);
+    g_free (job);
+}
+
+/* Compresses one block as a piece of the deflate stream of its file. A
+ * piece ends on a byte boundary (Z_SYNC_FLUSH) so that pieces compressed
+ * apart can be concatenated; the last one ends the stream. */
+static int
+deflate_block (const char *in, int in_len, gboolean last,
+               char **out, int *out_len)
+{
+    z_stream strm;
+    uLong bound;
+    int ret;
+
+    memset (&strm, 0, sizeof(strm));
+    if (deflateInit2 (&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                      -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        seaf_warning ("Failed to init deflate.\n");
+        return -1;
+    }
+
+    /* The sync flush marker takes a few bytes more than the bound. */
+    bound = deflateBound (&strm, in_len) + 16;
+    *out = g_malloc (bound);
+
+    strm.next_in = (Bytef *)in;
+    strm.avail_in = in_len;
+    strm.next_out = (Bytef *)*out;
+    strm.avail_out = bound;
+    ret = deflate (&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((last && ret != Z_STREAM_END) ||
+        (!last && (ret != Z_OK || strm.avail_in != 0 || strm.avail_out == 0))) {
+        seaf_warning ("Failed to deflate block: %d.\n", ret);
+        deflateEnd (&strm);
+        g_free (*out);
+        *out = NULL;
+        return -1;
+    }
+    *out_len = bound - strm.avail_out;
+    deflateEnd (&strm);
+
+    return 0;
+}
+
+static int
+pack_block (PackDirData *data, PackJob *job)
+{
+    char *buf, *dec_out = NULL;
+    int len, dec_out_len;
+    int ret = 0;
+
+    buf = seaf_block_manager_read_whole_block (seaf->block_mgr,
+                                               data->store_id,
+                                               data->repo_version,
+                                               job->block_id, &len);
+    if (!buf) {
+        seaf_warning ("Failed to read block %s:%s\n", data->store_id, job->block_id);
+        return -1;
+    }
+
+    if (data->crypt) {
+        if (seafile_decrypt (&dec_out, &dec_out_len, buf, len, data->crypt) < 0) {
+            seaf_warning ("Decrypt block %s failed.\n", job->block_id);
+            g_free (buf);
+            return -1;
+        }
+        g_free (buf);
+        buf = dec_out;
+        len = dec_out_len;
+    }
+
+    job->size = len;
+    job->crc = crc32 (0L, (const Bytef *)buf, len);
+
+    if (job->entry->method == ZIP_METHOD_STORE) {
+        job->out = buf;
+        job->out_len = len;
+        return 0;
+    }
+
+    ret = deflate_block (buf, len, job->last, &job->out, &job->out_len);
+    g_free (buf);
+
+    return ret;
+}
+
+static void
+pack_block_worker (gpointer vjob, gpointer vdata)
+{
+    PackJob *job = vjob;
+    PackDirData *data = vdata;
+    int ret = -1;
+
+    if (!g_atomic_int_get (&data->failed))
+        ret = pack_block (data, job);
+
+    pthread_mutex_lock (&data->lock);
+    job->status = ret;
+    job->done = TRUE;
+    pthread_cond_broadcast (&data->job_done);
+    pthread_mutex_unlock (&data->lock);
+}
+
+static PackJob *
+next_done_job (PackDirData *data)
+{
+    PackJob *job = g_queue_pop_head (data->jobs);
+
+    pthread_mutex_lock (&data->lock);
+    while (!job->done)
+        pthread_cond_wait (&data->job_done, &data->lock);
+    pthread_mutex_unlock (&data->lock);
+
+    return job;
+}
+
+/* Writes the oldest job into the archive. */
+static int
+write_next_job (PackDirData *data)
+{
+    PackJob *job = next_done_job (data);
+    PackEntry *entry = job->entry;
+    int ret = 0;
+
+    if (job->status < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    if (entry->is_dir) {
+        ret = zip_writer_add_dir (data->zip, entry->name, entry->utf8,
+                                  entry->mode, data->mtime);
+        goto out;
+    }
+
+    if (job->first) {
+        ret = zip_writer_begin_entry (data->zip, entry->name, entry->utf8,
+                                      entry->mode, data->mtime,
+                                      entry->method, entry->size);
+        if (ret < 0)
+            goto out;
+        data->crc = crc32 (0L, Z_NULL, 0);
+        data->written = 0;
+    }
+
+    if (job->out_len > 0) {
+        ret = zip_writer_write (data->zip, job->out, job->out_len);
+        if (ret < 0)
+            goto out;
+    }
+    data->crc = crc32_combine (data->crc, job->crc, job->size);
+    data->written += job->size;
+
+    if (job->last) {
+        ret = zip_writer_end_entry (data->zip, data->crc, data->written);
+        if (ret == 0 && entry->count_progress)
+            g_atomic_int_inc (&data->progress->zipped);
+    }
+
+out:
+    if (ret < 0)
+        g_atomic_int_set (&data->failed, 1);
+    free_pack_job (job);
+    return ret;
+}
+
+/* Waits for the jobs in flight after an error, dropping their results. */
+static void
+drop_jobs (PackDirData *data)
+{
+    g_atomic_int_set (&data->failed, 1);
+    while (!g_queue_is_empty (data->jobs))
+        free_pack_job (next_done_job (data));
+}
+
+/* Queues a job of @entry. Jobs without a block are done already. */
+static int
+queue_job (PackDirData *data, PackEntry *entry, const char *block_id,
+           gboolean first, gboolean last)
+{
+    PackJob *job = g_new0 (PackJob, 1);
+
+    ++entry->ref;
+    job->entry = entry;
+    job->first = first;
+    job->last = last;
+
+    g_queue_push_tail (data->jobs, job);
+    if (block_id) {
+        memcpy (job->block_id, block_id, 40);
+        g_thread_pool_push (data->pool, job, NULL);
+    } else {
+        job->done = TRUE;
+    }
+
+    while (g_queue_get_length (data->jobs) > data->max_jobs) {
+        if (write_next_job (data) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 static int
 add_file_to_archive (PackDirData *data,
                      const char *parent_dir,
                      SeafDirent *dent)
 {
-    struct archive *a = data->a;
-    struct SeafileCrypt *crypt = data->crypt;
-    gboolean is_windows = data->is_windows;
-    const char *top_dir_name = data->top_dir_name;
-    
-    struct archive_entry *entry = NULL;
     Seafile *file = NULL;
+    PackEntry *entry = NULL;
     char *pathname = NULL;
-    char buf[64 * 1024];
-    int len = 0;
-    int n = 0;
-    int idx = 0;
-    BlockHandle *handle = NULL;
-    BlockMetadata *bmd = NULL;
-    char *blk_id = NULL;
-    uint32_t remain = 0;
-    EVP_CIPHER_CTX *ctx;
-    gboolean enc_init = FALSE;
-    char *dec_out = NULL;
-    int dec_out_len = -1;
+    int i;
     int ret = 0;
 
-    pathname = g_build_filename (top_dir_name, parent_dir, dent->name, NULL);
+    pathname = g_build_filename (data->top_dir_name, parent_dir, dent->name, NULL);
 
     file = seaf_fs_manager_get_seafile (seaf->fs_mgr,
                                         data->store_id, data->repo_version,
@@ -100,170 +390,37 @@ add_file_to_archive (PackDirData *data,
         goto out;
     }
 
-    entry = archive_entry_new ();
-
-    /* File name fixup for WinRAR */
-    if (is_windows && seaf->http_server->windows_encoding) {
-        char *win_file_name = do_iconv ("UTF-8",
-                                        seaf->http_server->windows_encoding,
-                                        pathname);
-        if (!win_file_name) {
-            seaf_warning ("Failed to convert file name to %s\n",
-                          seaf->http_server->windows_encoding);
-            ret = -1;
-            goto out;
-        }
-        archive_entry_copy_pathname (entry, win_file_name);
-        g_free (win_file_name);
-
-    } else {
-        archive_entry_set_pathname (entry, pathname);
-    }
-
     /* FIXME: 0644 should be set when upload files in repo-mgr.c */
-    archive_entry_set_mode (entry, dent->mode | 0644);
-    archive_entry_set_size (entry, file->file_size);
-    archive_entry_set_mtime (entry, data->mtime, 0);
-
-    n = archive_write_header (a, entry);
-    if (n != ARCHIVE_OK) {
-        seaf_warning ("archive_write_header  error: %s\n", archive_error_string(a));
+    entry = pack_entry_new (data, pathname, dent->mode | 0644);
+    if (!entry) {
         ret = -1;
         goto out;
     }
+    entry->size = file->file_size;
+    entry->count_progress = S_ISREG(dent->mode);
+    if (seaf->http_server->zip_store || file->n_blocks == 0)
+        entry->method = ZIP_METHOD_STORE;
+    else
+        entry->method = ZIP_METHOD_DEFLATE;
+
+    if (file->n_blocks == 0) {
+        ret = queue_job (data, entry, NULL, TRUE, TRUE);
+        goto out;
+    }
 
-    /* Read data of this entry block by block */
-    while (idx < file->n_blocks) {
-        blk_id = file->blk_sha1s[idx];
-        handle = seaf_block_manager_open_block (seaf->block_mgr,
-                                                data->store_id,
-                                                data->repo_version,
-                                                blk_id, BLOCK_READ);
-        if (!handle) {
-            seaf_warning ("Failed to open block %s:%s\n", data->store_id, blk_id);
-            ret = -1;
-            goto out;
-        }
-
-        bmd = seaf_block_manager_stat_block_by_handle (seaf->block_mgr,
-                                                       handle);
-        if (!bmd) {
-            seaf_warning ("Failed to stat block %s:%s\n", data->store_id, blk_id);
-            ret = -1;
-            goto out;
-        }
-        remain = bmd->size;
-        g_free (bmd);
-
-        if (crypt) {
-            if (seafile_decrypt_init (&ctx, crypt->version,
-                                      crypt->key, crypt->iv) < 0) {
-                seaf_warning ("Failed to init decrypt.\n");
-                ret = -1;
-                goto out;
-            }
-            enc_init = TRUE;
-        }
-
-        while (remain != 0) {
-            n = seaf_block_manager_read_block (seaf->block_mgr, handle,
-                                               buf, sizeof(buf));
-            if (n <= 0) {
-                seaf_warning ("failed to read block %s\n", blk_id);
-                ret = -1;
-                goto out;
-            }
-            remain -= n;
-
-            /* OK, We're read some data of this block  */
-            if (crypt == NULL) {
-                /* not encrypted */
-                len = archive_write_data (a, buf, n);
-                if (len <= 0) {
-                    seaf_warning ("archive_write_data error: %s\n", archive_error_string(a));
-                    ret = -1;
-                    goto out;
-                }
-
-            } else {
-                /* an encrypted block */
-                dec_out = g_new (char, n + 16);
-                if (!dec_out) {
-                    seaf_warning ("Failed to alloc memory.\n");
-                    ret = -1;
-                    goto out;
-                }
-
-                int r = EVP_DecryptUpdate (ctx,
-                                           (unsigned char *)dec_out,
-                                           &dec_out_len,
-                                           (unsigned char *)buf,
-                                           n);
-
-                /* EVP_DecryptUpdate returns 1 on success, 0 on failure */
-                if (r != 1) {
-                    seaf_warning ("Decrypt block %s failed.\n", blk_id);
-                    ret = -1;
-                    goto out;
-                }
-
-                if (dec_out_len > 0) {
-                    len = archive_write_data (a, dec_out, dec_out_len);
-                    if (len <= 0) {
-                        seaf_warning ("archive_write_data error: %s\n", archive_error_string(a));
-                        ret = -1;
-                        goto out;
-                    }
-                }
-
-                /* If it's the last piece of a block, call decrypt_final()
-                 * to decrypt the possible partial block. */
-                if (remain == 0) {
-                    r = EVP_DecryptFinal_ex (ctx,
-                                             (unsigned char *)dec_out,
-                                             &dec_out_len);
-                    if (r != 1) {
-                        seaf_warning ("Decrypt block %s failed.\n", blk_id);
-                        ret = -1;
-                        goto out;
-                    }
-
-                    if (dec_out_len != 0) {
-                        len = archive_write_data (a, dec_out, dec_out_len);
-                        if (len <= 0) {
-                            seaf_warning ("archive_write_data error: %s\n", archive_error_string(a));
-                            ret = -1;
-                            goto out;
-                        }
-                    }
-                }
-
-                g_free (dec_out);
-                dec_out = NULL;
-            }
-        }
-
-        seaf_block_manager_close_block (seaf->block_mgr, handle);
-        seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
-        handle = NULL;
-
-        /* turn to next block */
-        idx++;
+    for (i = 0; i < file->n_blocks; ++i) {
+        ret = queue_job (data, entry, file->blk_sha1s[i],
+                         i == 0, i == file->n_blocks - 1);
+        if (ret < 0)
+            break;
     }
 
 out:
     g_free (pathname);
     if (entry)
-        archive_entry_free (entry);
+        pack_entry_unref (entry);
     if (file)
         seafile_unref (file);
-    if (handle) {
-        seaf_block_manager_close_block (seaf->block_mgr, handle);
-        seaf_block_manager_block_handle_free(seaf->block_mgr, handle);
-    }
-    if (crypt != NULL && enc_init)
-        EVP_CIPHER_CTX_free (ctx);
-    g_free (dec_out);
 
     return ret;
 }
@@ -276,6 +433,7 @@ archive_dir (PackDirData *data,
 {
     SeafDir *dir = NULL;
     SeafDirent *dent;
+    PackEntry *entry;
     GList *ptr;
     char *subpath = NULL;
     int ret = 0;
@@ -289,37 +447,16 @@ archive_dir (PackDirData *data,
     }
     if (!dir->entries) {
         char *pathname = g_build_filename (data->top_dir_name, dirpath, NULL);
-        struct archive_entry *entry = archive_entry_new ();
-        gboolean is_windows = data->is_windows;
-
-        if (is_windows && seaf->http_server->windows_encoding) {
-            char *win_file_name = do_iconv ("UTF-8",
-                    seaf->http_server->windows_encoding,
-                    pathname);
-            if (!win_file_name) {
-                seaf_warning ("Failed to convert file name to %s\n",
-                              seaf->http_server->windows_encoding);
-                ret = -1;
-                goto out;
-            }
-            archive_entry_copy_pathname (entry, win_file_name);
-            g_free (win_file_name);
-
-        } else {
-            archive_entry_set_pathname (entry, pathname);
-        }
 
-        archive_entry_set_filetype (entry, AE_IFDIR);
-        archive_entry_set_mtime (entry, data->mtime, 0);
-        archive_entry_set_perm (entry, 0755);
-        int n = archive_write_header (data->a, entry);
-        if (n != ARCHIVE_OK) {
-            seaf_warning ("archive_write_header  error: %s\n", archive_error_string(data->a));
+        entry = pack_entry_new (data, pathname, S_IFDIR | 0755);
+        g_free (pathname);
+        if (!entry) {
             ret = -1;
+            goto out;
         }
-
-        archive_entry_free (entry);
-        g_free (pathname);
+        entry->is_dir = TRUE;
+        ret = queue_job (data, entry, NULL, TRUE, TRUE);
+        pack_entry_unref (entry);
         goto out;
     }
 
@@ -330,18 +467,8 @@ archive_dir (PackDirData *data,
         }
 
         dent = ptr->data;
-        if (S_ISREG(dent->mode)) {
+        if (S_ISREG(dent->mode) || S_ISLNK(dent->mode)) {
             ret = add_file_to_archive (data, dirpath, dent);
-            if (ret == 0) {
-                g_atomic_int_inc (&progress->zipped);
-            }
-        } else if (S_ISLNK(dent->mode)) {
-            if (archive_version_number() >= 3000001) {
-                /* Symlink in zip arhive is not supported in earlier version
-                 * of libarchive */
-                ret = add_file_to_archive (data, dirpath, dent);
-            }
-
         } else if (S_ISDIR(dent->mode)) {
             subpath = g_build_filename (dirpath, dent->name, NULL);
             ret = archive_dir (data, dent->id, subpath, progress);
@@ -360,46 +487,77 @@ out:
     return ret;
 }
 
+/* Writes to @fd if it's not negative, otherwise to a new temp file. */
 static PackDirData *
 pack_dir_data_new (const char *store_id,
                    int repo_version,
                    const char *dirname,
                    SeafileCrypt *crypt,
-                   gboolean is_windows)
+                   gboolean is_windows,
+                   int fd,
+                   Progress *progress)
 {
-    struct archive *a = NULL;
     char *tmpfile_name = NULL ;
-    int fd = -1;
     PackDirData *data = NULL;
+    int n_threads = seaf->http_server->zip_pack_threads;
 
-    tmpfile_name = g_strdup_printf ("%s/seafile-XXXXXX.zip",
-                                    seaf->http_server->http_temp_dir);
-    fd = g_mkstemp (tmpfile_name);
     if (fd < 0) {
-        seaf_warning ("Failed to open temp file: %s.\n", strerror (errno));
-        g_free (tmpfile_name);
-        return NULL;
+        tmpfile_name = g_strdup_printf ("%s/seafile-XXXXXX.zip",
+                                        seaf->http_server->http_temp_dir);
+        fd = g_mkstemp (tmpfile_name);
+        if (fd < 0) {
+            seaf_warning ("Failed to open temp file: %s.\n", strerror (errno));
+            g_free (tmpfile_name);
+            return NULL;
+        }
     }
 
-    a = archive_write_new ();
-    archive_write_set_compression_none (a);
-    archive_write_set_format_zip (a);
-    archive_write_open_fd (a, fd);
+    if (tmpfile_name == NULL)
+        n_threads = MIN (n_threads, MAX_STREAM_PACK_THREADS);
 
     data = g_new0 (PackDirData, 1);
+    data->pool = g_thread_pool_new (pack_block_worker, data, n_threads, FALSE, NULL);
+    if (!data->pool) {
+        seaf_warning ("Failed to create pack thread pool.\n");
+        if (tmpfile_name) {
+            close (fd);
+            g_unlink (tmpfile_name);
+            g_free (tmpfile_name);
+        }
+        g_free (data);
+        return NULL;
+    }
+    data->jobs = g_queue_new ();
+    data->max_jobs = n_threads * PACK_JOBS_PER_THREAD;
+    pthread_mutex_init (&data->lock, NULL);
+    pthread_cond_init (&data->job_done, NULL);
+
+    data->zip = zip_writer_new (fd);
     data->crypt = crypt;
     data->is_windows = is_windows;
-    data->a = a;
     data->top_dir_name = dirname;
     data->mtime = time(NULL);
     memcpy (data->store_id, store_id, 36);
     data->repo_version = repo_version;
-    data->tmp_fd = fd;
+    data->tmp_fd = tmpfile_name ? fd : -1;
     data->tmp_zip_file = tmpfile_name;
+    data->progress = progress;
 
     return data;
 }
 
+/* All jobs must be written or dropped. */
+static void
+pack_dir_data_free (PackDirData *data)
+{
+    g_thread_pool_free (data->pool, FALSE, TRUE);
+    g_queue_free (data->jobs);
+    pthread_mutex_destroy (&data->lock);
+    pthread_cond_destroy (&data->job_done);
+    zip_writer_free (data->zip);
+    g_free (data);
+}
+
 static int
 archive_multi (PackDirData *data, GList *dirent_list,
                Progress *progress)
@@ -416,7 +574,6 @@ archive_multi (PackDirData *data, GList *dirent_list,
                 seaf_warning ("Failed to archive file: %s.\n", dirent->name);
                 return -1;
             }
-            g_atomic_int_inc (&progress->zipped);
         } else if (S_ISDIR(dirent->mode)) {
             if (archive_dir (data, dirent->id, dirent->name, progress) < 0) {
                 seaf_warning ("Failed to archive dir: %s.\n", dirent->name);
@@ -428,27 +585,14 @@ archive_multi (PackDirData *data, GList *dirent_list,
     return 0;
 }
 
-int
-pack_files (const char *store_id,
-            int repo_version,
-            const char *dirname,
-            void *internal,
-            SeafileCrypt *crypt,
-            gboolean is_windows,
-            Progress *progress)
+static int
+do_pack_files (PackDirData *data,
+               const char *store_id,
+               const char *dirname,
+               void *internal,
+               Progress *progress)
 {
     int ret = 0;
-    PackDirData *data = NULL;
-
-    data = pack_dir_data_new (store_id, repo_version, dirname,
-                              crypt, is_windows);
-    if (!data) {
-        seaf_warning ("Failed to create pack dir data for %s.\n",
-                      strcmp (dirname, "")==0 ? "multi files" : dirname);
-        return -1;
-    }
-
-    progress->zip_file_path = data->tmp_zip_file;
 
     if (strcmp (dirname, "") != 0) {
         // Pack dir
@@ -470,14 +614,78 @@ pack_files (const char *store_id,
         }
     }
 
-    if (archive_write_finish(data->a) < 0) {
+    while (ret == 0 && !g_queue_is_empty (data->jobs)) {
+        if (write_next_job (data) < 0)
+            ret = -1;
+    }
+    if (ret < 0) {
+        drop_jobs (data);
+        return -1;
+    }
+
+    if (zip_writer_finish (data->zip) < 0) {
         seaf_warning ("Failed to archive write finish for %s in repo %.8s.\n",
                       strcmp (dirname, "")==0 ? "multi files" : dirname, store_id);
         ret = -1;
     }
 
+    return ret;
+}
+
+int
+pack_files (const char *store_id,
+            int repo_version,
+            const char *dirname,
+            void *internal,
+            SeafileCrypt *crypt,
+            gboolean is_windows,
+            Progress *progress)
+{
+    int ret = 0;
+    PackDirData *data = NULL;
+
+    data = pack_dir_data_new (store_id, repo_version, dirname,
+                              crypt, is_windows, -1, progress);
+    if (!data) {
+        seaf_warning ("Failed to create pack dir data for %s.\n",
+                      strcmp (dirname, "")==0 ? "multi files" : dirname);
+        return -1;
+    }
+
+    progress->zip_file_path = data->tmp_zip_file;
+
+    ret = do_pack_files (data, store_id, dirname, internal, progress);
+
     close (data->tmp_fd);
-    free (data);
+    pack_dir_data_free (data);
+
+    return ret;
+}
+
+int
+pack_files_to_fd (const char *store_id,
+                  int repo_version,
+                  const char *dirname,
+                  void *internal,
+                  SeafileCrypt *crypt,
+                  gboolean is_windows,
+                  int fd,
+                  Progress *progress)
+{
+    int ret = 0;
+    PackDirData *data = NULL;
+
+    data = pack_dir_data_new (store_id, repo_version, dirname,
+                              crypt, is_windows, fd, progress);
+    if (!data) {
+        seaf_warning ("Failed to create pack dir data for %s.\n",
+                      strcmp (dirname, "")==0 ? "multi files" : dirname);
+        return -1;
+    }
+
+    ret = do_pack_files (data, store_id, dirname, internal, progress);
+
+    pack_dir_data_free (data);
 
     return ret;
 }
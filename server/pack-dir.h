@@ -11,6 +11,9 @@ typedef struct Progress {
     char *zip_file_path;
     gint64 expire_ts;
     gboolean canceled;
+    /* Streaming mode: 1 once the whole archive is written, -1 on error. */
+    gint stream_status;
+    gint ref;
 } Progress;
 
 int
@@ -22,4 +25,16 @@ pack_files (const char *store_id,
             gboolean is_windows,
             Progress *progress);
 
+/* Packs to @fd, usually a pipe the archive is downloaded from while it's
+ * generated. @fd is not closed. */
+int
+pack_files_to_fd (const char *store_id,
+                  int repo_version,
+                  const char *dirname,
+                  void *internal,
+                  SeafileCrypt *crypt,
+                  gboolean is_windows,
+                  int fd,
+                  Progress *progress);
+
 #endif
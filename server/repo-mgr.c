@@ -359,6 +359,11 @@ seaf_repo_manager_init (SeafRepoManager *mgr)
 int
 seaf_repo_manager_start (SeafRepoManager *mgr)
 {
+    if (seaf_repo_manager_init_perm_index (mgr) < 0) {
+        seaf_warning ("Failed to init permission index.\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -624,6 +629,9 @@ del_repo:
                              "WHERE repo_id=? OR origin_repo=?",
                              2, "string", repo_id, "string", repo_id);
 
+    seaf_repo_manager_perm_index_reload_vrepos (mgr, repo_id);
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+
     if (!head_commit)
         add_deleted_repo_record(mgr, repo_id);
 
@@ -639,9 +647,12 @@ seaf_repo_manager_del_virtual_repo (SeafRepoManager *mgr,
     if (ret < 0)
         return ret;
 
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "DELETE FROM VirtualRepo WHERE repo_id = ?",
-                                    1, "string", repo_id);
+    ret = seaf_db_statement_query (mgr->seaf->db,
+                                   "DELETE FROM VirtualRepo WHERE repo_id = ?",
+                                   1, "string", repo_id);
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+
+    return ret;
 }
 
 static gboolean
@@ -1077,6 +1088,12 @@ create_tables_mysql (SeafRepoManager *mgr)
     if (seaf_db_query (db, sql) < 0)
         return -1;
 
+    sql = "CREATE TABLE IF NOT EXISTS PermChange ("
+        "id BIGINT NOT NULL PRIMARY KEY AUTO_INCREMENT, repo_id CHAR(37) NOT NULL, "
+        "change_time BIGINT, INDEX(change_time)) ENGINE=INNODB";
+    if (seaf_db_query (db, sql) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -1230,6 +1247,15 @@ create_tables_sqlite (SeafRepoManager *mgr)
     if (seaf_db_query (db, sql) < 0)
         return -1;
 
+    sql = "CREATE TABLE IF NOT EXISTS PermChange (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "repo_id CHAR(37) NOT NULL, change_time BIGINT)";
+    if (seaf_db_query (db, sql) < 0)
+        return -1;
+
+    sql = "CREATE INDEX IF NOT EXISTS PermChangeTimeIndex ON PermChange (change_time)";
+    if (seaf_db_query (db, sql) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -2136,7 +2162,11 @@ seaf_repo_manager_set_repo_owner (SeafRepoManager *mgr,
                              "WHERE repo_id=? OR origin_repo=?",
                              2, "string", repo_id, "string", repo_id);
 
+    seaf_repo_manager_perm_index_reload_vrepos (mgr, repo_id);
+
 out:
+    if (ret == 0)
+        seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
     g_free (orig_owner);
     return ret;
 }
@@ -2900,6 +2930,9 @@ seaf_repo_manager_restore_repo_from_trash (SeafRepoManager *mgr,
 
     seaf_db_trans_close (trans);
 
+    if (ret == 0)
+        seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+
 out:
     g_object_unref (repo);
     return ret;
@@ -2975,6 +3008,7 @@ seaf_repo_manager_add_group_repo (SeafRepoManager *mgr,
                                  "string", owner, "string", permission) < 0)
         return -1;
 
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
     return 0;
 }
 
@@ -2984,10 +3018,13 @@ seaf_repo_manager_del_group_repo (SeafRepoManager *mgr,
                                   int group_id,
                                   GError **error)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "DELETE FROM RepoGroup WHERE group_id=? "
-                                    "AND repo_id=?",
-                                    2, "int", group_id, "string", repo_id);
+    int ret = seaf_db_statement_query (mgr->seaf->db,
+                                       "DELETE FROM RepoGroup WHERE group_id=? "
+                                       "AND repo_id=?",
+                                       2, "int", group_id, "string", repo_id);
+
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+    return ret;
 }
 
 static gboolean
@@ -3064,11 +3101,14 @@ seaf_repo_manager_set_group_repo_perm (SeafRepoManager *mgr,
                                        const char *permission,
                                        GError **error)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "UPDATE RepoGroup SET permission=? WHERE "
-                                    "repo_id=? AND group_id=?",
-                                    3, "string", permission, "string", repo_id,
-                                    "int", group_id);
+    int ret = seaf_db_statement_query (mgr->seaf->db,
+                                       "UPDATE RepoGroup SET permission=? WHERE "
+                                       "repo_id=? AND group_id=?",
+                                       3, "string", permission, "string", repo_id,
+                                       "int", group_id);
+
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+    return ret;
 }
 
 int
@@ -3079,15 +3119,18 @@ seaf_repo_manager_set_subdir_group_perm_by_path (SeafRepoManager *mgr,
                                                  const char *permission,
                                                  const char *path)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "UPDATE RepoGroup SET permission=? WHERE repo_id IN "
-                                    "(SELECT repo_id FROM VirtualRepo WHERE origin_repo=? AND path=?) "
-                                    "AND group_id=? AND user_name=?",
-                                    5, "string", permission,
-                                    "string", repo_id,
-                                    "string", path,
-                                    "int", group_id,
-                                    "string", username);
+    int ret = seaf_db_statement_query (mgr->seaf->db,
+                                       "UPDATE RepoGroup SET permission=? WHERE repo_id IN "
+                                       "(SELECT repo_id FROM VirtualRepo WHERE origin_repo=? AND path=?) "
+                                       "AND group_id=? AND user_name=?",
+                                       5, "string", permission,
+                                       "string", repo_id,
+                                       "string", path,
+                                       "int", group_id,
+                                       "string", username);
+
+    seaf_repo_manager_perm_index_reload_vrepos (mgr, repo_id);
+    return ret;
 }
 static gboolean
 get_group_repoids_cb (SeafDBRow *row, void *data)
@@ -3360,6 +3403,7 @@ seaf_repo_manager_remove_group_repos (SeafRepoManager *mgr,
                                       2, "int", group_id, "string", owner);
     }
 
+    seaf_repo_manager_perm_index_reload_group (mgr, group_id);
     return rc;
 }
 
@@ -3372,6 +3416,7 @@ seaf_repo_manager_set_inner_pub_repo (SeafRepoManager *mgr,
 {
     SeafDB *db = mgr->seaf->db;
     char sql[256];
+    int ret;
 
     if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL) {
         gboolean err;
@@ -3388,23 +3433,27 @@ seaf_repo_manager_set_inner_pub_repo (SeafRepoManager *mgr,
                      "('%s', '%s')", repo_id, permission);
         if (err)
             return -1;
-        return seaf_db_query (db, sql);
+        ret = seaf_db_query (db, sql);
     } else {
-        return seaf_db_statement_query (db,
-                                        "REPLACE INTO InnerPubRepo (repo_id, permission) VALUES (?, ?)",
-                                        2, "string", repo_id, "string", permission);
+        ret = seaf_db_statement_query (db,
+                                       "REPLACE INTO InnerPubRepo (repo_id, permission) VALUES (?, ?)",
+                                       2, "string", repo_id, "string", permission);
     }
 
-    return -1;
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+    return ret;
 }
 
 int
 seaf_repo_manager_unset_inner_pub_repo (SeafRepoManager *mgr,
                                         const char *repo_id)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "DELETE FROM InnerPubRepo WHERE repo_id = ?",
-                                    1, "string", repo_id);
+    int ret = seaf_db_statement_query (mgr->seaf->db,
+                                       "DELETE FROM InnerPubRepo WHERE repo_id = ?",
+                                       1, "string", repo_id);
+
+    seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
+    return ret;
 }
 
 gboolean
@@ -329,6 +329,24 @@ seaf_repo_manager_post_multi_files (SeafRepoManager *mgr,
                                     char **task_id,
                                     GError **error);
 
+/**
+ * Add files whose blocks and seafile objects have already been written,
+ * e.g. by a stream indexer while they were uploaded.
+ * @id_list:   file ids in the same order as @filenames
+ * @size_list: pointers to gint64 file sizes
+ */
+int
+seaf_repo_manager_post_indexed_files (SeafRepoManager *mgr,
+                                      const char *repo_id,
+                                      const char *parent_dir,
+                                      GList *filenames,
+                                      GList *id_list,
+                                      GList *size_list,
+                                      const char *user,
+                                      int replace_existed,
+                                      char **ret_json,
+                                      GError **error);
+
 /* int */
 /* seaf_repo_manager_post_file_blocks (SeafRepoManager *mgr, */
 /*                                     const char *repo_id, */
@@ -714,6 +732,37 @@ seaf_repo_manager_check_permission (SeafRepoManager *mgr,
                                     const char *user,
                                     GError **error);
 
+/*
+ * In-memory index of the permissions checked above, see repo-perm.c.
+ * Code that changes owners, shares, inner public repos, virtual repos or
+ * group memberships in the db reloads the affected entries afterwards,
+ * which also makes other servers sharing the db reload them.
+ */
+int
+seaf_repo_manager_init_perm_index (SeafRepoManager *mgr);
+
+int
+seaf_repo_manager_rebuild_perm_index (SeafRepoManager *mgr);
+
+void
+seaf_repo_manager_perm_index_reload_repo (SeafRepoManager *mgr,
+                                          const char *repo_id);
+
+/* Reloads the virtual repos of @origin_repo_id, i.e. its shared folders. */
+void
+seaf_repo_manager_perm_index_reload_vrepos (SeafRepoManager *mgr,
+                                            const char *origin_repo_id);
+
+/* Reloads the repos shared to @group_id. */
+void
+seaf_repo_manager_perm_index_reload_group (SeafRepoManager *mgr, int group_id);
+
+/* Repos @user can sync, with their head commits, as the json array returned
+ * by the accessible-repos api of the http server. Returns NULL on db errors.
+ */
+json_t *
+seaf_repo_manager_get_accessible_repos (SeafRepoManager *mgr, const char *user);
+
 GList *
 seaf_repo_manager_list_dir_with_perm (SeafRepoManager *mgr,
                                       const char *repo_id,
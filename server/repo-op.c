@@ -990,6 +990,32 @@ format_json_ret (GList *name_list, GList *id_list, GList *size_list)
     return ret;
 }
 
+static int
+check_post_files_input (GList *filenames, const char *parent_dir, GError **error)
+{
+    GList *ptr;
+    char *filename;
+
+    for (ptr = filenames; ptr; ptr = ptr->next) {
+        filename = ptr->data;
+        if (should_ignore_file (filename, NULL)) {
+            seaf_debug ("[post files] Invalid filename %s.\n", filename);
+            g_set_error (error, SEAFILE_DOMAIN, POST_FILE_ERR_FILENAME,
+                         "%s", filename);
+            return -1;
+        }
+    }
+
+    if (strstr (parent_dir, "//") != NULL) {
+        seaf_debug ("[post file] parent_dir cantains // sequence.\n");
+        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_BAD_ARGS,
+                     "Invalid parent dir");
+        return -1;
+    }
+
+    return 0;
+}
+
 int
 seaf_repo_manager_post_multi_files (SeafRepoManager *mgr,
                                     const char *repo_id,
@@ -1005,7 +1031,7 @@ seaf_repo_manager_post_multi_files (SeafRepoManager *mgr,
     SeafRepo *repo = NULL;
     char *canon_path = NULL;
     GList *filenames = NULL, *paths = NULL, *id_list = NULL, *size_list = NULL, *ptr;
-    char *filename, *path;
+    char *path;
     unsigned char sha1[20];
     SeafileCrypt *crypt = NULL;
     char hex[41];
@@ -1026,21 +1052,7 @@ seaf_repo_manager_post_multi_files (SeafRepoManager *mgr,
     }
 
     /* Check inputs. */
-    for (ptr = filenames; ptr; ptr = ptr->next) {
-        filename = ptr->data;
-        if (should_ignore_file (filename, NULL)) {
-            seaf_debug ("[post files] Invalid filename %s.\n", filename);
-            g_set_error (error, SEAFILE_DOMAIN, POST_FILE_ERR_FILENAME,
-                         "%s", filename);
-            ret = -1;
-            goto out;
-        }
-    }
-
-    if (strstr (parent_dir, "//") != NULL) {
-        seaf_debug ("[post file] parent_dir cantains // sequence.\n");
-        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_BAD_ARGS,
-                     "Invalid parent dir");
+    if (check_post_files_input (filenames, parent_dir, error) < 0) {
         ret = -1;
         goto out;
     }
@@ -1120,6 +1132,49 @@ out:
     return ret;
 }
 
+int
+seaf_repo_manager_post_indexed_files (SeafRepoManager *mgr,
+                                      const char *repo_id,
+                                      const char *parent_dir,
+                                      GList *filenames,
+                                      GList *id_list,
+                                      GList *size_list,
+                                      const char *user,
+                                      int replace_existed,
+                                      char **ret_json,
+                                      GError **error)
+{
+    SeafRepo *repo = NULL;
+    char *canon_path = NULL;
+    int ret = 0;
+
+    GET_REPO_OR_FAIL(repo, repo_id);
+
+    canon_path = get_canonical_path (parent_dir);
+
+    if (check_post_files_input (filenames, parent_dir, error) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    ret = post_files_and_gen_commit (filenames,
+                                     repo,
+                                     user,
+                                     ret_json,
+                                     replace_existed,
+                                     canon_path,
+                                     id_list,
+                                     size_list,
+                                     error);
+
+out:
+    if (repo)
+        seaf_repo_unref (repo);
+    g_free (canon_path);
+
+    return ret;
+}
+
 int
 post_files_and_gen_commit (GList *filenames,
                            SeafRepo *repo,
@@ -211,16 +211,10 @@ check_virtual_repo_permission (SeafRepoManager *mgr,
     return permission;
 }
 
-/*
- * Comprehensive repo access permission checker.
- *
- * Returns read/write permission.
- */
-char *
-seaf_repo_manager_check_permission (SeafRepoManager *mgr,
-                                    const char *repo_id,
-                                    const char *user,
-                                    GError **error)
+static char *
+check_permission_in_db (SeafRepoManager *mgr,
+                        const char *repo_id,
+                        const char *user)
 {
     SeafVirtRepo *vinfo;
     char *owner = NULL;
@@ -249,6 +243,1275 @@ out:
     return permission;
 }
 
+/*
+ * Effective permission index.
+ *
+ * Everything the checks above read from the db -- owners, user and group
+ * shares, inner public repos and virtual repos -- is kept in memory, keyed
+ * by repo, so a check is a few hash lookups. The groups of a user, with
+ * their ancestors, come from the in-memory group graph of the group manager.
+ *
+ * Code that changes these tables reloads the affected repos afterwards,
+ * see seaf_repo_manager_perm_index_reload_repo() and friends. A repo whose
+ * reload failed is checked on the db until the next rebuild, and the whole
+ * index is rebuilt periodically.
+ *
+ * Servers sharing the db (a cluster) see each other's changes through the
+ * PermChange table: a reload caused by a change appends the repo id there,
+ * and before the index is used, the rows added by anyone since the last
+ * look are read, at most every PERM_SYNC_INTERVAL ms, and their repos are
+ * reloaded. While the table can't be read, permissions are checked on the
+ * db. Tables changed directly in the db, bypassing seaf-server, are only
+ * picked up by the next rebuild, and group memberships by the next reload
+ * of the group manager.
+ */
+
+#define DEFAULT_PERM_INDEX_REBUILD_INTERVAL 3600 /* 1 hour */
+#define PERM_SYNC_INTERVAL 1000 /* ms */
+#define PERM_CHANGE_TTL (24 * 3600) /* 1 day */
+
+typedef struct PermIndexRepo {
+    char *owner;
+    GHashTable *user_perms;     /* to_email -> permission */
+    GHashTable *group_perms;    /* group_id -> permission */
+    const char *inner_pub_perm;
+    char *origin_repo_id;       /* Set for virtual repos. */
+    char *path;
+    GHashTable *vrepos;         /* Virtual repos created from this repo. */
+} PermIndexRepo;
+
+typedef struct PermIndex {
+    pthread_rwlock_t lock;
+    gboolean ready;
+    GHashTable *repos;          /* repo_id -> PermIndexRepo */
+    GHashTable *stale;          /* Repos checked on the db. */
+    gboolean rebuilding;
+    GHashTable *dirty;          /* Repos reloaded during a rebuild. */
+    pthread_mutex_t rebuild_lock;
+
+    int rebuild_interval;
+
+    pthread_mutex_t sync_lock;
+    gint64 last_change_id;      /* Last PermChange row read. */
+    gint64 next_sync;           /* Monotonic time of the next read. */
+    gboolean sync_failed;       /* The index can't be trusted. */
+} PermIndex;
+
+static PermIndex *perm_index = NULL;
+
+static void invalidate_accessible_repos (const char *user);
+static void invalidate_repo_users (PermIndexRepo *old, PermIndexRepo *new);
+
+static void
+perm_index_repo_free (PermIndexRepo *r)
+{
+    g_free (r->owner);
+    if (r->user_perms)
+        g_hash_table_destroy (r->user_perms);
+    if (r->group_perms)
+        g_hash_table_destroy (r->group_perms);
+    g_free (r->origin_repo_id);
+    g_free (r->path);
+    if (r->vrepos)
+        g_hash_table_destroy (r->vrepos);
+    g_free (r);
+}
+
+static GHashTable *
+perm_index_repos_new ()
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)perm_index_repo_free);
+}
+
+static gboolean
+perm_index_repo_is_empty (PermIndexRepo *r)
+{
+    return !r->owner && !r->user_perms && !r->group_perms && !r->inner_pub_perm &&
+        !r->origin_repo_id && (!r->vrepos || g_hash_table_size (r->vrepos) == 0);
+}
+
+static PermIndexRepo *
+get_repo_entry (GHashTable *repos, const char *repo_id)
+{
+    PermIndexRepo *r = g_hash_table_lookup (repos, repo_id);
+
+    if (!r) {
+        r = g_new0 (PermIndexRepo, 1);
+        g_hash_table_insert (repos, g_strdup (repo_id), r);
+    }
+    return r;
+}
+
+/* "rw" is preferred over "r", which is preferred over other permissions. */
+static const char *
+better_perm (const char *perm1, const char *perm2)
+{
+    if (!perm1)
+        return perm2;
+    if (!perm2 || strcmp (perm1, "rw") == 0)
+        return perm1;
+    if (strcmp (perm2, "rw") == 0 || strcmp (perm2, "r") == 0)
+        return perm2;
+    return perm1;
+}
+
+static gboolean
+load_owner_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *repos = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *owner = seaf_db_row_get_column_text (row, 1);
+    PermIndexRepo *r;
+
+    if (!repo_id || !owner)
+        return TRUE;
+
+    r = get_repo_entry (repos, repo_id);
+    g_free (r->owner);
+    r->owner = g_ascii_strdown (owner, -1);
+    return TRUE;
+}
+
+static gboolean
+load_user_share_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *repos = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *to_email = seaf_db_row_get_column_text (row, 1);
+    const char *perm = seaf_db_row_get_column_text (row, 2);
+    PermIndexRepo *r;
+
+    if (!repo_id || !to_email || !perm)
+        return TRUE;
+
+    r = get_repo_entry (repos, repo_id);
+    if (!r->user_perms)
+        r->user_perms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    if (!g_hash_table_lookup (r->user_perms, to_email))
+        g_hash_table_insert (r->user_perms, g_strdup (to_email),
+                             (gpointer)g_intern_string (perm));
+    return TRUE;
+}
+
+static gboolean
+load_group_share_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *repos = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    int group_id = seaf_db_row_get_column_int (row, 1);
+    const char *perm = seaf_db_row_get_column_text (row, 2);
+    gpointer key = GINT_TO_POINTER (group_id);
+    PermIndexRepo *r;
+
+    if (!repo_id || !perm)
+        return TRUE;
+
+    r = get_repo_entry (repos, repo_id);
+    if (!r->group_perms)
+        r->group_perms = g_hash_table_new (g_direct_hash, g_direct_equal);
+    g_hash_table_insert (r->group_perms, key,
+                         (gpointer)better_perm (g_hash_table_lookup (r->group_perms, key),
+                                                g_intern_string (perm)));
+    return TRUE;
+}
+
+static gboolean
+load_inner_pub_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *repos = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *perm = seaf_db_row_get_column_text (row, 1);
+
+    if (!repo_id || !perm)
+        return TRUE;
+
+    get_repo_entry (repos, repo_id)->inner_pub_perm = g_intern_string (perm);
+    return TRUE;
+}
+
+static gboolean
+load_virtual_repo_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *repos = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *origin_repo_id = seaf_db_row_get_column_text (row, 1);
+    const char *path = seaf_db_row_get_column_text (row, 2);
+    PermIndexRepo *r;
+
+    if (!repo_id || !origin_repo_id || !path)
+        return TRUE;
+
+    r = get_repo_entry (repos, repo_id);
+    g_free (r->origin_repo_id);
+    g_free (r->path);
+    r->origin_repo_id = g_strdup (origin_repo_id);
+    r->path = g_strdup (path);
+    return TRUE;
+}
+
+static const struct {
+    const char *sql;
+    const char *sql_by_repo;
+    SeafDBRowFunc callback;
+} perm_index_queries[] = {
+    { "SELECT repo_id, owner_id FROM RepoOwner",
+      "SELECT repo_id, owner_id FROM RepoOwner WHERE repo_id=?",
+      load_owner_cb },
+    { "SELECT repo_id, to_email, permission FROM SharedRepo",
+      "SELECT repo_id, to_email, permission FROM SharedRepo WHERE repo_id=?",
+      load_user_share_cb },
+    { "SELECT repo_id, group_id, permission FROM RepoGroup",
+      "SELECT repo_id, group_id, permission FROM RepoGroup WHERE repo_id=?",
+      load_group_share_cb },
+    { "SELECT repo_id, permission FROM InnerPubRepo",
+      "SELECT repo_id, permission FROM InnerPubRepo WHERE repo_id=?",
+      load_inner_pub_cb },
+    { "SELECT repo_id, origin_repo, path FROM VirtualRepo",
+      "SELECT repo_id, origin_repo, path FROM VirtualRepo WHERE repo_id=?",
+      load_virtual_repo_cb },
+};
+
+/* Loads all repos, or only @repo_id, into @repos. */
+static int
+load_repos (GHashTable *repos, const char *repo_id)
+{
+    int i, rc;
+
+    for (i = 0; i < G_N_ELEMENTS(perm_index_queries); ++i) {
+        if (repo_id)
+            rc = seaf_db_statement_foreach_row (seaf->db,
+                                                perm_index_queries[i].sql_by_repo,
+                                                perm_index_queries[i].callback,
+                                                repos, 1, "string", repo_id);
+        else
+            rc = seaf_db_statement_foreach_row (seaf->db,
+                                                perm_index_queries[i].sql,
+                                                perm_index_queries[i].callback,
+                                                repos, 0);
+        if (rc < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+link_vrepo (GHashTable *repos, const char *origin_repo_id, const char *repo_id)
+{
+    PermIndexRepo *origin = get_repo_entry (repos, origin_repo_id);
+
+    if (!origin->vrepos)
+        origin->vrepos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_add (origin->vrepos, g_strdup (repo_id));
+}
+
+static void
+unlink_vrepo (GHashTable *repos, const char *origin_repo_id, const char *repo_id)
+{
+    PermIndexRepo *origin = g_hash_table_lookup (repos, origin_repo_id);
+
+    if (!origin || !origin->vrepos)
+        return;
+
+    g_hash_table_remove (origin->vrepos, repo_id);
+    if (perm_index_repo_is_empty (origin))
+        g_hash_table_remove (repos, origin_repo_id);
+}
+
+static void
+link_all_vrepos (GHashTable *repos)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GList *vrepos = NULL, *ptr;
+    PermIndexRepo *r;
+
+    /* Origin entries may be created while linking. */
+    g_hash_table_iter_init (&iter, repos);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        if (((PermIndexRepo *)value)->origin_repo_id)
+            vrepos = g_list_prepend (vrepos, key);
+    }
+
+    for (ptr = vrepos; ptr; ptr = ptr->next) {
+        r = g_hash_table_lookup (repos, ptr->data);
+        link_vrepo (repos, r->origin_repo_id, ptr->data);
+    }
+    g_list_free (vrepos);
+}
+
+/* Replaces the entry of @repo_id with @r, which may be NULL. */
+static void
+replace_repo_locked (const char *repo_id, PermIndexRepo *r)
+{
+    GHashTable *repos = perm_index->repos;
+    PermIndexRepo *old = g_hash_table_lookup (repos, repo_id);
+
+    if (old) {
+        if (old->origin_repo_id)
+            unlink_vrepo (repos, old->origin_repo_id, repo_id);
+
+        /* Virtual repos of this repo are reloaded on their own. */
+        if (old->vrepos && g_hash_table_size (old->vrepos) > 0) {
+            if (!r)
+                r = g_new0 (PermIndexRepo, 1);
+            r->vrepos = old->vrepos;
+            old->vrepos = NULL;
+        }
+        g_hash_table_remove (repos, repo_id);
+    }
+
+    if (!r)
+        return;
+    if (perm_index_repo_is_empty (r)) {
+        perm_index_repo_free (r);
+        return;
+    }
+
+    g_hash_table_insert (repos, g_strdup (repo_id), r);
+    if (r->origin_repo_id)
+        link_vrepo (repos, r->origin_repo_id, repo_id);
+}
+
+static void
+reload_repo (SeafRepoManager *mgr, const char *repo_id)
+{
+    GHashTable *repos;
+    PermIndexRepo *r = NULL;
+    gpointer key, value;
+    int rc;
+
+    if (!perm_index) {
+        invalidate_accessible_repos (NULL);
+        return;
+    }
+
+    repos = perm_index_repos_new ();
+    rc = load_repos (repos, repo_id);
+    if (rc == 0 && g_hash_table_lookup_extended (repos, repo_id, &key, &value)) {
+        g_hash_table_steal (repos, repo_id);
+        g_free (key);
+        r = value;
+    }
+
+    pthread_rwlock_wrlock (&perm_index->lock);
+
+    if (perm_index->rebuilding)
+        g_hash_table_add (perm_index->dirty, g_strdup (repo_id));
+
+    if (rc < 0 || !perm_index->ready)
+        invalidate_accessible_repos (NULL);
+    else
+        invalidate_repo_users (g_hash_table_lookup (perm_index->repos, repo_id), r);
+
+    if (rc < 0) {
+        seaf_warning ("Failed to reload permissions of repo %.8s, "
+                      "checking it on the db.\n", repo_id);
+        g_hash_table_add (perm_index->stale, g_strdup (repo_id));
+    } else {
+        g_hash_table_remove (perm_index->stale, repo_id);
+        replace_repo_locked (repo_id, r);
+    }
+
+    pthread_rwlock_unlock (&perm_index->lock);
+
+    g_hash_table_destroy (repos);
+}
+
+/* Tells the other servers sharing the db to reload @repo_id. */
+static void
+publish_perm_change (SeafRepoManager *mgr, const char *repo_id)
+{
+    if (seaf_db_statement_query (mgr->seaf->db,
+                                 "INSERT INTO PermChange (repo_id, change_time) "
+                                 "VALUES (?, ?)",
+                                 2, "string", repo_id,
+                                 "int64", (gint64)time(NULL)) < 0)
+        seaf_warning ("Failed to publish permission change of repo %.8s.\n",
+                      repo_id);
+}
+
+void
+seaf_repo_manager_perm_index_reload_repo (SeafRepoManager *mgr,
+                                          const char *repo_id)
+{
+    if (perm_index)
+        publish_perm_change (mgr, repo_id);
+    reload_repo (mgr, repo_id);
+}
+
+static void
+reload_repo_list (SeafRepoManager *mgr, GList *repo_ids)
+{
+    GList *ptr;
+
+    for (ptr = repo_ids; ptr; ptr = ptr->next)
+        seaf_repo_manager_perm_index_reload_repo (mgr, ptr->data);
+}
+
+typedef struct PermChanges {
+    gint64 last_id;
+    GHashTable *repo_ids;
+} PermChanges;
+
+static gboolean
+collect_perm_change_cb (SeafDBRow *row, void *data)
+{
+    PermChanges *changes = data;
+    gint64 id = seaf_db_row_get_column_int64 (row, 0);
+    const char *repo_id = seaf_db_row_get_column_text (row, 1);
+
+    changes->last_id = MAX (changes->last_id, id);
+    if (repo_id)
+        g_hash_table_add (changes->repo_ids, g_strdup (repo_id));
+
+    return TRUE;
+}
+
+/*
+ * Reloads the repos changed by other servers, unless that was done less
+ * than PERM_SYNC_INTERVAL ago or another thread is doing it. Returns -1 if
+ * the changes can't be read and the index must not be used.
+ */
+static int
+perm_index_sync (SeafRepoManager *mgr)
+{
+    PermChanges changes;
+    GHashTableIter iter;
+    gpointer key;
+    gint64 now = g_get_monotonic_time ();
+    int rc;
+
+    if (now < __atomic_load_n (&perm_index->next_sync, __ATOMIC_RELAXED) ||
+        pthread_mutex_trylock (&perm_index->sync_lock) != 0)
+        return __atomic_load_n (&perm_index->sync_failed, __ATOMIC_RELAXED) ? -1 : 0;
+
+    if (now < perm_index->next_sync) {
+        pthread_mutex_unlock (&perm_index->sync_lock);
+        return perm_index->sync_failed ? -1 : 0;
+    }
+
+    changes.last_id = perm_index->last_change_id;
+    changes.repo_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    rc = seaf_db_statement_foreach_row (mgr->seaf->db,
+                                        "SELECT id, repo_id FROM PermChange WHERE id > ?",
+                                        collect_perm_change_cb, &changes,
+                                        1, "int64", perm_index->last_change_id);
+    if (rc >= 0) {
+        g_hash_table_iter_init (&iter, changes.repo_ids);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+            reload_repo (mgr, key);
+        perm_index->last_change_id = changes.last_id;
+    } else if (!perm_index->sync_failed) {
+        seaf_warning ("Failed to read permission changes, "
+                      "checking permissions on the db.\n");
+    }
+    g_hash_table_destroy (changes.repo_ids);
+
+    __atomic_store_n (&perm_index->sync_failed, rc < 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&perm_index->next_sync,
+                      g_get_monotonic_time () + PERM_SYNC_INTERVAL * 1000,
+                      __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&perm_index->sync_lock);
+
+    return rc < 0 ? -1 : 0;
+}
+
+void
+seaf_repo_manager_perm_index_reload_vrepos (SeafRepoManager *mgr,
+                                            const char *origin_repo_id)
+{
+    PermIndexRepo *origin;
+    GList *repo_ids = NULL;
+    GHashTableIter iter;
+    gpointer key;
+
+    if (!perm_index)
+        return;
+
+    pthread_rwlock_rdlock (&perm_index->lock);
+    origin = g_hash_table_lookup (perm_index->repos, origin_repo_id);
+    if (origin && origin->vrepos) {
+        g_hash_table_iter_init (&iter, origin->vrepos);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+            repo_ids = g_list_prepend (repo_ids, g_strdup (key));
+    }
+    pthread_rwlock_unlock (&perm_index->lock);
+
+    reload_repo_list (mgr, repo_ids);
+    string_list_free (repo_ids);
+}
+
+void
+seaf_repo_manager_perm_index_reload_group (SeafRepoManager *mgr, int group_id)
+{
+    PermIndexRepo *r;
+    GList *repo_ids = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    if (!perm_index)
+        return;
+
+    pthread_rwlock_rdlock (&perm_index->lock);
+    g_hash_table_iter_init (&iter, perm_index->repos);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        r = value;
+        if (r->group_perms &&
+            g_hash_table_contains (r->group_perms, GINT_TO_POINTER(group_id)))
+            repo_ids = g_list_prepend (repo_ids, g_strdup (key));
+    }
+    pthread_rwlock_unlock (&perm_index->lock);
+
+    reload_repo_list (mgr, repo_ids);
+    string_list_free (repo_ids);
+}
+
+static const char *
+get_group_perm (PermIndexRepo *r, GArray *groups)
+{
+    const char *perm = NULL;
+    guint i;
+
+    if (!r->group_perms)
+        return NULL;
+
+    for (i = 0; i < groups->len; ++i)
+        perm = better_perm (perm, g_hash_table_lookup (r->group_perms,
+                                GINT_TO_POINTER(g_array_index (groups, int, i))));
+
+    return perm;
+}
+
+static const char *
+get_share_perm (PermIndexRepo *r, const char *user, GArray *groups)
+{
+    const char *perm = NULL;
+
+    if (r->user_perms)
+        perm = g_hash_table_lookup (r->user_perms, user);
+    if (perm)
+        return perm;
+
+    /* Other permissions of group shares are ignored, see
+     * check_repo_share_perm_cb().
+     */
+    perm = get_group_perm (r, groups);
+    if (perm && (strcmp (perm, "rw") == 0 || strcmp (perm, "r") == 0))
+        return perm;
+
+    if (!seaf->cloud_mode)
+        return r->inner_pub_perm;
+
+    return NULL;
+}
+
+static gboolean
+is_path_prefix (const char *prefix, const char *path)
+{
+    int len = strlen (prefix);
+
+    return strncmp (prefix, path, len) == 0 &&
+        (path[len] == '\0' || path[len] == '/');
+}
+
+/* The permission of the longest shared folder that contains @vpath, see
+ * get_dir_perm().
+ */
+static const char *
+get_dir_perm_in_index (PermIndexRepo *origin, const char *vpath,
+                       const char *user, GArray *groups)
+{
+    GHashTableIter iter;
+    gpointer key;
+    PermIndexRepo *vrepo;
+    const char *perm, *user_perm = NULL, *group_perm = NULL;
+    int len, user_len = 0, group_len = 0;
+
+    if (!origin->vrepos)
+        return NULL;
+
+    g_hash_table_iter_init (&iter, origin->vrepos);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        vrepo = g_hash_table_lookup (perm_index->repos, key);
+        if (!vrepo || !vrepo->path || !is_path_prefix (vrepo->path, vpath))
+            continue;
+        len = strlen (vrepo->path);
+
+        perm = vrepo->user_perms ? g_hash_table_lookup (vrepo->user_perms, user) : NULL;
+        if (perm && len > user_len) {
+            user_perm = perm;
+            user_len = len;
+        }
+
+        perm = get_group_perm (vrepo, groups);
+        if (perm && len > group_len) {
+            group_perm = perm;
+            group_len = len;
+        } else if (perm && len == group_len) {
+            group_perm = better_perm (group_perm, perm);
+        }
+    }
+
+    return user_perm ? user_perm : group_perm;
+}
+
+/*
+ * Returns 0 and sets @perm if the permission can be decided from the
+ * index, or -1 if the db has to be checked.
+ */
+static int
+check_permission_in_index (const char *repo_id, const char *user, char **perm)
+{
+    PermIndexRepo *r, *origin = NULL;
+    GArray *groups;
+    const char *ret = NULL;
+    int rc = 0;
+
+    if (!perm_index || !perm_index->ready ||
+        perm_index_sync (seaf->repo_mgr) < 0)
+        return -1;
+
+    /* Served from the in-memory group graph of the group manager. */
+    groups = ccnet_group_manager_get_group_ids_by_user (seaf->group_mgr, user,
+                                                        TRUE, NULL);
+
+    pthread_rwlock_rdlock (&perm_index->lock);
+
+    if (!perm_index->ready || g_hash_table_contains (perm_index->stale, repo_id)) {
+        rc = -1;
+        goto out;
+    }
+
+    r = g_hash_table_lookup (perm_index->repos, repo_id);
+    if (!r)
+        goto out;
+
+    if (r->origin_repo_id) {
+        if (g_hash_table_contains (perm_index->stale, r->origin_repo_id)) {
+            rc = -1;
+            goto out;
+        }
+
+        origin = g_hash_table_lookup (perm_index->repos, r->origin_repo_id);
+        if (!origin)
+            goto out;
+        if (g_strcmp0 (user, origin->owner) == 0) {
+            ret = "rw";
+            goto out;
+        }
+
+        ret = get_dir_perm_in_index (origin, r->path, user, groups);
+        if (!ret)
+            ret = get_share_perm (origin, user, groups);
+    } else if (r->owner) {
+        if (strcmp (r->owner, user) == 0)
+            ret = "rw";
+        else
+            ret = get_share_perm (r, user, groups);
+    }
+
+out:
+    pthread_rwlock_unlock (&perm_index->lock);
+    g_array_free (groups, TRUE);
+
+    *perm = g_strdup (ret);
+    return rc;
+}
+
+int
+seaf_repo_manager_rebuild_perm_index (SeafRepoManager *mgr)
+{
+    GHashTable *repos, *dirty;
+    GHashTableIter iter;
+    gpointer key;
+    gint64 start = g_get_monotonic_time ();
+    guint n_repos;
+    int rc;
+
+    if (!perm_index)
+        return -1;
+
+    pthread_mutex_lock (&perm_index->rebuild_lock);
+
+    pthread_rwlock_wrlock (&perm_index->lock);
+    perm_index->rebuilding = TRUE;
+    pthread_rwlock_unlock (&perm_index->lock);
+
+    repos = perm_index_repos_new ();
+    rc = load_repos (repos, NULL);
+    if (rc == 0)
+        link_all_vrepos (repos);
+
+    pthread_rwlock_wrlock (&perm_index->lock);
+    perm_index->rebuilding = FALSE;
+    dirty = perm_index->dirty;
+    perm_index->dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    if (rc == 0) {
+        GHashTable *tmp = perm_index->repos;
+        perm_index->repos = repos;
+        repos = tmp;
+        g_hash_table_remove_all (perm_index->stale);
+        perm_index->ready = TRUE;
+    }
+    n_repos = g_hash_table_size (perm_index->repos);
+    pthread_rwlock_unlock (&perm_index->lock);
+
+    g_hash_table_destroy (repos);
+
+    /* Repos changed while loading may have been loaded before the change. */
+    g_hash_table_iter_init (&iter, dirty);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        reload_repo (mgr, key);
+    g_hash_table_destroy (dirty);
+
+    seaf_db_statement_query (mgr->seaf->db,
+                             "DELETE FROM PermChange WHERE change_time < ?",
+                             1, "int64", (gint64)time(NULL) - PERM_CHANGE_TTL);
+
+    /* Picks up changes made by other programs. */
+    invalidate_accessible_repos (NULL);
+
+    pthread_mutex_unlock (&perm_index->rebuild_lock);
+
+    if (rc < 0) {
+        seaf_warning ("Failed to build permission index.\n");
+        return -1;
+    }
+
+    seaf_message ("Built permission index of %u repos in %"G_GINT64_FORMAT" ms.\n",
+                  n_repos, (g_get_monotonic_time () - start) / 1000);
+    return 0;
+}
+
+static void *
+rebuild_perm_index_thread (void *arg)
+{
+    SeafRepoManager *mgr = arg;
+
+    while (1) {
+        sleep (perm_index->rebuild_interval);
+        seaf_repo_manager_rebuild_perm_index (mgr);
+    }
+
+    return NULL;
+}
+
+int
+seaf_repo_manager_init_perm_index (SeafRepoManager *mgr)
+{
+    GError *error = NULL;
+    pthread_t tid;
+    int interval;
+
+    perm_index = g_new0 (PermIndex, 1);
+    pthread_rwlock_init (&perm_index->lock, NULL);
+    perm_index->repos = perm_index_repos_new ();
+    perm_index->stale = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    perm_index->dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    pthread_mutex_init (&perm_index->rebuild_lock, NULL);
+    pthread_mutex_init (&perm_index->sync_lock, NULL);
+
+    /* Changes made before are picked up by the build below. */
+    perm_index->last_change_id = seaf_db_get_int64 (mgr->seaf->db,
+                                                    "SELECT COALESCE(MAX(id), 0) "
+                                                    "FROM PermChange");
+    if (perm_index->last_change_id < 0) {
+        seaf_warning ("Failed to read permission changes, "
+                      "checking permissions on the db.\n");
+        perm_index->last_change_id = 0;
+        perm_index->sync_failed = TRUE;
+    }
+
+    interval = g_key_file_get_integer (seaf->config, "general",
+                                       "perm_index_rebuild_interval", &error);
+    if (error) {
+        interval = DEFAULT_PERM_INDEX_REBUILD_INTERVAL;
+        g_clear_error (&error);
+    }
+    perm_index->rebuild_interval = interval;
+
+    /* Permissions are checked on the db until the index is built. */
+    seaf_repo_manager_rebuild_perm_index (mgr);
+
+    if (interval > 0) {
+        if (pthread_create (&tid, NULL, rebuild_perm_index_thread, mgr) != 0) {
+            seaf_warning ("Failed to create permission index thread.\n");
+            return -1;
+        }
+        pthread_detach (tid);
+    }
+
+    return 0;
+}
+
+/*
+ * Comprehensive repo access permission checker.
+ *
+ * Returns read/write permission.
+ */
+char *
+seaf_repo_manager_check_permission (SeafRepoManager *mgr,
+                                    const char *repo_id,
+                                    const char *user,
+                                    GError **error)
+{
+    char *permission = NULL;
+
+    if (check_permission_in_index (repo_id, user, &permission) == 0)
+        return permission;
+
+    return check_permission_in_db (mgr, repo_id, user);
+}
+
+/*
+ * Accessible repos of sync clients.
+ *
+ * Clients poll the list of repos they can sync, which used to be assembled
+ * from the listing functions above and filled from head commits. Here the
+ * repos a user can access, with the permissions and owners, are loaded by
+ * one query per kind of access and cached per user. Head commits, names
+ * and mtimes change all the time, so they are read from Branch and
+ * RepoInfo on every request, in batches. Commit objects are only read for
+ * old repos missing from RepoInfo, which is filled for them on the way.
+ *
+ * A cached list is dropped when a permission index reload touches the
+ * owner or a direct share of the user, or group and public shares of any
+ * repo. Reloads include the changes made by other servers, so the cache is
+ * only used while those can be read, see perm_index_sync(). Changes to the
+ * groups of the user are caught by comparing the group ids the list was
+ * made with.
+ */
+
+#define MAX_ACCESSIBLE_REPOS_USERS 10000
+#define ACCESSIBLE_REPOS_BATCH 200
+
+typedef struct AccessibleRepo {
+    char *repo_id;
+    const char *type;           /* "repo", "srepo" or "grepo" */
+    const char *permission;
+    char *owner;
+} AccessibleRepo;
+
+typedef struct AccessibleRepos {
+    GPtrArray *repos;
+    GArray *group_ids;
+    gint64 version;             /* acc_version when the list was loaded. */
+} AccessibleRepos;
+
+static pthread_mutex_t acc_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable *acc_cache = NULL;    /* lowercased user -> AccessibleRepos */
+static gint64 acc_version = 0;
+static gint64 acc_invalidated = 0;   /* acc_version of the last invalidation. */
+
+static void
+accessible_repo_free (AccessibleRepo *r)
+{
+    g_free (r->repo_id);
+    g_free (r->owner);
+    g_free (r);
+}
+
+static void
+accessible_repos_free (AccessibleRepos *list)
+{
+    if (list->repos)
+        g_ptr_array_unref (list->repos);
+    if (list->group_ids)
+        g_array_free (list->group_ids, TRUE);
+    g_free (list);
+}
+
+/* Drops the cached list of @user, or of all users if @user is NULL. */
+static void
+invalidate_accessible_repos (const char *user)
+{
+    pthread_mutex_lock (&acc_lock);
+
+    /* Lists being loaded are not stored if they started before this, whoever
+     * they belong to. Keeping the version per user would need an entry for
+     * every user ever invalidated. */
+    acc_invalidated = ++acc_version;
+    if (acc_cache) {
+        if (!user) {
+            g_hash_table_remove_all (acc_cache);
+        } else {
+            char *user_l = g_ascii_strdown (user, -1);
+            g_hash_table_remove (acc_cache, user_l);
+            g_free (user_l);
+        }
+    }
+
+    pthread_mutex_unlock (&acc_lock);
+}
+
+/* Called with the index lock held, before @old is replaced by @new. */
+static void
+invalidate_repo_users (PermIndexRepo *old, PermIndexRepo *new)
+{
+    PermIndexRepo *entries[2] = { old, new };
+    GHashTableIter iter;
+    gpointer key;
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        if (entries[i] && (entries[i]->group_perms || entries[i]->inner_pub_perm)) {
+            invalidate_accessible_repos (NULL);
+            return;
+        }
+    }
+
+    for (i = 0; i < 2; ++i) {
+        if (!entries[i])
+            continue;
+        if (entries[i]->owner)
+            invalidate_accessible_repos (entries[i]->owner);
+        if (!entries[i]->user_perms)
+            continue;
+        g_hash_table_iter_init (&iter, entries[i]->user_perms);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+            invalidate_accessible_repos (key);
+    }
+}
+
+typedef struct AccessibleReposLoad {
+    GPtrArray *repos;
+    GHashTable *index;          /* repo_id -> AccessibleRepo, not owned */
+    const char *type;
+    const char *owner;          /* Owner of all rows, if set. */
+} AccessibleReposLoad;
+
+static char *
+accessible_repo_owner (AccessibleReposLoad *load, SeafDBRow *row)
+{
+    const char *owner;
+
+    if (load->owner)
+        return g_strdup (load->owner);
+    owner = seaf_db_row_get_column_text (row, 1);
+    return g_ascii_strdown (owner ? owner : "", -1);
+}
+
+/* Rows are repo_id, owner and permission. */
+static gboolean
+load_accessible_repo_cb (SeafDBRow *row, void *data)
+{
+    AccessibleReposLoad *load = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *permission = "rw";
+    AccessibleRepo *r;
+
+    if (!repo_id)
+        return TRUE;
+    if (seaf_db_row_get_column_count (row) > 2)
+        permission = seaf_db_row_get_column_text (row, 2);
+
+    r = g_hash_table_lookup (load->index, repo_id);
+    if (r) {
+        /* Of the groups sharing a repo, the one giving "rw" wins. */
+        if (strcmp (r->type, load->type) == 0 && g_strcmp0 (r->permission, "r") == 0 &&
+            g_strcmp0 (permission, "rw") == 0) {
+            r->permission = g_intern_string ("rw");
+            g_free (r->owner);
+            r->owner = accessible_repo_owner (load, row);
+        }
+        return TRUE;
+    }
+
+    r = g_new0 (AccessibleRepo, 1);
+    r->repo_id = g_strdup (repo_id);
+    r->type = load->type;
+    r->permission = g_intern_string (permission ? permission : "r");
+    r->owner = accessible_repo_owner (load, row);
+    g_ptr_array_add (load->repos, r);
+    g_hash_table_insert (load->index, r->repo_id, r);
+
+    return TRUE;
+}
+
+static GPtrArray *
+load_accessible_repos (SeafRepoManager *mgr, const char *user, GArray *group_ids)
+{
+    SeafDB *db = mgr->seaf->db;
+    AccessibleReposLoad load;
+    GString *sql = g_string_new ("");
+    guint i;
+    int rc;
+
+    load.repos = g_ptr_array_new_with_free_func ((GDestroyNotify)accessible_repo_free);
+    load.index = g_hash_table_new (g_str_hash, g_str_equal);
+
+    load.type = "repo";
+    load.owner = user;
+    rc = seaf_db_statement_foreach_row (db,
+                                        "SELECT repo_id FROM RepoOwner WHERE owner_id=? AND "
+                                        "repo_id NOT IN (SELECT repo_id FROM VirtualRepo)",
+                                        load_accessible_repo_cb, &load,
+                                        1, "string", user);
+    if (rc < 0)
+        goto error;
+
+    load.type = "srepo";
+    load.owner = NULL;
+    rc = seaf_db_statement_foreach_row (db,
+                                        "SELECT repo_id, from_email, permission FROM SharedRepo "
+                                        "WHERE to_email=?",
+                                        load_accessible_repo_cb, &load,
+                                        1, "string", user);
+    if (rc < 0)
+        goto error;
+
+    if (group_ids->len > 0) {
+        g_string_assign (sql, "SELECT repo_id, user_name, permission FROM RepoGroup "
+                         "WHERE group_id IN (");
+        for (i = 0; i < group_ids->len; ++i)
+            g_string_append_printf (sql, i == 0 ? "%d" : ",%d",
+                                    g_array_index (group_ids, int, i));
+        g_string_append (sql, ") ORDER BY group_id");
+
+        load.type = "grepo";
+        rc = seaf_db_statement_foreach_row (db, sql->str,
+                                            load_accessible_repo_cb, &load, 0);
+        if (rc < 0)
+            goto error;
+    }
+
+    /* Repos shared to the organization are listed as group repos. */
+    load.owner = "Organization";
+    rc = seaf_db_statement_foreach_row (db,
+                                        "SELECT p.repo_id, o.owner_id, p.permission FROM "
+                                        "InnerPubRepo p, RepoOwner o "
+                                        "WHERE p.repo_id = o.repo_id",
+                                        load_accessible_repo_cb, &load, 0);
+    if (rc < 0)
+        goto error;
+
+    g_string_free (sql, TRUE);
+    g_hash_table_destroy (load.index);
+    return load.repos;
+
+error:
+    seaf_warning ("DB error when loading accessible repos of %s.\n", user);
+    g_string_free (sql, TRUE);
+    g_hash_table_destroy (load.index);
+    g_ptr_array_unref (load.repos);
+    return NULL;
+}
+
+static gboolean
+group_ids_equal (GArray *a, GArray *b)
+{
+    return a->len == b->len &&
+        memcmp (a->data, b->data, a->len * sizeof(int)) == 0;
+}
+
+/* Returns a reference to the repos @user can access. */
+static GPtrArray *
+get_accessible_repos (SeafRepoManager *mgr, const char *user)
+{
+    AccessibleRepos *list;
+    GPtrArray *repos = NULL;
+    GArray *group_ids;
+    gint64 version;
+    gboolean use_cache;
+
+    use_cache = perm_index && perm_index_sync (mgr) == 0;
+    group_ids = ccnet_group_manager_get_group_ids_by_user (seaf->group_mgr, user,
+                                                          TRUE, NULL);
+    char *user_l = g_ascii_strdown (user, -1);
+
+    pthread_mutex_lock (&acc_lock);
+    if (acc_cache && use_cache) {
+        list = g_hash_table_lookup (acc_cache, user_l);
+        if (list && group_ids_equal (list->group_ids, group_ids))
+            repos = g_ptr_array_ref (list->repos);
+    }
+    version = acc_version;
+    pthread_mutex_unlock (&acc_lock);
+
+    if (repos) {
+        g_array_free (group_ids, TRUE);
+        g_free (user_l);
+        return repos;
+    }
+
+    repos = load_accessible_repos (mgr, user, group_ids);
+    if (!repos) {
+        g_array_free (group_ids, TRUE);
+        g_free (user_l);
+        return NULL;
+    }
+
+    pthread_mutex_lock (&acc_lock);
+    if (!acc_cache) {
+        acc_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify)accessible_repos_free);
+    }
+    if (use_cache && version >= acc_invalidated) {
+        if (g_hash_table_size (acc_cache) >= MAX_ACCESSIBLE_REPOS_USERS)
+            g_hash_table_remove_all (acc_cache);
+        list = g_new0 (AccessibleRepos, 1);
+        list->repos = g_ptr_array_ref (repos);
+        list->group_ids = group_ids;
+        list->version = version;
+        g_hash_table_replace (acc_cache, user_l, list);
+        group_ids = NULL;
+        user_l = NULL;
+    }
+    pthread_mutex_unlock (&acc_lock);
+
+    if (group_ids)
+        g_array_free (group_ids, TRUE);
+    g_free (user_l);
+    return repos;
+}
+
+typedef struct HeadInfo {
+    char *commit_id;
+    char *name;
+    gint64 mtime;
+    int version;
+} HeadInfo;
+
+static void
+head_info_free (HeadInfo *info)
+{
+    g_free (info->commit_id);
+    g_free (info->name);
+    g_free (info);
+}
+
+static gboolean
+load_head_info_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *heads = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *commit_id = seaf_db_row_get_column_text (row, 1);
+    HeadInfo *info;
+
+    if (!repo_id || !commit_id)
+        return TRUE;
+
+    info = g_new0 (HeadInfo, 1);
+    info->commit_id = g_strdup (commit_id);
+    info->name = g_strdup (seaf_db_row_get_column_text (row, 2));
+    info->mtime = seaf_db_row_get_column_int64 (row, 3);
+    info->version = seaf_db_row_get_column_int (row, 4);
+    g_hash_table_replace (heads, g_strdup (repo_id), info);
+
+    return TRUE;
+}
+
+static int
+load_head_infos (SeafRepoManager *mgr, GPtrArray *repos, GHashTable *heads)
+{
+    GString *sql = g_string_new ("");
+    AccessibleRepo *r;
+    guint i, n;
+    int rc = 0;
+
+    for (i = 0; i < repos->len && rc == 0; i += n) {
+        g_string_assign (sql, "SELECT b.repo_id, b.commit_id, i.name, i.update_time, "
+                         "i.version FROM Branch b LEFT JOIN RepoInfo i "
+                         "ON b.repo_id = i.repo_id "
+                         "WHERE b.name = 'master' AND b.repo_id IN (");
+        for (n = 0; n < ACCESSIBLE_REPOS_BATCH && i + n < repos->len; ++n) {
+            r = g_ptr_array_index (repos, i + n);
+            /* Ids come from the db, but are put in the sql text. */
+            if (!is_uuid_valid (r->repo_id))
+                continue;
+            g_string_append_printf (sql, "'%s',", r->repo_id);
+        }
+        if (sql->str[sql->len - 1] != ',')
+            continue;
+        g_string_truncate (sql, sql->len - 1);
+        g_string_append (sql, ")");
+
+        if (seaf_db_statement_foreach_row (mgr->seaf->db, sql->str,
+                                           load_head_info_cb, heads, 0) < 0)
+            rc = -1;
+    }
+
+    g_string_free (sql, TRUE);
+    return rc;
+}
+
+/* Repos created by old versions may have no RepoInfo yet. */
+static gboolean
+fill_head_info_from_commit (const char *repo_id, HeadInfo *info)
+{
+    SeafCommit *commit;
+
+    commit = seaf_commit_manager_get_commit_compatible (seaf->commit_mgr,
+                                                        repo_id, info->commit_id);
+    if (!commit) {
+        seaf_warning ("Commit %s not found in repo %s\n", info->commit_id, repo_id);
+        return FALSE;
+    }
+
+    info->name = g_strdup (commit->repo_name);
+    info->mtime = commit->ctime;
+    info->version = commit->version;
+    set_repo_commit_to_db (repo_id, commit->repo_name, commit->ctime, commit->version,
+                           commit->encrypted, commit->creator_name);
+    seaf_commit_unref (commit);
+
+    return TRUE;
+}
+
+json_t *
+seaf_repo_manager_get_accessible_repos (SeafRepoManager *mgr, const char *user)
+{
+    GPtrArray *repos;
+    GHashTable *heads;
+    AccessibleRepo *r;
+    HeadInfo *info;
+    json_t *array, *obj;
+    guint i;
+
+    repos = get_accessible_repos (mgr, user);
+    if (!repos)
+        return NULL;
+
+    heads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                   (GDestroyNotify)head_info_free);
+    if (load_head_infos (mgr, repos, heads) < 0) {
+        seaf_warning ("DB error when loading head commits of repos of %s.\n", user);
+        g_hash_table_destroy (heads);
+        g_ptr_array_unref (repos);
+        return NULL;
+    }
+
+    array = json_array ();
+    for (i = 0; i < repos->len; ++i) {
+        r = g_ptr_array_index (repos, i);
+
+        /* Repos without a head branch are corrupted or being deleted. */
+        info = g_hash_table_lookup (heads, r->repo_id);
+        if (!info)
+            continue;
+        if (!info->name && !fill_head_info_from_commit (r->repo_id, info))
+            continue;
+
+        obj = json_object ();
+        json_object_set_new (obj, "version", json_integer (info->version));
+        json_object_set_new (obj, "id", json_string (r->repo_id));
+        json_object_set_new (obj, "head_commit_id", json_string (info->commit_id));
+        json_object_set_new (obj, "name", json_string (info->name));
+        json_object_set_new (obj, "mtime", json_integer (info->mtime));
+        json_object_set_new (obj, "permission", json_string (r->permission));
+        json_object_set_new (obj, "type", json_string (r->type));
+        json_object_set_new (obj, "owner", json_string (r->owner));
+        json_array_append_new (array, obj);
+    }
+
+    g_hash_table_destroy (heads);
+    g_ptr_array_unref (repos);
+
+    return array;
+}
+
 /*
  * Directories are always before files. Otherwise compare the names.
  */
@@ -664,6 +664,22 @@ static void start_rpc_service (const char *seafile_dir,
                                      "pop_event",
                                      searpc_signature_json__string());
 
+    /* fs object cache */
+    searpc_server_register_function ("seafserv-threaded-rpcserver",
+                                     seafile_get_dir_cache_stats,
+                                     "get_dir_cache_stats",
+                                     searpc_signature_json__void());
+    searpc_server_register_function ("seafserv-threaded-rpcserver",
+                                     seafile_get_commit_cache_stats,
+                                     "get_commit_cache_stats",
+                                     searpc_signature_json__void());
+
+    /* database connection pool */
+    searpc_server_register_function ("seafserv-threaded-rpcserver",
+                                     seafile_get_db_pool_stats,
+                                     "get_db_pool_stats",
+                                     searpc_signature_json__void());
+
                                      
     searpc_server_register_function ("seafserv-threaded-rpcserver",
                                      seafile_set_inner_pub_repo,
@@ -885,6 +901,10 @@ static void start_rpc_service (const char *seafile_dir,
                                      ccnet_rpc_get_groups,
                                      "get_groups",
                                      searpc_signature_objlist__string_int());
+    searpc_server_register_function ("seafserv-threaded-rpcserver",
+                                     ccnet_rpc_get_user_group_ids,
+                                     "get_user_group_ids",
+                                     searpc_signature_json__string());
     searpc_server_register_function ("seafserv-threaded-rpcserver",
                                       ccnet_rpc_list_all_departments,
                                      "list_all_departments",
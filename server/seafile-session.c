@@ -262,6 +262,14 @@ seafile_session_start (SeafileSession *session)
         return -1;
     }
 
+    /* The permission index of the repo manager asks groups of users. */
+    ccnet_group_manager_start (session->group_mgr);
+
+    if (seaf_repo_manager_start (session->repo_mgr) < 0) {
+        seaf_warning ("Failed to start repo manager.\n");
+        return -1;
+    }
+
     if (seaf_web_at_manager_start (session->web_at_mgr) < 0) {
         seaf_warning ("Failed to start web access check manager.\n");
         return -1;
@@ -112,6 +112,8 @@ seaf_share_manager_add_share (SeafShareManager *mgr, const char *repo_id,
         goto out;
     }
 
+    seaf_repo_manager_perm_index_reload_repo (seaf->repo_mgr, repo_id);
+
 out:
     g_free (from_email_l);
     g_free (to_email_l);
@@ -138,6 +140,8 @@ seaf_share_manager_set_subdir_perm_by_path (SeafShareManager *mgr, const char *r
                                    "string", path,
                                    "string", from_email_l,
                                    "string", to_email_l);
+    if (ret >= 0)
+        seaf_repo_manager_perm_index_reload_vrepos (seaf->repo_mgr, repo_id);
     g_free (from_email_l);
     g_free (to_email_l);
     return ret;
@@ -159,6 +163,8 @@ seaf_share_manager_set_permission (SeafShareManager *mgr, const char *repo_id,
     ret = seaf_db_statement_query (mgr->seaf->db, sql,
                                    4, "string", permission, "string", repo_id,
                                    "string", from_email_l, "string", to_email_l);
+    if (ret >= 0)
+        seaf_repo_manager_perm_index_reload_repo (seaf->repo_mgr, repo_id);
 
     g_free (from_email_l);
     g_free (to_email_l);
@@ -644,6 +650,7 @@ seaf_share_manager_remove_share (SeafShareManager *mgr, const char *repo_id,
                        "string", to_email) < 0)
         return -1;
 
+    seaf_repo_manager_perm_index_reload_repo (seaf->repo_mgr, repo_id);
     return 0;
 }
 
@@ -666,6 +673,7 @@ seaf_share_manager_unshare_subdir (SeafShareManager* mgr,
                                  "string", path) < 0)
         return -1;
 
+    seaf_repo_manager_perm_index_reload_vrepos (seaf->repo_mgr, orig_repo_id);
     return 0;
 }
 
@@ -677,6 +685,7 @@ seaf_share_manager_remove_repo (SeafShareManager *mgr, const char *repo_id)
                        1, "string", repo_id) < 0)
         return -1;
 
+    seaf_repo_manager_perm_index_reload_repo (seaf->repo_mgr, repo_id);
     return 0;
 }
 
@@ -872,6 +881,7 @@ seaf_share_manager_unshare_group_subdir (SeafShareManager* mgr,
                                  "string", path) < 0)
         return -1;
 
+    seaf_repo_manager_perm_index_reload_vrepos (seaf->repo_mgr, repo_id);
     return 0;
 }
 
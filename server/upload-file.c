@@ -59,6 +59,7 @@ typedef struct RecvFSM {
     char *repo_id;
     char *user;
     char *boundary;        /* boundary of multipart form-data. */
+    char *delimiter;       /* CRLF "--" boundary, ends the data of a part. */
     char *input_name;      /* input name of the current form field. */
     char *parent_dir;
     evbuf_t *line;          /* buffer for a line */
@@ -73,6 +74,21 @@ typedef struct RecvFSM {
     int fd;
     GList *tmp_files;           /* tmp files for each uploading file */
 
+    /* Files are indexed while being received, instead of written to
+     * tmp files and indexed after the whole body is received. */
+    gboolean stream_index;
+    char *store_id;
+    int repo_version;
+    SeafileCrypt *crypt;
+    StreamIndexer *indexer;     /* for the file being received */
+    GList *indexers;            /* finished files, same order as filenames */
+    GList *file_ids;            /* ids of indexed files, same order as filenames */
+    GList *file_sizes;
+    evhtp_request_t *req;
+    struct event *wake_ev;      /* activated by indexer threads */
+    gboolean paused;            // 等待写块时暂停读取请求
+    void (*deferred_cb) (evhtp_request_t *req, void *arg); // 等待索引完成的请求回调
+
     /* For upload progress. */
     char *progress_id;
     Progress *progress;
@@ -93,6 +109,9 @@ static pthread_mutex_t pg_lock;
 static int
 write_block_data_to_tmp_file (RecvFSM *fsm, const char *parent_dir,
                               const char *file_name);
+static gboolean
+wait_for_indexed_files (evhtp_request_t *req, RecvFSM *fsm,
+                        void (*cb) (evhtp_request_t *req, void *arg));
 
 /* IE8 will set filename to the full path of the uploaded file.
  * So we need to strip out the basename from it.
@@ -216,6 +235,28 @@ send_reply_by_error_code (evhtp_request_t *req, int error_code)
     }
 }
 
+static gboolean
+check_upload_size (gint64 total_size, int *error_code)
+{
+    gint64 max_upload_size;
+
+    /* default is MB */
+    max_upload_size = seaf_cfg_manager_get_config_int64 (seaf->cfg_mgr, "fileserver",
+                                                         "max_upload_size");
+    if (max_upload_size > 0)
+        max_upload_size = max_upload_size * ((gint64)1 << 20);
+    else
+        max_upload_size = -1;
+    
+    if (max_upload_size > 0 && total_size > max_upload_size) {
+        seaf_debug ("[upload] File size is too large.\n");
+        *error_code = ERROR_SIZE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static gboolean
 check_tmp_file_list (GList *tmp_files, int *error_code)
 {
@@ -223,7 +264,6 @@ check_tmp_file_list (GList *tmp_files, int *error_code)
     char *tmp_file;
     SeafStat st;
     gint64 total_size = 0;
-    gint64 max_upload_size;
 
     for (ptr = tmp_files; ptr; ptr = ptr->next) {
         tmp_file = ptr->data;
@@ -236,21 +276,23 @@ check_tmp_file_list (GList *tmp_files, int *error_code)
 
         total_size += (gint64)st.st_size;
     }
-    /* default is MB */
-    max_upload_size = seaf_cfg_manager_get_config_int64 (seaf->cfg_mgr, "fileserver",
-                                                         "max_upload_size");
-    if (max_upload_size > 0)
-        max_upload_size = max_upload_size * ((gint64)1 << 20);
-    else
-        max_upload_size = -1;
-    
-    if (max_upload_size > 0 && total_size > max_upload_size) {
-        seaf_debug ("[upload] File size is too large.\n");
-        *error_code = ERROR_SIZE;
-        return FALSE;
-    }
 
-    return TRUE;
+    return check_upload_size (total_size, error_code);
+}
+
+static gboolean
+check_uploaded_files (RecvFSM *fsm, int *error_code)
+{
+    GList *ptr;
+    gint64 total_size = 0;
+
+    if (!fsm->stream_index)
+        return check_tmp_file_list (fsm->files, error_code);
+
+    for (ptr = fsm->file_sizes; ptr; ptr = ptr->next)
+        total_size += *(gint64 *)ptr->data;
+
+    return check_upload_size (total_size, error_code);
 }
 
 static char *
@@ -421,6 +463,46 @@ file_id_list_from_json (const char *ret_json)
     return g_string_free (id_list, FALSE);
 }
 
+/* Adds the uploaded files to the repo, indexing the tmp files first unless
+ * they were indexed while being received. */
+static int
+post_uploaded_files (RecvFSM *fsm, const char *parent_dir, int replace,
+                     char **ret_json, char **task_id, GError **error)
+{
+    char *filenames_json, *tmp_files_json;
+    int rc;
+
+    if (fsm->stream_index)
+        return seaf_repo_manager_post_indexed_files (seaf->repo_mgr,
+                                                     fsm->repo_id,
+                                                     parent_dir,
+                                                     fsm->filenames,
+                                                     fsm->file_ids,
+                                                     fsm->file_sizes,
+                                                     fsm->user,
+                                                     replace,
+                                                     ret_json,
+                                                     error);
+
+    filenames_json = file_list_to_json (fsm->filenames);
+    tmp_files_json = file_list_to_json (fsm->files);
+
+    rc = seaf_repo_manager_post_multi_files (seaf->repo_mgr,
+                                             fsm->repo_id,
+                                             parent_dir,
+                                             filenames_json,
+                                             tmp_files_json,
+                                             fsm->user,
+                                             replace,
+                                             ret_json,
+                                             fsm->need_idx_progress ? task_id : NULL,
+                                             error);
+    g_free (filenames_json);
+    g_free (tmp_files_json);
+
+    return rc;
+}
+
 static void
 upload_api_cb(evhtp_request_t *req, void *arg)
 {
@@ -429,7 +511,6 @@ upload_api_cb(evhtp_request_t *req, void *arg)
     char *relative_path = NULL, *new_parent_dir = NULL;
     GError *error = NULL;
     int error_code = -1;
-    char *filenames_json, *tmp_files_json;
     int replace = 0;
     int rc;
 
@@ -461,6 +542,9 @@ upload_api_cb(evhtp_request_t *req, void *arg)
     if (!fsm || fsm->state == RECV_ERROR)
         return;
 
+    if (!wait_for_indexed_files (req, fsm, upload_api_cb))
+        return;
+
     if (!fsm->filenames) {
         seaf_debug ("[upload] No file uploaded.\n");
         send_error_reply (req, EVHTP_RES_BADREQ, "No file.\n");
@@ -524,7 +608,7 @@ upload_api_cb(evhtp_request_t *req, void *arg)
         }
     }
 
-    if (!fsm->files) {
+    if (!fsm->files && !fsm->file_ids) {
         seaf_debug ("[upload] No file uploaded.\n");
         send_error_reply (req, EVHTP_RES_BADREQ, "No file.\n");
         goto out;
@@ -538,7 +622,7 @@ upload_api_cb(evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    if (!check_tmp_file_list (fsm->files, &error_code))
+    if (!check_uploaded_files (fsm, &error_code))
         goto out;
 
     gint64 content_len;
@@ -559,23 +643,10 @@ upload_api_cb(evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    filenames_json = file_list_to_json (fsm->filenames);
-    tmp_files_json = file_list_to_json (fsm->files);
-
     char *ret_json = NULL;
     char *task_id = NULL;
-    rc = seaf_repo_manager_post_multi_files (seaf->repo_mgr,
-                                             fsm->repo_id,
-                                             new_parent_dir,
-                                             filenames_json,
-                                             tmp_files_json,
-                                             fsm->user,
-                                             replace,
-                                             &ret_json,
-                                             fsm->need_idx_progress ? &task_id : NULL,
-                                             &error);
-    g_free (filenames_json);
-    g_free (tmp_files_json);
+    rc = post_uploaded_files (fsm, new_parent_dir, replace,
+                              &ret_json, &task_id, &error);
     if (rc < 0) {
         error_code = ERROR_INTERNAL;
         if (error) {
@@ -1057,7 +1128,6 @@ upload_ajax_cb(evhtp_request_t *req, void *arg)
     char *parent_dir = NULL, *relative_path = NULL, *new_parent_dir = NULL;
     GError *error = NULL;
     int error_code = -1;
-    char *filenames_json, *tmp_files_json;
     int rc;
 
     evhtp_headers_add_header (req->headers_out,
@@ -1088,6 +1158,9 @@ upload_ajax_cb(evhtp_request_t *req, void *arg)
     if (!fsm || fsm->state == RECV_ERROR)
         return;
 
+    if (!wait_for_indexed_files (req, fsm, upload_ajax_cb))
+        return;
+
     parent_dir = g_hash_table_lookup (fsm->form_kvs, "parent_dir");
     if (!parent_dir) {
         seaf_debug ("[upload] No parent dir given.\n");
@@ -1143,7 +1216,7 @@ upload_ajax_cb(evhtp_request_t *req, void *arg)
         }
     }
 
-    if (!fsm->files) {
+    if (!fsm->files && !fsm->file_ids) {
         seaf_debug ("[upload] No file uploaded.\n");
         send_error_reply (req, EVHTP_RES_BADREQ, "No file.\n");
         goto out;
@@ -1157,7 +1230,7 @@ upload_ajax_cb(evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    if (!check_tmp_file_list (fsm->files, &error_code))
+    if (!check_uploaded_files (fsm, &error_code))
         goto out;
 
     gint64 content_len;
@@ -1179,23 +1252,10 @@ upload_ajax_cb(evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    filenames_json = file_list_to_json (fsm->filenames);
-    tmp_files_json = file_list_to_json (fsm->files);
-
     char *ret_json = NULL;
     char *task_id = NULL;
-    rc = seaf_repo_manager_post_multi_files (seaf->repo_mgr,
-                                             fsm->repo_id,
-                                             new_parent_dir,
-                                             filenames_json,
-                                             tmp_files_json,
-                                             fsm->user,
-                                             0,
-                                             &ret_json,
-                                             fsm->need_idx_progress ? &task_id : NULL,
-                                             &error);
-    g_free (filenames_json);
-    g_free (tmp_files_json);
+    rc = post_uploaded_files (fsm, new_parent_dir, 0,
+                              &ret_json, &task_id, &error);
     if (rc < 0) {
         error_code = ERROR_INTERNAL;
         if (error) {
@@ -1767,6 +1827,7 @@ upload_finish_cb (evhtp_request_t *req, void *arg)
     g_free (fsm->parent_dir);
     g_free (fsm->user);
     g_free (fsm->boundary);
+    g_free (fsm->delimiter);
     g_free (fsm->input_name);
     g_free (fsm->token_type);
 
@@ -1790,6 +1851,17 @@ upload_finish_cb (evhtp_request_t *req, void *arg)
     string_list_free (fsm->filenames);
     string_list_free (fsm->files);
 
+    /* The indexers don't wake the request any more once freed. */
+    seaf_fs_manager_stream_index_free (fsm->indexer);
+    g_list_free_full (fsm->indexers,
+                      (GDestroyNotify)seaf_fs_manager_stream_index_free);
+    if (fsm->wake_ev)
+        event_free (fsm->wake_ev);
+    g_free (fsm->crypt);
+    g_free (fsm->store_id);
+    string_list_free (fsm->file_ids);
+    g_list_free_full (fsm->file_sizes, g_free);
+
     evbuffer_free (fsm->line);
 
     if (fsm->progress_id) {
@@ -2111,6 +2183,182 @@ recv_file_data (RecvFSM *fsm, gboolean *no_line)
     return EVHTP_RES_OK;
 }
 
+/* The blocks of the file are still being written, see
+ * wait_for_indexed_files(). */
+static void
+add_indexed_file (RecvFSM *fsm)
+{
+    seaf_fs_manager_stream_index_finish (fsm->indexer);
+    fsm->indexers = g_list_prepend (fsm->indexers, fsm->indexer);
+    fsm->indexer = NULL;
+
+    fsm->filenames = g_list_prepend (fsm->filenames,
+                                     get_basename(fsm->file_name));
+    g_free (fsm->file_name);
+    fsm->file_name = NULL;
+}
+
+/* Called by indexer threads, with the lock of the indexer held. */
+static void
+wake_stream_index (void *data)
+{
+    RecvFSM *fsm = data;
+
+    event_active (fsm->wake_ev, EV_TIMEOUT, 0);
+}
+
+static gboolean
+all_files_indexed (RecvFSM *fsm)
+{
+    GList *ptr;
+
+    for (ptr = fsm->indexers; ptr; ptr = ptr->next) {
+        if (!seaf_fs_manager_stream_index_is_done (ptr->data))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Runs on the loop of the request. Resumes reading once the blocks of the
+ * current file are written, or runs the request callback deferred by
+ * wait_for_indexed_files() once all files are indexed.
+ */
+static void
+stream_index_wake_cb (evutil_socket_t sock, short what, void *arg)
+{
+    RecvFSM *fsm = arg;
+    evhtp_request_t *req = fsm->req;
+    void (*cb) (evhtp_request_t *req, void *arg);
+    gboolean paused = fsm->paused;
+
+    if (fsm->deferred_cb) {
+        if (!all_files_indexed (fsm))
+            return;
+        cb = fsm->deferred_cb;
+        fsm->deferred_cb = NULL;
+        fsm->paused = FALSE;
+        /* Sends the reply. */
+        cb (req, fsm);
+        if (paused)
+            evhtp_request_resume (req);
+        return;
+    }
+
+    if (paused && !(fsm->indexer &&
+                    seaf_fs_manager_stream_index_is_busy (fsm->indexer))) {
+        fsm->paused = FALSE;
+        evhtp_request_resume (req);
+    }
+}
+
+/*
+ * Returns FALSE if @cb has to wait for the blocks of the uploaded files to
+ * be written. The request is paused, and @cb is called again by
+ * stream_index_wake_cb(). Otherwise the ids of the indexed files are
+ * collected into fsm->file_ids.
+ */
+static gboolean
+wait_for_indexed_files (evhtp_request_t *req, RecvFSM *fsm,
+                        void (*cb) (evhtp_request_t *req, void *arg))
+{
+    unsigned char sha1[20];
+    char file_id[41];
+    gint64 *size;
+    GList *ptr;
+
+    if (!fsm->stream_index || !fsm->indexers)
+        return TRUE;
+
+    if (!all_files_indexed (fsm)) {
+        fsm->deferred_cb = cb;
+        if (!fsm->paused) {
+            evhtp_request_pause (req);
+            fsm->paused = TRUE;
+        }
+        return FALSE;
+    }
+
+    for (ptr = fsm->indexers; ptr; ptr = ptr->next) {
+        size = g_new (gint64, 1);
+        if (seaf_fs_manager_stream_index_get_result (ptr->data, sha1, size) < 0) {
+            seaf_warning ("[upload] Failed to index uploaded files in %s.\n",
+                          fsm->repo_id);
+            g_free (size);
+            send_error_reply (req, EVHTP_RES_SERVERR, "Internal error\n");
+            return FALSE;
+        }
+        rawdata_to_hex (sha1, file_id, 20);
+        fsm->file_ids = g_list_prepend (fsm->file_ids, g_strdup(file_id));
+        fsm->file_sizes = g_list_prepend (fsm->file_sizes, size);
+    }
+    fsm->file_ids = g_list_reverse (fsm->file_ids);
+    fsm->file_sizes = g_list_reverse (fsm->file_sizes);
+
+    g_list_free_full (fsm->indexers,
+                      (GDestroyNotify)seaf_fs_manager_stream_index_free);
+    fsm->indexers = NULL;
+
+    return TRUE;
+}
+
+/* Moves the first @len bytes of the received data into the indexer,
+ * segment by segment without copying them out of the evbuffer first. */
+static int
+feed_indexer (RecvFSM *fsm, size_t len)
+{
+    struct evbuffer_iovec vec;
+    size_t n;
+
+    while (len > 0) {
+        if (evbuffer_peek (fsm->line, -1, NULL, &vec, 1) < 1)
+            return -1;
+        n = MIN (len, vec.iov_len);
+        if (seaf_fs_manager_stream_index_feed (fsm->indexer, vec.iov_base, n) < 0)
+            return -1;
+        evbuffer_drain (fsm->line, n);
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Unlike recv_file_data(), the data isn't split into lines. The delimiter
+ * is searched for in the received segments, and everything before it, or
+ * before a partial delimiter at the end, is file data. */
+static evhtp_res
+recv_file_data_stream (RecvFSM *fsm, gboolean *no_line)
+{
+    struct evbuffer_ptr pos;
+    size_t dlen = strlen (fsm->delimiter);
+    size_t size = evbuffer_get_length (fsm->line);
+
+    *no_line = FALSE;
+
+    pos = evbuffer_search (fsm->line, fsm->delimiter, dlen, NULL);
+    if (pos.pos < 0) {
+        if (size >= dlen && feed_indexer (fsm, size - dlen + 1) < 0)
+            return EVHTP_RES_SERVERR;
+        *no_line = TRUE;
+        return EVHTP_RES_OK;
+    }
+
+    seaf_debug ("[upload] file data ends.\n");
+
+    if (feed_indexer (fsm, pos.pos) < 0)
+        return EVHTP_RES_SERVERR;
+
+    add_indexed_file (fsm);
+
+    /* Leave the boundary line to RECV_INIT. */
+    evbuffer_drain (fsm->line, 2);
+    g_free (fsm->input_name);
+    fsm->input_name = NULL;
+    fsm->state = RECV_INIT;
+
+    return EVHTP_RES_OK;
+}
+
 /*
    Example multipart form-data request content format:
 
@@ -2177,7 +2425,19 @@ upload_read_cb (evhtp_request_t *req, evbuf_t *buf, void *arg)
                 if (len == 0) {
                     /* Read an blank line, headers end. */
                     free (line);
-                    if (g_strcmp0 (fsm->input_name, "file") == 0) {
+                    if (g_strcmp0 (fsm->input_name, "file") == 0 &&
+                        fsm->stream_index) {
+                        fsm->indexer = seaf_fs_manager_stream_index_new (seaf->fs_mgr,
+                                                                         fsm->store_id,
+                                                                         fsm->repo_version,
+                                                                         fsm->crypt,
+                                                                         wake_stream_index,
+                                                                         fsm);
+                        if (!fsm->indexer) {
+                            res = EVHTP_RES_SERVERR;
+                            goto out;
+                        }
+                    } else if (g_strcmp0 (fsm->input_name, "file") == 0) {
                         if (open_temp_file (fsm) < 0) {
                             seaf_warning ("[upload] Failed open temp file, errno:[%d]\n", errno);
                             res = EVHTP_RES_SERVERR;
@@ -2198,7 +2458,9 @@ upload_read_cb (evhtp_request_t *req, evbuf_t *buf, void *arg)
             }
             break;
         case RECV_CONTENT:
-            if (g_strcmp0 (fsm->input_name, "file") == 0)
+            if (g_strcmp0 (fsm->input_name, "file") == 0 && fsm->stream_index)
+                res = recv_file_data_stream (fsm, &no_line);
+            else if (g_strcmp0 (fsm->input_name, "file") == 0)
                 res = recv_file_data (fsm, &no_line);
             else
                 res = recv_form_field (fsm, &no_line);
@@ -2210,6 +2472,14 @@ upload_read_cb (evhtp_request_t *req, evbuf_t *buf, void *arg)
         }
     }
 
+    /* Stop reading while the blocks can't be written as fast as they are
+     * received. stream_index_wake_cb() resumes the request. */
+    if (fsm->indexer && !fsm->paused &&
+        seaf_fs_manager_stream_index_is_busy (fsm->indexer)) {
+        evhtp_request_pause (req);
+        fsm->paused = TRUE;
+    }
+
 out:
     if (res != EVHTP_RES_OK) {
         /* Don't receive any data before the connection is closed. */
@@ -2425,6 +2695,60 @@ get_progress_info (evhtp_request_t *req,
     return 0;
 }
 
+/* Files uploaded to upload-api and upload-aj are indexed while being
+ * received. Resumable uploads are assembled from several requests and
+ * still go through a tmp file, as do updates. */
+static void
+init_stream_index (evhtp_request_t *req, RecvFSM *fsm, const char *url_op)
+{
+    SeafRepo *repo;
+    unsigned char key[32], iv[16];
+    gint64 content_len;
+    int error_code;
+
+    if (fsm->rstart >= 0 || fsm->need_idx_progress)
+        return;
+    if (strcmp (url_op, "upload-api") != 0 && strcmp (url_op, "upload-aj") != 0)
+        return;
+
+    /* Blocks are written before the request callback checks the uploaded
+     * files. Uploads that may be rejected go through tmp files instead, so
+     * that they don't leave orphan blocks. */
+    content_len = get_content_length (req);
+    if (content_len <= 0 || !check_upload_size (content_len, &error_code))
+        return;
+    if (seaf_quota_manager_check_quota_with_delta (seaf->quota_mgr,
+                                                   fsm->repo_id,
+                                                   content_len) != 0)
+        return;
+
+    repo = seaf_repo_manager_get_repo (seaf->repo_mgr, fsm->repo_id);
+    if (!repo)
+        return;
+
+    /* Files of version 0 repos are cut with CDC, which needs the whole file. */
+    if (repo->version == 0)
+        goto out;
+
+    /* Without the password the upload fails later with the usual error. */
+    if (repo->encrypted) {
+        if (seaf_passwd_manager_get_decrypt_key_raw (seaf->passwd_mgr,
+                                                     repo->id, fsm->user,
+                                                     key, iv) < 0)
+            goto out;
+        fsm->crypt = seafile_crypt_new (repo->enc_version, key, iv);
+    }
+
+    fsm->stream_index = TRUE;
+    fsm->store_id = g_strdup (repo->store_id);
+    fsm->repo_version = repo->version;
+    fsm->wake_ev = event_new (bufferevent_get_base (evhtp_request_get_bev (req)),
+                              -1, 0, stream_index_wake_cb, fsm);
+
+out:
+    seaf_repo_unref (repo);
+}
+
 static evhtp_res
 upload_headers_cb (evhtp_request_t *req, evhtp_headers_t *hdr, void *arg)
 {
@@ -2492,6 +2816,7 @@ upload_headers_cb (evhtp_request_t *req, evhtp_headers_t *hdr, void *arg)
 
     fsm = g_new0 (RecvFSM, 1);
     fsm->boundary = boundary;
+    fsm->delimiter = g_strconcat ("\r\n--", boundary, NULL);
     fsm->repo_id = repo_id;
     fsm->parent_dir = parent_dir;
     fsm->user = user;
@@ -2507,6 +2832,9 @@ upload_headers_cb (evhtp_request_t *req, evhtp_headers_t *hdr, void *arg)
     /*     fsm->need_idx_progress = TRUE; */
     fsm->need_idx_progress = FALSE;
 
+    fsm->req = req;
+    init_stream_index (req, fsm, url_op);
+
     if (progress_id != NULL) {
         progress = g_new0 (Progress, 1);
         progress->size = content_len;
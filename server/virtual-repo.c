@@ -57,6 +57,8 @@ save_virtual_repo_info (SeafRepoManager *mgr,
                        4, "string", repo_id, "string", origin_repo_id,
                        "string", path, "string", base_commit) < 0)
         ret = -1;
+    else
+        seaf_repo_manager_perm_index_reload_repo (mgr, repo_id);
 
     return ret;
 }
@@ -565,14 +567,26 @@ seaf_repo_manager_get_virtual_info_by_origin (SeafRepoManager *mgr,
     return g_list_reverse (ret);
 }
 
+static void
+set_virtual_repo_base_commit (const char *vrepo_id, const char *base_commit_id)
+{
+    seaf_db_statement_query (seaf->db,
+                             "UPDATE VirtualRepo SET base_commit=? WHERE repo_id=?",
+                             2, "string", base_commit_id, "string", vrepo_id);
+}
+
 static void
 set_virtual_repo_base_commit_path (const char *vrepo_id, const char *base_commit_id,
                                    const char *new_path)
 {
-    seaf_db_statement_query (seaf->db,
-                             "UPDATE VirtualRepo SET base_commit=?, path=? WHERE repo_id=?",
-                             3, "string", base_commit_id, "string", new_path,
-                             "string", vrepo_id);
+    if (seaf_db_statement_query (seaf->db,
+                                 "UPDATE VirtualRepo SET base_commit=?, path=? WHERE repo_id=?",
+                                 3, "string", base_commit_id, "string", new_path,
+                                 "string", vrepo_id) < 0)
+        return;
+
+    /* Permissions of shared folders are checked against their paths. */
+    seaf_repo_manager_perm_index_reload_repo (seaf->repo_mgr, vrepo_id);
 }
 
 int
@@ -903,8 +917,7 @@ static void *merge_virtual_repo (void *vtask)
             goto out;
         }
 
-        set_virtual_repo_base_commit_path (repo->id, orig_repo->head->commit_id,
-                                           vinfo->path);
+        set_virtual_repo_base_commit (repo->id, orig_repo->head->commit_id);
     } else if (strcmp (base_root, orig_root) == 0) {
         /* Origin not changed, virutal repo changed. */
         seaf_debug ("Origin not changed, virutal repo changed.\n");
@@ -922,7 +935,7 @@ static void *merge_virtual_repo (void *vtask)
             goto out;
         }
 
-        set_virtual_repo_base_commit_path (repo->id, new_base_commit, vinfo->path);
+        set_virtual_repo_base_commit (repo->id, new_base_commit);
 
         /* Since origin repo is updated, we have to merge it with other
          * virtual repos if necessary. But we don't need to merge with
@@ -988,7 +1001,7 @@ static void *merge_virtual_repo (void *vtask)
             goto out;
         }
 
-        set_virtual_repo_base_commit_path (repo->id, new_base_commit, vinfo->path);
+        set_virtual_repo_base_commit (repo->id, new_base_commit);
 
         seaf_repo_manager_cleanup_virtual_repos (mgr, vinfo->origin_repo_id);
         seaf_repo_manager_merge_virtual_repo (mgr,
@@ -20,19 +20,39 @@ typedef struct ZipDownloadMgrPriv {
     pthread_mutex_t progress_lock;
     GHashTable *progress_store;
     GThreadPool *zip_tpool;
+    // Streaming mode: writes archives while they're downloaded. A stream holds
+    // its thread at the pace of the client, so streams don't share zip_tpool
+    // and the pool is not bounded.
+    GThreadPool *stream_tpool;
+    // Streaming mode: token -> DownloadObj checked and waiting for the download request.
+    // Protected by progress_lock.
+    GHashTable *pending_streams;
     // Abnormal behavior lead to no download request for the zip finished progress,
     // so related progress will not be removed,
     // this timer is used to scan progress and remove invalid progress.
     CcnetTimer *scan_progress_timer;
 } ZipDownloadMgrPriv;
 
+static Progress *
+progress_ref (Progress *progress)
+{
+    g_atomic_int_inc (&progress->ref);
+    return progress;
+}
+
+/* A streaming zip task keeps a ref of its progress, so the progress can be
+ * removed while the archive is still being written. */
 void
 free_progress (Progress *progress)
 {
     if (!progress)
         return;
 
-    if (g_file_test (progress->zip_file_path, G_FILE_TEST_EXISTS)) {
+    if (!g_atomic_int_dec_and_test (&progress->ref))
+        return;
+
+    if (progress->zip_file_path &&
+        g_file_test (progress->zip_file_path, G_FILE_TEST_EXISTS)) {
         g_unlink (progress->zip_file_path);
     }
     g_free (progress->zip_file_path);
@@ -55,6 +75,9 @@ typedef struct DownloadObj {
     // download-dir: obj_id; download-multi: dirent list
     void *internal;
     Progress *progress;
+    // Streaming mode: write end of the pipe the archive is downloaded from, -1 before
+    // the download starts.
+    int stream_fd;
 } DownloadObj;
 
 static void
@@ -78,6 +101,9 @@ free_download_obj (DownloadObj *obj)
 static void
 start_zip_task (gpointer data, gpointer user_data);
 
+static void
+stream_zip_task (gpointer data, gpointer user_data);
+
 static int
 scan_progress (void *data);
 
@@ -107,9 +133,22 @@ zip_download_mgr_new ()
         return NULL;
     }
 
+    priv->stream_tpool = g_thread_pool_new (stream_zip_task, priv, -1, FALSE, &error);
+    if (!priv->stream_tpool) {
+        seaf_warning ("Failed to create zip stream thread pool: %s.\n",
+                      error ? error->message : "");
+        g_clear_error (&error);
+        g_thread_pool_free (priv->zip_tpool, TRUE, FALSE);
+        g_free (priv);
+        g_free (mgr);
+        return NULL;
+    }
+
     pthread_mutex_init (&priv->progress_lock, NULL);
     priv->progress_store = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                                                   (GDestroyNotify)free_progress);
+    priv->pending_streams = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                   (GDestroyNotify)free_download_obj);
     priv->scan_progress_timer = ccnet_timer_new (scan_progress, priv,
                                                  SCAN_PROGRESS_INTERVAL * 1000);
     mgr->priv = priv;
@@ -121,6 +160,7 @@ static void
 remove_progress_by_token (ZipDownloadMgrPriv *priv, const char *token)
 {
     pthread_mutex_lock (&priv->progress_lock);
+    g_hash_table_remove (priv->pending_streams, token);
     g_hash_table_remove (priv->progress_store, token);
     pthread_mutex_unlock (&priv->progress_lock);
 }
@@ -140,6 +180,7 @@ scan_progress (void *data)
     while (g_hash_table_iter_next (&iter, &key, &value)) {
         progress = value;
         if (now >= progress->expire_ts) {
+            g_hash_table_remove (priv->pending_streams, key);
             g_hash_table_iter_remove (&iter);
         }
     }
@@ -178,6 +219,38 @@ get_seafile_crypt (SeafRepo *repo, const char *user)
     return crypt;
 }
 
+/* Writes the archive to the pipe of the download request. Closing the pipe
+ * tells the http thread the archive is complete, stream_status tells
+ * whether it's valid. */
+static void
+stream_zip_task (gpointer data, gpointer user_data)
+{
+    DownloadObj *obj = data;
+    SeafRepo *repo = obj->repo;
+    Progress *progress = obj->progress;
+    SeafileCrypt *crypt = NULL;
+    int ret = 0;
+
+    if (repo->encrypted) {
+        crypt = get_seafile_crypt (repo, obj->user);
+        if (!crypt) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    ret = pack_files_to_fd (repo->store_id, repo->version, obj->dir_name,
+                            obj->internal, crypt, obj->is_windows,
+                            obj->stream_fd, progress);
+
+out:
+    g_atomic_int_set (&progress->stream_status, ret < 0 ? -1 : 1);
+    close (obj->stream_fd);
+    g_free (crypt);
+    free_progress (progress);
+    free_download_obj (obj);
+}
+
 static void
 start_zip_task (gpointer data, gpointer user_data)
 {
@@ -185,6 +258,7 @@ start_zip_task (gpointer data, gpointer user_data)
     ZipDownloadMgrPriv *priv = user_data;
     SeafRepo *repo = obj->repo;
     SeafileCrypt *crypt = NULL;
+    gboolean pending = FALSE;
     int ret = 0;
 
     if (repo->encrypted) {
@@ -207,6 +281,20 @@ start_zip_task (gpointer data, gpointer user_data)
     }
     obj->progress->total = file_count;
 
+    if (seaf->http_server->streaming_zip) {
+        /* The archive is written when it's downloaded. Report it as zipped
+         * so that clients go on to download it; zipped counts the files
+         * actually written once the download starts. */
+        pthread_mutex_lock (&priv->progress_lock);
+        if (g_hash_table_lookup (priv->progress_store, obj->token)) {
+            g_hash_table_replace (priv->pending_streams, g_strdup (obj->token), obj);
+            g_atomic_int_set (&obj->progress->zipped, file_count);
+            pending = TRUE;
+        }
+        pthread_mutex_unlock (&priv->progress_lock);
+        goto out;
+    }
+
     ret = pack_files (repo->store_id, repo->version, obj->dir_name,
                       obj->internal, crypt, obj->is_windows, obj->progress);
 
@@ -217,7 +305,8 @@ out:
     if (ret == -1) {
         remove_progress_by_token (priv, obj->token);
     }
-    free_download_obj (obj);
+    if (!pending)
+        free_download_obj (obj);
 }
 
 static int
@@ -517,6 +606,7 @@ zip_download_mgr_start_zip_task (ZipDownloadMgr *mgr,
     obj->token = g_strdup (token);
     obj->repo = repo;
     obj->user = g_strdup (seafile_web_access_get_username (info));
+    obj->stream_fd = -1;
 
     if (strcmp (operation, "download-dir") == 0 ||
         strcmp (operation, "download-dir-link") == 0) {
@@ -551,6 +641,7 @@ zip_download_mgr_start_zip_task (ZipDownloadMgr *mgr,
      * the zip has been finished too early.
      */
     progress->total = 1;
+    progress->ref = 1;
     progress->expire_ts = time(NULL) + PROGRESS_TTL;
     obj->progress = progress;
 
@@ -636,3 +727,69 @@ zip_download_mgr_cancel_zip_task (ZipDownloadMgr *mgr,
 
     return 0;
 }
+
+gboolean
+zip_download_mgr_is_zip_stream_pending (ZipDownloadMgr *mgr,
+                                        const char *token)
+{
+    ZipDownloadMgrPriv *priv = mgr->priv;
+    gboolean ret;
+
+    pthread_mutex_lock (&priv->progress_lock);
+    ret = (g_hash_table_lookup (priv->pending_streams, token) != NULL);
+    pthread_mutex_unlock (&priv->progress_lock);
+
+    return ret;
+}
+
+Progress *
+zip_download_mgr_start_zip_stream (ZipDownloadMgr *mgr,
+                                   const char *token,
+                                   int fd)
+{
+    ZipDownloadMgrPriv *priv = mgr->priv;
+    DownloadObj *obj = NULL;
+    Progress *progress;
+    gpointer key;
+
+    pthread_mutex_lock (&priv->progress_lock);
+    progress = g_hash_table_lookup (priv->progress_store, token);
+    if (progress &&
+        g_hash_table_lookup_extended (priv->pending_streams, token,
+                                      &key, (gpointer *)&obj)) {
+        g_hash_table_steal (priv->pending_streams, token);
+        g_free (key);
+        obj->progress = progress_ref (progress);
+    }
+    pthread_mutex_unlock (&priv->progress_lock);
+
+    if (!obj) {
+        seaf_warning ("No zip task to stream for token %s.\n", token);
+        return NULL;
+    }
+
+    g_atomic_int_set (&progress->zipped, 0);
+    obj->stream_fd = fd;
+    g_thread_pool_push (priv->stream_tpool, obj, NULL);
+
+    /* One ref for the zip task, one for the caller. */
+    return progress_ref (progress);
+}
+
+int
+zip_download_mgr_get_zip_stream_status (ZipDownloadMgr *mgr,
+                                        Progress *progress)
+{
+    return g_atomic_int_get (&progress->stream_status);
+}
+
+void
+zip_download_mgr_release_zip_stream (ZipDownloadMgr *mgr,
+                                     Progress *progress)
+{
+    if (!progress)
+        return;
+
+    progress->canceled = TRUE;
+    free_progress (progress);
+}
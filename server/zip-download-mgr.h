@@ -4,6 +4,7 @@
 #include "seafile-object.h"
 
 struct ZipDownloadMgrPriv;
+struct Progress;
 
 typedef struct ZipDownloadMgr {
     struct ZipDownloadMgrPriv *priv;
@@ -34,4 +35,34 @@ int
 zip_download_mgr_cancel_zip_task (ZipDownloadMgr *mgr,
                                   const char *token);
 
+/*
+ * Streaming mode ([zip] streaming = true): no temp file is created, the
+ * archive is generated by the zip thread pool while it's downloaded.
+ */
+
+/* Whether the task of @token is checked and waits for its download. */
+gboolean
+zip_download_mgr_is_zip_stream_pending (ZipDownloadMgr *mgr,
+                                        const char *token);
+
+/* Starts writing the archive to @fd, usually the write end of a pipe.
+ * Takes ownership of @fd on success. Returns the progress of the task,
+ * which stays valid until it's released, even if the token expires.
+ * Returns NULL on error. */
+struct Progress *
+zip_download_mgr_start_zip_stream (ZipDownloadMgr *mgr,
+                                   const char *token,
+                                   int fd);
+
+/* 0 while the archive is being written, 1 once it's complete, -1 on
+ * error. Valid once @fd is closed. */
+int
+zip_download_mgr_get_zip_stream_status (ZipDownloadMgr *mgr,
+                                        struct Progress *progress);
+
+/* Cancels the task if it's still running and drops @progress. */
+void
+zip_download_mgr_release_zip_stream (ZipDownloadMgr *mgr,
+                                     struct Progress *progress);
+
 #endif
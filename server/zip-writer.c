@@ -0,0 +1,385 @@
+// 顺序写入的ZIP压缩包
+#include "common.h"
+
+#include <time.h>
+
+#include "log.h"
+#include "utils.h"
+
+#include "zip-writer.h"
+
+#define OUT_BUF_SIZE (64 * 1024)
+#define ZIP64_LIMIT 0xFFFFFFFFULL
+/* Deflate can make data a little larger, so entries close to the limit
+ * get ZIP64 sizes too. */
+#define ZIP64_SIZE_HINT 0xFF000000ULL
+
+#define ZIP_VERSION 20
+#define ZIP_VERSION_ZIP64 45
+#define ZIP_MADE_BY_UNIX (3 << 8)
+
+#define FLAG_DATA_DESCRIPTOR (1 << 3)
+#define FLAG_UTF8 (1 << 11)
+
+#define SIG_LOCAL_HEADER 0x04034b50
+#define SIG_DATA_DESCRIPTOR 0x08074b50
+#define SIG_CENTRAL_HEADER 0x02014b50
+#define SIG_ZIP64_END 0x06064b50
+#define SIG_ZIP64_LOCATOR 0x07064b50
+#define SIG_END 0x06054b50
+
+#define EXTRA_ZIP64 0x0001
+#define EXTRA_TIMESTAMP 0x5455
+
+struct ZipWriter {
+    int fd;
+    GByteArray *out; // 输出缓冲
+    guint64 offset; // 已输出的字节数
+    GByteArray *cdir; // 中央目录
+    guint64 n_entries;
+
+    /* The current entry */
+    gboolean in_entry;
+    char *name;
+    guint16 flags;
+    guint16 method;
+    guint16 dos_time;
+    guint16 dos_date;
+    guint32 mtime;
+    guint32 mode;
+    gboolean zip64; // 本地头中有ZIP64扩展字段
+    guint64 header_offset;
+    guint64 data_offset;
+};
+
+static void
+put16 (GByteArray *a, guint16 v)
+{
+    guint8 b[2] = { v & 0xff, v >> 8 };
+    g_byte_array_append (a, b, 2);
+}
+
+static void
+put32 (GByteArray *a, guint32 v)
+{
+    put16 (a, v & 0xffff);
+    put16 (a, v >> 16);
+}
+
+static void
+put64 (GByteArray *a, guint64 v)
+{
+    put32 (a, v & 0xffffffff);
+    put32 (a, v >> 32);
+}
+
+static void
+put_timestamp_extra (GByteArray *a, guint32 mtime)
+{
+    guint8 flags = 1; // 只有修改时间
+
+    put16 (a, EXTRA_TIMESTAMP);
+    put16 (a, 5);
+    g_byte_array_append (a, &flags, 1);
+    put32 (a, mtime);
+}
+
+static int
+flush_out (ZipWriter *w)
+{
+    if (w->out->len == 0)
+        return 0;
+
+    if (writen (w->fd, w->out->data, w->out->len) < 0) {
+        seaf_warning ("Failed to write zip archive: %s.\n", strerror (errno));
+        return -1;
+    }
+    g_byte_array_set_size (w->out, 0);
+
+    return 0;
+}
+
+/* Headers are appended to w->out directly, this accounts for them. */
+static int
+out_appended (ZipWriter *w, guint old_len)
+{
+    w->offset += w->out->len - old_len;
+    if (w->out->len >= OUT_BUF_SIZE)
+        return flush_out (w);
+    return 0;
+}
+
+static void
+to_dos_time (time_t t, guint16 *dos_time, guint16 *dos_date)
+{
+    struct tm tm;
+
+    localtime_r (&t, &tm);
+    if (tm.tm_year < 80) {
+        *dos_time = 0;
+        *dos_date = (1 << 5) | 1;
+        return;
+    }
+    *dos_time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+    *dos_date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+ZipWriter *
+zip_writer_new (int fd)
+{
+    ZipWriter *w = g_new0 (ZipWriter, 1);
+
+    w->fd = fd;
+    w->out = g_byte_array_sized_new (OUT_BUF_SIZE);
+    w->cdir = g_byte_array_new ();
+
+    return w;
+}
+
+void
+zip_writer_free (ZipWriter *w)
+{
+    if (!w)
+        return;
+
+    g_byte_array_free (w->out, TRUE);
+    g_byte_array_free (w->cdir, TRUE);
+    g_free (w->name);
+    g_free (w);
+}
+
+static int
+write_local_header (ZipWriter *w, const char *name, gboolean utf8,
+                    guint32 mode, time_t mtime, int method,
+                    gboolean data_descriptor, gboolean zip64)
+{
+    GByteArray *a = w->out;
+    guint old_len = a->len;
+    guint16 extra_len = 9 + (zip64 ? 20 : 0);
+
+    g_free (w->name);
+    w->name = g_strdup (name);
+    w->flags = (data_descriptor ? FLAG_DATA_DESCRIPTOR : 0) | (utf8 ? FLAG_UTF8 : 0);
+    w->method = method;
+    to_dos_time (mtime, &w->dos_time, &w->dos_date);
+    w->mtime = (guint32)mtime;
+    w->mode = mode;
+    w->zip64 = zip64;
+    w->header_offset = w->offset;
+
+    put32 (a, SIG_LOCAL_HEADER);
+    put16 (a, zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION);
+    put16 (a, w->flags);
+    put16 (a, w->method);
+    put16 (a, w->dos_time);
+    put16 (a, w->dos_date);
+    /* CRC and sizes are in the data descriptor */
+    put32 (a, 0);
+    put32 (a, zip64 ? 0xFFFFFFFF : 0);
+    put32 (a, zip64 ? 0xFFFFFFFF : 0);
+    put16 (a, strlen (name));
+    put16 (a, extra_len);
+    g_byte_array_append (a, (const guint8 *)name, strlen (name));
+    put_timestamp_extra (a, w->mtime);
+    if (zip64) {
+        put16 (a, EXTRA_ZIP64);
+        put16 (a, 16);
+        put64 (a, 0);
+        put64 (a, 0);
+    }
+
+    if (out_appended (w, old_len) < 0)
+        return -1;
+    w->data_offset = w->offset;
+
+    return 0;
+}
+
+static void
+add_central_record (ZipWriter *w, guint32 crc, guint64 comp_size, guint64 size)
+{
+    GByteArray *a = w->cdir;
+    gboolean big_comp = comp_size >= ZIP64_LIMIT;
+    gboolean big_size = size >= ZIP64_LIMIT;
+    gboolean big_offset = w->header_offset >= ZIP64_LIMIT;
+    int n_zip64 = big_size + big_comp + big_offset;
+    guint16 version = (n_zip64 > 0 || w->zip64) ? ZIP_VERSION_ZIP64 : ZIP_VERSION;
+    guint32 attrs = w->mode << 16;
+
+    if (S_ISDIR (w->mode))
+        attrs |= 0x10; // MS-DOS目录属性
+
+    put32 (a, SIG_CENTRAL_HEADER);
+    put16 (a, ZIP_MADE_BY_UNIX | version);
+    put16 (a, version);
+    put16 (a, w->flags);
+    put16 (a, w->method);
+    put16 (a, w->dos_time);
+    put16 (a, w->dos_date);
+    put32 (a, crc);
+    put32 (a, big_comp ? 0xFFFFFFFF : comp_size);
+    put32 (a, big_size ? 0xFFFFFFFF : size);
+    put16 (a, strlen (w->name));
+    put16 (a, 9 + (n_zip64 > 0 ? 4 + 8 * n_zip64 : 0));
+    put16 (a, 0); // 注释长度
+    put16 (a, 0); // 起始磁盘
+    put16 (a, 0); // 内部属性
+    put32 (a, attrs);
+    put32 (a, big_offset ? 0xFFFFFFFF : w->header_offset);
+    g_byte_array_append (a, (const guint8 *)w->name, strlen (w->name));
+    put_timestamp_extra (a, w->mtime);
+    if (n_zip64 > 0) {
+        put16 (a, EXTRA_ZIP64);
+        put16 (a, 8 * n_zip64);
+        if (big_size)
+            put64 (a, size);
+        if (big_comp)
+            put64 (a, comp_size);
+        if (big_offset)
+            put64 (a, w->header_offset);
+    }
+
+    ++w->n_entries;
+}
+
+int
+zip_writer_begin_entry (ZipWriter *w, const char *name, gboolean utf8,
+                        guint32 mode, time_t mtime, int method, guint64 size)
+{
+    if (w->in_entry) {
+        seaf_warning ("Zip entry %s is not ended.\n", w->name);
+        return -1;
+    }
+
+    if (write_local_header (w, name, utf8, mode, mtime, method,
+                            TRUE, size >= ZIP64_SIZE_HINT) < 0)
+        return -1;
+    w->in_entry = TRUE;
+
+    return 0;
+}
+
+int
+zip_writer_write (ZipWriter *w, const void *buf, size_t len)
+{
+    if (len < OUT_BUF_SIZE - w->out->len) {
+        g_byte_array_append (w->out, buf, len);
+        w->offset += len;
+        return 0;
+    }
+
+    if (flush_out (w) < 0)
+        return -1;
+    if (writen (w->fd, buf, len) < 0) {
+        seaf_warning ("Failed to write zip archive: %s.\n", strerror (errno));
+        return -1;
+    }
+    w->offset += len;
+
+    return 0;
+}
+
+int
+zip_writer_end_entry (ZipWriter *w, guint32 crc, guint64 size)
+{
+    GByteArray *a = w->out;
+    guint old_len = a->len;
+    guint64 comp_size = w->offset - w->data_offset;
+
+    if (!w->zip64 && (comp_size >= ZIP64_LIMIT || size >= ZIP64_LIMIT)) {
+        seaf_warning ("Zip entry %s is larger than its size hint.\n", w->name);
+        return -1;
+    }
+
+    put32 (a, SIG_DATA_DESCRIPTOR);
+    put32 (a, crc);
+    if (w->zip64) {
+        put64 (a, comp_size);
+        put64 (a, size);
+    } else {
+        put32 (a, comp_size);
+        put32 (a, size);
+    }
+
+    add_central_record (w, crc, comp_size, size);
+    w->in_entry = FALSE;
+
+    return out_appended (w, old_len);
+}
+
+int
+zip_writer_add_dir (ZipWriter *w, const char *name, gboolean utf8,
+                    guint32 mode, time_t mtime)
+{
+    char *dir_name = g_strconcat (name, "/", NULL);
+    int ret;
+
+    if (w->in_entry) {
+        seaf_warning ("Zip entry %s is not ended.\n", w->name);
+        g_free (dir_name);
+        return -1;
+    }
+
+    ret = write_local_header (w, dir_name, utf8, mode, mtime,
+                              ZIP_METHOD_STORE, FALSE, FALSE);
+    g_free (dir_name);
+    if (ret < 0)
+        return -1;
+
+    add_central_record (w, 0, 0, 0);
+
+    return 0;
+}
+
+int
+zip_writer_finish (ZipWriter *w)
+{
+    GByteArray *a = w->out;
+    guint64 cdir_offset, cdir_size, zip64_end_offset;
+    guint old_len;
+
+    if (w->in_entry) {
+        seaf_warning ("Zip entry %s is not ended.\n", w->name);
+        return -1;
+    }
+
+    cdir_offset = w->offset;
+    cdir_size = w->cdir->len;
+    if (zip_writer_write (w, w->cdir->data, w->cdir->len) < 0)
+        return -1;
+
+    old_len = a->len;
+    if (w->n_entries >= 0xFFFF || cdir_offset >= ZIP64_LIMIT || cdir_size >= ZIP64_LIMIT) {
+        zip64_end_offset = w->offset;
+
+        put32 (a, SIG_ZIP64_END);
+        put64 (a, 44); // 以下记录的长度
+        put16 (a, ZIP_MADE_BY_UNIX | ZIP_VERSION_ZIP64);
+        put16 (a, ZIP_VERSION_ZIP64);
+        put32 (a, 0);
+        put32 (a, 0);
+        put64 (a, w->n_entries);
+        put64 (a, w->n_entries);
+        put64 (a, cdir_size);
+        put64 (a, cdir_offset);
+
+        put32 (a, SIG_ZIP64_LOCATOR);
+        put32 (a, 0);
+        put64 (a, zip64_end_offset);
+        put32 (a, 1);
+    }
+
+    put32 (a, SIG_END);
+    put16 (a, 0);
+    put16 (a, 0);
+    put16 (a, MIN (w->n_entries, 0xFFFF));
+    put16 (a, MIN (w->n_entries, 0xFFFF));
+    put32 (a, MIN (cdir_size, ZIP64_LIMIT));
+    put32 (a, MIN (cdir_offset, ZIP64_LIMIT));
+    put16 (a, 0); // 注释长度
+
+    if (out_appended (w, old_len) < 0)
+        return -1;
+
+    return flush_out (w);
+}
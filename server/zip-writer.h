@@ -0,0 +1,48 @@
+#ifndef ZIP_WRITER_H
+#define ZIP_WRITER_H
+
+#include <glib.h>
+#include <time.h>
+
+/*
+ * Writes a zip archive front to back, without seeking, so the output can
+ * be a pipe. The caller supplies entry data already compressed (raw
+ * deflate or stored); the CRC and sizes are written after the data in a
+ * data descriptor, and the central directory at the end. ZIP64 records
+ * are used where sizes or counts need them.
+ */
+
+#define ZIP_METHOD_STORE 0
+#define ZIP_METHOD_DEFLATE 8
+
+typedef struct ZipWriter ZipWriter;
+
+ZipWriter *
+zip_writer_new (int fd);
+
+/* Flushes nothing and doesn't close the fd. */
+void
+zip_writer_free (ZipWriter *w);
+
+/* Starts a file entry. @size is the uncompressed size, it decides whether
+ * the entry needs ZIP64 sizes. @utf8 tells the name is UTF-8. */
+int
+zip_writer_begin_entry (ZipWriter *w, const char *name, gboolean utf8,
+                        guint32 mode, time_t mtime, int method, guint64 size);
+
+/* Writes (compressed) data of the current entry. */
+int
+zip_writer_write (ZipWriter *w, const void *buf, size_t len);
+
+int // 结束当前条目，写入数据描述符
+zip_writer_end_entry (ZipWriter *w, guint32 crc, guint64 size);
+
+/* Adds a directory entry; a '/' is appended to @name. */
+int
+zip_writer_add_dir (ZipWriter *w, const char *name, gboolean utf8,
+                    guint32 mode, time_t mtime);
+
+int // 写入中央目录，完成压缩包
+zip_writer_finish (ZipWriter *w);
+
+#endif
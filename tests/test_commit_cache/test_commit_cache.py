@@ -0,0 +1,64 @@
+import os
+import threading
+import requests
+from tests.config import USER
+from seaserv import seafile_api as api
+
+file_name = 'test_commit_cache.txt'
+file_path = os.getcwd() + '/' + file_name
+base_url = 'http://127.0.0.1:8082/'
+
+n_threads = 16
+n_rounds = 20
+
+def create_the_file():
+    with open(file_path, 'w') as fp:
+        fp.write('test commit cache')
+
+def test_commit_cache_concurrent_access():
+    create_the_file()
+    t_repo_id = api.create_repo('test_commit_cache', '', USER, passwd=None)
+    for i in range(5):
+        api.post_file(t_repo_id, file_path, '/', 'file%d.txt' % i, USER)
+
+    t_head_id = api.get_repo(t_repo_id).head_cmmt_id
+    t_n_commits = len(api.get_commit_list(t_repo_id, 0, 100))
+    t_token = api.generate_repo_token(t_repo_id, USER)
+    t_stats = api.get_commit_cache_stats()
+
+    errors = []
+
+    # Hammer the head commit and history from many threads at once, through
+    # both the rpc server threads and the http server worker threads.
+    def worker():
+        session = requests.Session()
+        headers = {'Seafile-Repo-Token': t_token}
+        url = base_url + 'repo/' + t_repo_id + '/fs-id-list/?server-head=' + t_head_id
+        try:
+            for i in range(n_rounds):
+                if api.get_repo(t_repo_id).head_cmmt_id != t_head_id:
+                    errors.append('wrong head commit')
+                commits = api.get_commit_list(t_repo_id, 0, 100)
+                if len(commits) != t_n_commits or commits[0].id != t_head_id:
+                    errors.append('wrong commit list')
+                response = session.get(url, headers=headers)
+                if response.status_code != 200:
+                    errors.append('fs-id-list returned %d' % response.status_code)
+        except Exception as e:
+            errors.append(str(e))
+
+    threads = [threading.Thread(target=worker) for i in range(n_threads)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    assert not errors
+
+    if t_stats['enabled']:
+        t_new_stats = api.get_commit_cache_stats()
+        assert t_new_stats['hits'] > t_stats['hits']
+        assert t_new_stats['entries'] <= t_new_stats['max_entries']
+
+    api.remove_repo(t_repo_id)
+    os.remove(file_path)
@@ -515,3 +515,39 @@ def test_api(repo):
     time.sleep(1)
     del_repo_files(repo.id)
     del_local_files()
+
+def test_api_multi_block(repo):
+    # Larger than the default 8MB block size, and full of CRLFs and
+    # boundary-like lines, so that the multipart parser has to tell them
+    # apart from the real delimiter.
+    line = b'--' + b'x' * 60 + b'\r\n--\r\n\r\n-'
+    big_content = line * (9 * 1024 * 1024 // len(line) + 1)
+    big_name = 'big.bin'
+    big_path = os.getcwd() + '/' + big_name
+    with open(big_path, 'wb') as fp:
+        fp.write(big_content)
+
+    obj_id = '{"parent_dir":"/"}'
+    token = api.get_fileserver_access_token(repo.id, obj_id, 'upload', USER, False)
+    upload_url_base = 'http://127.0.0.1:8082/upload-api/' + token
+    m = MultipartEncoder(
+            fields={
+                    'parent_dir': '/',
+                    'file': (big_name, open(big_path, 'rb'), 'application/octet-stream')
+            })
+    response = requests.post(upload_url_base, params = {'ret-json':'1'},
+                             data = m, headers = {'Content-Type': m.content_type})
+    assert response.status_code == 200
+    response_json = response.json()
+    assert response_json[0]['size'] == len(big_content)
+    new_file_id = response_json[0]['id']
+    assert len(new_file_id) == 40 and new_file_id != file_id
+    assert api.get_file_id_by_path(repo.id, '/' + big_name) == new_file_id
+
+    token = api.get_fileserver_access_token(repo.id, new_file_id, 'download', USER, False)
+    response = requests.get('http://127.0.0.1:8082/files/%s/%s' % (token, big_name))
+    assert response.status_code == 200
+    assert response.content == big_content
+
+    api.del_file(repo.id, '/', big_name, USER)
+    os.remove(big_path)
@@ -91,6 +91,14 @@ def test_file_property_and_dir_listing ():
     t_dir_list = api.list_dir_by_path(t_repo_id, '/test_dir')
     assert len(t_dir_list) == 1
 
+    #test get_dir_cache_stats
+    t_stats = api.get_dir_cache_stats()
+    if t_stats['enabled']:
+        t_hits = t_stats['hits']
+        t_dir_list = api.list_dir_by_path(t_repo_id, '/test_dir')
+        assert len(t_dir_list) == 1
+        assert api.get_dir_cache_stats()['hits'] > t_hits
+
     #test get_dir_id_by_commit_and_path
     t_dir_id = api.get_dir_id_by_commit_and_path(t_repo_id, t_commit_id, '/test_dir')
     assert t_dir_id
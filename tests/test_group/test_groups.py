@@ -58,9 +58,16 @@ def test_multi_tier_groups(repo):
         assert g.id == group4_order[i]
         i = i + 1
 
+    assert ccnet_api.get_user_group_ids(USER2) == sorted(ances_order)
+    assert ccnet_api.get_user_group_ids(USER) == sorted([id1, id3])
+
+    descendants = ccnet_api.get_descendants_groups(id3)
+    assert sorted([g.id for g in descendants]) == [id3, id4]
+
     rm5 = ccnet_api.remove_group(id5)
     rm4 = ccnet_api.remove_group(id4)
     rm3 = ccnet_api.remove_group(id3)
     rm2 = ccnet_api.remove_group(id2)
     rm1 = ccnet_api.remove_group(id1)
     assert rm5 == 0 and rm4 == 0 and rm3 == 0 and rm2 == 0 and rm1 == 0
+    assert ccnet_api.get_user_group_ids(USER2) == []
@@ -39,3 +39,9 @@ def test_server_config():
     api.set_server_config_boolean(t_group, t_key, t_value)
     t_ret = api.get_server_config_boolean(t_group, t_key)
     assert t_ret == t_value
+
+    #test get_db_pool_stats
+    t_stats = api.get_db_pool_stats()
+    assert t_stats['seafile']['type'] in ('sqlite', 'mysql')
+    if t_stats['seafile']['type'] == 'mysql':
+        assert t_stats['seafile']['checkouts'] > 0